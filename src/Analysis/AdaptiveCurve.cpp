@@ -0,0 +1,370 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#include "AdaptiveCurve.h"
+#include "Trace.h"
+
+namespace
+{
+    // Steps bending further than this fraction of the curve's range from a straight line are halved
+    const float curvatureTolerance = 0.002f;
+    
+    // Narrowest step, as a fraction of the range
+    const float minStepWidth = 1e-6f;
+    
+    // Steps evaluated between checks for whether the job should exit
+    const int batchSize = 4096;
+}
+
+//==============================================================================
+AdaptiveCurve::AdaptiveCurve()
+{
+    start = 1;
+    end = 2;
+    isLog = false;
+}
+
+AdaptiveCurve::~AdaptiveCurve()
+{
+}
+
+bool AdaptiveCurve::sample (const IntervalDissonance& intervals, float startRatio, float endRatio,
+                            bool logSpaced, int numCoarseSteps, int maxSteps, const ThreadPoolJob* job)
+{
+    TRACE_SCOPE ("AdaptiveCurve::sample");
+    
+    setRange (startRatio, endRatio, logSpaced);
+    
+    positions.clearQuick();
+    dissonance.clearQuick();
+    
+    numCoarseSteps = jlimit (2, jmax (2, maxSteps), numCoarseSteps);
+    
+    if (start <= 0 || end <= start)
+        return true;
+    
+    // Coarse grid
+    Array<float> ratios;
+    
+    for (int i = 0; i < numCoarseSteps; ++i)
+    {
+        positions.add ((float) i / (numCoarseSteps - 1));
+        ratios.add (getRatioAtPosition (positions.getLast()));
+    }
+    
+    if (! evaluate (intervals, ratios, dissonance, job))
+    {
+        positions.clearQuick();
+        dissonance.clearQuick();
+        return false;
+    }
+    
+    float minDissonance, maxDissonance;
+    findMinAndMax (dissonance.getRawDataPointer(), dissonance.size(), minDissonance, maxDissonance);
+    
+    const float tolerance = jmax (std::numeric_limits<float>::min(), (maxDissonance - minDissonance) * curvatureTolerance);
+    
+    // One flag per step (between 2 positions), for whether it's halved in the next pass
+    Array<bool> refine;
+    refine.insertMultiple (0, true, positions.size() - 1);
+    
+    Array<float> midPositions, midRatios, midDissonance;
+    Array<float> newPositions, newDissonance;
+    Array<bool> newRefine;
+    
+    while (positions.size() < maxSteps)
+    {
+        midPositions.clearQuick();
+        midRatios.clearQuick();
+        
+        for (int i = 0; i < refine.size(); ++i)
+        {
+            if (refine[i] && positions[i + 1] - positions[i] > minStepWidth
+                && positions.size() + midPositions.size() < maxSteps)
+            {
+                midPositions.add ((positions[i] + positions[i + 1]) * 0.5f);
+                midRatios.add (getRatioAtPosition (midPositions.getLast()));
+            }
+            else
+            {
+                refine.set (i, false);
+            }
+        }
+        
+        if (midPositions.isEmpty())
+            break;
+        
+        if (! evaluate (intervals, midRatios, midDissonance, job))
+        {
+            positions.clearQuick();
+            dissonance.clearQuick();
+            return false;
+        }
+        
+        // Merge the new steps in, flagging the halves that still need refining
+        newPositions.clearQuick();
+        newDissonance.clearQuick();
+        newRefine.clearQuick();
+        
+        int mid = 0;
+        
+        for (int i = 0; i < refine.size(); ++i)
+        {
+            newPositions.add (positions[i]);
+            newDissonance.add (dissonance[i]);
+            
+            if (refine[i])
+            {
+                const float left = dissonance[i];
+                const float right = dissonance[i + 1];
+                const float middle = midDissonance[mid];
+                
+                const bool bends = std::abs (middle - (left + right) * 0.5f) > tolerance;
+                const bool brackets = middle < jmin (left, right) || middle > jmax (left, right);
+                
+                newPositions.add (midPositions[mid]);
+                newDissonance.add (middle);
+                
+                newRefine.add (bends || brackets);
+                newRefine.add (bends || brackets);
+                
+                ++mid;
+            }
+            else
+            {
+                newRefine.add (false);
+            }
+        }
+        
+        newPositions.add (positions.getLast());
+        newDissonance.add (dissonance.getLast());
+        
+        // Steps either side of an optimum are kept refining until it's pinned down
+        for (int i = 1; i < newDissonance.size() - 1; ++i)
+        {
+            if ((newDissonance[i] < newDissonance[i - 1] && newDissonance[i] <= newDissonance[i + 1])
+                || (newDissonance[i] > newDissonance[i - 1] && newDissonance[i] >= newDissonance[i + 1]))
+            {
+                newRefine.set (i - 1, true);
+                newRefine.set (i, true);
+            }
+        }
+        
+        positions.swapWith (newPositions);
+        dissonance.swapWith (newDissonance);
+        refine.swapWith (newRefine);
+    }
+    
+    return true;
+}
+
+void AdaptiveCurve::setRange (float startRatio, float endRatio, bool logSpaced)
+{
+    start = startRatio;
+    end = endRatio;
+    isLog = logSpaced;
+}
+
+void AdaptiveCurve::setSteps (const Array<float>& newPositions, const Array<float>& newDissonance)
+{
+    positions = newPositions;
+    dissonance = newDissonance;
+}
+
+int AdaptiveCurve::getNumSteps() const
+{
+    return positions.size();
+}
+
+const float* AdaptiveCurve::getRawDissonanceData() const
+{
+    return dissonance.begin();
+}
+
+float AdaptiveCurve::getPositionAtStep (int step) const
+{
+    return positions[step];
+}
+
+float AdaptiveCurve::getPositionOfRatio (float ratio) const
+{
+    if (isLog)
+        return ratio > 0 ? std::log (ratio / start) / std::log (end / start) : 0;
+    
+    return (ratio - start) / (end - start);
+}
+
+float AdaptiveCurve::getRatioAtPosition (float position) const
+{
+    if (isLog)
+        return start * std::pow (end / start, position);
+    
+    return start + position * (end - start);
+}
+
+float AdaptiveCurve::getDissonanceAtRatio (float ratio) const
+{
+    return getDissonanceAtPosition (getPositionOfRatio (ratio));
+}
+
+float AdaptiveCurve::getDissonanceAtPosition (float position) const
+{
+    if (positions.isEmpty())
+        return 0;
+    
+    const int upper = (int) (std::upper_bound (positions.begin(), positions.end(), position) - positions.begin());
+    
+    if (upper == 0)
+        return dissonance.getFirst();
+    
+    if (upper == positions.size())
+        return dissonance.getLast();
+    
+    const float proportion = (position - positions[upper - 1]) / (positions[upper] - positions[upper - 1]);
+    
+    return dissonance[upper - 1] + proportion * (dissonance[upper] - dissonance[upper - 1]);
+}
+
+Array<float> AdaptiveCurve::findOptima (bool minima, float minInterval) const
+{
+    Array<float> optimaRatios, optimaDissonance;
+    
+    for (int i = 1; i < dissonance.size() - 1; ++i)
+    {
+        // Maxima are found as the minima of the inverted curve
+        const float sign = minima ? 1.f : -1.f;
+        const float left = sign * dissonance[i - 1];
+        const float middle = sign * dissonance[i];
+        const float right = sign * dissonance[i + 1];
+        
+        if (! (middle < left && middle <= right))
+            continue;
+        
+        const float ratio = getRatioAtPosition (getVertexPosition (i));
+        
+        // Keep only the most extreme of optima closer than the min interval
+        if (! optimaRatios.isEmpty() && ratio / optimaRatios.getLast() < minInterval)
+        {
+            if (middle < optimaDissonance.getLast())
+            {
+                optimaRatios.setUnchecked (optimaRatios.size() - 1, ratio);
+                optimaDissonance.setUnchecked (optimaDissonance.size() - 1, middle);
+            }
+            
+            continue;
+        }
+        
+        optimaRatios.add (ratio);
+        optimaDissonance.add (middle);
+    }
+    
+    return optimaRatios;
+}
+
+Array<float> AdaptiveCurve::trackOptima (const Array<float>& previousRatios, bool minima, float minInterval) const
+{
+    Array<float> optimaRatios;
+    
+    if (dissonance.size() < 3)
+    {
+        optimaRatios.insertMultiple (0, 0, previousRatios.size());
+        return optimaRatios;
+    }
+    
+    // Maxima are tracked as the minima of the inverted curve
+    const float sign = minima ? 1.f : -1.f;
+    const int last = dissonance.size() - 1;
+    
+    Array<int> optimaSteps;
+    
+    for (auto previous : previousRatios)
+    {
+        const float position = getPositionOfRatio (previous);
+        
+        // Nearest step to the previous optimum
+        int step = jlimit (0, last, (int) (std::lower_bound (positions.begin(), positions.end(), position) - positions.begin()));
+        
+        if (step > 0 && position - positions[step - 1] < positions[step] - position)
+            --step;
+        
+        // Follows the curve to the nearest optimum, towards whichever neighbour is more extreme
+        for (;;)
+        {
+            int next = step;
+            
+            if (step > 0 && sign * dissonance[step - 1] < sign * dissonance[next])
+                next = step - 1;
+            
+            if (step < last && sign * dissonance[step + 1] < sign * dissonance[next])
+                next = step + 1;
+            
+            if (next == step)
+                break;
+            
+            step = next;
+        }
+        
+        float ratio = 0;
+        
+        // An optimum that ran off either end of the curve, or into an earlier optimum, has vanished
+        if (step > 0 && step < last && ! optimaSteps.contains (step))
+        {
+            ratio = getRatioAtPosition (getVertexPosition (step));
+            
+            for (auto kept : optimaRatios)
+                if (kept > 0 && jmax (ratio, kept) / jmin (ratio, kept) < minInterval)
+                    ratio = 0;
+        }
+        
+        optimaRatios.add (ratio);
+        optimaSteps.add (ratio > 0 ? step : -1);
+    }
+    
+    return optimaRatios;
+}
+
+float AdaptiveCurve::getVertexPosition (int step) const
+{
+    // Vertex of the parabola through the step and its neighbours
+    const float x0 = positions[step - 1];
+    const float x1 = positions[step];
+    const float x2 = positions[step + 1];
+    
+    const float left = dissonance[step - 1];
+    const float middle = dissonance[step];
+    const float right = dissonance[step + 1];
+    
+    const float numerator = (x1 - x0) * (x1 - x0) * (middle - right) - (x1 - x2) * (x1 - x2) * (middle - left);
+    const float denominator = (x1 - x0) * (middle - right) - (x1 - x2) * (middle - left);
+    
+    if (denominator == 0)
+        return x1;
+    
+    return jlimit (x0, x2, x1 - 0.5f * numerator / denominator);
+}
+
+bool AdaptiveCurve::evaluate (const IntervalDissonance& intervals, const Array<float>& ratios,
+                              Array<float>& results, const ThreadPoolJob* job)
+{
+    results.resize (ratios.size());
+    
+    for (int i = 0; i < ratios.size(); i += batchSize)
+    {
+        if (job != nullptr && job->shouldExit())
+            return false;
+        
+        intervals.getDissonance (ratios.begin() + i, results.begin() + i, jmin (batchSize, ratios.size() - i));
+    }
+    
+    return true;
+}
@@ -0,0 +1,82 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "IntervalDissonance.h"
+
+//==============================================================================
+/*
+    A dissonance curve sampled at steps that needn't be uniform.
+ 
+    Adaptive sampling starts from a coarse uniform grid (linear or logarithmic), then repeatedly halves
+    only the steps where the curve bends away from a straight line, or where a step brackets a
+    minimum or maximum. Each pass is evaluated as one batch, and refinement stops when nothing
+    is left to refine or the step budget is spent, so narrow dips near simple ratios are
+    resolved without a dense grid over the whole range.
+*/
+class AdaptiveCurve
+{
+public:
+    AdaptiveCurve();
+    ~AdaptiveCurve();
+    
+    /*  Samples the dissonance between the given ratios, with at most maxSteps steps
+ 
+        When sampled by a job, it checks whether the job should exit between batches of steps,
+        and returns false with no steps if it should.
+    */
+    bool sample (const IntervalDissonance& intervals, float startRatio, float endRatio,
+                 bool logSpaced, int numCoarseSteps, int maxSteps, const ThreadPoolJob* job = nullptr);
+    
+    // Sets steps that were evaluated elsewhere, at positions within the range
+    void setRange (float startRatio, float endRatio, bool logSpaced);
+    void setSteps (const Array<float>& newPositions, const Array<float>& newDissonance);
+    
+    int getNumSteps() const;
+    const float* getRawDissonanceData() const;
+    
+    // Positions run from 0 at the start ratio to 1 at the end ratio, in linear or log spacing
+    float getPositionAtStep (int step) const;
+    float getPositionOfRatio (float ratio) const;
+    float getRatioAtPosition (float position) const;
+    
+    // Linearly interpolated between the nearest steps
+    float getDissonanceAtRatio (float ratio) const;
+    float getDissonanceAtPosition (float position) const;
+    
+    // Ratios of the minima or maxima, refined between steps with a parabola through the
+    // neighbouring steps. Optima closer than the min interval keep only the most extreme one.
+    Array<float> findOptima (bool minima, float minInterval) const;
+    
+    /*  Follows the previous optima to the nearest optima of this curve, for a curve that has only
+        changed slightly. The ratios are returned in the same order as the previous ones, with 0 for
+        an optimum that has run off the end of the curve or within the min interval of another.
+    */
+    Array<float> trackOptima (const Array<float>& previousRatios, bool minima, float minInterval) const;
+
+private:
+    Array<float> positions, dissonance;
+    float start, end;
+    bool isLog;
+    
+    // Position of an optimum, refined between its step's neighbours
+    float getVertexPosition (int step) const;
+    
+    // Evaluates the ratios in batches, returning false if the job should exit before they're done
+    static bool evaluate (const IntervalDissonance& intervals, const Array<float>& ratios,
+                          Array<float>& results, const ThreadPoolJob* job);
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AdaptiveCurve)
+};
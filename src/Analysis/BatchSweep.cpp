@@ -0,0 +1,498 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#include "BatchSweep.h"
+#include "MapExporter.h"
+#include "Trace.h"
+#include "../../DisMAL/FileIO.h"
+
+namespace
+{
+    // Claims are touched this often while their shard runs
+    const int heartbeatSeconds = 10;
+    
+    // Many missed heartbeats, so a claim this old is from a worker that crashed
+    const int staleClaimSeconds = 120;
+    
+    // Times a shard is claimed before it's marked as failed
+    const int maxAttempts = 3;
+    
+    // Middle C, an octave up
+    const float defaultStartFreq = 261.6256f;
+    const float defaultEndRatio = 2;
+    
+    // Touches a claim from its own thread, so a task that runs long doesn't let the claim go stale
+    class ClaimHeartbeat   : private Thread
+    {
+    public:
+        ClaimHeartbeat (const File& claimFile)   : Thread ("Sweep Claim Heartbeat"),
+                                                   claim (claimFile)
+        {
+            startThread();
+        }
+        
+        ~ClaimHeartbeat()
+        {
+            stopThread (1000);
+        }
+    
+    private:
+        File claim;
+        
+        void run() override
+        {
+            while (! threadShouldExit())
+            {
+                claim.setLastModificationTime (Time::getCurrentTime());
+                wait (heartbeatSeconds * 1000);
+            }
+        }
+    };
+}
+
+//==============================================================================
+BatchSweep::BatchSweep (const File& jobDirectory)   : directory (jobDirectory),
+                                                      claimLock ("PsychoCAT Sweep "
+                                                                 + String::toHexString (jobDirectory.getFullPathName().hashCode64()))
+{
+    numSteps = 2048;
+    shardSize = 16;
+    isAdaptive = false;
+    isLog = false;
+    minInterval = 1.001f;
+}
+
+BatchSweep::~BatchSweep()
+{
+}
+
+bool BatchSweep::load()
+{
+    const File planFile = directory.getChildFile ("plan.json");
+    
+    if (! planFile.existsAsFile() && ! plan())
+        return false;
+    
+    var planned = JSON::parse (planFile);
+    
+    if (! planned.isObject())
+    {
+        Logger::writeToLog ("Couldn't read " + planFile.getFullPathName());
+        return false;
+    }
+    
+    timbres.clearQuick();
+    startFreqs.clearQuick();
+    endRatios.clearQuick();
+    models.clearQuick();
+    
+    if (auto* files = planned["timbres"].getArray())
+        for (auto& file : *files)
+            timbres.add (File (file.toString()));
+    
+    if (auto* ranges = planned["ranges"].getArray())
+    {
+        for (auto& range : *ranges)
+        {
+            if (range.size() >= 2 && (float) range[0] > 0 && (float) range[1] > 1)
+            {
+                startFreqs.add ((float) range[0]);
+                endRatios.add ((float) range[1]);
+            }
+        }
+    }
+    
+    if (startFreqs.isEmpty())
+    {
+        startFreqs.add (defaultStartFreq);
+        endRatios.add (defaultEndRatio);
+    }
+    
+    if (auto* modelNames = planned["models"].getArray())
+        for (auto& modelName : *modelNames)
+            models.addIfNotAlreadyThere (modelName.toString());
+    
+    if (models.isEmpty())
+        models.add ("Sethares");
+    
+    numSteps = jmax (2, (int) planned.getProperty ("steps", 2048));
+    shardSize = jmax (1, (int) planned.getProperty ("shardSize", 16));
+    isAdaptive = planned.getProperty ("adaptive", false);
+    isLog = planned.getProperty ("logSteps", false);
+    minInterval = jmax (1.f, (float) planned.getProperty ("minInterval", 1.001f));
+    
+    return getNumTasks() > 0;
+}
+
+int BatchSweep::getNumTasks() const
+{
+    return timbres.size() * startFreqs.size() * models.size();
+}
+
+int BatchSweep::getNumShards() const
+{
+    return (getNumTasks() + shardSize - 1) / shardSize;
+}
+
+bool BatchSweep::runWorker()
+{
+    for (int shard = claimShard(); shard >= 0; shard = claimShard())
+    {
+        if (! runShard (shard))
+        {
+            Logger::writeToLog ("Couldn't write " + getShardFile (shard, ".csv").getFullPathName());
+            return false;
+        }
+        
+        getShardFile (shard, ".claim").deleteFile();
+    }
+    
+    return true;
+}
+
+bool BatchSweep::runCoordinator (int numWorkers)
+{
+    if (numWorkers <= 0)
+        numWorkers = SystemStats::getNumCpus();
+    
+    const String executable = File::getSpecialLocation (File::currentExecutableFile).getFullPathName();
+    OwnedArray<ChildProcess> workers;
+    int numReported = -1;
+    
+    for (;;)
+    {
+        for (int i = workers.size(); --i >= 0;)
+            if (! workers[i]->isRunning())
+                workers.remove (i);
+        
+        int numFinished = 0, numFailed = 0;
+        bool hasClaimable = false;
+        
+        for (int shard = 0; shard < getNumShards(); ++shard)
+        {
+            if (isShardFinished (shard))
+                ++numFinished;
+            else if (isShardFailed (shard))
+                ++numFailed;
+            else if (isClaimable (shard))
+                hasClaimable = true;
+        }
+        
+        if (numFinished != numReported)
+        {
+            Logger::writeToLog (String (numFinished) + " of " + String (getNumShards()) + " shards done");
+            numReported = numFinished;
+        }
+        
+        if (numFinished + numFailed == getNumShards())
+        {
+            if (numFailed > 0)
+                Logger::writeToLog (String (numFailed) + " shards failed, and are left out of the results");
+            
+            return mergeResults() && numFailed == 0;
+        }
+        
+        // Workers exit when there's nothing left to claim, and any that crash are replaced
+        // once their claims go quiet
+        if (hasClaimable && workers.size() < numWorkers)
+        {
+            std::unique_ptr<ChildProcess> worker (new ChildProcess());
+            
+            if (! worker->start (StringArray ({ executable, "--sweep-worker", directory.getFullPathName() }), 0))
+            {
+                Logger::writeToLog ("Couldn't start a worker");
+                return false;
+            }
+            
+            workers.add (worker.release());
+            continue;
+        }
+        
+        Thread::sleep (500);
+    }
+}
+
+bool BatchSweep::plan()
+{
+    const File sweepFile = directory.getChildFile ("sweep.json");
+    var sweep = JSON::parse (sweepFile);
+    
+    if (! sweep.isObject())
+    {
+        Logger::writeToLog ("Couldn't read " + sweepFile.getFullPathName());
+        return false;
+    }
+    
+    Array<var> sources;
+    
+    if (auto* list = sweep["timbres"].getArray())
+        sources.addArray (*list);
+    else
+        sources.add (sweep["timbres"]);
+    
+    // Listed in a fixed order, so every worker splits the tasks into the same shards
+    Array<var> files;
+    
+    for (auto& source : sources)
+    {
+        const File location = directory.getChildFile (source.toString());
+        
+        if (location.isDirectory())
+        {
+            Array<File> found = location.findChildFiles (File::findFiles, true, "*.dismal");
+            found.sort();
+            
+            for (auto& file : found)
+                files.add (file.getFullPathName());
+        }
+        else if (location.existsAsFile())
+        {
+            files.add (location.getFullPathName());
+        }
+    }
+    
+    if (files.isEmpty())
+    {
+        Logger::writeToLog ("No timbres found for the sweep");
+        return false;
+    }
+    
+    DynamicObject::Ptr planned = new DynamicObject();
+    
+    for (auto& property : sweep.getDynamicObject()->getProperties())
+        planned->setProperty (property.name, property.value);
+    
+    planned->setProperty ("timbres", files);
+    
+    // Renamed into place, so a plan is never half written
+    TemporaryFile planFile (directory.getChildFile ("plan.json"));
+    
+    return planFile.getFile().replaceWithText (JSON::toString (var (planned.get())))
+           && planFile.overwriteTargetFileWithTemporary();
+}
+
+File BatchSweep::getShardFile (int shard, const String& extension) const
+{
+    return directory.getChildFile ("Shards").getChildFile ("Shard " + String (shard) + extension);
+}
+
+bool BatchSweep::isShardFinished (int shard) const
+{
+    return getShardFile (shard, ".csv").existsAsFile();
+}
+
+bool BatchSweep::isShardFailed (int shard) const
+{
+    return getShardFile (shard, ".failed").existsAsFile();
+}
+
+bool BatchSweep::isClaimable (int shard) const
+{
+    if (isShardFinished (shard) || isShardFailed (shard))
+        return false;
+    
+    const File claim = getShardFile (shard, ".claim");
+    
+    return ! claim.existsAsFile()
+           || Time::getCurrentTime() - claim.getLastModificationTime() > RelativeTime::seconds (staleClaimSeconds);
+}
+
+int BatchSweep::claimShard()
+{
+    const InterProcessLock::ScopedLockType lock (claimLock);
+    
+    if (! lock.isLocked() || ! getShardFile (0, "").getParentDirectory().createDirectory())
+        return -1;
+    
+    for (int shard = 0; shard < getNumShards(); ++shard)
+    {
+        if (! isClaimable (shard))
+            continue;
+        
+        // Claims hold the number of times the shard has been claimed
+        const File claim = getShardFile (shard, ".claim");
+        const int attempts = claim.existsAsFile() ? claim.loadFileAsString().getIntValue() : 0;
+        
+        if (attempts >= maxAttempts)
+        {
+            claim.moveFileTo (getShardFile (shard, ".failed"));
+            continue;
+        }
+        
+        if (claim.replaceWithText (String (attempts + 1)))
+            return shard;
+    }
+    
+    return -1;
+}
+
+bool BatchSweep::runShard (int shard)
+{
+    TRACE_SCOPE ("BatchSweep::runShard");
+    
+    const ClaimHeartbeat heartbeat (getShardFile (shard, ".claim"));
+    const int tasksPerTimbre = startFreqs.size() * models.size();
+    const int end = jmin (getNumTasks(), (shard + 1) * shardSize);
+    
+    // Renamed into place once every task is written, which checkpoints the shard
+    TemporaryFile output (getShardFile (shard, ".csv"));
+    
+    {
+        MapExporter exporter (output.getFile(), MapExporter::csv);
+        
+        if (! exporter.openedOk())
+            return false;
+        
+        // Kept across tasks, so ranges of the same timbre and model reuse each other's tiles
+        MapTileCache tiles;
+        AdaptiveCurve curve;
+        Array<float> minima, maxima;
+        ValueTree distribution;
+        int loaded = -1;
+        
+        for (int task = shard * shardSize; task < end; ++task)
+        {
+            const int timbre = task / tasksPerTimbre;
+            const int range = (task / models.size()) % startFreqs.size();
+            const String& model = models[task % models.size()];
+            const float startFreq = startFreqs[range];
+            
+            // Tasks are in the order of their timbres, so each timbre is loaded once per shard
+            if (timbre != loaded)
+            {
+                FileIO io = timbres[timbre];
+                distribution = io.loadTreeFromFile();
+                PartialArray::convertLegacyPartials (distribution);
+                loaded = timbre;
+            }
+            
+            String name = distribution[IDs::Name].toString();
+            
+            if (name.isEmpty())
+                name = timbres[timbre].getFileNameWithoutExtension();
+            
+            name << " @ " << String (startFreq) << " Hz x " << String (endRatios[range]) << " (" << model << ")";
+            
+            exporter.beginMap (name, model);
+            
+            // Files that aren't timbres, or have no sounding partials, are left as empty maps
+            if (distribution.hasType (IDs::OvertoneDistribution))
+                tiles.setCalc (IntervalDissonance::createTimbreCalc (distribution, startFreq, model));
+            
+            if (distribution.hasType (IDs::OvertoneDistribution) && ! tiles.getIntervals().isEmpty()
+                && calculateCurve (tiles, startFreq, endRatios[range], curve, minima, maxima))
+            {
+                exporter.writeCurve (curve, startFreq);
+                
+                for (auto isMin : { true, false })
+                {
+                    Array<MapExporter::Optimum> optima;
+                    
+                    for (auto freq : isMin ? minima : maxima)
+                    {
+                        MapExporter::Optimum optimum = { freq, 0, curve.getDissonanceAtRatio (freq / startFreq) };
+                        optima.add (optimum);
+                    }
+                    
+                    exporter.writeOptima (optima, isMin);
+                }
+            }
+            
+            exporter.endMap();
+        }
+    }
+    
+    return output.overwriteTargetFileWithTemporary();
+}
+
+bool BatchSweep::calculateCurve (MapTileCache& tiles, float startFreq, float endRatio,
+                                 AdaptiveCurve& curve, Array<float>& minima, Array<float>& maxima) const
+{
+    minima.clearQuick();
+    maxima.clearQuick();
+    
+    // Adaptive steps are sampled and searched the same way as an adaptive map
+    if (isAdaptive)
+    {
+        if (! curve.sample (tiles.getIntervals(), 1, endRatio, isLog, jmin (128, numSteps), numSteps))
+            return false;
+        
+        for (auto ratio : curve.findOptima (true, minInterval))
+            minima.add (ratio * startFreq);
+        
+        for (auto ratio : curve.findOptima (false, minInterval))
+            maxima.add (ratio * startFreq);
+        
+        return true;
+    }
+    
+    // Uniform steps and their optima come from the cached DisMAL tiles of a map's last pass
+    const double startOctave = std::log2 ((double) startFreq);
+    const double endOctave = std::log2 ((double) startFreq * endRatio);
+    const int level = MapTileCache::getLevel (startOctave, endOctave, numSteps, isLog);
+    
+    Array<double> octaves;
+    Array<float> positions, dissonance;
+    
+    if (! tiles.getSteps (level, startOctave, endOctave, octaves, dissonance, nullptr)
+        || ! tiles.getOptima (level, startOctave, endOctave, minima, maxima, nullptr))
+        return false;
+    
+    curve.setRange (1, endRatio, isLog);
+    
+    for (auto octave : octaves)
+        positions.add (curve.getPositionOfRatio ((float) (std::pow (2.0, octave) / startFreq)));
+    
+    curve.setSteps (positions, dissonance);
+    return true;
+}
+
+bool BatchSweep::mergeResults() const
+{
+    TemporaryFile merged (directory.getChildFile ("results.csv"));
+    
+    {
+        FileOutputStream stream (merged.getFile());
+        
+        if (! stream.openedOk())
+            return false;
+        
+        bool hasHeader = false;
+        
+        for (int shard = 0; shard < getNumShards(); ++shard)
+        {
+            FileInputStream shardStream (getShardFile (shard, ".csv"));
+            
+            if (! shardStream.openedOk())
+                continue;
+            
+            // Every shard starts with the same header, which is only kept once
+            const String header = shardStream.readNextLine();
+            
+            if (! hasHeader)
+            {
+                stream << header << "\n";
+                hasHeader = true;
+            }
+            
+            stream.writeFromInputStream (shardStream, -1);
+        }
+        
+        stream.flush();
+        
+        if (stream.getStatus().failed())
+            return false;
+    }
+    
+    return merged.overwriteTargetFileWithTemporary();
+}
@@ -0,0 +1,99 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "AdaptiveCurve.h"
+#include "MapTileCache.h"
+
+//==============================================================================
+/*
+    A headless sweep of dissonance curves over many timbres, ranges and models, run by worker
+    processes that share a job directory.
+ 
+    The job directory holds a sweep.json, with every key optional except the timbres:
+ 
+        { "timbres": "a .dismal file, a folder of them, or an array of either",
+          "ranges": [[startFreq, endRatio], ...], "models": ["Sethares", "Vassilakis"],
+          "steps": 2048, "adaptive": false, "logSteps": false, "minInterval": 1.001,
+          "shardSize": 16 }
+ 
+    Every timbre is played against itself over every range with every model, each curve being a
+    task, and the tasks are split into shards of consecutive tasks. The timbres are listed in
+    plan.json the first time the sweep is run, so the shards stay the same when it's resumed.
+    Uniform curves and their optima come from DisMAL maps through a MapTileCache, the same as a
+    map's last pass, and adaptive curves are sampled and searched like adaptive maps.
+ 
+    Workers claim shards one at a time through claim files, and write each shard to a CSV file
+    (see MapExporter) that's renamed into place when it's done, so every finished shard is a
+    checkpoint. A worker touches its claim from a heartbeat thread while the shard runs (however
+    long a task takes), so a claim that's gone quiet is from a worker that crashed, and its
+    shard is taken up again. Shards that crash their worker too many times are marked as failed
+    rather than holding up the rest.
+ 
+    The coordinator starts the workers, replaces any that crash while there are shards left,
+    and merges the shards into results.csv once every shard is done. Running it again resumes
+    the sweep from the shards that were finished.
+*/
+class BatchSweep
+{
+public:
+    BatchSweep (const File& jobDirectory);
+    ~BatchSweep();
+    
+    // Reads the sweep's plan, planning it from sweep.json if it hasn't been planned yet
+    bool load();
+    
+    int getNumTasks() const;
+    int getNumShards() const;
+    
+    // Claims and calculates shards until there are none left to claim
+    bool runWorker();
+    
+    // Runs the sweep in worker processes, then merges the results, returning false if any shard failed
+    bool runCoordinator (int numWorkers);
+
+private:
+    File directory;
+    InterProcessLock claimLock;
+    
+    // The plan
+    Array<File> timbres;
+    Array<float> startFreqs, endRatios;
+    StringArray models;
+    int numSteps, shardSize;
+    bool isAdaptive, isLog;
+    float minInterval;
+    
+    bool plan();
+    
+    File getShardFile (int shard, const String& extension) const;
+    bool isShardFinished (int shard) const;
+    bool isShardFailed (int shard) const;
+    
+    // Whether a shard is unclaimed, or its claim has gone quiet
+    bool isClaimable (int shard) const;
+    int claimShard();
+    
+    // Calculates a shard's tasks, returning false if it couldn't be written
+    bool runShard (int shard);
+    
+    // Calculates a task's curve and its optima freqs the way a map would
+    bool calculateCurve (MapTileCache& tiles, float startFreq, float endRatio,
+                         AdaptiveCurve& curve, Array<float>& minima, Array<float>& maxima) const;
+    
+    bool mergeResults() const;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (BatchSweep)
+};
@@ -0,0 +1,549 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#include "DissonanceSurface.h"
+#include "Trace.h"
+
+namespace
+{
+    // Tiles are square, and small enough for a tile's scratch to stay in L1
+    const int tileSize = 64;
+    
+    // A tile and the edge steps of its neighbours
+    const int haloSize = tileSize + 2;
+    
+    // Bigger grids are kept in a store file
+    const int64 maxStepsInMemory = 1024 * 1024;
+}
+
+//==============================================================================
+DissonanceSurface::DissonanceSurface()
+{
+    fixedDissonance = 0;
+    referenceFreq = 0;
+    numSteps = 0;
+    tilesPerSide = 0;
+    numFinished = 0;
+    listener = nullptr;
+}
+
+DissonanceSurface::~DissonanceSurface()
+{
+}
+
+bool DissonanceSurface::hasTwoVariables (const ValueTree& calc)
+{
+    bool hasX = false;
+    bool hasY = false;
+    
+    for (int i = 0; i < calc.getNumChildren(); ++i)
+    {
+        ValueTree distribution = calc.getChild (i);
+        
+        if (! distribution.hasType (IDs::OvertoneDistribution)
+            || distribution[IDs::Mute])
+            continue;
+        
+        if (distribution[IDs::XAxis])
+            hasX = true;
+        else if (distribution[IDs::YAxis])
+            hasY = true;
+    }
+    
+    return hasX && hasY;
+}
+
+void DissonanceSurface::setCalc (const ValueTree& calc, float startFreq, float endFreq, bool logSpaced, int steps)
+{
+    float calcStartFreq = calc[IDs::StartFreq];
+    Array<IntervalDissonance::Timbre> fixed;
+    IntervalDissonance::Timbre x, y;
+    
+    for (int i = 0; i < calc.getNumChildren(); ++i)
+    {
+        ValueTree distribution = calc.getChild (i);
+        
+        if (! distribution.hasType (IDs::OvertoneDistribution)
+            || distribution[IDs::Mute])
+            continue;
+        
+        if (distribution[IDs::XAxis])
+            x = IntervalDissonance::createTimbre (distribution, calcStartFreq);
+        else if (distribution[IDs::YAxis])
+            y = IntervalDissonance::createTimbre (distribution, calcStartFreq);
+        else
+            fixed.add (IntervalDissonance::createTimbre (distribution, calcStartFreq));
+    }
+    
+    // Same as the ratios of the calc's curve
+    referenceFreq = fixed.size() == 1 ? fixed.getFirst().fundamentalFreq : calcStartFreq;
+    
+    if (referenceFreq <= 0)
+        referenceFreq = startFreq;
+    
+    Roughness::Model model = calc[IDs::ModelName] == "Vassilakis" ? Roughness::vassilakis : Roughness::sethares;
+    
+    Array<float> freqs, amps;
+    
+    for (auto& timbre : fixed)
+    {
+        for (int i = 0; i < timbre.ratios.size(); ++i)
+        {
+            freqs.add (timbre.fundamentalFreq * timbre.ratios[i]);
+            amps.add (timbre.amps[i]);
+        }
+    }
+    
+    fixedDissonance = Roughness::ofSpectrum (freqs.getRawDataPointer(), amps.getRawDataPointer(), freqs.size(), model);
+    
+    auto addPairs = [&] (VariablePairs& pairs, const IntervalDissonance::Timbre& variable)
+    {
+        for (int i = 0; i < variable.ratios.size(); ++i)
+        {
+            for (int j = i + 1; j < variable.ratios.size(); ++j)
+            {
+                float weight = Roughness::getAmpWeight (variable.amps[i], variable.amps[j], model);
+                
+                if (weight > 0)
+                {
+                    pairs.selfFreqs1.add (referenceFreq * variable.ratios[i]);
+                    pairs.selfFreqs2.add (referenceFreq * variable.ratios[j]);
+                    pairs.selfWeights.add (weight);
+                }
+            }
+            
+            for (int j = 0; j < freqs.size(); ++j)
+            {
+                float weight = Roughness::getAmpWeight (amps[j], variable.amps[i], model);
+                
+                if (weight > 0)
+                {
+                    pairs.fixedFreqs.add (freqs[j]);
+                    pairs.variableFreqs.add (referenceFreq * variable.ratios[i]);
+                    pairs.weights.add (weight);
+                }
+            }
+        }
+    };
+    
+    addPairs (xPairs, x);
+    addPairs (yPairs, y);
+    
+    for (int i = 0; i < x.ratios.size(); ++i)
+    {
+        xFreqs.add (referenceFreq * x.ratios[i]);
+        
+        for (int j = 0; j < y.ratios.size(); ++j)
+        {
+            float weight = Roughness::getAmpWeight (x.amps[i], y.amps[j], model);
+            
+            if (weight > 0)
+            {
+                crossX.add (i);
+                crossYFreqs.add (referenceFreq * y.ratios[j]);
+                crossWeights.add (weight);
+            }
+        }
+    }
+    
+    numSteps = jmax (2, steps);
+    
+    const float startRatio = startFreq / referenceFreq;
+    const float endRatio = endFreq / referenceFreq;
+    
+    for (int i = 0; i < numSteps; ++i)
+    {
+        float position = (float) i / (numSteps - 1);
+        
+        ratios.add (logSpaced ? startRatio * std::pow (endRatio / startRatio, position)
+                              : startRatio + position * (endRatio - startRatio));
+    }
+    
+    tilesPerSide = (numSteps + tileSize - 1) / tileSize;
+    
+    if ((int64) numSteps * numSteps > maxStepsInMemory)
+        store.reset (new ResultStore (getKey(), getNumTiles(), haloSize * haloSize));
+    else
+        store.reset (new ResultStore (getNumTiles(), haloSize * haloSize));
+    
+    finished.insertMultiple (0, false, getNumTiles());
+    tileMinima.insertMultiple (0, Array<Optimum>(), getNumTiles());
+    tileMaxima.insertMultiple (0, Array<Optimum>(), getNumTiles());
+    tileMin.insertMultiple (0, 0, getNumTiles());
+    tileMax.insertMultiple (0, 0, getNumTiles());
+}
+
+int DissonanceSurface::getNumSteps() const
+{
+    return numSteps;
+}
+
+float DissonanceSurface::getReferenceFreq() const
+{
+    return referenceFreq;
+}
+
+float DissonanceSurface::getRatioAtStep (int step) const
+{
+    return ratios[step];
+}
+
+float DissonanceSurface::getRatioBetweenSteps (float step) const
+{
+    const int lower = jlimit (0, numSteps - 2, (int) std::floor (step));
+    return ratios[lower] + (step - lower) * (ratios[lower + 1] - ratios[lower]);
+}
+
+int DissonanceSurface::getNumTiles() const
+{
+    return tilesPerSide * tilesPerSide;
+}
+
+void DissonanceSurface::calculateTile (int tile)
+{
+    if (isCancelled())
+        return;
+    
+    const Rectangle<int> bounds = getTileBounds (tile);
+    
+    // The tile is calculated with a halo of its neighbours' edge steps, so its optima can be
+    // found without waiting for the neighbouring tiles
+    const Rectangle<int> halo = getHaloBounds (tile);
+    const int numColumns = halo.getWidth();
+    const int numRows = halo.getHeight();
+    
+    const float* columnRatios = ratios.begin() + halo.getX();
+    const float* rowRatios = ratios.begin() + halo.getY();
+    
+    // Steps are calculated straight into the store, unless they're there from before
+    float* cells = store->getChunk (tile);
+    
+    if (! store->isChunkFinished (tile))
+    {
+        float columnTerms[haloSize], rowTerms[haloSize];
+        
+        FloatVectorOperations::fill (columnTerms, fixedDissonance, numColumns);
+        addVariableTerms (xPairs, columnRatios, columnTerms, numColumns);
+        
+        FloatVectorOperations::clear (rowTerms, numRows);
+        addVariableTerms (yPairs, rowRatios, rowTerms, numRows);
+        
+        // The x-axis partials' freqs for every column of the tile
+        HeapBlock<float> columnFreqs ((size_t) jmax (1, xFreqs.size() * haloSize));
+        
+        for (int i = 0; i < xFreqs.size(); ++i)
+            FloatVectorOperations::copyWithMultiply (columnFreqs + i * haloSize, columnRatios, xFreqs.getUnchecked (i), numColumns);
+        
+        for (int r = 0; r < numRows; ++r)
+        {
+            if (isCancelled())
+                return;
+            
+            float* row = cells + r * numColumns;
+            
+            FloatVectorOperations::copy (row, columnTerms, numColumns);
+            FloatVectorOperations::add (row, rowTerms[r], numColumns);
+            
+            for (int i = 0; i < crossWeights.size(); ++i)
+                Roughness::addCurves (crossYFreqs.getUnchecked (i) * rowRatios[r], columnFreqs + crossX.getUnchecked (i) * haloSize,
+                                      crossWeights.getUnchecked (i), row, numColumns);
+        }
+        
+        store->setChunkFinished (tile);
+    }
+    
+    Range<float> tileRange;
+    
+    for (int y = bounds.getY(); y < bounds.getBottom(); ++y)
+    {
+        const float* row = cells + (y - halo.getY()) * numColumns + (bounds.getX() - halo.getX());
+        
+        Range<float> rowRange = FloatVectorOperations::findMinAndMax (row, bounds.getWidth());
+        tileRange = y == bounds.getY() ? rowRange : tileRange.getUnionWith (rowRange);
+    }
+    
+    Array<Optimum> newMinima, newMaxima;
+    
+    {
+        TRACE_SCOPE ("DissonanceSurface::findOptima");
+        
+        findOptima (cells, halo, bounds, true, newMinima);
+        findOptima (cells, halo, bounds, false, newMaxima);
+    }
+    
+    const ScopedLock sl (tileLock);
+    
+    finished.set (tile, true);
+    tileMin.set (tile, tileRange.getStart());
+    tileMax.set (tile, tileRange.getEnd());
+    tileMinima.getReference (tile).swapWith (newMinima);
+    tileMaxima.getReference (tile).swapWith (newMaxima);
+    ++numFinished;
+    
+    if (listener != nullptr)
+        listener->triggerAsyncUpdate();
+}
+
+void DissonanceSurface::findOptima (const float* cells, Rectangle<int> halo, Rectangle<int> bounds,
+                                    bool minima, Array<Optimum>& results) const
+{
+    // Maxima are found as the minima of the inverted surface
+    const float sign = minima ? 1.f : -1.f;
+    const int stride = halo.getWidth();
+    
+    // Steps on the edge of the grid don't have every neighbour, so they're skipped
+    const Rectangle<int> inner = bounds.getIntersection (Rectangle<int> (1, 1, numSteps - 2, numSteps - 2));
+    
+    for (int y = inner.getY(); y < inner.getBottom(); ++y)
+    {
+        for (int x = inner.getX(); x < inner.getRight(); ++x)
+        {
+            const float* cell = cells + (y - halo.getY()) * stride + (x - halo.getX());
+            const float middle = sign * *cell;
+            
+            // Ties go to the first step in the grid's order, so a flat optimum is only found once
+            if (! (middle < sign * cell[-stride - 1] && middle < sign * cell[-stride] && middle < sign * cell[-stride + 1]
+                   && middle < sign * cell[-1] && middle <= sign * cell[1]
+                   && middle <= sign * cell[stride - 1] && middle <= sign * cell[stride] && middle <= sign * cell[stride + 1]))
+                continue;
+            
+            // Vertex of the parabola through the neighbouring steps along each axis
+            const float left = cell[-1];
+            const float right = cell[1];
+            const float below = cell[-stride];
+            const float above = cell[stride];
+            
+            const float xCurvature = left - 2 * *cell + right;
+            const float yCurvature = below - 2 * *cell + above;
+            
+            const float xOffset = xCurvature != 0 ? jlimit (-0.5f, 0.5f, 0.5f * (left - right) / xCurvature) : 0;
+            const float yOffset = yCurvature != 0 ? jlimit (-0.5f, 0.5f, 0.5f * (below - above) / yCurvature) : 0;
+            
+            Optimum optimum;
+            optimum.xRatio = getRatioBetweenSteps (x + xOffset);
+            optimum.yRatio = getRatioBetweenSteps (y + yOffset);
+            optimum.dissonance = *cell - 0.25f * ((left - right) * xOffset + (below - above) * yOffset);
+            
+            results.add (optimum);
+        }
+    }
+}
+
+Array<DissonanceSurface::Optimum> DissonanceSurface::getOptima (bool minima, float minInterval) const
+{
+    TRACE_SCOPE ("DissonanceSurface::getOptima");
+    
+    Array<Optimum> all, optima;
+    
+    {
+        const ScopedLock sl (tileLock);
+        
+        for (int i = 0; i < finished.size(); ++i)
+            if (finished[i])
+                all.addArray (minima ? tileMinima.getReference (i) : tileMaxima.getReference (i));
+    }
+    
+    // The most extreme optima are kept first
+    struct Comparator
+    {
+        bool isMin;
+        
+        int compareElements (const Optimum& first, const Optimum& second) const
+        {
+            const float difference = isMin ? first.dissonance - second.dissonance : second.dissonance - first.dissonance;
+            return difference < 0 ? -1 : (difference > 0 ? 1 : 0);
+        }
+    };
+    
+    Comparator comparator { minima };
+    all.sort (comparator);
+    
+    // Optima closer than the min interval on both axes keep only the most extreme one
+    for (auto& optimum : all)
+    {
+        bool isDistinct = true;
+        
+        for (auto& kept : optima)
+        {
+            if (jmax (optimum.xRatio, kept.xRatio) / jmin (optimum.xRatio, kept.xRatio) < minInterval
+                && jmax (optimum.yRatio, kept.yRatio) / jmin (optimum.yRatio, kept.yRatio) < minInterval)
+            {
+                isDistinct = false;
+                break;
+            }
+        }
+        
+        if (isDistinct)
+            optima.add (optimum);
+    }
+    
+    return optima;
+}
+
+Rectangle<int> DissonanceSurface::getTileBounds (int tile) const
+{
+    return Rectangle<int> ((tile % tilesPerSide) * tileSize, (tile / tilesPerSide) * tileSize, tileSize, tileSize)
+           .getIntersection (Rectangle<int> (numSteps, numSteps));
+}
+
+bool DissonanceSurface::isTileFinished (int tile) const
+{
+    const ScopedLock sl (tileLock);
+    return finished[tile];
+}
+
+bool DissonanceSurface::isFinished() const
+{
+    const ScopedLock sl (tileLock);
+    return numFinished == getNumTiles();
+}
+
+Rectangle<int> DissonanceSurface::getHaloBounds (int tile) const
+{
+    return getTileBounds (tile).expanded (1).getIntersection (Rectangle<int> (numSteps, numSteps));
+}
+
+float DissonanceSurface::getDissonance (int xStep, int yStep) const
+{
+    const int tile = (yStep / tileSize) * tilesPerSide + xStep / tileSize;
+    const Rectangle<int> halo = getHaloBounds (tile);
+    
+    return store->getChunk (tile)[(yStep - halo.getY()) * halo.getWidth() + xStep - halo.getX()];
+}
+
+void DissonanceSurface::getRow (int yStep, float* results) const
+{
+    for (int tile = (yStep / tileSize) * tilesPerSide, x = 0; x < numSteps; ++tile, x += tileSize)
+    {
+        const Rectangle<int> halo = getHaloBounds (tile);
+        const int width = jmin (tileSize, numSteps - x);
+        
+        FloatVectorOperations::copy (results + x, store->getChunk (tile) + (yStep - halo.getY()) * halo.getWidth() + x - halo.getX(),
+                                     width);
+    }
+}
+
+MD5 DissonanceSurface::getKey() const
+{
+    MemoryOutputStream snapshot;
+    
+    auto writeArray = [&snapshot] (const Array<float>& values)
+    {
+        snapshot.writeInt (values.size());
+        snapshot.write (values.begin(), sizeof (float) * (size_t) values.size());
+    };
+    
+    // Results of older maths are never reused
+    snapshot.writeInt (Roughness::engineVersion);
+    
+    // The tile size changes the layout of the chunks
+    snapshot.writeInt (tileSize);
+    snapshot.writeInt (numSteps);
+    snapshot.writeFloat (fixedDissonance);
+    snapshot.writeFloat (referenceFreq);
+    writeArray (ratios);
+    
+    for (auto* pairs : { &xPairs, &yPairs })
+    {
+        writeArray (pairs->fixedFreqs);
+        writeArray (pairs->variableFreqs);
+        writeArray (pairs->weights);
+        writeArray (pairs->selfFreqs1);
+        writeArray (pairs->selfFreqs2);
+        writeArray (pairs->selfWeights);
+    }
+    
+    writeArray (xFreqs);
+    writeArray (crossYFreqs);
+    writeArray (crossWeights);
+    snapshot.write (crossX.begin(), sizeof (int) * (size_t) crossX.size());
+    
+    return MD5 (snapshot.getData(), snapshot.getDataSize());
+}
+
+Range<float> DissonanceSurface::getDissonanceRange() const
+{
+    const ScopedLock sl (tileLock);
+    
+    Range<float> range;
+    bool isFirst = true;
+    
+    for (int i = 0; i < finished.size(); ++i)
+    {
+        if (! finished[i])
+            continue;
+        
+        range = isFirst ? Range<float> (tileMin[i], tileMax[i])
+                        : range.getUnionWith (Range<float> (tileMin[i], tileMax[i]));
+        isFirst = false;
+    }
+    
+    return range;
+}
+
+void DissonanceSurface::cancel()
+{
+    cancelled = 1;
+    setListener (nullptr);
+}
+
+bool DissonanceSurface::isCancelled() const
+{
+    return cancelled.get() != 0;
+}
+
+void DissonanceSurface::setListener (AsyncUpdater* newListener)
+{
+    const ScopedLock sl (tileLock);
+    listener = newListener;
+}
+
+void DissonanceSurface::addVariableTerms (const VariablePairs& pairs, const float* tileRatios, float* results, int num)
+{
+    // Rows and columns include the tile's halo
+    jassert (num <= haloSize);
+    
+    float freqs[haloSize], otherFreqs[haloSize];
+    
+    for (int i = 0; i < pairs.weights.size(); ++i)
+    {
+        FloatVectorOperations::copyWithMultiply (freqs, tileRatios, pairs.variableFreqs.getUnchecked (i), num);
+        Roughness::addCurves (pairs.fixedFreqs.getUnchecked (i), freqs, pairs.weights.getUnchecked (i), results, num);
+    }
+    
+    for (int i = 0; i < pairs.selfWeights.size(); ++i)
+    {
+        FloatVectorOperations::copyWithMultiply (freqs, tileRatios, pairs.selfFreqs1.getUnchecked (i), num);
+        FloatVectorOperations::copyWithMultiply (otherFreqs, tileRatios, pairs.selfFreqs2.getUnchecked (i), num);
+        Roughness::addCurves (freqs, otherFreqs, pairs.selfWeights.getUnchecked (i), results, num);
+    }
+}
+
+//==============================================================================
+SurfaceTileJob::SurfaceTileJob (DissonanceSurface* owner, int tileIndex)   : ThreadPoolJob ("Surface Tile"),
+                                                                            surface (owner),
+                                                                            tile (tileIndex)
+{
+}
+
+SurfaceTileJob::~SurfaceTileJob()
+{
+}
+
+ThreadPoolJob::JobStatus SurfaceTileJob::runJob()
+{
+    TRACE_SCOPE ("SurfaceTileJob");
+    
+    surface->calculateTile (tile);
+    return jobHasFinished;
+}
@@ -0,0 +1,166 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "IntervalDissonance.h"
+#include "ResultStore.h"
+
+//==============================================================================
+/*
+    The dissonance of a triad over a grid of two intervals, for a calc with both an x-axis and
+    a y-axis distribution.
+ 
+    The x-axis and y-axis timbres are played at ratios of the reference freq (the same as the
+    calc's curve) against the calc's other timbres and each other, with both axes spanning the
+    same ratios. Only the pairs of an x-axis partial and a y-axis partial depend on both ratios,
+    so the rest are summed once per row and column.
+ 
+    The grid is calculated in square tiles, one job per tile, so the tiles are spread across
+    every thread of the pool. A tile keeps the x-axis partials' freqs for its columns and works
+    through its rows a pair at a time, so its scratch stays in cache.
+ 
+    Each tile is calculated with a halo of its neighbours' edge steps, so the tile's job can find
+    its local optima (steps more or less dissonant than all eight neighbours) as soon as it's
+    done. Each optimum is then refined to the vertex of the parabolas through its neighbours
+    along each axis.
+ 
+    Tiles are kept with their halo as the chunks of a result store. Grids bigger than a million
+    steps are stored in a memory mapped file, keyed by the snapshot, so they're paged in and out
+    a tile at a time rather than held in RAM, and a surface that's calculated again (in this
+    session or a later one) only calculates the tiles that weren't finished.
+ 
+    Jobs keep the surface alive while they run, so a surface is cancelled rather than deleted
+    when the calc changes.
+*/
+class DissonanceSurface   : public ReferenceCountedObject
+{
+public:
+    DissonanceSurface();
+    ~DissonanceSurface();
+    
+    typedef ReferenceCountedObjectPtr<DissonanceSurface> Ptr;
+    
+    // A chord of the reference freq and both ratios
+    struct Optimum
+    {
+        float xRatio, yRatio, dissonance;
+    };
+    
+    // Whether the calc has unmuted x-axis and y-axis distributions
+    static bool hasTwoVariables (const ValueTree& calc);
+    
+    // Takes a snapshot of the calc, over a square grid between the given freqs (message thread)
+    void setCalc (const ValueTree& calc, float startFreq, float endFreq, bool logSpaced, int numSteps);
+    
+    int getNumSteps() const;
+    float getReferenceFreq() const;
+    float getRatioAtStep (int step) const;
+    
+    // Calculates a tile, then triggers the listener (any thread)
+    int getNumTiles() const;
+    void calculateTile (int tile);
+    
+    // Steps covered by a tile, as x (columns) and y (rows)
+    Rectangle<int> getTileBounds (int tile) const;
+    
+    bool isTileFinished (int tile) const;
+    bool isFinished() const;
+    
+    // Dissonance at a step of each axis, once its tile is finished
+    float getDissonance (int xStep, int yStep) const;
+    
+    // A row of steps along the x-axis, once its tiles are finished
+    void getRow (int yStep, float* results) const;
+    
+    // Least and most dissonance of the finished tiles
+    Range<float> getDissonanceRange() const;
+    
+    /*  Optima of the finished tiles, most extreme first, leaving out any optimum within the min
+        interval of a more extreme one on both axes (any thread)
+    */
+    Array<Optimum> getOptima (bool minima, float minInterval) const;
+    
+    // Stops calculating tiles, and stops notifying the listener (message thread)
+    void cancel();
+    bool isCancelled() const;
+    
+    void setListener (AsyncUpdater* newListener);
+
+private:
+    // A variable timbre's pairs against the fixed partials, and within itself, with the
+    // variable freqs for a 1/1 interval
+    struct VariablePairs
+    {
+        Array<float> fixedFreqs, variableFreqs, weights;
+        Array<float> selfFreqs1, selfFreqs2, selfWeights;
+    };
+    
+    VariablePairs xPairs, yPairs;
+    
+    // Pairs of an x-axis partial (by index) and a y-axis partial
+    Array<float> xFreqs;
+    Array<int> crossX;
+    Array<float> crossYFreqs, crossWeights;
+    
+    float fixedDissonance, referenceFreq;
+    Array<float> ratios;
+    
+    // A tile and its halo per chunk, in rows of the halo's width
+    std::unique_ptr<ResultStore> store;
+    int numSteps, tilesPerSide;
+    
+    Array<bool> finished;
+    Array<float> tileMin, tileMax;
+    Array<Array<Optimum>> tileMinima, tileMaxima;
+    int numFinished;
+    CriticalSection mutable tileLock;
+    
+    AsyncUpdater* listener;
+    Atomic<int> cancelled;
+    
+    // Adds the dissonance that depends on only one of the ratios
+    static void addVariableTerms (const VariablePairs& pairs, const float* tileRatios, float* results, int num);
+    
+    // Finds the optima of a tile, from its steps and their halo
+    void findOptima (const float* cells, Rectangle<int> halo, Rectangle<int> bounds,
+                     bool minima, Array<Optimum>& results) const;
+    
+    float getRatioBetweenSteps (float step) const;
+    
+    Rectangle<int> getHaloBounds (int tile) const;
+    
+    // Everything the steps depend on (including the roughness maths' version), so a stored surface
+    // is only reused for the same snapshot
+    MD5 getKey() const;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (DissonanceSurface)
+};
+
+//==============================================================================
+/*
+    Calculates one tile of a surface.
+*/
+class SurfaceTileJob   : public ThreadPoolJob
+{
+public:
+    SurfaceTileJob (DissonanceSurface* owner, int tileIndex);
+    ~SurfaceTileJob();
+    
+    JobStatus runJob() override;
+
+private:
+    DissonanceSurface::Ptr surface;
+    int tile;
+};
@@ -0,0 +1,292 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#include "InputAnalyzer.h"
+
+namespace
+{
+    // Input quieter than this (about -80 dBFS) is treated as silence
+    const float silenceThreshold = 0.0001f;
+    
+    // Peaks more than 60 dB below the strongest one are ignored
+    const float peakThreshold = 0.001f;
+    
+    // The fundamental is the lowest peak within 20 dB of the strongest one
+    const float fundamentalThreshold = 0.1f;
+    
+    const float lowestFreq = 20;
+}
+
+//==============================================================================
+InputAnalyzer::InputAnalyzer()   : Thread ("Input Analyzer"),
+                                   fft (fftOrder),
+                                   fifo (fftSize * 4)
+{
+    window.allocate (fftSize, true);
+    frame.allocate (fftSize, true);
+    fftData.allocate (fftSize * 2, true);
+    fifoBuffer.allocate (fifo.getTotalSize(), true);
+    
+    dsp::WindowingFunction<float>::fillWindowingTables (window, fftSize, dsp::WindowingFunction<float>::hann, false);
+    
+    peakFreqs.ensureStorageAllocated (maxPeaks + 1);
+    peakAmps.ensureStorageAllocated (maxPeaks + 1);
+    latest.partials.ensureStorageAllocated (maxPeaks);
+    pending.partials.ensureStorageAllocated (maxPeaks);
+    
+    monoBufferSize = 0;
+    sampleRate = 44100;
+    model = Roughness::sethares;
+}
+
+InputAnalyzer::~InputAnalyzer()
+{
+    stopThread (1000);
+}
+
+void InputAnalyzer::prepare (int samplesPerBlockExpected, double newSampleRate)
+{
+    stopThread (1000);
+    
+    sampleRate = newSampleRate;
+    
+    monoBufferSize = 0;
+    monoBuffer.allocate (jmax (samplesPerBlockExpected, hopSize), true);
+    monoBufferSize = jmax (samplesPerBlockExpected, hopSize);
+    
+    fifo.reset();
+    FloatVectorOperations::clear (frame, fftSize);
+    
+    startThread();
+}
+
+void InputAnalyzer::release()
+{
+    stopThread (1000);
+    monoBufferSize = 0;
+}
+
+void InputAnalyzer::pushInput (const AudioSourceChannelInfo& bufferToFill)
+{
+    if (monoBufferSize == 0 || bufferToFill.buffer->getNumChannels() == 0)
+        return;
+    
+    const AudioBuffer<float>& buffer = *bufferToFill.buffer;
+    const int numChannels = buffer.getNumChannels();
+    
+    int startSample = bufferToFill.startSample;
+    int remaining = bufferToFill.numSamples;
+    
+    // Blocks larger than expected are mixed down in chunks, so nothing is allocated here
+    while (remaining > 0)
+    {
+        const int numSamples = jmin (remaining, monoBufferSize);
+        
+        FloatVectorOperations::copy (monoBuffer, buffer.getReadPointer (0, startSample), numSamples);
+        
+        for (int channel = 1; channel < numChannels; ++channel)
+            FloatVectorOperations::add (monoBuffer, buffer.getReadPointer (channel, startSample), numSamples);
+        
+        if (numChannels > 1)
+            FloatVectorOperations::multiply (monoBuffer, 1.f / numChannels, numSamples);
+        
+        // Whatever doesn't fit is dropped, as only the latest input gets analyzed anyway
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite (numSamples, start1, size1, start2, size2);
+        
+        if (size1 > 0)
+            FloatVectorOperations::copy (fifoBuffer + start1, monoBuffer, size1);
+        
+        if (size2 > 0)
+            FloatVectorOperations::copy (fifoBuffer + start2, monoBuffer + size1, size2);
+        
+        fifo.finishedWrite (size1 + size2);
+        
+        startSample += numSamples;
+        remaining -= numSamples;
+    }
+}
+
+InputAnalyzer::Analysis InputAnalyzer::getLatestAnalysis() const
+{
+    const ScopedLock sl (latestLock);
+    return latest;
+}
+
+void InputAnalyzer::setModel (Roughness::Model newModel)
+{
+    model = newModel;
+}
+
+void InputAnalyzer::run()
+{
+    while (! threadShouldExit())
+    {
+        const int numReady = fifo.getNumReady();
+        
+        if (numReady < hopSize)
+        {
+            wait (2);
+            continue;
+        }
+        
+        const int numSamples = (numReady / hopSize) * hopSize;
+        
+        if (numSamples >= fftSize)
+        {
+            // Fallen behind by a whole frame or more, so skip straight to the newest input
+            fifo.finishedRead (numSamples - fftSize);
+            readFromFifo (frame, fftSize);
+        }
+        else
+        {
+            memmove (frame, frame + numSamples, sizeof (float) * (size_t) (fftSize - numSamples));
+            readFromFifo (frame + fftSize - numSamples, numSamples);
+        }
+        
+        analyzeFrame();
+        sendChangeMessage();
+    }
+}
+
+void InputAnalyzer::readFromFifo (float* destination, int numSamples)
+{
+    int start1, size1, start2, size2;
+    fifo.prepareToRead (numSamples, start1, size1, start2, size2);
+    
+    if (size1 > 0)
+        FloatVectorOperations::copy (destination, fifoBuffer + start1, size1);
+    
+    if (size2 > 0)
+        FloatVectorOperations::copy (destination + size1, fifoBuffer + start2, size2);
+    
+    fifo.finishedRead (size1 + size2);
+}
+
+void InputAnalyzer::analyzeFrame()
+{
+    // The FFT buffer needs twice the frame size for the frequency-only transform
+    FloatVectorOperations::multiply (fftData, frame, window, fftSize);
+    FloatVectorOperations::clear (fftData + fftSize, fftSize);
+    fft.performFrequencyOnlyForwardTransform (fftData);
+    
+    const int numBins = fftSize / 2;
+    const float binWidth = (float) (sampleRate / fftSize);
+    
+    // Converts bin magnitudes to sine amplitudes, for a hann window
+    const float scale = 4.f / fftSize;
+    
+    const int firstBin = jmax (2, (int) std::ceil (lowestFreq / binWidth));
+    const float* magnitudes = fftData;
+    
+    float strongest = 0;
+    
+    for (int bin = firstBin; bin < numBins - 1; ++bin)
+        strongest = jmax (strongest, magnitudes[bin]);
+    
+    pending.fundamentalFreq = 0;
+    pending.fundamentalAmp = 0;
+    pending.partials.clearQuick();
+    pending.roughness = 0;
+    
+    peakFreqs.clearQuick();
+    peakAmps.clearQuick();
+    
+    if (strongest * scale >= silenceThreshold)
+    {
+        const float threshold = strongest * peakThreshold;
+        
+        for (int bin = firstBin; bin < numBins - 1; ++bin)
+        {
+            const float magnitude = magnitudes[bin];
+            
+            if (magnitude <= threshold
+                || magnitude <= magnitudes[bin - 1]
+                || magnitude < magnitudes[bin + 1])
+                continue;
+            
+            // Parabolic interpolation of the log magnitudes around the peak bin
+            const float a = std::log (magnitudes[bin - 1] + 1.0e-12f);
+            const float b = std::log (magnitude);
+            const float c = std::log (magnitudes[bin + 1] + 1.0e-12f);
+            const float denominator = a - 2 * b + c;
+            const float offset = denominator < 0 ? 0.5f * (a - c) / denominator : 0;
+            
+            const float freq = (bin + offset) * binWidth;
+            const float amp = std::exp (b - 0.25f * (a - c) * offset) * scale;
+            
+            if (peakAmps.size() < maxPeaks)
+            {
+                peakFreqs.add (freq);
+                peakAmps.add (amp);
+            }
+            else
+            {
+                // Keep the strongest peaks, replacing the weakest kept so far
+                int weakest = 0;
+                
+                for (int i = 1; i < peakAmps.size(); ++i)
+                    if (peakAmps.getUnchecked (i) < peakAmps.getUnchecked (weakest))
+                        weakest = i;
+                
+                if (amp > peakAmps.getUnchecked (weakest))
+                {
+                    peakFreqs.remove (weakest);
+                    peakAmps.remove (weakest);
+                    peakFreqs.add (freq);
+                    peakAmps.add (amp);
+                }
+            }
+        }
+    }
+    
+    if (! peakFreqs.isEmpty())
+    {
+        // Peaks are kept in ascending freq order, since replacements only remove from the middle
+        float strongestPeak = 0;
+        
+        for (auto amp : peakAmps)
+            strongestPeak = jmax (strongestPeak, amp);
+        
+        int fundamental = 0;
+        
+        while (peakAmps.getUnchecked (fundamental) < strongestPeak * fundamentalThreshold)
+            ++fundamental;
+        
+        // Assumes peaks below the fundamental are noise
+        peakFreqs.removeRange (0, fundamental);
+        peakAmps.removeRange (0, fundamental);
+        
+        pending.fundamentalFreq = peakFreqs.getUnchecked (0);
+        pending.fundamentalAmp = peakAmps.getUnchecked (0);
+        
+        for (int i = 1; i < peakFreqs.size(); ++i)
+        {
+            PartialData partial;
+            partial.freq = peakFreqs.getUnchecked (i) / pending.fundamentalFreq;
+            partial.amp = peakAmps.getUnchecked (i) / pending.fundamentalAmp;
+            
+            pending.partials.add (partial);
+        }
+        
+        pending.roughness = Roughness::ofSpectrum (peakFreqs.getRawDataPointer(), peakAmps.getRawDataPointer(),
+                                                   peakFreqs.size(), (Roughness::Model) model.get());
+    }
+    
+    const ScopedLock sl (latestLock);
+    
+    latest.fundamentalFreq = pending.fundamentalFreq;
+    latest.fundamentalAmp = pending.fundamentalAmp;
+    latest.partials.swapWith (pending.partials);
+    latest.roughness = pending.roughness;
+}
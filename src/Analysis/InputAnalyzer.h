@@ -0,0 +1,101 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "PartialArray.h"
+#include "Roughness.h"
+
+//==============================================================================
+/*
+    Live spectral analysis of the audio input.
+ 
+    The audio callback only mixes the input down to mono and writes it into a lock-free
+    fifo. A worker thread reads it a hop at a time, runs a windowed FFT, picks spectral
+    peaks, and publishes them as an overtone distribution (the lowest strong peak being
+    the fundamental) along with the roughness of the whole spectrum.
+ 
+    Only the latest analysis is kept. If the worker falls behind, older hops are skipped,
+    and listeners are sent a change message whenever a new analysis is available.
+ 
+    Frames are 2048 samples with a hop of 256, so a new sound is fully in the frame about
+    46 ms after it starts at 44.1 kHz, and analyses follow each other about every 6 ms. The
+    shorter frame resolves partials about 21 Hz apart (before interpolating the peaks), so
+    partials closer than that are heard as one.
+*/
+class InputAnalyzer   : public Thread,
+                        public ChangeBroadcaster
+{
+public:
+    InputAnalyzer();
+    ~InputAnalyzer();
+    
+    struct Analysis
+    {
+        // Fundamental freq is in Hz and 0 when the input is silent
+        float fundamentalFreq = 0;
+        float fundamentalAmp = 0;
+        
+        // Freq and amp ratios to the fundamental, in ascending freq order
+        Array<PartialData> partials;
+        
+        float roughness = 0;
+    };
+    
+    // Allocates everything the audio callback and worker need, and starts the worker
+    void prepare (int samplesPerBlockExpected, double sampleRate);
+    void release();
+    
+    // Called from the audio callback, never allocates or locks
+    void pushInput (const AudioSourceChannelInfo& bufferToFill);
+    
+    // Copies out the latest analysis (message thread)
+    Analysis getLatestAnalysis() const;
+    
+    void setModel (Roughness::Model newModel);
+    
+    void run() override;
+
+private:
+    enum
+    {
+        fftOrder = 11,
+        fftSize = 1 << fftOrder,
+        hopSize = 256,
+        maxPeaks = 32
+    };
+    
+    dsp::FFT fft;
+    HeapBlock<float> window, frame, fftData;
+    
+    // Audio thread to worker
+    AbstractFifo fifo;
+    HeapBlock<float> fifoBuffer, monoBuffer;
+    int monoBufferSize;
+    
+    double sampleRate;
+    Atomic<int> model;
+    
+    // Worker to message thread
+    Analysis latest, pending;
+    CriticalSection mutable latestLock;
+    
+    // Worker-only scratch space
+    Array<float> peakFreqs, peakAmps;
+    
+    void readFromFifo (float* destination, int numSamples);
+    void analyzeFrame();
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (InputAnalyzer)
+};
@@ -0,0 +1,496 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#include "IntervalDissonance.h"
+
+namespace
+{
+    // Ratios are evaluated in blocks, to keep the scratch freqs on the stack
+    const int blockSize = 256;
+}
+
+//==============================================================================
+IntervalDissonance::IntervalDissonance()
+{
+    fixedDissonance = 0;
+    referenceFreq = 0;
+}
+
+IntervalDissonance::~IntervalDissonance()
+{
+}
+
+void IntervalDissonance::setCalcs (const ValueTree& calcList)
+{
+    clear();
+    
+    for (int i = 0; i < calcList.getNumChildren(); ++i)
+        addCalc (calcList.getChild (i));
+}
+
+void IntervalDissonance::setCalc (const ValueTree& calc)
+{
+    clear();
+    addCalc (calc);
+}
+
+void IntervalDissonance::setTimbre (const ValueTree& distribution, float fundamentalFreq, const String& modelName)
+{
+    setCalc (createTimbreCalc (distribution, fundamentalFreq, modelName));
+}
+
+ValueTree IntervalDissonance::createTimbreCalc (const ValueTree& distribution, float fundamentalFreq, const String& modelName)
+{
+    ValueTree calc (IDs::Calculator);
+    calc.setProperty (IDs::ModelName, modelName, nullptr);
+    calc.setProperty (IDs::StartFreq, fundamentalFreq, nullptr);
+    
+    ValueTree lower = distribution.createCopy();
+    lower.setProperty (IDs::FundamentalFreq, fundamentalFreq, nullptr);
+    lower.setProperty (IDs::XAxis, false, nullptr);
+    lower.setProperty (IDs::Mute, false, nullptr);
+    
+    ValueTree upper = lower.createCopy();
+    upper.setProperty (IDs::XAxis, true, nullptr);
+    
+    calc.addChild (lower, -1, nullptr);
+    calc.addChild (upper, -1, nullptr);
+    
+    return calc;
+}
+
+bool IntervalDissonance::isEmpty() const
+{
+    return crossPairs.weights.isEmpty() && selfPairs.weights.isEmpty();
+}
+
+bool IntervalDissonance::hasSameTimbres (const IntervalDissonance& other) const
+{
+    return referenceFreq == other.referenceFreq
+           && fixedDissonance == other.fixedDissonance
+           && crossPairs.isSame (other.crossPairs)
+           && selfPairs.isSame (other.selfPairs);
+}
+
+bool IntervalDissonance::hasSamePairs (const IntervalDissonance& other) const
+{
+    if (partialLocations.size() != other.partialLocations.size())
+        return false;
+    
+    // Pairs hold partial indices, so each index has to be the same partial in both snapshots
+    for (int i = 0; i < partialLocations.size(); ++i)
+    {
+        const PartialLocation location = partialLocations[i];
+        const PartialLocation otherLocation = other.partialLocations[i];
+        
+        if (location.calc != otherLocation.calc
+            || location.distribution != otherLocation.distribution
+            || location.partial != otherLocation.partial)
+            return false;
+    }
+    
+    return crossPairs.hasSamePartials (other.crossPairs)
+           && selfPairs.hasSamePartials (other.selfPairs);
+}
+
+float IntervalDissonance::getReferenceFreq() const
+{
+    return referenceFreq;
+}
+
+int IntervalDissonance::getNumPartials() const
+{
+    return partialLocations.size();
+}
+
+IntervalDissonance::PartialLocation IntervalDissonance::getPartialLocation (int index) const
+{
+    return partialLocations[index];
+}
+
+void IntervalDissonance::clear()
+{
+    crossPairs.clear();
+    selfPairs.clear();
+    fixedPairs.clear();
+    
+    partialLocations.clearQuick();
+    partialRatios.clearQuick();
+    partialAmps.clearQuick();
+    ampScales.clearQuick();
+    
+    fixedDissonance = 0;
+    referenceFreq = 0;
+}
+
+void IntervalDissonance::addCalc (const ValueTree& calc)
+{
+    if (! calc.hasType (IDs::Calculator))
+        return;
+    
+    float startFreq = calc[IDs::StartFreq];
+    const int calcIndex = calc.getParent().indexOf (calc);
+    Array<Timbre> fixed;
+    Timbre variable;
+    bool hasVariable = false;
+    
+    for (int i = 0; i < calc.getNumChildren(); ++i)
+    {
+        ValueTree distribution = calc.getChild (i);
+        
+        if (! distribution.hasType (IDs::OvertoneDistribution)
+            || distribution[IDs::Mute])
+            continue;
+        
+        if (distribution[IDs::XAxis] && ! hasVariable)
+        {
+            variable = createTimbre (distribution, startFreq);
+            hasVariable = true;
+        }
+        else
+        {
+            fixed.add (createTimbre (distribution, startFreq));
+        }
+    }
+    
+    // Without an x-axis distribution, the first one is used for the interval's upper note
+    if (! hasVariable)
+    {
+        if (fixed.isEmpty())
+            return;
+        
+        variable = fixed.getFirst();
+        fixed.remove (0);
+    }
+    
+    if (fixed.isEmpty())
+        fixed.add (variable);
+    
+    // Same as the ratios of a calc's minima
+    float reference = fixed.size() == 1 ? fixed.getFirst().fundamentalFreq : startFreq;
+    Roughness::Model model = calc[IDs::ModelName] == "Vassilakis" ? Roughness::vassilakis : Roughness::sethares;
+    
+    if (reference <= 0)
+        return;
+    
+    referenceFreq = reference;
+    
+    // A distribution used for both notes is one set of partials in the table
+    const int variableFirst = addPartials (variable, calcIndex);
+    
+    Array<float> freqs, amps;
+    Array<int> partials;
+    
+    for (auto& timbre : fixed)
+    {
+        const int first = timbre.distribution == variable.distribution ? variableFirst : addPartials (timbre, calcIndex);
+        
+        for (int i = 0; i < timbre.ratios.size(); ++i)
+        {
+            freqs.add (timbre.fundamentalFreq * timbre.ratios[i]);
+            amps.add (timbre.amps[i]);
+            partials.add (first + i);
+        }
+    }
+    
+    fixedDissonance += Roughness::ofSpectrum (freqs.getRawDataPointer(), amps.getRawDataPointer(), freqs.size(), model);
+    
+    for (int i = 0; i < freqs.size(); ++i)
+        for (int j = i + 1; j < freqs.size(); ++j)
+            fixedPairs.add (partials[i], partials[j], freqs[i], freqs[j], amps[i], amps[j], model);
+    
+    for (int i = 0; i < variable.ratios.size(); ++i)
+        for (int j = i + 1; j < variable.ratios.size(); ++j)
+            selfPairs.add (variableFirst + i, variableFirst + j,
+                           reference * variable.ratios[i], reference * variable.ratios[j],
+                           variable.amps[i], variable.amps[j], model);
+    
+    for (int i = 0; i < freqs.size(); ++i)
+        for (int j = 0; j < variable.ratios.size(); ++j)
+            crossPairs.add (partials[i], variableFirst + j,
+                            freqs[i], reference * variable.ratios[j],
+                            amps[i], variable.amps[j], model);
+}
+
+int IntervalDissonance::addPartials (const Timbre& timbre, int calcIndex)
+{
+    const int first = partialLocations.size();
+    
+    for (int i = 0; i < timbre.ratios.size(); ++i)
+    {
+        partialLocations.add ({ calcIndex, timbre.distribution, timbre.partials[i] });
+        partialRatios.add (timbre.ratios[i]);
+        partialAmps.add (timbre.amps[i]);
+        
+        // Partials' amps are multiplied by the fundamental amp
+        ampScales.add (timbre.partials[i] < 0 ? 1 : timbre.fundamentalAmp);
+    }
+    
+    return first;
+}
+
+float IntervalDissonance::getDissonance (float ratio) const
+{
+    float total = fixedDissonance;
+    
+    for (int i = 0; i < crossPairs.weights.size(); ++i)
+        total += crossPairs.weights[i] * Roughness::getCurve (crossPairs.freqs1[i], crossPairs.freqs2[i] * ratio);
+    
+    for (int i = 0; i < selfPairs.weights.size(); ++i)
+        total += selfPairs.weights[i] * Roughness::getCurve (selfPairs.freqs1[i] * ratio, selfPairs.freqs2[i] * ratio);
+    
+    return total;
+}
+
+float IntervalDissonance::getDissonance (float ratio, Gradient& gradient) const
+{
+    const int numPartials = partialLocations.size();
+    
+    gradient.ratio = 0;
+    gradient.freqs.clearQuick();
+    gradient.freqs.insertMultiple (0, 0, numPartials);
+    gradient.amps.clearQuick();
+    gradient.amps.insertMultiple (0, 0, numPartials);
+    gradient.contributions.clearQuick();
+    gradient.contributions.insertMultiple (0, 0, numPartials);
+    
+    float total = 0;
+    float* freqSlopes = gradient.freqs.getRawDataPointer();
+    float* ampSlopes = gradient.amps.getRawDataPointer();
+    float* contributions = gradient.contributions.getRawDataPointer();
+    
+    auto addPairs = [&] (const PairList& pairs, bool firstMoves, bool secondMoves)
+    {
+        for (int i = 0; i < pairs.weights.size(); ++i)
+        {
+            const int partial1 = pairs.partials1.getUnchecked (i);
+            const int partial2 = pairs.partials2.getUnchecked (i);
+            const float weight = pairs.weights.getUnchecked (i);
+            
+            const float freq1 = pairs.freqs1.getUnchecked (i) * (firstMoves ? ratio : 1);
+            const float freq2 = pairs.freqs2.getUnchecked (i) * (secondMoves ? ratio : 1);
+            
+            float slope1, slope2;
+            const float curve = Roughness::getCurve (freq1, freq2, slope1, slope2);
+            
+            total += weight * curve;
+            contributions[partial1] += 0.5f * weight * curve;
+            contributions[partial2] += 0.5f * weight * curve;
+            
+            // Freqs are proportional to both the partials' ratios and (for the variable timbre) the interval
+            freqSlopes[partial1] += weight * slope1 * freq1 / partialRatios.getUnchecked (partial1);
+            freqSlopes[partial2] += weight * slope2 * freq2 / partialRatios.getUnchecked (partial2);
+            
+            if (firstMoves)
+                gradient.ratio += weight * slope1 * pairs.freqs1.getUnchecked (i);
+            
+            if (secondMoves)
+                gradient.ratio += weight * slope2 * pairs.freqs2.getUnchecked (i);
+            
+            ampSlopes[partial1] += pairs.weightSlopes1.getUnchecked (i) * curve;
+            ampSlopes[partial2] += pairs.weightSlopes2.getUnchecked (i) * curve;
+        }
+    };
+    
+    addPairs (fixedPairs, false, false);
+    addPairs (crossPairs, false, true);
+    addPairs (selfPairs, true, true);
+    
+    // Every amp of a distribution is proportional to its fundamental amp
+    HeapBlock<float> fundamentalSlopes ((size_t) jmax (1, numPartials), true);
+    
+    for (int i = 0; i < numPartials; ++i)
+    {
+        if (partialLocations.getReference (i).partial >= 0)
+            continue;
+        
+        for (int j = 0; j < numPartials; ++j)
+            if (partialLocations.getReference (j).calc == partialLocations.getReference (i).calc
+                && partialLocations.getReference (j).distribution == partialLocations.getReference (i).distribution)
+                fundamentalSlopes[i] += ampSlopes[j] * partialAmps.getUnchecked (j) / partialAmps.getUnchecked (i);
+    }
+    
+    for (int i = 0; i < numPartials; ++i)
+    {
+        if (partialLocations.getReference (i).partial < 0)
+            ampSlopes[i] = fundamentalSlopes[i];
+        else
+            ampSlopes[i] *= ampScales.getUnchecked (i);
+    }
+    
+    return total;
+}
+
+bool IntervalDissonance::getSensitivity (float ratio, Sensitivity& sensitivity) const
+{
+    sensitivity.dissonance = 0;
+    sensitivity.contributions.clearQuick();
+    sensitivity.freqShifts.clearQuick();
+    sensitivity.ampShifts.clearQuick();
+    
+    if (ratio <= 0 || partialLocations.isEmpty())
+        return false;
+    
+    // Second slopes are the difference of the exact slopes either side, in log ratio
+    const float step = 0.001f;
+    const float lowerRatio = ratio * std::exp (-step);
+    const float upperRatio = ratio * std::exp (step);
+    
+    Gradient centre, lower, upper;
+    
+    sensitivity.dissonance = getDissonance (ratio, centre);
+    getDissonance (lowerRatio, lower);
+    getDissonance (upperRatio, upper);
+    
+    sensitivity.contributions = centre.contributions;
+    
+    // How fast the curve's slope (with respect to log ratio) changes across the optimum
+    const float curvature = (upper.ratio * upperRatio - lower.ratio * lowerRatio) / (2 * step);
+    
+    if (std::abs (curvature) <= std::numeric_limits<float>::epsilon() * jmax (1.f, std::abs (sensitivity.dissonance)))
+        return false;
+    
+    // The optimum moves so the slope stays at 0, so a partial moves it by the change of slope
+    // it makes, over the curvature (both in log freq and log amp, as cents per cent)
+    const float percent = 1200 * std::log (1.01f) / std::log (2.f);
+    
+    for (int i = 0; i < partialLocations.size(); ++i)
+    {
+        const float freq = partialRatios.getUnchecked (i);
+        const float amp = partialAmps.getUnchecked (i) / ampScales.getUnchecked (i);
+        
+        const float freqCrossSlope = (upper.freqs.getUnchecked (i) - lower.freqs.getUnchecked (i)) / (2 * step);
+        const float ampCrossSlope = (upper.amps.getUnchecked (i) - lower.amps.getUnchecked (i)) / (2 * step);
+        
+        sensitivity.freqShifts.add (-freqCrossSlope * freq / curvature);
+        sensitivity.ampShifts.add (-ampCrossSlope * amp / curvature * percent);
+    }
+    
+    return true;
+}
+
+void IntervalDissonance::getDissonance (const float* ratios, float* results, int numRatios) const
+{
+    float freqs[blockSize], otherFreqs[blockSize];
+    
+    FloatVectorOperations::fill (results, fixedDissonance, numRatios);
+    
+    for (int start = 0; start < numRatios; start += blockSize)
+    {
+        const int num = jmin (blockSize, numRatios - start);
+        
+        for (int i = 0; i < crossPairs.weights.size(); ++i)
+        {
+            FloatVectorOperations::copyWithMultiply (freqs, ratios + start, crossPairs.freqs2.getUnchecked (i), num);
+            Roughness::addCurves (crossPairs.freqs1.getUnchecked (i), freqs, crossPairs.weights.getUnchecked (i), results + start, num);
+        }
+        
+        for (int i = 0; i < selfPairs.weights.size(); ++i)
+        {
+            FloatVectorOperations::copyWithMultiply (freqs, ratios + start, selfPairs.freqs1.getUnchecked (i), num);
+            FloatVectorOperations::copyWithMultiply (otherFreqs, ratios + start, selfPairs.freqs2.getUnchecked (i), num);
+            Roughness::addCurves (freqs, otherFreqs, selfPairs.weights.getUnchecked (i), results + start, num);
+        }
+    }
+}
+
+Array<float> IntervalDissonance::getDissonance (const Array<float>& ratios) const
+{
+    Array<float> results;
+    results.resize (ratios.size());
+    
+    getDissonance (ratios.begin(), results.getRawDataPointer(), ratios.size());
+    
+    return results;
+}
+
+IntervalDissonance::Timbre IntervalDissonance::createTimbre (const ValueTree& distribution, float startFreq)
+{
+    Timbre timbre;
+    timbre.distribution = distribution.getParent().indexOf (distribution);
+    
+    // Fundamental freqs below 20 are ratios to the calc's start freq
+    timbre.fundamentalFreq = distribution[IDs::FundamentalFreq];
+    
+    if (timbre.fundamentalFreq < 20)
+        timbre.fundamentalFreq *= startFreq;
+    
+    float fundamentalAmp = distribution.getProperty (IDs::FundamentalAmp, 1);
+    timbre.fundamentalAmp = fundamentalAmp;
+    
+    if (! distribution[IDs::FundamentalMute])
+    {
+        timbre.ratios.add (1);
+        timbre.amps.add (fundamentalAmp);
+        timbre.partials.add (-1);
+    }
+    
+    Array<PartialData> partials = PartialArray (distribution).getAll();
+    
+    for (int i = 0; i < partials.size(); ++i)
+    {
+        const PartialData& partial = partials.getReference (i);
+        
+        if (! partial.mute && partial.freq > 0 && partial.amp > 0)
+        {
+            timbre.ratios.add (partial.freq);
+            timbre.amps.add (partial.amp * fundamentalAmp);
+            timbre.partials.add (i);
+        }
+    }
+    
+    return timbre;
+}
+
+//==============================================================================
+void IntervalDissonance::PairList::add (int partial1, int partial2, float freq1, float freq2,
+                                        float amp1, float amp2, Roughness::Model model)
+{
+    float slope1, slope2;
+    const float weight = Roughness::getAmpWeight (amp1, amp2, model, slope1, slope2);
+    
+    if (weight <= 0)
+        return;
+    
+    partials1.add (partial1);
+    partials2.add (partial2);
+    freqs1.add (freq1);
+    freqs2.add (freq2);
+    weights.add (weight);
+    weightSlopes1.add (slope1);
+    weightSlopes2.add (slope2);
+}
+
+void IntervalDissonance::PairList::clear()
+{
+    partials1.clearQuick();
+    partials2.clearQuick();
+    freqs1.clearQuick();
+    freqs2.clearQuick();
+    weights.clearQuick();
+    weightSlopes1.clearQuick();
+    weightSlopes2.clearQuick();
+}
+
+bool IntervalDissonance::PairList::isSame (const PairList& other) const
+{
+    return weights == other.weights
+           && freqs1 == other.freqs1
+           && freqs2 == other.freqs2;
+}
+
+bool IntervalDissonance::PairList::hasSamePartials (const PairList& other) const
+{
+    return partials1 == other.partials1
+           && partials2 == other.partials2;
+}
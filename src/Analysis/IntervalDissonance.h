@@ -0,0 +1,174 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "IDs.h"
+#include "PartialArray.h"
+#include "Roughness.h"
+
+//==============================================================================
+/*
+    A snapshot of the timbres of one or more calcs, for evaluating the dissonance of
+    individual intervals off the message thread.
+ 
+    An interval is played with each calc's x-axis timbre against its other timbres, the same
+    way as the calc's dissonance map, and the dissonance of every calc is summed. This includes
+    the x-axis timbre's own partials, which move with the interval, and a constant for the
+    dissonance among the other timbres. Ratios are relative to the same reference as the map's
+    ratios: the fixed distribution's fundamental for 2 distributions, or the start freq
+    otherwise.
+ 
+    Only the ratios asked for are evaluated, rather than a full map sweep. Every pair of
+    partials is flattened into one list with its amp weight precomputed, since the weights
+    don't depend on the interval, and batches of ratios are evaluated a pair at a time.
+ 
+    Each pair also keeps which partials it's made of, and the slopes of its amp weight, so a
+    single interval can be evaluated along with its exact gradient.
+*/
+class IntervalDissonance
+{
+public:
+    IntervalDissonance();
+    ~IntervalDissonance();
+    
+    // Takes a snapshot of the unmuted distributions of every calc in the list (message thread)
+    void setCalcs (const ValueTree& calcList);
+    
+    // Same as setCalcs(), for a single calc
+    void setCalc (const ValueTree& calc);
+    
+    // Same as setCalc(), for a distribution played against itself with the lower note at the
+    // given freq (it doesn't need to be in a calc, so saved timbres can be scored off the message thread)
+    void setTimbre (const ValueTree& distribution, float fundamentalFreq, const String& modelName);
+    
+    // The calc that setTimbre() takes a snapshot of
+    static ValueTree createTimbreCalc (const ValueTree& distribution, float fundamentalFreq, const String& modelName);
+    
+    bool isEmpty() const;
+    
+    // Whether both snapshots give the same dissonance for every interval
+    bool hasSameTimbres (const IntervalDissonance& other) const;
+    
+    // Whether both snapshots pair up the same partials, so only their freqs or amps differ
+    bool hasSamePairs (const IntervalDissonance& other) const;
+    
+    // The freq that ratios are relative to, for the last calc added
+    float getReferenceFreq() const;
+    
+    // Dissonance of the given interval, summed over every calc
+    float getDissonance (float ratio) const;
+    
+    // Dissonance of a batch of intervals (any thread)
+    void getDissonance (const float* ratios, float* results, int numRatios) const;
+    Array<float> getDissonance (const Array<float>& ratios) const;
+    
+    // Where a partial of the snapshot comes from, as the child indices of its calc and
+    // distribution, and its index in the distribution's partial array (-1 for the fundamental)
+    struct PartialLocation
+    {
+        int calc, distribution, partial;
+    };
+    
+    int getNumPartials() const;
+    PartialLocation getPartialLocation (int index) const;
+    
+    /*  Slopes of an interval's dissonance with respect to the interval's ratio, and to the freq
+        and amp of each partial of the snapshot, in the same order as getPartialLocation()
+ 
+        Freqs are ratios to the partial's fundamental and amps are relative to the fundamental
+        amp (as they're stored in the distribution), with the fundamental's freq at 1 and its
+        amp being the fundamental amp, which scales every partial of its distribution.
+ 
+        Each partial's contribution is its share of the interval's dissonance, with the
+        dissonance of every pair split evenly between its 2 partials.
+    */
+    struct Gradient
+    {
+        float ratio;
+        Array<float> freqs, amps, contributions;
+    };
+    
+    // Dissonance of the given interval, with its gradient from the same pass
+    float getDissonance (float ratio, Gradient& gradient) const;
+    
+    /*  How an optimum at the given interval depends on each partial, in the same order as
+        getPartialLocation()
+ 
+        Shifts are how far the optimum moves (in cents) per cent that a partial's freq moves,
+        and per percent that its amp changes, from the slope of the curve's slope where it
+        crosses 0 (the implicit function theorem). They only hold near the optimum, for small
+        changes.
+    */
+    struct Sensitivity
+    {
+        float dissonance;
+        Array<float> contributions, freqShifts, ampShifts;
+    };
+    
+    // Returns false if the curve is too flat at the interval for the optimum to have a location
+    bool getSensitivity (float ratio, Sensitivity& sensitivity) const;
+    
+    // An unmuted distribution's partials, as ratios to its fundamental freq, along with the
+    // distribution's child index and the partials' indices (-1 for the fundamental)
+    struct Timbre
+    {
+        float fundamentalFreq, fundamentalAmp;
+        Array<float> ratios, amps;
+        int distribution;
+        Array<int> partials;
+    };
+    
+    static Timbre createTimbre (const ValueTree& distribution, float startFreq);
+
+private:
+    // Pairs of partials by their index in the partial table, with each freq in Hz for a 1/1
+    // interval, and the amp weight and its slope with respect to each amp
+    struct PairList
+    {
+        Array<int> partials1, partials2;
+        Array<float> freqs1, freqs2, weights, weightSlopes1, weightSlopes2;
+        
+        // Skips pairs that have no weight
+        void add (int partial1, int partial2, float freq1, float freq2, float amp1, float amp2, Roughness::Model model);
+        void clear();
+        
+        bool isSame (const PairList& other) const;
+        
+        // Whether both lists pair up the same partial indices, in the same order
+        bool hasSamePartials (const PairList& other) const;
+    };
+    
+    // Pairs of a fixed partial and a variable partial
+    PairList crossPairs;
+    
+    // Pairs within the variable timbre, where both freqs move with the interval
+    PairList selfPairs;
+    
+    // Pairs of fixed partials, which only add a constant to every interval
+    PairList fixedPairs;
+    
+    float fixedDissonance, referenceFreq;
+    
+    // Every partial of the snapshot, with its freq ratio, its amp in the spectrum, and the amp
+    // that multiplies its own amp
+    Array<PartialLocation> partialLocations;
+    Array<float> partialRatios, partialAmps, ampScales;
+    
+    void clear();
+    void addCalc (const ValueTree& calc);
+    int addPartials (const Timbre& timbre, int calcIndex);
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (IntervalDissonance)
+};
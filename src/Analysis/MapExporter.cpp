@@ -0,0 +1,317 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#include "MapExporter.h"
+
+namespace
+{
+    // Freqs of a curve's steps are worked out this many at a time for .npy files
+    const int freqBlockSize = 4096;
+}
+
+//==============================================================================
+MapExporter::MapExporter (const File& fileToWrite, Format exportFormat)   : file (fileToWrite),
+                                                                              format (exportFormat)
+{
+    numMaps = 0;
+    numFields = 0;
+    
+    if (format == npy)
+        return;
+    
+    file.deleteFile();
+    stream.reset (new FileOutputStream (file));
+    
+    if (! stream->openedOk())
+    {
+        stream.reset();
+        return;
+    }
+    
+    if (format == csv)
+        *stream << "map,kind,freq,y_freq,dissonance\n";
+    else
+        *stream << "{\"maps\": [";
+}
+
+MapExporter::~MapExporter()
+{
+    if (stream != nullptr && format == json)
+        *stream << "\n]}\n";
+}
+
+bool MapExporter::openedOk() const
+{
+    return format == npy ? file.getParentDirectory().isDirectory() : stream != nullptr;
+}
+
+String MapExporter::getFileExtension (Format format)
+{
+    return format == csv ? ".csv" : (format == json ? ".json" : ".npy");
+}
+
+void MapExporter::beginMap (const String& name, const String& modelName)
+{
+    mapName = name;
+    numFields = 0;
+    
+    // Names with commas or quotes are quoted, with their quotes doubled
+    csvName = name.containsAnyOf (",\"\r\n") ? "\"" + name.replace ("\"", "\"\"") + "\"" : name;
+    
+    if (format == json && stream != nullptr)
+    {
+        *stream << (numMaps > 0 ? ",\n" : "\n") << "{";
+        
+        beginField ("name");
+        *stream << JSON::toString (name);
+        
+        beginField ("model");
+        *stream << JSON::toString (modelName);
+    }
+    
+    ++numMaps;
+}
+
+void MapExporter::endMap()
+{
+    if (format == json && stream != nullptr)
+        *stream << "}";
+}
+
+void MapExporter::writeCurve (const AdaptiveCurve& curve, float referenceFreq)
+{
+    const int numSteps = curve.getNumSteps();
+    const float* dissonance = curve.getRawDissonanceData();
+    
+    if (format == npy)
+    {
+        std::unique_ptr<FileOutputStream> out (createNpyFile (""));
+        
+        if (out == nullptr)
+            return;
+        
+        // Column major, so each column is one run of values
+        writeNpyHeader (*out, "(" + String (numSteps) + ", 2)", true);
+        
+        HeapBlock<float> freqs ((size_t) freqBlockSize);
+        
+        for (int start = 0; start < numSteps; start += freqBlockSize)
+        {
+            const int num = jmin (freqBlockSize, numSteps - start);
+            
+            for (int i = 0; i < num; ++i)
+                freqs[i] = curve.getRatioAtPosition (curve.getPositionAtStep (start + i)) * referenceFreq;
+            
+            out->write (freqs, sizeof (float) * (size_t) num);
+        }
+        
+        out->write (dissonance, sizeof (float) * (size_t) numSteps);
+        return;
+    }
+    
+    if (stream == nullptr)
+        return;
+    
+    if (format == csv)
+    {
+        for (int i = 0; i < numSteps; ++i)
+            *stream << csvName << ",step," << String (curve.getRatioAtPosition (curve.getPositionAtStep (i)) * referenceFreq)
+                    << ",," << String (dissonance[i]) << "\n";
+        
+        return;
+    }
+    
+    beginField ("freqs");
+    *stream << "[";
+    
+    for (int i = 0; i < numSteps; ++i)
+        *stream << (i > 0 ? ", " : "") << String (curve.getRatioAtPosition (curve.getPositionAtStep (i)) * referenceFreq);
+    
+    *stream << "]";
+    
+    beginField ("dissonance");
+    *stream << "[";
+    
+    for (int i = 0; i < numSteps; ++i)
+        *stream << (i > 0 ? ", " : "") << String (dissonance[i]);
+    
+    *stream << "]";
+}
+
+void MapExporter::writeSurface (const DissonanceSurface& surface)
+{
+    const int numSteps = surface.getNumSteps();
+    const float referenceFreq = surface.getReferenceFreq();
+    
+    // Steps are read a row at a time, so a stored surface is paged through rather than read in whole
+    HeapBlock<float> row ((size_t) jmax (1, numSteps));
+    
+    if (format == npy)
+    {
+        std::unique_ptr<FileOutputStream> out (createNpyFile (""));
+        std::unique_ptr<FileOutputStream> freqsOut (createNpyFile (" freqs"));
+        
+        if (out == nullptr || freqsOut == nullptr)
+            return;
+        
+        writeNpyHeader (*out, "(" + String (numSteps) + ", " + String (numSteps) + ")", false);
+        
+        for (int y = 0; y < numSteps; ++y)
+        {
+            surface.getRow (y, row);
+            out->write (row, sizeof (float) * (size_t) numSteps);
+        }
+        
+        writeNpyHeader (*freqsOut, "(" + String (numSteps) + ",)", false);
+        
+        for (int i = 0; i < numSteps; ++i)
+            row[i] = surface.getRatioAtStep (i) * referenceFreq;
+        
+        freqsOut->write (row, sizeof (float) * (size_t) numSteps);
+        
+        return;
+    }
+    
+    if (stream == nullptr)
+        return;
+    
+    if (format == csv)
+    {
+        for (int y = 0; y < numSteps; ++y)
+        {
+            const String yFreq (surface.getRatioAtStep (y) * referenceFreq);
+            surface.getRow (y, row);
+            
+            for (int x = 0; x < numSteps; ++x)
+                *stream << csvName << ",step," << String (surface.getRatioAtStep (x) * referenceFreq) << ","
+                        << yFreq << "," << String (row[x]) << "\n";
+        }
+        
+        return;
+    }
+    
+    beginField ("freqs");
+    *stream << "[";
+    
+    for (int i = 0; i < numSteps; ++i)
+        *stream << (i > 0 ? ", " : "") << String (surface.getRatioAtStep (i) * referenceFreq);
+    
+    *stream << "]";
+    
+    beginField ("dissonance");
+    *stream << "[";
+    
+    for (int y = 0; y < numSteps; ++y)
+    {
+        *stream << (y > 0 ? ",\n  [" : "\n  [");
+        surface.getRow (y, row);
+        
+        for (int x = 0; x < numSteps; ++x)
+            *stream << (x > 0 ? ", " : "") << String (row[x]);
+        
+        *stream << "]";
+    }
+    
+    *stream << "]";
+}
+
+void MapExporter::writeOptima (const Array<Optimum>& optima, bool minima)
+{
+    if (format == npy)
+    {
+        std::unique_ptr<FileOutputStream> out (createNpyFile (minima ? " minima" : " maxima"));
+        
+        if (out == nullptr)
+            return;
+        
+        // A row of freq, y-axis freq and dissonance per optimum
+        writeNpyHeader (*out, "(" + String (optima.size()) + ", 3)", false);
+        
+        for (auto& optimum : optima)
+        {
+            const float row[] = { optimum.freq, optimum.yFreq, optimum.dissonance };
+            out->write (row, sizeof (row));
+        }
+        
+        return;
+    }
+    
+    if (stream == nullptr)
+        return;
+    
+    if (format == csv)
+    {
+        for (auto& optimum : optima)
+            *stream << csvName << (minima ? ",minimum," : ",maximum,") << String (optimum.freq) << ","
+                    << (optimum.yFreq > 0 ? String (optimum.yFreq) : String()) << "," << String (optimum.dissonance) << "\n";
+        
+        return;
+    }
+    
+    beginField (minima ? "minima" : "maxima");
+    *stream << "[";
+    
+    for (int i = 0; i < optima.size(); ++i)
+    {
+        const Optimum& optimum = optima.getReference (i);
+        
+        *stream << (i > 0 ? ", " : "") << "{\"freq\": " << String (optimum.freq);
+        
+        if (optimum.yFreq > 0)
+            *stream << ", \"yFreq\": " << String (optimum.yFreq);
+        
+        *stream << ", \"dissonance\": " << String (optimum.dissonance) << "}";
+    }
+    
+    *stream << "]";
+}
+
+void MapExporter::beginField (const String& name)
+{
+    *stream << (numFields > 0 ? ",\n " : "\n ") << JSON::toString (name) << ": ";
+    ++numFields;
+}
+
+void MapExporter::writeNpyHeader (OutputStream& out, const String& shape, bool fortranOrder)
+{
+    String header = String ("{'descr': '") + (ByteOrder::isBigEndian() ? ">f4" : "<f4")
+                    + "', 'fortran_order': " + (fortranOrder ? "True" : "False")
+                    + ", 'shape': " + shape + ", }";
+    
+    // The magic string, version and header length take 10 bytes, and the data starts on a
+    // multiple of 64 bytes, with the header padded by spaces and ending in a newline
+    const int length = header.length() + 1;
+    const int padding = (64 - (10 + length) % 64) % 64;
+    
+    header << String::repeatedString (" ", padding) << "\n";
+    
+    const char magic[] = { (char) 0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0 };
+    out.write (magic, sizeof (magic));
+    out.writeShort ((short) header.length());
+    out.write (header.toRawUTF8(), (size_t) header.length());
+}
+
+std::unique_ptr<FileOutputStream> MapExporter::createNpyFile (const String& suffix) const
+{
+    // Map names are user text, so they may hold characters that aren't allowed in file names
+    File npyFile = file.getSiblingFile (File::createLegalFileName (file.getFileNameWithoutExtension() + " - "
+                                                                  + mapName + suffix + ".npy"));
+    npyFile.deleteFile();
+    
+    std::unique_ptr<FileOutputStream> out (new FileOutputStream (npyFile));
+    
+    if (! out->openedOk())
+        return nullptr;
+    
+    return out;
+}
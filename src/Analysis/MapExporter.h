@@ -0,0 +1,88 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "AdaptiveCurve.h"
+#include "DissonanceSurface.h"
+
+//==============================================================================
+/*
+    Writes dissonance maps and their optima to a file, as they're handed over.
+ 
+    Values are streamed to the file one at a time (through the file stream's buffer), so a map
+    of any size is exported without building it up in memory first, and a surface kept in a
+    result store is read a row at a time.
+ 
+    CSV is one table for every map, with a row per step or optimum. JSON is an object with an
+    array of maps, each with its freqs, dissonance (as rows of y-axis steps for a surface),
+    minima and maxima. NumPy can only hold one array per file, so .npy exports write a file per
+    array next to the chosen one, named after it and the map: a curve's steps are an (n, 2)
+    array of freqs and dissonance in Fortran order, so the dissonance is written straight from
+    the curve's buffer, and a surface is its (n, n) grid with its axis freqs in a separate file.
+*/
+class MapExporter
+{
+public:
+    enum Format
+    {
+        csv = 1,
+        json,
+        npy
+    };
+    
+    MapExporter (const File& fileToWrite, Format exportFormat);
+    ~MapExporter();
+    
+    bool openedOk() const;
+    
+    static String getFileExtension (Format format);
+    
+    // Every map's steps and optima go between beginMap() and endMap()
+    void beginMap (const String& name, const String& modelName);
+    void endMap();
+    
+    // A curve's steps, at freqs of its ratios to the reference freq
+    void writeCurve (const AdaptiveCurve& curve, float referenceFreq);
+    
+    // A finished surface's grid, with the y-axis steps as rows
+    void writeSurface (const DissonanceSurface& surface);
+    
+    // The y-axis freq is 0 for a curve's optima
+    struct Optimum
+    {
+        float freq, yFreq, dissonance;
+    };
+    
+    void writeOptima (const Array<Optimum>& optima, bool minima);
+
+private:
+    File file;
+    Format format;
+    
+    // The whole export for CSV and JSON
+    std::unique_ptr<FileOutputStream> stream;
+    
+    String mapName, csvName;
+    int numMaps, numFields;
+    
+    // Starts a field of the current map's JSON object
+    void beginField (const String& name);
+    
+    // Writes a .npy file header, for an array of floats in the host's byte order
+    static void writeNpyHeader (OutputStream& out, const String& shape, bool fortranOrder);
+    std::unique_ptr<FileOutputStream> createNpyFile (const String& suffix) const;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MapExporter)
+};
@@ -0,0 +1,358 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#include "MapTileCache.h"
+#include "PartialArray.h"
+#include "Trace.h"
+
+namespace
+{
+    const int tileSize = 256;
+    
+    // Level 15 steps are about as close as float ratios can resolve
+    const int minLevel = -4;
+    const int maxLevel = 15;
+    
+    // About 1MB of dissonance per map
+    const int maxTiles = 1024;
+}
+
+//==============================================================================
+MapTileCache::MapTileCache()
+{
+    useCount = 0;
+}
+
+MapTileCache::~MapTileCache()
+{
+}
+
+bool MapTileCache::setCalc (const ValueTree& calcData)
+{
+    copyCalc (calcData, calc);
+    
+    IntervalDissonance latest;
+    latest.setCalc (calcData);
+    
+    // Changes to the range, resolution or step type leave the timbres as they were
+    if (latest.hasSameTimbres (intervals))
+        return true;
+    
+    const bool hasSamePairs = ! intervals.isEmpty() && latest.hasSamePairs (intervals);
+    
+    clear();
+    intervals.setCalc (calcData);
+    
+    return hasSamePairs;
+}
+
+const IntervalDissonance& MapTileCache::getIntervals() const
+{
+    return intervals;
+}
+
+int MapTileCache::getLevel (double spacing)
+{
+    if (spacing <= 0)
+        return maxLevel;
+    
+    return jlimit (minLevel, maxLevel, (int) std::ceil (-std::log2 (spacing * tileSize)));
+}
+
+int MapTileCache::getLevel (double startOctave, double endOctave, int numSteps, bool isLog)
+{
+    numSteps = jmax (2, numSteps);
+    
+    if (isLog)
+        return getLevel ((endOctave - startOctave) / (numSteps - 1));
+    
+    const double startFreq = std::pow (2.0, startOctave);
+    const double endFreq = std::pow (2.0, endOctave);
+    
+    return getLevel ((endFreq - startFreq) / (numSteps - 1) / (endFreq * std::log (2.0)));
+}
+
+bool MapTileCache::getSteps (int level, double startOctave, double endOctave,
+                             Array<double>& octaves, Array<float>& dissonance, const ThreadPoolJob* job)
+{
+    octaves.clearQuick();
+    dissonance.clearQuick();
+    
+    level = jlimit (minLevel, maxLevel, level);
+    
+    const double width = std::ldexp (1.0, -level);
+    const double first = startOctave - width / tileSize;
+    const double last = endOctave + width / tileSize;
+    
+    const int64 lastIndex = (int64) std::floor (last / width);
+    
+    for (int64 index = (int64) std::floor (first / width); index <= lastIndex; ++index)
+    {
+        Tile* tile = getTile (level, index, false, job);
+        
+        if (tile == nullptr)
+            return false;
+        
+        for (int i = 0; i < tile->numSteps; ++i)
+        {
+            const double octave = tile->octaves[i];
+            
+            if (octave > first && octave < last
+                && (octaves.isEmpty() || octave > octaves.getLast()))
+            {
+                octaves.add (octave);
+                dissonance.add (tile->dissonance[i]);
+            }
+        }
+    }
+    
+    return true;
+}
+
+bool MapTileCache::getOptima (int level, double startOctave, double endOctave,
+                              Array<float>& minima, Array<float>& maxima, const ThreadPoolJob* job)
+{
+    minima.clearQuick();
+    maxima.clearQuick();
+    
+    level = jlimit (minLevel, maxLevel, level);
+    
+    const double width = std::ldexp (1.0, -level);
+    const Range<double> view (startOctave, endOctave);
+    const int64 lastIndex = (int64) std::floor (endOctave / width);
+    
+    for (int64 index = (int64) std::floor (startOctave / width); index <= lastIndex; ++index)
+    {
+        Tile* tile = getTile (level, index, true, job);
+        
+        if (tile == nullptr)
+            return false;
+        
+        for (auto min : tile->minima)
+            if (view.contains (std::log2 ((double) min)))
+                minima.add (min);
+        
+        for (auto max : tile->maxima)
+            if (view.contains (std::log2 ((double) max)))
+                maxima.add (max);
+    }
+    
+    return true;
+}
+
+void MapTileCache::clear()
+{
+    tilesByKey.clear();
+    tiles.clear();
+}
+
+MapTileCache::Tile* MapTileCache::getTile (int level, int64 index, bool withOptima, const ThreadPoolJob* job)
+{
+    Tile* tile = findTile (level, index);
+    
+    if (tile != nullptr && (tile->hasOptima || ! withOptima))
+    {
+        tile->lastUsed = ++useCount;
+        return tile;
+    }
+    
+    if ((job != nullptr && job->shouldExit()) || ! calc.isReadyToProcess())
+        return nullptr;
+    
+    if (tile == nullptr)
+        return calculateTile (level, index, withOptima);
+    
+    TRACE_SCOPE ("MapTileCache::findOptima");
+    
+    // The tile's steps were calculated without its optima, so its map is calculated again
+    const double width = std::ldexp (1.0, -level);
+    
+    if (calculateMap (index * width - width / tileSize, width / tileSize, tileSize + 2))
+        findOptima (*tile);
+    
+    tile->hasOptima = true;
+    tile->lastUsed = ++useCount;
+    
+    return tile;
+}
+
+MapTileCache::Tile* MapTileCache::calculateTile (int level, int64 index, bool withOptima)
+{
+    TRACE_SCOPE ("MapTileCache::calculateTile");
+    
+    const double width = std::ldexp (1.0, -level);
+    const double spacing = width / tileSize;
+    const double start = index * width;
+    
+    Tile* tile = new Tile();
+    tile->level = level;
+    tile->index = index;
+    tile->numSteps = 0;
+    tile->octaves.malloc ((size_t) tileSize);
+    tile->dissonance.malloc ((size_t) tileSize);
+    tile->hasOptima = withOptima;
+    tile->lastUsed = ++useCount;
+    
+    const int64 parentIndex = index >= 0 ? index / 2 : (index - 1) / 2;
+    Tile* parent = level > minLevel ? findTile (level - 1, parentIndex) : nullptr;
+    
+    // Maps have a step either side of the tile, so optima at the tile's ends aren't at the map's
+    if (parent != nullptr && parent->numSteps == tileSize)
+    {
+        // The even steps are the parent's, so only the odd steps are calculated
+        const int offset = (int) (index - parentIndex * 2) * tileSize / 2;
+        
+        if (calculateMap (start - spacing, spacing * 2, tileSize / 2 + 2))
+        {
+            for (int i = 0; i < tileSize / 2; ++i)
+            {
+                tile->octaves[i * 2] = parent->octaves[offset + i];
+                tile->dissonance[i * 2] = parent->dissonance[offset + i];
+                tile->octaves[i * 2 + 1] = std::log2 ((double) calc.getFrequencyAtStep (i + 1));
+                tile->dissonance[i * 2 + 1] = calc.getDissonanceAtStep (i + 1);
+            }
+            
+            tile->numSteps = tileSize;
+        }
+    }
+    else if (calculateMap (start - spacing, spacing, tileSize + 2))
+    {
+        // Steps are kept at the freqs DisMAL calculated them at
+        for (int i = 0; i < tileSize; ++i)
+        {
+            tile->octaves[i] = std::log2 ((double) calc.getFrequencyAtStep (i + 1));
+            tile->dissonance[i] = calc.getDissonanceAtStep (i + 1);
+        }
+        
+        tile->numSteps = tileSize;
+    }
+    
+    if (withOptima && tile->numSteps > 0)
+        findOptima (*tile);
+    
+    tilesByKey.set (getKey (level, index), tile);
+    tiles.add (tile);
+    
+    if (tiles.size() > maxTiles)
+        removeLeastRecentlyUsed();
+    
+    return tile;
+}
+
+MapTileCache::Tile* MapTileCache::findTile (int level, int64 index) const
+{
+    return tilesByKey[getKey (level, index)];
+}
+
+void MapTileCache::removeLeastRecentlyUsed()
+{
+    Tile* oldest = tiles.getFirst();
+    
+    for (auto* tile : tiles)
+        if (tile->lastUsed < oldest->lastUsed)
+            oldest = tile;
+    
+    tilesByKey.remove (getKey (oldest->level, oldest->index));
+    tiles.removeObject (oldest);
+}
+
+bool MapTileCache::calculateMap (double firstOctave, double spacing, int numSteps)
+{
+    calc.setRange ((float) std::pow (2.0, firstOctave), (float) std::pow (2.0, firstOctave + (numSteps - 1) * spacing));
+    calc.useLogarithmicSteps (true);
+    calc.setNumSteps (numSteps);
+    calc.calculateDissonanceMap();
+    
+    return calc.getNumSteps() == numSteps;
+}
+
+void MapTileCache::findOptima (Tile& tile)
+{
+    const double width = std::ldexp (1.0, -tile.level);
+    const Range<double> span (tile.index * width, (tile.index + 1) * width);
+    
+    calc.optimize2D();
+    
+    for (auto min : calc.getOptimalFreqs())
+        if (span.contains (std::log2 ((double) min)))
+            tile.minima.add (min);
+    
+    calc.optimize2D (false);
+    
+    for (auto max : calc.getOptimalFreqs (false))
+        if (span.contains (std::log2 ((double) max)))
+            tile.maxima.add (max);
+}
+
+int64 MapTileCache::getKey (int level, int64 index)
+{
+    return index * 32 + (level - minLevel);
+}
+
+void MapTileCache::copyCalc (const ValueTree& calcData, DissonanceCalc& calc)
+{
+    while (calc.numOvertoneDistributions() > 0)
+        calc.removeOvertoneDistribution (calc.numOvertoneDistributions() - 1);
+    
+    if (calcData[IDs::ModelName] == "Vassilakis")
+        calc.setModel (new VassilakisModel());
+    else
+        calc.setModel (new SetharesModel());
+    
+    const float startFreq = calcData[IDs::StartFreq];
+    
+    // Set the same way as the map's distribution bindings set them
+    for (auto distribution : calcData)
+    {
+        if (! distribution.hasType (IDs::OvertoneDistribution))
+            continue;
+        
+        calc.addOvertoneDistribution (new OvertoneDistribution());
+        
+        const int index = calc.numOvertoneDistributions() - 1;
+        OvertoneDistribution* dist = calc.getDistributionReference (index);
+        
+        float freq = distribution[IDs::FundamentalFreq];
+        
+        // Fundamental freqs below 20 are ratios to the calc's start freq
+        if (freq > 0)
+            dist->setFundamentalFreq (freq < 20 && startFreq > 0 ? freq * startFreq : freq);
+        
+        if (distribution[IDs::FundamentalAmp].operator float() > 0)
+            dist->setFundamentalAmp (distribution[IDs::FundamentalAmp]);
+        
+        PartialArray partials (distribution);
+        
+        for (int i = 0; i < partials.size(); ++i)
+        {
+            PartialData partial = partials.get (i);
+            
+            if (partial.freq > 0 && partial.amp > 0)
+                dist->addPartial (partial.freq, partial.amp);
+            else
+                dist->addPartial();
+            
+            if (partial.mute)
+                dist->mutePartial (i, true);
+        }
+        
+        if (distribution[IDs::FundamentalMute])
+            dist->muteFundamental (true);
+        
+        if (distribution[IDs::Mute])
+            dist->mute (true);
+        
+        if (distribution[IDs::XAxis])
+            calc.set2dVariableDistribution (index);
+    }
+}
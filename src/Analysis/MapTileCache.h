@@ -0,0 +1,113 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "IntervalDissonance.h"
+#include "../../DisMAL/DisMAL.h"
+
+//==============================================================================
+/*
+    A cache of a calc's dissonance curve in tiles, keyed by log-frequency range.
+ 
+    Freqs are measured in octaves above 1 Hz. A tile at level 0 spans an octave starting at a
+    whole number of octaves, and each level halves the span, so the tiles of a level hold 256
+    log spaced steps apiece and twice the steps per octave of the level before. Every other
+    step of a tile is a step of its parent tile, so when the parent is cached only the other
+    half are calculated. Steps are calculated as DisMAL maps, with a copy of the calc, and a
+    tile can also keep DisMAL's optima within its span.
+ 
+    Tiles are kept when the view changes, so panning reuses the tiles it overlaps and zooming in
+    only calculates the newly exposed detail. The least recently used tiles are dropped once the
+    cache is full, and every tile is dropped when the calc's timbres change.
+ 
+    Not thread safe: it belongs to one job, and the snapshot is only taken while the job is idle.
+*/
+class MapTileCache
+{
+public:
+    MapTileCache();
+    ~MapTileCache();
+    
+    /*  Takes a snapshot of the calc, dropping every tile if its timbres have changed (message thread)
+ 
+        Returns false if partials have been added, removed or muted, rather than only moved or
+        scaled.
+    */
+    bool setCalc (const ValueTree& calc);
+    const IntervalDissonance& getIntervals() const;
+    
+    // The coarsest level with steps at most the given number of octaves apart
+    static int getLevel (double spacing);
+    
+    // The coarsest level with at least a calc's number of log or linear steps between the octaves
+    // (linear steps are closest together at the end)
+    static int getLevel (double startOctave, double endOctave, int numSteps, bool isLog);
+    
+    /*  Gets the steps of a level between the given octaves, plus one step either side so the
+        curve reaches both ends, calculating the tiles that aren't cached.
+ 
+        Returns false if the job (if there is one) should exit before every tile is calculated.
+    */
+    bool getSteps (int level, double startOctave, double endOctave,
+                   Array<double>& octaves, Array<float>& dissonance, const ThreadPoolJob* job);
+    
+    /*  Gets DisMAL's optima freqs of a level between the given octaves, in freq order, finding
+        the optima of tiles that don't have them yet.
+ 
+        Returns false if the job (if there is one) should exit before every tile's optima are found.
+    */
+    bool getOptima (int level, double startOctave, double endOctave,
+                    Array<float>& minima, Array<float>& maxima, const ThreadPoolJob* job);
+    
+    void clear();
+
+private:
+    struct Tile
+    {
+        int level;
+        int64 index;
+        int numSteps;
+        HeapBlock<double> octaves;
+        HeapBlock<float> dissonance;
+        bool hasOptima;
+        Array<float> minima, maxima;
+        uint32 lastUsed;
+    };
+    
+    IntervalDissonance intervals;
+    DissonanceCalc calc;
+    
+    OwnedArray<Tile> tiles;
+    HashMap<int64, Tile*> tilesByKey;
+    uint32 useCount;
+    
+    Tile* getTile (int level, int64 index, bool withOptima, const ThreadPoolJob* job);
+    Tile* calculateTile (int level, int64 index, bool withOptima);
+    Tile* findTile (int level, int64 index) const;
+    
+    // Calculates a DisMAL map of log spaced steps, returning false if DisMAL didn't take the steps
+    bool calculateMap (double firstOctave, double spacing, int numSteps);
+    
+    // Keeps the optima of the calc's last map that are within the tile's span
+    void findOptima (Tile& tile);
+    void removeLeastRecentlyUsed();
+    
+    static int64 getKey (int level, int64 index);
+    
+    // Sets the DisMAL calc up with the distributions and model of a calc's valuetree
+    static void copyCalc (const ValueTree& calcData, DissonanceCalc& calc);
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MapTileCache)
+};
@@ -0,0 +1,234 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#include "ResultStore.h"
+
+namespace
+{
+    // "PCRS", then a version that changes whenever the layout does
+    const int magic = 0x53524350;
+    const int version = 1;
+    
+    // The magic, version, layout and key, padded out
+    const int headerSize = 64;
+    const int pageSize = 4096;
+    
+    // Old store files are deleted to keep the folder within this size
+    const int64 maxFolderSize = (int64) 8 * 1024 * 1024 * 1024;
+    
+    // Space left free on the volume when creating a store file
+    const int64 minFreeSpace = (int64) 512 * 1024 * 1024;
+}
+
+//==============================================================================
+ResultStore::ResultStore (int chunks, int size)   : data (nullptr),
+                                                    numChunks (jmax (1, chunks)),
+                                                    chunkSize (jmax (1, size))
+{
+    allocate();
+}
+
+ResultStore::ResultStore (const MD5& key, int chunks, int size)   : data (nullptr),
+                                                                    numChunks (jmax (1, chunks)),
+                                                                    chunkSize (jmax (1, size))
+{
+    dataOffset = ((headerSize + (int64) sizeof (int32) * numChunks + pageSize - 1) / pageSize) * pageSize;
+    file = getFolder().getChildFile (key.toHexString() + ".results");
+    
+    if (! openFile (key) && ! createFile (key))
+    {
+        mappedFile.reset();
+        file = File();
+        allocate();
+    }
+}
+
+ResultStore::~ResultStore()
+{
+}
+
+bool ResultStore::isMapped() const
+{
+    return mappedFile != nullptr;
+}
+
+File ResultStore::getFile() const
+{
+    return file;
+}
+
+int ResultStore::getNumChunks() const
+{
+    return numChunks;
+}
+
+int ResultStore::getChunkSize() const
+{
+    return chunkSize;
+}
+
+float* ResultStore::getChunk (int chunk) const
+{
+    return reinterpret_cast<float*> (data + dataOffset) + (size_t) chunk * (size_t) chunkSize;
+}
+
+bool ResultStore::isChunkFinished (int chunk) const
+{
+    return getIndex()[chunk] != 0;
+}
+
+void ResultStore::setChunkFinished (int chunk)
+{
+    getIndex()[chunk] = 1;
+}
+
+File ResultStore::getFolder()
+{
+    // Kept with the app's other data rather than in the temp folder, which can be held in RAM
+    if (JUCE_MAC)
+        return File ("~/Library/Caches/PsychoCAT/Results");
+    
+    return File::getSpecialLocation (File::userApplicationDataDirectory).getChildFile ("PsychoCAT").getChildFile ("Results");
+}
+
+void ResultStore::trimFolder (int64 maxBytes)
+{
+    Array<File> files = getFolder().findChildFiles (File::findFiles, false, "*.results");
+    
+    struct Comparator
+    {
+        int compareElements (const File& first, const File& second) const
+        {
+            const Time firstTime = first.getLastModificationTime();
+            const Time secondTime = second.getLastModificationTime();
+            
+            return firstTime < secondTime ? -1 : (secondTime < firstTime ? 1 : 0);
+        }
+    };
+    
+    Comparator comparator;
+    files.sort (comparator);
+    
+    int64 total = 0;
+    
+    for (auto& storeFile : files)
+        total += storeFile.getSize();
+    
+    // Least recently used first
+    for (int i = 0; i < files.size() && total > maxBytes; ++i)
+    {
+        const int64 size = files.getReference (i).getSize();
+        
+        if (files.getReference (i).deleteFile())
+            total -= size;
+    }
+}
+
+int32* ResultStore::getIndex() const
+{
+    return reinterpret_cast<int32*> (data + headerSize);
+}
+
+bool ResultStore::openFile (const MD5& key)
+{
+    const int64 totalSize = dataOffset + (int64) sizeof (float) * numChunks * chunkSize;
+    
+    if (! file.existsAsFile() || file.getSize() != totalSize)
+        return false;
+    
+    {
+        FileInputStream stream (file);
+        
+        if (! stream.openedOk()
+            || stream.readInt() != magic
+            || stream.readInt() != version
+            || stream.readInt() != numChunks
+            || stream.readInt() != chunkSize)
+            return false;
+        
+        MemoryBlock storedKey;
+        
+        if (stream.readIntoMemoryBlock (storedKey, 16) != 16
+            || storedKey != key.getRawChecksumData())
+            return false;
+    }
+    
+    mappedFile.reset (new MemoryMappedFile (file, MemoryMappedFile::readWrite));
+    
+    if (mappedFile->getData() == nullptr || (int64) mappedFile->getSize() < totalSize)
+    {
+        mappedFile.reset();
+        return false;
+    }
+    
+    data = static_cast<char*> (mappedFile->getData());
+    
+    // Stores are trimmed by when they were last used
+    file.setLastModificationTime (Time::getCurrentTime());
+    
+    return true;
+}
+
+bool ResultStore::createFile (const MD5& key)
+{
+    const int64 totalSize = dataOffset + (int64) sizeof (float) * numChunks * chunkSize;
+    
+    if (! getFolder().createDirectory())
+        return false;
+    
+    file.deleteFile();
+    trimFolder (jmax ((int64) 0, maxFolderSize - totalSize));
+    
+    if (getFolder().getBytesFreeOnVolume() < totalSize + minFreeSpace)
+        return false;
+    
+    bool written = false;
+    
+    {
+        FileOutputStream stream (file);
+        
+        if (! stream.openedOk())
+            return false;
+        
+        stream.writeInt (magic);
+        stream.writeInt (version);
+        stream.writeInt (numChunks);
+        stream.writeInt (chunkSize);
+        
+        const MemoryBlock keyData = key.getRawChecksumData();
+        stream.write (keyData.getData(), keyData.getSize());
+        
+        // The rest is left as a hole, which reads as zeros, so every chunk starts unfinished
+        stream.setPosition (totalSize - 1);
+        stream.writeByte (0);
+        stream.flush();
+        
+        written = stream.getStatus().wasOk();
+    }
+    
+    if (written && openFile (key))
+        return true;
+    
+    file.deleteFile();
+    return false;
+}
+
+void ResultStore::allocate()
+{
+    dataOffset = ((headerSize + (int64) sizeof (int32) * numChunks + pageSize - 1) / pageSize) * pageSize;
+    
+    memory.allocate ((size_t) (dataOffset + (int64) sizeof (float) * numChunks * chunkSize), false);
+    data = memory;
+    
+    zeromem (getIndex(), sizeof (int32) * (size_t) numChunks);
+}
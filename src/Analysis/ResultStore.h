@@ -0,0 +1,79 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+//==============================================================================
+/*
+    Results of a calculation in fixed size chunks of floats, with an index of the chunks that
+    are finished.
+ 
+    A store is either held in memory or kept in a memory mapped file in the store folder, named
+    after a key of everything the results depend on. A mapped store's chunks are only paged in
+    when they're read or written, and paged out by the OS when memory is short, so results far
+    bigger than the RAM can be held. Reopening a store with the same key and layout picks up the
+    chunks that were already finished, so a calculation can resume where it stopped.
+ 
+    The file is a header, the index (a flag per chunk) and then the chunks, starting on a page
+    boundary. A chunk is written and marked finished by one thread, and read once it's finished.
+*/
+class ResultStore
+{
+public:
+    // Holds the chunks in memory
+    ResultStore (int numChunks, int chunkSize);
+    
+    // Keeps the chunks in the store file for the key, or in memory if the file can't be mapped
+    ResultStore (const MD5& key, int numChunks, int chunkSize);
+    
+    ~ResultStore();
+    
+    bool isMapped() const;
+    File getFile() const;
+    
+    int getNumChunks() const;
+    int getChunkSize() const;
+    
+    // A chunk's values, which are written before the chunk is marked finished
+    float* getChunk (int chunk) const;
+    
+    bool isChunkFinished (int chunk) const;
+    void setChunkFinished (int chunk);
+    
+    // Where store files are kept, between sessions
+    static File getFolder();
+    
+    // Deletes the least recently used store files until the folder takes at most the given size
+    static void trimFolder (int64 maxBytes);
+
+private:
+    File file;
+    std::unique_ptr<MemoryMappedFile> mappedFile;
+    HeapBlock<char> memory;
+    char* data;
+    
+    int numChunks, chunkSize;
+    int64 dataOffset;
+    
+    int32* getIndex() const;
+    
+    // Maps a store file, if it's for the same key and layout
+    bool openFile (const MD5& key);
+    bool createFile (const MD5& key);
+    
+    void allocate();
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ResultStore)
+};
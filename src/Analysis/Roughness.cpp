@@ -0,0 +1,148 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#include "Roughness.h"
+
+namespace
+{
+    // Plomp-Levelt curve fit constants (Sethares, "Tuning, Timbre, Spectrum, Scale")
+    const float b1 = 3.5f;
+    const float b2 = 5.75f;
+    const float dStar = 0.24f;
+    const float s1 = 0.0207f;
+    const float s2 = 18.96f;
+}
+
+//==============================================================================
+float Roughness::ofPair (float freq1, float amp1, float freq2, float amp2, Model model)
+{
+    float weight = getAmpWeight (amp1, amp2, model);
+    
+    return weight > 0 ? weight * getCurve (freq1, freq2) : 0;
+}
+
+float Roughness::getAmpWeight (float amp1, float amp2, Model model)
+{
+    if (amp1 <= 0 || amp2 <= 0)
+        return 0;
+    
+    if (model == vassilakis)
+    {
+        float minAmp = jmin (amp1, amp2);
+        
+        return std::pow (amp1 * amp2, 0.1f)
+               * 0.5f * std::pow (2 * minAmp / (amp1 + amp2), 3.11f);
+    }
+    
+    return jmin (amp1, amp2);
+}
+
+float Roughness::getAmpWeight (float amp1, float amp2, Model model, float& slope1, float& slope2)
+{
+    slope1 = 0;
+    slope2 = 0;
+    
+    if (amp1 <= 0 || amp2 <= 0)
+        return 0;
+    
+    const bool isFirstLower = amp1 <= amp2;
+    
+    if (model == vassilakis)
+    {
+        const float weight = getAmpWeight (amp1, amp2, model);
+        
+        // From the log of the weight: each amp adds 0.1 / amp, the lower amp adds 3.11 / amp
+        // through the min, and both take away 3.11 / (amp1 + amp2) through the sum
+        const float sumSlope = 3.11f / (amp1 + amp2);
+        
+        slope1 = weight * ((isFirstLower ? 3.21f : 0.1f) / amp1 - sumSlope);
+        slope2 = weight * ((isFirstLower ? 0.1f : 3.21f) / amp2 - sumSlope);
+        
+        return weight;
+    }
+    
+    // Only the lower amp counts towards the min
+    (isFirstLower ? slope1 : slope2) = 1;
+    
+    return jmin (amp1, amp2);
+}
+
+float Roughness::getCurve (float freq1, float freq2)
+{
+    float minFreq = jmin (freq1, freq2);
+    float s = dStar / (s1 * minFreq + s2);
+    float freqDiff = std::abs (freq2 - freq1);
+    
+    return std::exp (-b1 * s * freqDiff) - std::exp (-b2 * s * freqDiff);
+}
+
+float Roughness::getCurve (float freq1, float freq2, float& slope1, float& slope2)
+{
+    const bool isFirstLower = freq1 <= freq2;
+    const float minFreq = isFirstLower ? freq1 : freq2;
+    const float denominator = s1 * minFreq + s2;
+    const float s = dStar / denominator;
+    const float freqDiff = std::abs (freq2 - freq1);
+    
+    const float decay1 = std::exp (-b1 * s * freqDiff);
+    const float decay2 = std::exp (-b2 * s * freqDiff);
+    
+    // Slope of the curve with respect to s * freqDiff
+    const float slope = b2 * decay2 - b1 * decay1;
+    
+    // Raising the upper freq only widens the difference, while raising the lower freq
+    // narrows the difference and lowers s
+    const float upperSlope = slope * s;
+    const float lowerSlope = -slope * s * (1 + freqDiff * s1 / denominator);
+    
+    slope1 = isFirstLower ? lowerSlope : upperSlope;
+    slope2 = isFirstLower ? upperSlope : lowerSlope;
+    
+    return decay1 - decay2;
+}
+
+void Roughness::addCurves (float freq, const float* freqs, float weight, float* results, int num)
+{
+    // Kept branch-free so the loop can be vectorised
+    for (int i = 0; i < num; ++i)
+    {
+        float minFreq = jmin (freq, freqs[i]);
+        float s = dStar / (s1 * minFreq + s2);
+        float freqDiff = std::abs (freqs[i] - freq);
+        
+        results[i] += weight * (std::exp (-b1 * s * freqDiff) - std::exp (-b2 * s * freqDiff));
+    }
+}
+
+float Roughness::ofSpectrum (const float* freqs, const float* amps, int numPartials, Model model)
+{
+    float total = 0;
+    
+    for (int i = 0; i < numPartials; ++i)
+        for (int j = i + 1; j < numPartials; ++j)
+            total += ofPair (freqs[i], amps[i], freqs[j], amps[j], model);
+    
+    return total;
+}
+
+void Roughness::addCurves (const float* freqs1, const float* freqs2, float weight, float* results, int num)
+{
+    for (int i = 0; i < num; ++i)
+    {
+        float minFreq = jmin (freqs1[i], freqs2[i]);
+        float s = dStar / (s1 * minFreq + s2);
+        float freqDiff = std::abs (freqs2[i] - freqs1[i]);
+        
+        results[i] += weight * (std::exp (-b1 * s * freqDiff) - std::exp (-b2 * s * freqDiff));
+    }
+}
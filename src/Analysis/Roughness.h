@@ -0,0 +1,65 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+//==============================================================================
+/*
+    Pairwise sensory roughness of sine partials, for analysis that runs outside of
+    a DissonanceCalc (ie, on the audio input).
+ 
+    Uses the same Plomp-Levelt curve parameterisations as DisMAL's Sethares and
+    Vassilakis models. Freqs are in Hz and amps are linear.
+*/
+class Roughness
+{
+public:
+    enum Model
+    {
+        sethares = 0,
+        vassilakis
+    };
+    
+    // Version of the roughness maths here and in IntervalDissonance, which is part of the key of
+    // cached results. Bump it whenever a change to either would change the results.
+    static const int engineVersion = 1;
+    
+    // Roughness between two partials
+    static float ofPair (float freq1, float amp1, float freq2, float amp2, Model model);
+    
+    // The roughness of a pair is the product of a weight from its amps, and a curve from its freqs
+    static float getAmpWeight (float amp1, float amp2, Model model);
+    
+    // The amp weight, and its slope with respect to each amp
+    static float getAmpWeight (float amp1, float amp2, Model model, float& slope1, float& slope2);
+    static float getCurve (float freq1, float freq2);
+    
+    // The curve, and its slope with respect to each freq
+    static float getCurve (float freq1, float freq2, float& slope1, float& slope2);
+    
+    // Adds the roughness of a partial against a batch of partials with the same amp weight
+    static void addCurves (float freq, const float* freqs, float weight, float* results, int num);
+    
+    // Adds the roughness of a batch of pairs with the same amp weight
+    static void addCurves (const float* freqs1, const float* freqs2, float weight, float* results, int num);
+    
+    // Total roughness of every pair of partials in a spectrum
+    static float ofSpectrum (const float* freqs, const float* amps, int numPartials, Model model);
+
+private:
+    Roughness();
+    
+    JUCE_DECLARE_NON_COPYABLE (Roughness)
+};
@@ -0,0 +1,390 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#include "TimbreIndex.h"
+#include "../../DisMAL/FileIO.h"
+
+namespace
+{
+    // Changes whenever the features or the cache's layout do, so an old cache is ignored
+    const int cacheVersion = 2;
+    
+    // Partials are binned up to 5 octaves above the fundamental
+    const float binsPerOctave = 8;
+    
+    // Dissonance curves are taken at middle C with the Sethares model, so timbres are compared alike
+    const float curveFreq = 261.6256f;
+}
+
+//==============================================================================
+TimbreIndex::TimbreIndex()   : Thread ("Timbre Index")
+{
+    root = -1;
+}
+
+TimbreIndex::~TimbreIndex()
+{
+    stopThread (5000);
+}
+
+void TimbreIndex::setDirectory (const File& directory)
+{
+    stopThread (5000);
+    
+    folder = directory;
+    ready = 0;
+    startThread();
+}
+
+bool TimbreIndex::isReady() const
+{
+    return ready.get() != 0;
+}
+
+Array<File> TimbreIndex::findNearest (const ValueTree& distribution, int numResults) const
+{
+    Array<File> results;
+    IntervalDissonance intervals;
+    float query[numFeatures];
+    
+    if (! getFeatures (distribution, intervals, query))
+        return results;
+    
+    const ScopedLock sl (indexLock);
+    
+    Array<int> nearest;
+    Array<float> distances;
+    
+    search (root, query, jmax (1, numResults), nearest, distances);
+    
+    for (auto item : nearest)
+        results.add (files[item]);
+    
+    return results;
+}
+
+void TimbreIndex::run()
+{
+    Array<File> newFiles = folder.findChildFiles (File::findFiles, true, "*.dismal");
+    newFiles.sort();
+    
+    HashMap<String, int64> times;
+    HashMap<String, int> offsets;
+    Array<float> cached;
+    readCache (times, offsets, cached);
+    
+    Array<File> indexedFiles, newFailedFiles;
+    Array<float> newFeatures;
+    IntervalDissonance intervals;
+    float vector[numFeatures];
+    bool changed = newFiles.size() != times.size();
+    
+    for (auto& file : newFiles)
+    {
+        if (threadShouldExit())
+            return;
+        
+        const String path = file.getRelativePathFrom (folder);
+        
+        // Unchanged files keep their cached features
+        if (times.contains (path) && times[path] == file.getLastModificationTime().toMilliseconds())
+        {
+            if (offsets[path] < 0)
+            {
+                newFailedFiles.add (file);
+            }
+            else
+            {
+                indexedFiles.add (file);
+                newFeatures.addArray (cached.getRawDataPointer() + offsets[path], numFeatures);
+            }
+            
+            continue;
+        }
+        
+        changed = true;
+        
+        FileIO io = file;
+        ValueTree distribution = io.loadTreeFromFile();
+        PartialArray::convertLegacyPartials (distribution);
+        
+        if (getFeatures (distribution, intervals, vector))
+        {
+            indexedFiles.add (file);
+            newFeatures.addArray (vector, numFeatures);
+        }
+        else
+        {
+            newFailedFiles.add (file);
+        }
+    }
+    
+    // Built outside the lock, so searches aren't held up
+    Array<Node> tree;
+    HeapBlock<int> items ((size_t) jmax (1, indexedFiles.size()));
+    HeapBlock<float> distances ((size_t) jmax (1, indexedFiles.size()));
+    
+    for (int i = 0; i < indexedFiles.size(); ++i)
+        items[i] = i;
+    
+    const int newRoot = build (tree, newFeatures.getRawDataPointer(), items, distances, indexedFiles.size());
+    
+    {
+        const ScopedLock sl (indexLock);
+        
+        files.swapWith (indexedFiles);
+        failedFiles.swapWith (newFailedFiles);
+        features.swapWith (newFeatures);
+        nodes.swapWith (tree);
+        root = newRoot;
+    }
+    
+    if (changed)
+        writeCache();
+    
+    ready = 1;
+    sendChangeMessage();
+}
+
+bool TimbreIndex::getFeatures (const ValueTree& distribution, IntervalDissonance& intervals, float* features)
+{
+    FloatVectorOperations::clear (features, numFeatures);
+    
+    if (! distribution.hasType (IDs::OvertoneDistribution))
+        return false;
+    
+    float* bins = features;
+    float* curve = features + numPartialBins;
+    
+    // Each partial's amp is shared between the 2 nearest bins, so a small detune is a small change
+    IntervalDissonance::Timbre timbre = IntervalDissonance::createTimbre (distribution, curveFreq);
+    
+    for (int i = 0; i < timbre.ratios.size(); ++i)
+    {
+        const float position = std::log2 (timbre.ratios[i]) * binsPerOctave;
+        
+        if (position < 0 || position >= numPartialBins - 1)
+            continue;
+        
+        const int bin = (int) position;
+        const float proportion = position - bin;
+        
+        bins[bin] += timbre.amps[i] * (1 - proportion);
+        bins[bin + 1] += timbre.amps[i] * proportion;
+    }
+    
+    intervals.setTimbre (distribution, curveFreq, "Sethares");
+    
+    if (intervals.isEmpty())
+        return false;
+    
+    float ratios[numCurveSteps];
+    
+    for (int i = 0; i < numCurveSteps; ++i)
+        ratios[i] = std::pow (2.f, (i + 0.5f) / numCurveSteps);
+    
+    intervals.getDissonance (ratios, curve, numCurveSteps);
+    
+    // Only the curve's shape counts, since louder timbres are rougher everywhere
+    float mean = 0;
+    
+    for (int i = 0; i < numCurveSteps; ++i)
+        mean += curve[i] / numCurveSteps;
+    
+    FloatVectorOperations::add (curve, -mean, numCurveSteps);
+    
+    // Both halves have the same weight, with the whole vector's length at 1
+    auto normalise = [] (float* half, int num)
+    {
+        float length = 0;
+        
+        for (int i = 0; i < num; ++i)
+            length += half[i] * half[i];
+        
+        if (length > 0)
+            FloatVectorOperations::multiply (half, 1 / std::sqrt (2 * length), num);
+    };
+    
+    normalise (bins, numPartialBins);
+    normalise (curve, numCurveSteps);
+    
+    return true;
+}
+
+float TimbreIndex::getDistance (const float* first, const float* second)
+{
+    float total = 0;
+    
+    for (int i = 0; i < numFeatures; ++i)
+        total += (first[i] - second[i]) * (first[i] - second[i]);
+    
+    return std::sqrt (total);
+}
+
+int TimbreIndex::build (Array<Node>& tree, const float* vectors, int* items, float* distances, int numItems)
+{
+    if (numItems <= 0)
+        return -1;
+    
+    const int index = tree.size();
+    
+    Node node;
+    node.item = items[0];
+    node.radius = 0;
+    node.inside = -1;
+    node.outside = -1;
+    tree.add (node);
+    
+    if (numItems == 1)
+        return index;
+    
+    // The rest are split in half at the median distance from the vantage point
+    const float* vantage = vectors + (size_t) items[0] * numFeatures;
+    
+    for (int i = 1; i < numItems; ++i)
+        distances[items[i]] = getDistance (vantage, vectors + (size_t) items[i] * numFeatures);
+    
+    const int median = numItems / 2;
+    
+    std::nth_element (items + 1, items + median, items + numItems,
+                      [distances] (int a, int b) { return distances[a] < distances[b]; });
+    
+    const float radius = distances[items[median]];
+    const int inside = build (tree, vectors, items + 1, distances, median - 1);
+    const int outside = build (tree, vectors, items + median, distances, numItems - median);
+    
+    tree.getReference (index).radius = radius;
+    tree.getReference (index).inside = inside;
+    tree.getReference (index).outside = outside;
+    
+    return index;
+}
+
+void TimbreIndex::search (int node, const float* query, int numResults, Array<int>& nearest, Array<float>& distances) const
+{
+    if (node < 0)
+        return;
+    
+    const Node& current = nodes.getReference (node);
+    const float distance = getDistance (query, features.getRawDataPointer() + (size_t) current.item * numFeatures);
+    
+    // Nearest so far, in order
+    if (nearest.size() < numResults || distance < distances.getLast())
+    {
+        int index = 0;
+        
+        while (index < distances.size() && distances[index] <= distance)
+            ++index;
+        
+        nearest.insert (index, current.item);
+        distances.insert (index, distance);
+        
+        if (nearest.size() > numResults)
+        {
+            nearest.removeLast();
+            distances.removeLast();
+        }
+    }
+    
+    // The furthest of the nearest so far, which a branch has to be able to beat
+    auto getBound = [&] { return nearest.size() < numResults ? std::numeric_limits<float>::max() : distances.getLast(); };
+    
+    // The side the query is on is searched first, as it's most likely to hold the nearest
+    if (distance < current.radius)
+    {
+        if (distance - getBound() <= current.radius)
+            search (current.inside, query, numResults, nearest, distances);
+        
+        if (distance + getBound() >= current.radius)
+            search (current.outside, query, numResults, nearest, distances);
+    }
+    else
+    {
+        if (distance + getBound() >= current.radius)
+            search (current.outside, query, numResults, nearest, distances);
+        
+        if (distance - getBound() <= current.radius)
+            search (current.inside, query, numResults, nearest, distances);
+    }
+}
+
+void TimbreIndex::readCache (HashMap<String, int64>& times, HashMap<String, int>& offsets, Array<float>& cached) const
+{
+    FileInputStream stream (getCacheFile());
+    
+    if (! stream.openedOk()
+        || stream.readInt() != cacheVersion
+        || stream.readInt() != numFeatures)
+        return;
+    
+    const int numFiles = stream.readInt();
+    
+    for (int i = 0; i < numFiles && ! stream.isExhausted(); ++i)
+    {
+        const String path = stream.readString();
+        const int64 time = stream.readInt64();
+        
+        times.set (path, time);
+        
+        // Files without features have an offset of -1
+        if (! stream.readBool())
+        {
+            offsets.set (path, -1);
+            continue;
+        }
+        
+        offsets.set (path, cached.size());
+        
+        for (int j = 0; j < numFeatures; ++j)
+            cached.add (stream.readFloat());
+    }
+}
+
+void TimbreIndex::writeCache() const
+{
+    const File cache = getCacheFile();
+    cache.deleteFile();
+    
+    FileOutputStream stream (cache);
+    
+    if (! stream.openedOk())
+        return;
+    
+    const ScopedLock sl (indexLock);
+    
+    stream.writeInt (cacheVersion);
+    stream.writeInt (numFeatures);
+    stream.writeInt (files.size() + failedFiles.size());
+    
+    for (int i = 0; i < files.size(); ++i)
+    {
+        stream.writeString (files[i].getRelativePathFrom (folder));
+        stream.writeInt64 (files[i].getLastModificationTime().toMilliseconds());
+        stream.writeBool (true);
+        
+        for (int j = 0; j < numFeatures; ++j)
+            stream.writeFloat (features[i * numFeatures + j]);
+    }
+    
+    for (auto& file : failedFiles)
+    {
+        stream.writeString (file.getRelativePathFrom (folder));
+        stream.writeInt64 (file.getLastModificationTime().toMilliseconds());
+        stream.writeBool (false);
+    }
+}
+
+File TimbreIndex::getCacheFile() const
+{
+    return folder.getChildFile (".timbre-index");
+}
@@ -0,0 +1,92 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "IntervalDissonance.h"
+
+//==============================================================================
+/*
+    Finds the saved timbres most similar to a distribution, by their spectral content.
+ 
+    Every timbre has a feature vector made of its partials' amps in eighth octave bins above
+    the fundamental, and the shape of its dissonance curve against itself over an octave, each
+    normalised and weighted equally. Similar timbres are the nearest vectors, found with a
+    vantage point tree: each node splits the timbres under it by their distance from one of
+    them, so a search only visits the nodes whose shell could hold a nearer timbre.
+ 
+    Feature vectors are kept in a cache file in the saved timbres folder, and only the files
+    that are new or have changed since the cache was written are loaded again. The index is
+    updated in the background, and sends a change message when it's ready.
+*/
+class TimbreIndex   : public Thread,
+                      public ChangeBroadcaster
+{
+public:
+    TimbreIndex();
+    ~TimbreIndex();
+    
+    // Updates the index to the .dismal files in the folder (and its subfolders) in the background
+    void setDirectory (const File& directory);
+    
+    bool isReady() const;
+    
+    // The saved timbres nearest to the distribution, from most to least similar
+    Array<File> findNearest (const ValueTree& distribution, int numResults) const;
+    
+    void run() override;
+    
+    static const int numPartialBins = 40;
+    static const int numCurveSteps = 32;
+    static const int numFeatures = numPartialBins + numCurveSteps;
+    
+    // Fills the feature vector of a distribution, returning false if it has no sounding partials
+    static bool getFeatures (const ValueTree& distribution, IntervalDissonance& intervals, float* features);
+
+private:
+    struct Node
+    {
+        int item;
+        float radius;
+        
+        // Child nodes within and beyond the radius, or -1
+        int inside, outside;
+    };
+    
+    File folder;
+    
+    // Files and their features in the same order, with the tree's nodes pointing into both
+    Array<File> files;
+    Array<float> features;
+    Array<Node> nodes;
+    
+    // Files that aren't timbres or have no sounding partials, cached so they aren't loaded every time
+    Array<File> failedFiles;
+    int root;
+    CriticalSection mutable indexLock;
+    Atomic<int> ready;
+    
+    static float getDistance (const float* first, const float* second);
+    
+    int build (Array<Node>& tree, const float* vectors, int* items, float* distances, int numItems);
+    
+    void search (int node, const float* query, int numResults, Array<int>& nearest, Array<float>& distances) const;
+    
+    // Reads and writes the feature cache, as each file's path, modification time and features (if it has any)
+    void readCache (HashMap<String, int64>& times, HashMap<String, int>& offsets, Array<float>& cached) const;
+    void writeCache() const;
+    File getCacheFile() const;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (TimbreIndex)
+};
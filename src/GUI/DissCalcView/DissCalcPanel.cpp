@@ -14,11 +14,13 @@
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "DissCalcPanel.h"
 #include "DissCalcView.h"
+#include "MainComponent.h"
 
 //==============================================================================
 DistributionOptions::DistributionOptions()
 {
     muteButton.setButtonText ("M");
+    setYAxisButton.setButtonText ("Y");
     duplicateButton.setIcon (true, FontAwesome_Clone);
     setXAxisButton.setIcon (true, FontAwesome_Times);
     setFromSavedButton.setIcon (true, FontAwesome_FolderOpenO);
@@ -28,18 +30,21 @@ DistributionOptions::DistributionOptions()
     muteButton.setTooltip ("Mute");
     duplicateButton.setTooltip ("Clone");
     setXAxisButton.setTooltip ("Set as the x-axis variable");
+    setYAxisButton.setTooltip ("Set as the y-axis variable (triad surface)");
     setFromSavedButton.setTooltip ("Open saved");
     saveButton.setTooltip ("Save");
     removeButton.setTooltip ("Remove");
     
     setXAxisButton.setIconSize (15);
     muteButton.setFontSize (16);
+    setYAxisButton.setFontSize (16);
     removeButton.setIconSize (16);
     saveButton.setIconSize (16);
     
     muteButton.setBorders (true, true, true, true, 3);
     duplicateButton.setBorders (true, true, true, true, 3);
     setXAxisButton.setBorders (true, true, true, true, 3);
+    setYAxisButton.setBorders (true, true, true, true, 3);
     setFromSavedButton.setBorders (true, true, true, true, 3);
     saveButton.setBorders (true, true, true, true, 3);
     removeButton.setBorders (true, true, true, true, 3);
@@ -47,6 +52,7 @@ DistributionOptions::DistributionOptions()
     addAndMakeVisible (muteButton);
     addAndMakeVisible (duplicateButton);
     addAndMakeVisible (setXAxisButton);
+    addAndMakeVisible (setYAxisButton);
     addAndMakeVisible (setFromSavedButton);
     addAndMakeVisible (saveButton);
     addAndMakeVisible (removeButton);
@@ -88,12 +94,19 @@ void DistributionOptions::resized()
                                   .withY (6));
         setXAxisButton.setBounds (setXAxisButton.getBounds().withX (setXAxisButton.getX() - 6));
         
-        xDisplacement = 6;
+        setYAxisButton.setVisible (true);
+        setYAxisButton.setBounds (area.removeFromLeft (getHeight() - 6)
+                                  .reduced (3, 6)
+                                  .withY (6));
+        setYAxisButton.setBounds (setYAxisButton.getBounds().withX (setYAxisButton.getX() - 9));
+        
+        xDisplacement = 9;
     }
     else
     {
         muteButton.setVisible (false);
         setXAxisButton.setVisible (false);
+        setYAxisButton.setVisible (false);
     }
     
     duplicateButton.setBounds (area.removeFromLeft (getHeight() - 6)
@@ -183,6 +196,12 @@ void DistributionComponent::paint (Graphics& g)
                     getLocalBounds().removeFromRight (getHeight() + 9).withY (-1),
                     Justification::centredLeft, true);
     }
+    else if (distribution[IDs::YAxis])
+    {
+        g.drawText ("Y",
+                    getLocalBounds().removeFromRight (getHeight() + 9).withY (-1),
+                    Justification::centredLeft, true);
+    }
 }
 
 void DistributionComponent::resized()
@@ -249,7 +268,7 @@ void DistributionComponent::valueTreePropertyChanged (ValueTree& parent,
 {
     if (parent == distribution)
     {
-        if (ID == IDs::Name || ID == IDs::IsViewed || ID == IDs::Mute || ID == IDs::XAxis)
+        if (ID == IDs::Name || ID == IDs::IsViewed || ID == IDs::Mute || ID == IDs::XAxis || ID == IDs::YAxis)
             repaint();
         
         if (ID == IDs::XAxis && parent[IDs::Mute])
@@ -323,6 +342,14 @@ void DistributionList::valueTreeChildAdded (ValueTree& parent, ValueTree& newChi
                                                                         false, nullptr);
         }
         
+        // Only one distribution is the y-axis variable
+        if (newChild[IDs::YAxis].operator bool())
+        {
+            for (int i = 0; i < parent.getNumChildren(); ++i)
+                if (parent.getChild (i) != newChild && parent.getChild (i)[IDs::YAxis])
+                    parent.getChild (i).setProperty (IDs::YAxis, false, nullptr);
+        }
+        
         // Ensures that fundamental freqs/amps aren't initialized with illegal values
         if (newChild[IDs::FundamentalAmp].operator float() <= 0
             || newChild[IDs::FundamentalFreq].operator float() <= 0)
@@ -413,11 +440,23 @@ DissCalc::DissCalc()
     logButton.setIconSize (16);
     logButton.setTooltip ("Use logarithmic frequency range\n(X-axis, currently linear)");
 
+    adaptiveButton.setIcon (true, FontAwesome_LineChart);
+    addAndMakeVisible (adaptiveButton);
+    adaptiveButton.addListener (this);
+    adaptiveButton.setIconSize (13);
+    adaptiveButton.setTooltip ("Refine steps around curves and optima");
+    
     lockScaleButton.setIcon (true, FontAwesome_Unlock);
     addAndMakeVisible (lockScaleButton);
     lockScaleButton.addListener (this);
     lockScaleButton.setIconSize (15);
     lockScaleButton.setTooltip ("Lock the dissonance scale (Y-axis");
+    
+    liveInputButton.setIcon (true, FontAwesome_Microphone);
+    addAndMakeVisible (liveInputButton);
+    liveInputButton.addListener (this);
+    liveInputButton.setIconSize (14);
+    liveInputButton.setTooltip ("Add a timbre that follows the audio input");
 }
 
 DissCalc::~DissCalc()
@@ -441,6 +480,11 @@ void DissCalc::paint (Graphics& g)
     
     logButton.setIconSize (getCalcData()[IDs::LogSteps] ? 14 : 16);
     
+    adaptiveButton.setToggleState (getCalcData()[IDs::AdaptiveSteps], dontSendNotification);
+    adaptiveButton.setTooltip (getCalcData()[IDs::AdaptiveSteps]
+                               ? "Use uniform steps"
+                               : "Refine steps around curves and optima");
+    
     lockScaleButton.setIcon (true, getCalcData()[IDs::ScaleLocked] ? FontAwesome_Lock : FontAwesome_Unlock);
     lockScaleButton.setTooltip (getCalcData()[IDs::ScaleLocked]
                                 ? "Unlock the dissonance scale (Y-axis)"
@@ -472,6 +516,14 @@ void DissCalc::resized()
                          .reduced (3)
                          .withRightX (header.getWidth() + (height * 2) + 9));
     
+    adaptiveButton.setBounds (header.removeFromRight (height)
+                              .reduced (3)
+                              .withRightX (header.getWidth() + (height * 2) + 12));
+    
+    liveInputButton.setBounds (header.removeFromRight (height)
+                               .reduced (3)
+                               .withRightX (header.getWidth() + (height * 2) + 15));
+    
     view.setBounds (area);
     
     // Only resize the distribution list if it is larger than the viewport
@@ -488,6 +540,16 @@ void DissCalc::buttonClicked (Button* clickedButton)
         distributionList.distributions.appendChild (ValueTree (IDs::OvertoneDistribution),
                                                     findParentComponentOfClass<DissCalcPanel>()->undo);
     }
+    else if (clickedButton == &liveInputButton)
+    {
+        ValueTree tree = ValueTree (IDs::OvertoneDistribution);
+        tree.setProperty (IDs::Name, "Input", nullptr);
+        tree.setProperty (IDs::LiveInput, true, nullptr);
+        
+        findParentComponentOfClass<DissCalcPanel>()->undo->beginNewTransaction();
+        
+        distributionList.distributions.appendChild (tree, findParentComponentOfClass<DissCalcPanel>()->undo);
+    }
     else if (clickedButton == &copyButton)
     {
         ValueTree tree = ValueTree (IDs::Calculator);
@@ -537,6 +599,15 @@ void DissCalc::buttonClicked (Button* clickedButton)
         
         logButton.setIconSize (getCalcData()[IDs::LogSteps] ? 14 : 16);
     }
+    else if (clickedButton == &adaptiveButton)
+    {
+        getCalcData().setProperty (IDs::AdaptiveSteps, ! getCalcData()[IDs::AdaptiveSteps], nullptr);
+        
+        adaptiveButton.setToggleState (getCalcData()[IDs::AdaptiveSteps], dontSendNotification);
+        adaptiveButton.setTooltip (getCalcData()[IDs::AdaptiveSteps]
+                                   ? "Use uniform steps"
+                                   : "Refine steps around curves and optima");
+    }
 }
 
 void DissCalc::setCalcData (ValueTree& distributions)
@@ -663,6 +734,9 @@ void DissCalcPanel::buttonClicked (Button* clickedButton)
         newCalc.getChild (0).setProperty (IDs::FundamentalFreq, 1, undo);
         newCalc.getChild (0).setProperty (IDs::FundamentalAmp, 1, undo);
         newCalc.setProperty (IDs::LogSteps, false, undo);
+        newCalc.setProperty (IDs::NumSteps,
+                             findParentComponentOfClass<MainComponent>()->getSettings()->getIntValue ("Map Resolution"),
+                             undo);
         newCalc.setProperty (IDs::ScaleLocked, false, undo);
         newCalc.setProperty (IDs::Mute, false, undo);
     }
@@ -687,22 +761,24 @@ void DissCalcPanel::buttonClicked (Button* clickedButton)
         if (tree[IDs::XAxis])
             tree.setProperty (IDs::XAxis, false, nullptr);
         
+        if (tree[IDs::YAxis])
+            tree.setProperty (IDs::YAxis, false, nullptr);
+        
         if (tree[IDs::Mute])
             tree.setProperty (IDs::Mute, false, nullptr);
         
         if (tree[IDs::IsViewed])
             tree.setProperty (IDs::IsViewed, false, nullptr);
         
+        // Copies of a live input distribution keep the spectrum heard when copied
+        if (tree[IDs::LiveInput])
+            tree.removeProperty (IDs::LiveInput, nullptr);
+        
         // Don't copy any partials with incomplete data
-        for (auto child : tree)
-        {
-            if (child.hasType (IDs::Partial)
-                && (child[IDs::Freq].operator float() <= 0
-                    || child[IDs::Amp].operator float() <= 0))
-            {
-                tree.removeChild (child, nullptr);
-            }
-        }
+        Array<PartialData> partials = PartialArray (tree).getAll();
+        
+        partials.removeIf ([] (const PartialData& partial) { return partial.freq <= 0 || partial.amp <= 0; });
+        PartialArray (tree).replaceAll (partials, nullptr);
 
         undo->beginNewTransaction();
         parent.appendChild (tree, undo);
@@ -719,6 +795,9 @@ void DissCalcPanel::buttonClicked (Button* clickedButton)
         parent.getChildWithProperty (IDs::XAxis, true).setProperty (IDs::XAxis, false, undo);
         options->distribution->distribution.setProperty (IDs::XAxis, true, undo);
         
+        if (options->distribution->distribution[IDs::YAxis])
+            options->distribution->distribution.setProperty (IDs::YAxis, false, undo);
+        
         options->setVisible (false);
         options->distribution->optionsButton.setToggleState (false, dontSendNotification);
         
@@ -735,6 +814,24 @@ void DissCalcPanel::buttonClicked (Button* clickedButton)
         
         options->distribution = nullptr;
     }
+    else if (clickedButton == &options->setYAxisButton)
+    {
+        ValueTree distribution = options->distribution->distribution;
+        ValueTree previous = distribution.getParent().getChildWithProperty (IDs::YAxis, true);
+        
+        // Setting the y-axis distribution again unsets it, leaving the map as a curve
+        undo->beginNewTransaction();
+        
+        if (previous.isValid())
+            previous.setProperty (IDs::YAxis, false, undo);
+        
+        if (previous != distribution)
+            distribution.setProperty (IDs::YAxis, true, undo);
+        
+        options->setVisible (false);
+        options->distribution->optionsButton.setToggleState (false, dontSendNotification);
+        options->distribution = nullptr;
+    }
     else if (clickedButton == &options->setFromSavedButton)
     {
         DissCalcView* view = findParentComponentOfClass<DissCalcView>();
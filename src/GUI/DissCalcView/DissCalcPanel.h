@@ -133,7 +133,7 @@ public:
     void setCalcData (ValueTree& distributions);
     ValueTree& getCalcData();
     
-    ThemedButton addDistributionButton, removeButton, copyButton, lockScaleButton, logButton;
+    ThemedButton addDistributionButton, removeButton, copyButton, lockScaleButton, logButton, adaptiveButton, liveInputButton;
 
 private:
     DistributionList distributionList;
@@ -190,7 +190,7 @@ public:
     void paint (Graphics& g) override;
     void resized() override;
         
-    ThemedButton removeButton, duplicateButton, setXAxisButton, setFromSavedButton, saveButton, muteButton;
+    ThemedButton removeButton, duplicateButton, setXAxisButton, setYAxisButton, setFromSavedButton, saveButton, muteButton;
     DistributionComponent* distribution;
     
 private:
@@ -15,8 +15,11 @@
 #include "DissCalcView.h"
 
 //==============================================================================
-DissCalcView::DissCalcView()   : tips (this)
+DissCalcView::DissCalcView()   : inputAnalyzer (nullptr),
+                                 tips (this)
 {
+    hasNewAnalysis = false;
+    
     addAndMakeVisible (&distributionPanel);
     addAndMakeVisible (&calcPanel);
     addAndMakeVisible (&mapComponent);
@@ -27,6 +30,7 @@ DissCalcView::DissCalcView()   : tips (this)
     
     addChildComponent (saveDistribution);
     addChildComponent (savedDistributionList);
+    addChildComponent (tuningWindow);
     
     addKeyListener (this);
     
@@ -36,6 +40,7 @@ DissCalcView::DissCalcView()   : tips (this)
     distributionOptions.muteButton.addListener (&calcPanel);
     distributionOptions.duplicateButton.addListener (&calcPanel);
     distributionOptions.setXAxisButton.addListener (&calcPanel);
+    distributionOptions.setYAxisButton.addListener (&calcPanel);
     distributionOptions.setFromSavedButton.addListener (&calcPanel);
     distributionOptions.saveButton.addListener (&calcPanel);
     distributionOptions.removeButton.addListener (&calcPanel);
@@ -51,6 +56,8 @@ DissCalcView::DissCalcView()   : tips (this)
 
 DissCalcView::~DissCalcView()
 {
+    if (inputAnalyzer != nullptr)
+        inputAnalyzer->removeChangeListener (this);
 }
 
 void DissCalcView::paint (Graphics& g)
@@ -68,6 +75,7 @@ void DissCalcView::resized()
     
     saveDistribution.centreWithSize (200, 80);
     savedDistributionList.centreWithSize (400, 350);
+    tuningWindow.centreWithSize (400, 350);
     
     distributionPanel.toFront (false);
     calcPanel.toFront (false);
@@ -85,6 +93,72 @@ void DissCalcView::setData (ValueTree& data)
         calcPanel.undo = &undo;
         distributionPanel.undo = &undo;
         savedDistributionList.undo = &undo;
+        tuningWindow.calcData = data;
+        tuningWindow.undo = &undo;
+    }
+}
+
+void DissCalcView::setTuningData (ValueTree& tuning)
+{
+    if (tuning.hasType (IDs::Tuning))
+        tuningWindow.tuning = tuning;
+}
+
+Array<float> DissCalcView::getMinimaRatios()
+{
+    return mapComponent.getMinimaRatios();
+}
+
+void DissCalcView::setInputAnalyzer (InputAnalyzer& analyzer)
+{
+    inputAnalyzer = &analyzer;
+    inputAnalyzer->addChangeListener (this);
+    
+    mapComponent.setInputAnalyzer (analyzer);
+}
+
+void DissCalcView::changeListenerCallback (ChangeBroadcaster* source)
+{
+    // Analyses arrive faster than the maps can redraw, so they're coalesced into one write a frame
+    hasNewAnalysis = true;
+    
+    if (! isTimerRunning())
+        startTimerHz (60);
+}
+
+void DissCalcView::timerCallback()
+{
+    if (! hasNewAnalysis)
+    {
+        stopTimer();
+        return;
+    }
+    
+    hasNewAnalysis = false;
+    
+    InputAnalyzer::Analysis analysis = inputAnalyzer->getLatestAnalysis();
+    
+    // Keep showing the last spectrum heard while the input is silent
+    if (analysis.fundamentalFreq <= 0)
+        return;
+    
+    // Live input isn't undoable, only adding or removing the distribution is
+    for (int i = 0; i < calcData.getNumChildren(); ++i)
+    {
+        ValueTree calc = calcData.getChild (i);
+        
+        for (int j = 0; j < calc.getNumChildren(); ++j)
+        {
+            ValueTree distribution = calc.getChild (j);
+            
+            if (distribution.hasType (IDs::OvertoneDistribution)
+                && distribution[IDs::LiveInput])
+            {
+                distribution.setProperty (IDs::FundamentalFreq, analysis.fundamentalFreq, nullptr);
+                distribution.setProperty (IDs::FundamentalAmp, analysis.fundamentalAmp, nullptr);
+                PartialArray (distribution).replaceAll (analysis.partials, nullptr);
+            }
+        }
     }
 }
 
@@ -191,8 +265,13 @@ void DissCalcView::openOptions (DistributionComponent* component)
                                                ? "Unmute"
                                                : "Mute");
     
+    distributionOptions.setYAxisButton.setToggleState (distributionOptions.distribution->getDistributionData()[IDs::YAxis], dontSendNotification);
+    distributionOptions.setYAxisButton.setTooltip (distributionOptions.distribution->getDistributionData()[IDs::YAxis]
+                                                   ? "Unset as the y-axis variable"
+                                                   : "Set as the y-axis variable (triad surface)");
+    
     int height = component->getHeight() + 4;
-    int width = component->getDistributionData()[IDs::XAxis] ? height * 4 - 33 : height * 6 - 51;
+    int width = component->getDistributionData()[IDs::XAxis] ? height * 4 - 33 : height * 7 - 60;
     
     distributionOptions.setSize (width, height);
     distributionOptions.setTopLeftPosition (getLocalPoint (component, Point<int> (component->getWidth(), -3)));
@@ -221,8 +300,8 @@ void DissCalcView::openOptions (PartialEditor* component, bool isFundamental)
     
     if (component != nullptr && ! isFundamental)
     {
-        partialOptions.muteButton.setToggleState (partialOptions.partial->getPartialData()[IDs::Mute], dontSendNotification);
-        partialOptions.muteButton.setTooltip (partialOptions.partial->getPartialData()[IDs::Mute] ? "Unmute" : "Mute");
+        partialOptions.muteButton.setToggleState (partialOptions.partial->isMuted(), dontSendNotification);
+        partialOptions.muteButton.setTooltip (partialOptions.partial->isMuted() ? "Unmute" : "Mute");
     }
     else if (isFundamental)
     {
@@ -247,6 +326,7 @@ void DissCalcView::mouseDown (const MouseEvent& event)
     if (distributionOptions.isVisible()
         && event.eventComponent != &distributionOptions.duplicateButton
         && event.eventComponent != &distributionOptions.setXAxisButton
+        && event.eventComponent != &distributionOptions.setYAxisButton
         && event.eventComponent != &distributionOptions.setFromSavedButton
         && event.eventComponent != &distributionOptions.saveButton
         && event.eventComponent != &distributionOptions.removeButton
@@ -19,13 +19,16 @@
 #include "DistributionPanel.h"
 #include "SaveDistributionWindow.h"
 #include "SavedDistributionsList.h"
+#include "TuningWindow.h"
 
 //==============================================================================
 /*
     This class creates the GUI view and controls when calculating dissonances and creating dissonance maps.
 */
 class DissCalcView   : public Component,
-                       public KeyListener
+                       public KeyListener,
+                       public ChangeListener,
+                       private Timer
 {
 public:
     DissCalcView();
@@ -37,6 +40,14 @@ public:
     // Sets the top-level valuetree node to hold all dissonance calculation data
     void setData (ValueTree& data);
     
+    // Live input distributions and the roughness meter follow this analyzer
+    void setInputAnalyzer (InputAnalyzer& analyzer);
+    void changeListenerCallback (ChangeBroadcaster* source) override;
+    
+    // Sets the tuning node that generated tunings are written to
+    void setTuningData (ValueTree& tuning);
+    Array<float> getMinimaRatios();
+    
     void openDistributionPanel (ValueTree& distributionToOpen);
     void closeDistributionPanel();
     bool distributionPanelIsOpen();
@@ -53,6 +64,7 @@ public:
     
     SaveDistributionWindow saveDistribution;
     SavedDistributionsList savedDistributionList;
+    TuningWindow tuningWindow;
     
 private:
     DissCalcPanel calcPanel;
@@ -63,6 +75,11 @@ private:
 
     ValueTree calcData;
     UndoManager undo;
+    InputAnalyzer* inputAnalyzer;
+    bool hasNewAnalysis;
+    
+    // Writes the latest analysis to the live input distributions, at most once a frame
+    void timerCallback() override;
     
     TooltipWindow tips;
     
@@ -14,14 +14,26 @@
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "DissMapComponent.h"
 #include "DissCalcView.h"
+#include "MainComponent.h"
+#include "Trace.h"
+
+namespace
+{
+    // Bigger surfaces are kept in a result store file rather than RAM
+    const int maxSurfaceSteps = 16384;
+    
+    // Surfaces are drawn at most this many pixels a side, from the step at or before each pixel
+    const int maxSurfaceImageSize = 1024;
+}
 
 //==============================================================================
-OptimaComponent::OptimaComponent (float frequency, String tooltip, bool isMinima)
+OptimaComponent::OptimaComponent (float frequency, String tooltip, bool isMinima, float yFrequency)
 {
     setTooltip (tooltip);
     
     isMin = isMinima;
     freq = frequency;
+    yFreq = yFrequency;
     
     setSize (10, 10);
 }
@@ -38,11 +50,29 @@ void OptimaComponent::paint (Graphics& g)
     g.drawEllipse (1, 1, getWidth() - 2, getHeight() - 2, 2);
 }
 
+void OptimaComponent::mouseEnter (const MouseEvent& event)
+{
+    // Surface optima depend on 2 intervals, which the readout doesn't cover
+    if (yFreq <= 0)
+        findParentComponentOfClass<DissonanceMap>()->readOutSensitivity (this);
+}
+
 float OptimaComponent::getFreq()
 {
     return freq;
 }
 
+void OptimaComponent::setFreq (float frequency, String tooltip)
+{
+    freq = frequency;
+    setTooltip (tooltip);
+}
+
+float OptimaComponent::getYFreq()
+{
+    return yFreq;
+}
+
 //==============================================================================
 FindAndCreateOptimaJob::FindAndCreateOptimaJob (DissonanceMap* parentComponent,
                                                 bool isMinima)   : ThreadPoolJob ("Find and Create Optima"),
@@ -58,6 +88,8 @@ FindAndCreateOptimaJob::~FindAndCreateOptimaJob()
 
 ThreadPoolJob::JobStatus FindAndCreateOptimaJob::runJob()
 {
+    TRACE_SCOPE ("FindAndCreateOptimaJob");
+    
     parent->createOptimaComponents (isMin);
     
     while (rerun)
@@ -87,258 +119,1016 @@ void AsyncOptimaUpdater::handleAsyncUpdate()
 }
 
 //==============================================================================
-DissonanceMap::DissonanceMap()   : mapData (IDs::Calculator),
-                                   asyncOptimaUpdater (this),
-                                   updateMinimaJob (this, true),
-                                   updateMaximaJob (this, false)
+AsyncSurfaceUpdater::AsyncSurfaceUpdater (DissonanceMap* parentComponent)   : parent (parentComponent)
 {
-    startFreq.setTextToShowWhenEmpty ("Start Freq", Theme::border);
-    startFreq.setTooltip (String ("Starting frequency in Hz\n")
-                          + String ("(left edge of the map)"));
-    startFreq.setEvaluateExpressions (true);
-    startFreq.setFont (15.f);
-    addAndMakeVisible (startFreq);
-    startFreq.addListener (this);
+}
 
-    endRatio.setTextToShowWhenEmpty ("End Ratio", Theme::border);
-    endRatio.setTooltip (String ("End frequency ratio\n")
-                          + String ("(right edge of the map)"));
-    endRatio.setEvaluateExpressions (true);
-    endRatio.setFont (15.f);
-    addAndMakeVisible (endRatio);
-    endRatio.addListener (this);
+void AsyncSurfaceUpdater::handleAsyncUpdate()
+{
+    parent->surfaceCalculated();
+}
+
+//==============================================================================
+ProgressiveMapJob::ProgressiveMapJob (DissonanceMap* parentComponent)   : ThreadPoolJob ("Progressive Map"),
+                                                                           parent (parentComponent)
+{
+    startRatio = 1;
+    endRatio = 2;
+    isLog = false;
+    isAdaptive = false;
+    steps = 0;
+    minInterval = 1.001f;
+    isFinal = false;
+    hasPass = false;
+    hasOptima = false;
+    hasTrackedOptima = false;
+    numCurveMinima = 0;
+    numCurveMaxima = 0;
+}
+
+ProgressiveMapJob::~ProgressiveMapJob()
+{
+    cancelPendingUpdate();
+}
+
+bool ProgressiveMapJob::setCalc (const ValueTree& calcData, float startFreq, float endFreq, int numSteps)
+{
+    // Passes of the previous calc are stale now
+    cancelPendingUpdate();
     
-    dissonanceModel.addSectionHeading ("Dissonance Model");
-    dissonanceModel.addItem ("Sethares", 1);
-    dissonanceModel.addItem ("Vassilakis", 2);
-    dissonanceModel.setTextWhenNothingSelected ("Dissonance Model");
-    dissonanceModel.setTooltip ("Sets the dissonance model");
-    dissonanceModel.addListener (this);
-    addAndMakeVisible (dissonanceModel);
+    {
+        const ScopedLock sl (passLock);
+        hasPass = false;
+        hasOptima = false;
+        hasTrackedOptima = false;
+    }
     
-    setRepaintsOnMouseActivity (true);
-    setWantsKeyboardFocus (true);
+    const bool hasSamePairs = tiles.setCalc (calcData);
     
-    mapData.addListener (this);
+    const bool hasSameSteps = freqRange == Range<float> (startFreq, endFreq)
+                              && isLog == calcData[IDs::LogSteps].operator bool()
+                              && isAdaptive == calcData[IDs::AdaptiveSteps].operator bool()
+                              && steps == jmax (2, numSteps);
+    
+    freqRange = Range<float> (startFreq, endFreq);
+    
+    // Sampled in ratios of the same reference as the optima
+    float referenceFreq = jmax (std::numeric_limits<float>::min(), getReferenceFreq());
+    
+    startRatio = startFreq / referenceFreq;
+    endRatio = endFreq / referenceFreq;
+    isLog = calcData[IDs::LogSteps];
+    isAdaptive = calcData[IDs::AdaptiveSteps];
+    steps = jmax (2, numSteps);
+    minInterval = calcData.getProperty (IDs::MinInterval, 1.001);
+    
+    followedMinima.clearQuick();
+    followedMaxima.clearQuick();
+    
+    return hasSamePairs && hasSameSteps;
 }
 
-DissonanceMap::~DissonanceMap()
+void ProgressiveMapJob::followOptima (const Array<float>& minima, const Array<float>& maxima, float optimaReferenceFreq)
 {
+    followedMinima.clearQuick();
+    followedMaxima.clearQuick();
+    
+    // Followed as ratios, so they move with the fundamental
+    for (auto freq : minima)
+        followedMinima.add (freq / optimaReferenceFreq);
+    
+    for (auto freq : maxima)
+        followedMaxima.add (freq / optimaReferenceFreq);
 }
 
-void DissonanceMap::paint (Graphics& g)
+ThreadPoolJob::JobStatus ProgressiveMapJob::runJob()
 {
-    g.fillAll (Theme::mainBackground);
+    TRACE_SCOPE ("ProgressiveMapJob");
     
-    g.setColour (Theme::headerBackground);
-    g.fillRect (getLocalBounds().removeFromBottom (30));
-    g.drawLine (0, 0, 0, getHeight(), 6);
+    const IntervalDissonance& intervals = tiles.getIntervals();
     
-    // Check if all the data needed to calculate a dissonance map is available
-    if (calc.isReadyToProcess())
+    if (intervals.isEmpty())
+        return jobHasFinished;
+    
+    AdaptiveCurve sampler;
+    sampler.setRange (startRatio, endRatio, isLog);
+    
+    Array<float> newPositions, newDissonance;
+    
+    if (isAdaptive)
     {
-        // Draw map grid lines
-        int gridLines = mapData.getParent()[IDs::GridLines];
+        if (! sampler.sample (intervals, startRatio, endRatio, isLog, jmin (128, steps), steps, this))
+            return jobHasFinished;
         
-        if (gridLines < 4)
+        for (int i = 0; i < sampler.getNumSteps(); ++i)
         {
-            g.drawLine (0, denormalizer.convertFrom0to1 (0.5),
-                        getWidth(), denormalizer.convertFrom0to1 (0.5));
-            
-            if (gridLines < 3)
-            {
-                g.drawLine (0, denormalizer.convertFrom0to1 (0.25),
-                            getWidth(), denormalizer.convertFrom0to1 (0.25));
-                
-                g.drawLine (0, denormalizer.convertFrom0to1 (0.75),
-                            getWidth(), denormalizer.convertFrom0to1 (0.75));
-                
-                if (gridLines < 2)
-                {
-                    g.drawLine (0, denormalizer.convertFrom0to1 (0.125),
-                                getWidth(), denormalizer.convertFrom0to1 (0.125));
-                    
-                    g.drawLine (0, denormalizer.convertFrom0to1 (0.375),
-                                getWidth(), denormalizer.convertFrom0to1 (0.375));
-                    
-                    g.drawLine (0, denormalizer.convertFrom0to1 (0.625),
-                                getWidth(), denormalizer.convertFrom0to1 (0.625));
-                    
-                    g.drawLine (0, denormalizer.convertFrom0to1 (0.875),
-                                getWidth(), denormalizer.convertFrom0to1 (0.875));
-                }
-            }
+            newPositions.add (sampler.getPositionAtStep (i));
+            newDissonance.add (sampler.getRawDissonanceData()[i]);
         }
         
-        g.setColour (Theme::activeText);
-        float dissHeight;
-        float nextDissHeight;
-
-        // Draw the dissonance curve
-        // (Inverted because (0, 0) is the top-left corner of the component)
-        for (int i = 0; i < calc.getNumSteps() - 1; ++i)
-        {
-            dissHeight = normalizer.convertTo0to1 (calc.getDissonanceAtStep (i));
-            dissHeight = abs (dissHeight - 1);
-            dissHeight = denormalizer.convertFrom0to1 (dissHeight);
-            
-            nextDissHeight = normalizer.convertTo0to1 (calc.getDissonanceAtStep (i + 1));
-            nextDissHeight = abs (nextDissHeight - 1);
-            nextDissHeight = denormalizer.convertFrom0to1 (nextDissHeight);
-            
-            g.drawLine (i + 8, dissHeight, i + 9, nextDissHeight, 2);
-        }
+        if (! shouldExit())
+            publish (newPositions, newDissonance, true);
         
-        // Draw mouse-over frequency and ratio boxes that show the frequency in Hz and as
-        // a ratio to the start frequency at the location of the cursor
-        if (isMouseOver()
-            && getMouseXYRelative().getY() < getHeight() - 30
-            && getMouseXYRelative().getX() > 7
-            && getMouseXYRelative().getX() < getWidth() - 3)
-        {
-            Rectangle<int> ratioBox (0, 0, 90, 40);
-            ratioBox.setCentre (getLocalBounds().getCentre());
-            ratioBox.setY (0);
-            g.setColour (Theme::headerBackground);
-            g.fillRect (ratioBox);
-
-            Rectangle<int> freqBox (ratioBox.removeFromBottom (20));
-
-            g.setColour (Theme::mainBackground);
-            Font f = g.getCurrentFont();
-            f.setHeight (16.f);
-            f.setBold (true);
-            g.setFont (f);
-
-            g.drawText (String (calc.getFrequencyAtStep (getMouseXYRelative().getX() - 8), 1) + String (" Hz"),
-                        freqBox.reduced (3), Justification::centred);
-            g.drawText (String (calc.getFreqRatioAtStep (getMouseXYRelative().getX() - 8), 3),
-                        ratioBox.reduced (3), Justification::centred);
-        }
+        return jobHasFinished;
     }
-}
-
-void DissonanceMap::resized()
-{
-    Rectangle<int> area = getLocalBounds();
-    Rectangle<int> footer = area.removeFromBottom (30);
     
-    startFreq.setBounds (footer.removeFromLeft (75).reduced (2));
-    dissonanceModel.setBounds (footer.removeFromLeft (150).reduced (-1, 2));
-    endRatio.setBounds (footer.removeFromRight (75).reduced (2));
+    const double referenceFreq = getReferenceFreq();
+    const double startOctave = std::log2 (startRatio * referenceFreq);
+    const double endOctave = std::log2 (endRatio * referenceFreq);
     
-    mapData.setProperty (IDs::NumSteps, getWidth() - 12, nullptr);
+    // The finest level has at least the calc's number of steps across the view
+    const int finestLevel = MapTileCache::getLevel (startOctave, endOctave, steps, isLog);
+    Array<double> octaves;
     
-    denormalizer.start = 5;
-    denormalizer.end = getHeight() - 35;
-}
-
-void DissonanceMap::comboBoxChanged (ComboBox* changedBox)
-{
-    if (changedBox == &dissonanceModel)
+    // Each level has twice the steps of the one before, and the tiles of the last pass are
+    // calculated from the cached tiles of the pass before
+    for (int level = finestLevel - 3; level <= finestLevel; ++level)
     {
-        mapData.setProperty (IDs::ModelName, changedBox->getText(), nullptr);
+        if (! tiles.getSteps (level, startOctave, endOctave, octaves, newDissonance, this))
+            return jobHasFinished;
+        
+        newPositions.clearQuick();
+        
+        for (auto octave : octaves)
+            newPositions.add (sampler.getPositionOfRatio ((float) (std::pow (2.0, octave) / referenceFreq)));
+        
+        if (level < finestLevel)
+            publish (newPositions, newDissonance, false);
     }
-}
-
-void DissonanceMap::textEditorFocusLost (TextEditor& editor)
-{
-    if (&editor == &startFreq)
+    
+    Array<float> newMinima, newMaxima;
+    
+    AdaptiveCurve curve;
+    curve.setRange (startRatio, endRatio, isLog);
+    curve.setSteps (newPositions, newDissonance);
+    
+    // Optima that can be followed from the previous curve aren't searched for again
+    if (trackOptima (curve, newMinima, newMaxima))
     {
-        if (startFreq.getEvaluated() >= 20
-            && startFreq.getEvaluated() <= 10000)
-        {
-            if (mapData[IDs::StartFreq].operator float() > 0)
-            {
-                findParentComponentOfClass<MapList>()->undo->beginNewTransaction();
-                
-                mapData.setProperty (IDs::StartFreq,
-                                     startFreq.getEvaluated(),
-                                     findParentComponentOfClass<MapList>()->undo);
-            }
-            else
-            {
-                mapData.setProperty (IDs::StartFreq,
-                                     startFreq.getEvaluated(),
-                                     nullptr);
-            }
-        }
-        else
-        {
-            editor.setText (mapData[IDs::StartFreq].toString());
-        }
+        if (! shouldExit())
+            publish (newPositions, newDissonance, true, newMinima, newMaxima, true);
+        
+        return jobHasFinished;
     }
-    else if (&editor == &endRatio)
+    
     {
-        if (endRatio.getEvaluated() > 1)
-        {
-            findParentComponentOfClass<MapList>()->undo->beginNewTransaction();
-            
-            mapData.setProperty (IDs::EndRatio,
-                                 endRatio.getEvaluated(),
-                                 findParentComponentOfClass<MapList>()->undo);
-        }
-        else
-        {
-            editor.setText (mapData[IDs::EndRatio].toString());
-        }
+        TRACE_SCOPE ("optimize2D");
+        
+        if (! tiles.getOptima (finestLevel, startOctave, endOctave, newMinima, newMaxima, this))
+            return jobHasFinished;
     }
+    
+    if (! shouldExit())
+        publish (newPositions, newDissonance, true, newMinima, newMaxima);
+    
+    return jobHasFinished;
 }
 
-void DissonanceMap::textEditorReturnKeyPressed (TextEditor& editor)
+bool ProgressiveMapJob::trackOptima (const AdaptiveCurve& curve, Array<float>& newMinima, Array<float>& newMaxima)
 {
-    if (&editor == &startFreq)
-    {
-        if (startFreq.getEvaluated() >= 20
-            && startFreq.getEvaluated() <= 10000)
-        {
-            findParentComponentOfClass<MapList>()->undo->beginNewTransaction();
+    // Optima have appeared or vanished if the curve's steps bracket a different number of them
+    // than the last pass of the previous curve
+    const int numMinima = curve.findOptima (true, minInterval).size();
+    const int numMaxima = curve.findOptima (false, minInterval).size();
+    
+    const bool hasSameOptima = numMinima == numCurveMinima && numMaxima == numCurveMaxima;
+    
+    numCurveMinima = numMinima;
+    numCurveMaxima = numMaxima;
+    
+    if (! hasSameOptima || (followedMinima.isEmpty() && followedMaxima.isEmpty()))
+        return false;
+    
+    const float referenceFreq = getReferenceFreq();
+    
+    for (auto ratio : curve.trackOptima (followedMinima, true, minInterval))
+        newMinima.add (ratio * referenceFreq);
+    
+    for (auto ratio : curve.trackOptima (followedMaxima, false, minInterval))
+        newMaxima.add (ratio * referenceFreq);
+    
+    return true;
+}
 
-            mapData.setProperty (IDs::StartFreq,
-                                 startFreq.getEvaluated(),
-                                 findParentComponentOfClass<MapList>()->undo);
-        }
-        else
-        {
-            editor.setText (mapData[IDs::StartFreq].toString());
-        }
-    }
-    else if (&editor == &endRatio)
+void ProgressiveMapJob::publish (const Array<float>& newPositions, const Array<float>& newDissonance, bool isLastPass,
+                                 const Array<float>& newMinima, const Array<float>& newMaxima, bool areTracked)
+{
     {
-        if (endRatio.getEvaluated() > 1)
-        {
-            findParentComponentOfClass<MapList>()->undo->beginNewTransaction();
-
-            mapData.setProperty (IDs::EndRatio,
-                                 endRatio.getEvaluated(),
-                                 findParentComponentOfClass<MapList>()->undo);
-        }
-        else
-        {
-            editor.setText (mapData[IDs::EndRatio].toString());
-        }
+        const ScopedLock sl (passLock);
+        
+        positions = newPositions;
+        dissonance = newDissonance;
+        passMinima = newMinima;
+        passMaxima = newMaxima;
+        isFinal = isLastPass;
+        hasOptima = isLastPass && ! isAdaptive;
+        hasTrackedOptima = hasOptima && areTracked;
+        hasPass = true;
     }
     
-    unfocusAllComponents();
+    triggerAsyncUpdate();
 }
 
-void DissonanceMap::mouseMove (const MouseEvent& event)
+bool ProgressiveMapJob::getLatestCurve (AdaptiveCurve& curve)
 {
-    if (isMouseOver()
-        && getMouseXYRelative().getY() < getHeight() - 30
-        && getMouseXYRelative().getX() > 0
-        && getMouseXYRelative().getX() < getWidth() - 2)
-        repaint();
+    const ScopedLock sl (passLock);
+    
+    curve.setRange (startRatio, endRatio, isLog);
+    curve.setSteps (positions, dissonance);
+    
+    return isFinal;
 }
 
-void DissonanceMap::valueTreeChildAdded (ValueTree& parent, ValueTree& newChild)
+bool ProgressiveMapJob::getOptima (Array<float>& minima, Array<float>& maxima)
 {
-    if (newChild.hasType (IDs::OvertoneDistribution)
-        && parent == mapData)
-    {
+    const ScopedLock sl (passLock);
+    
+    if (! hasOptima || hasTrackedOptima)
+        return false;
+    
+    minima = passMinima;
+    maxima = passMaxima;
+    
+    return true;
+}
+
+bool ProgressiveMapJob::getTrackedOptima (Array<float>& minima, Array<float>& maxima)
+{
+    const ScopedLock sl (passLock);
+    
+    if (! hasTrackedOptima)
+        return false;
+    
+    minima = passMinima;
+    maxima = passMaxima;
+    
+    return true;
+}
+
+float ProgressiveMapJob::getReferenceFreq() const
+{
+    return tiles.getIntervals().getReferenceFreq();
+}
+
+void ProgressiveMapJob::handleAsyncUpdate()
+{
+    bool hasNewPass;
+    
+    {
+        const ScopedLock sl (passLock);
+        hasNewPass = hasPass;
+    }
+    
+    if (hasNewPass)
+        parent->curveCalculated();
+}
+
+//==============================================================================
+MapRefresher::MapRefresher (DissonanceMap* parentComponent)   : parent (parentComponent)
+{
+    refreshPending = false;
+}
+
+MapRefresher::~MapRefresher()
+{
+}
+
+void MapRefresher::requestRefresh()
+{
+    if (isTimerRunning())
+    {
+        // Picked up on the next frame, with whatever the data is by then
+        refreshPending = true;
+        return;
+    }
+    
+    // The first change after the map has been idle is calculated straight away
+    refreshPending = false;
+    startTimerHz (60);
+    
+    parent->recalculateDissonance();
+    parent->repaint();
+    
+    // Optima that can't follow the change are hidden until they're searched for again
+    if (! parent->isTrackingOptima())
+        parent->hideOptima();
+}
+
+void MapRefresher::retryRefresh()
+{
+    refreshPending = true;
+    
+    if (! isTimerRunning())
+        startTimerHz (60);
+}
+
+void MapRefresher::timerCallback()
+{
+    if (refreshPending)
+    {
+        refreshPending = false;
+        parent->recalculateDissonance();
+        parent->repaint();
+        
+        if (! parent->isTrackingOptima())
+            parent->hideOptima();
+    }
+    else
+    {
+        // No changes for a whole frame, so optima are only searched for once the edits have settled
+        stopTimer();
+        parent->updateOptima();
+    }
+}
+
+//==============================================================================
+OptimumSensitivityJob::OptimumSensitivityJob (DissonanceMap* parentComponent)   : ThreadPoolJob ("Optimum Sensitivity"),
+                                                                                   parent (parentComponent)
+{
+    freq = 0;
+}
+
+OptimumSensitivityJob::~OptimumSensitivityJob()
+{
+    cancelPendingUpdate();
+}
+
+void OptimumSensitivityJob::setOptimum (const ValueTree& calcData, OptimaComponent* optimaComponent)
+{
+    // A readout of the previous optimum is stale now
+    cancelPendingUpdate();
+    
+    intervals.setCalc (calcData);
+    optimum = optimaComponent;
+    freq = optimaComponent->getFreq();
+    
+    distributionNames.clearQuick();
+    
+    for (int i = 0; i < calcData.getNumChildren(); ++i)
+    {
+        String name = calcData.getChild (i)[IDs::Name];
+        distributionNames.add (name.isNotEmpty() ? name : "Distribution " + String (i + 1));
+    }
+}
+
+ThreadPoolJob::JobStatus OptimumSensitivityJob::runJob()
+{
+    TRACE_SCOPE ("OptimumSensitivityJob");
+    
+    IntervalDissonance::Sensitivity sensitivity;
+    String newReadout;
+    
+    if (intervals.getSensitivity (freq / jmax (std::numeric_limits<float>::min(), intervals.getReferenceFreq()), sensitivity)
+        && sensitivity.dissonance > 0)
+    {
+        // Most dissonant partials first
+        Array<int> order;
+        
+        for (int i = 0; i < sensitivity.contributions.size(); ++i)
+        {
+            int index = 0;
+            
+            while (index < order.size() && sensitivity.contributions[order[index]] >= sensitivity.contributions[i])
+                ++index;
+            
+            order.insert (index, i);
+        }
+        
+        const int maxPartialsShown = 5;
+        newReadout << "Depends most on:";
+        
+        for (int i = 0; i < jmin (maxPartialsShown, order.size()) && ! shouldExit(); ++i)
+        {
+            const int index = order[i];
+            const IntervalDissonance::PartialLocation location = intervals.getPartialLocation (index);
+            
+            newReadout << "\n" << distributionNames[location.distribution] << ", "
+                       << (location.partial < 0 ? String ("fundamental") : "partial " + String (location.partial + 1)) << ": "
+                       << String (100 * sensitivity.contributions[index] / sensitivity.dissonance, 1) << "% of dissonance, "
+                       << String (sensitivity.freqShifts[index], 2) << " cents per cent of freq, "
+                       << String (sensitivity.ampShifts[index], 2) << " cents per % of amp";
+        }
+    }
+    
+    // Cut short for a newer hover, so there's nothing to show
+    if (shouldExit())
+        return jobHasFinished;
+    
+    {
+        const ScopedLock sl (readoutLock);
+        readout = newReadout;
+    }
+    
+    triggerAsyncUpdate();
+    return jobHasFinished;
+}
+
+void OptimumSensitivityJob::handleAsyncUpdate()
+{
+    String newReadout;
+    
+    {
+        const ScopedLock sl (readoutLock);
+        newReadout = readout;
+    }
+    
+    // Optima that have been tracked to a new freq are read out again on the next hover
+    if (optimum != nullptr && optimum->getFreq() == freq && newReadout.isNotEmpty())
+        optimum->setTooltip (parent->getOptimumTooltip (freq) + "\n\n" + newReadout);
+}
+
+//==============================================================================
+DistributionBinding::DistributionBinding (DissonanceMap& owner,
+                                          ValueTree& distributionNode,
+                                          int dismalIndex)   : distribution (distributionNode),
+                                                               index (dismalIndex),
+                                                               map (owner),
+                                                               numDismalPartials (0),
+                                                               partialsVersion (0)
+{
+    distribution.addListener (this);
+}
+
+DistributionBinding::~DistributionBinding()
+{
+    distribution.removeListener (this);
+}
+
+OvertoneDistribution* DistributionBinding::getDistribution()
+{
+    return map.calc.getDistributionReference (index);
+}
+
+void DistributionBinding::updateFundamentalFreq (float startFreq)
+{
+    float freq = distribution[IDs::FundamentalFreq];
+    
+    if (freq <= 0)
+        return;
+    
+    // Fundamental freqs below 20 are ratios to the calc's start freq
+    if (freq < 20 && startFreq > 0)
+        getDistribution()->setFundamentalFreq (freq * startFreq);
+    else
+        getDistribution()->setFundamentalFreq (freq);
+}
+
+void DistributionBinding::addPartial (int partialIndex, const PartialData& partial)
+{
+    OvertoneDistribution* dist = getDistribution();
+    
+    // Checks if the new partial already has data to set in the corresponding DisMAL partial
+    if (partial.freq > 0 && partial.amp > 0)
+        dist->addPartial (partial.freq, partial.amp);
+    else
+        dist->addPartial();
+    
+    if (partial.mute)
+        dist->mutePartial (numDismalPartials, true);
+    
+    dismalIndices.insert (partialIndex, numDismalPartials++);
+}
+
+void DistributionBinding::addAllPartials()
+{
+    PartialArray partials (distribution);
+    partialsVersion = partials.getVersion();
+    
+    for (int i = 0; i < partials.size(); ++i)
+        addPartial (i, partials.get (i));
+}
+
+void DistributionBinding::removeAllPartials()
+{
+    OvertoneDistribution* dist = getDistribution();
+    
+    while (numDismalPartials > 0)
+        dist->removePartial (--numDismalPartials);
+    
+    dismalIndices.clear();
+}
+
+void DistributionBinding::partialsChanged()
+{
+    PartialArray partials (distribution);
+    PartialArray::Edit edit = partials.getEditSince (partialsVersion);
+    partialsVersion = partials.getVersion();
+    
+    if (edit.type == PartialArray::added)
+    {
+        addPartial (edit.index, partials.get (edit.index));
+    }
+    else if (edit.type == PartialArray::removed)
+    {
+        int removedIndex = dismalIndices[edit.index];
+        
+        getDistribution()->removePartial (removedIndex);
+        dismalIndices.remove (edit.index);
+        --numDismalPartials;
+        
+        for (auto& dismalIndex : dismalIndices)
+            if (dismalIndex > removedIndex)
+                --dismalIndex;
+    }
+    else if (edit.type == PartialArray::changed)
+    {
+        OvertoneDistribution* dist = getDistribution();
+        PartialData partial = partials.get (edit.index);
+        int dismalIndex = dismalIndices[edit.index];
+        
+        // Edits without a field may have changed any of the partial's values
+        bool anyField = ! edit.field.isValid();
+        
+        if ((anyField || edit.field == IDs::Freq) && partial.freq > 0)
+            dist->setFreqRatio (dismalIndex, partial.freq);
+        
+        if ((anyField || edit.field == IDs::Amp) && partial.amp > 0)
+            dist->setAmpRatio (dismalIndex, partial.amp);
+        
+        if (anyField || edit.field == IDs::Mute)
+            dist->mutePartial (dismalIndex, partial.mute);
+    }
+    else
+    {
+        removeAllPartials();
+        addAllPartials();
+    }
+}
+
+void DistributionBinding::valueTreePropertyChanged (ValueTree& parent, const Identifier& ID)
+{
+    if (parent != distribution
+        || ID == IDs::IsViewed
+        || ID == IDs::MinInterval)
+        return;
+    
+    OvertoneDistribution* dist = getDistribution();
+    
+    if (ID == IDs::XAxis && parent[ID].operator bool() == true)
+    {
+        map.calc.set2dVariableDistribution (index);
+    }
+    else if (ID == IDs::Mute)
+    {
+        dist->mute (parent[IDs::Mute]);
+    }
+    else if (ID == IDs::Name)
+    {
+        dist->setDistributionName (parent[IDs::Name]);
+        return;
+    }
+    else if (ID == IDs::FundamentalFreq)
+    {
+        updateFundamentalFreq (map.mapData[IDs::StartFreq]);
+    }
+    else if (ID == IDs::FundamentalAmp)
+    {
+        if (parent[ID].operator float() > 0)
+            dist->setFundamentalAmp (parent[ID]);
+    }
+    else if (ID == IDs::FundamentalMute)
+    {
+        dist->muteFundamental (parent[ID]);
+    }
+    else if (ID == IDs::Partials)
+    {
+        partialsChanged();
+    }
+    
+    map.requestRefresh();
+}
+
+//==============================================================================
+DissonanceMap::DissonanceMap()   : mapData (IDs::Calculator),
+                                   asyncOptimaUpdater (this),
+                                   asyncSurfaceUpdater (this),
+                                   refresher (this),
+                                   curveJob (this),
+                                   updateMinimaJob (this, true),
+                                   updateMaximaJob (this, false),
+                                   sensitivityJob (this)
+{
+    startFreq.setTextToShowWhenEmpty ("Start Freq", Theme::border);
+    startFreq.setTooltip (String ("Starting frequency in Hz\n")
+                          + String ("(left edge of the map)"));
+    startFreq.setEvaluateExpressions (true);
+    startFreq.setFont (15.f);
+    addAndMakeVisible (startFreq);
+    startFreq.addListener (this);
+
+    endRatio.setTextToShowWhenEmpty ("End Ratio", Theme::border);
+    endRatio.setTooltip (String ("End frequency ratio\n")
+                          + String ("(right edge of the map)"));
+    endRatio.setEvaluateExpressions (true);
+    endRatio.setFont (15.f);
+    addAndMakeVisible (endRatio);
+    endRatio.addListener (this);
+    
+    resolution.setTextToShowWhenEmpty ("Steps", Theme::border);
+    resolution.setTooltip (String ("Number of steps calculated\n")
+                           + String ("(independent of the map's width)"));
+    resolution.setInputRestrictions (7, "1234567890");
+    resolution.setFont (15.f);
+    addAndMakeVisible (resolution);
+    resolution.addListener (this);
+    
+    numColumns = 0;
+    referenceFreq = 0;
+    curveFinished = false;
+    optimaRequested = false;
+    surfaceMinInterval = 1.001f;
+    trackingOptima = false;
+    optimaReferenceFreq = 0;
+    sensitivityGeneration = 0;
+    
+    dissonanceModel.addSectionHeading ("Dissonance Model");
+    dissonanceModel.addItem ("Sethares", 1);
+    dissonanceModel.addItem ("Vassilakis", 2);
+    dissonanceModel.setTextWhenNothingSelected ("Dissonance Model");
+    dissonanceModel.setTooltip ("Sets the dissonance model");
+    dissonanceModel.addListener (this);
+    addAndMakeVisible (dissonanceModel);
+    
+    setRepaintsOnMouseActivity (true);
+    setWantsKeyboardFocus (true);
+    
+    mapData.addListener (this);
+}
+
+DissonanceMap::~DissonanceMap()
+{
+    // Tile jobs keep the surface alive, but mustn't notify this map
+    if (surface != nullptr)
+        surface->cancel();
+}
+
+void DissonanceMap::paint (Graphics& g)
+{
+    TRACE_SCOPE ("DissonanceMap::paint");
+    
+    g.fillAll (Theme::mainBackground);
+    
+    g.setColour (Theme::headerBackground);
+    g.fillRect (getLocalBounds().removeFromBottom (30));
+    g.drawLine (0, 0, 0, getHeight(), 6);
+    
+    // Check if all the data needed to calculate a dissonance map is available
+    if (calc.isReadyToProcess())
+    {
+        // Draw map grid lines
+        int gridLines = mapData.getParent()[IDs::GridLines];
+        
+        if (gridLines < 4)
+        {
+            g.drawLine (0, denormalizer.convertFrom0to1 (0.5),
+                        getWidth(), denormalizer.convertFrom0to1 (0.5));
+            
+            if (gridLines < 3)
+            {
+                g.drawLine (0, denormalizer.convertFrom0to1 (0.25),
+                            getWidth(), denormalizer.convertFrom0to1 (0.25));
+                
+                g.drawLine (0, denormalizer.convertFrom0to1 (0.75),
+                            getWidth(), denormalizer.convertFrom0to1 (0.75));
+                
+                if (gridLines < 2)
+                {
+                    g.drawLine (0, denormalizer.convertFrom0to1 (0.125),
+                                getWidth(), denormalizer.convertFrom0to1 (0.125));
+                    
+                    g.drawLine (0, denormalizer.convertFrom0to1 (0.375),
+                                getWidth(), denormalizer.convertFrom0to1 (0.375));
+                    
+                    g.drawLine (0, denormalizer.convertFrom0to1 (0.625),
+                                getWidth(), denormalizer.convertFrom0to1 (0.625));
+                    
+                    g.drawLine (0, denormalizer.convertFrom0to1 (0.875),
+                                getWidth(), denormalizer.convertFrom0to1 (0.875));
+                }
+            }
+        }
+        
+        g.setColour (Theme::activeText);
+        float dissHeight;
+        float nextDissHeight;
+
+        // Draw the dissonance curve
+        // (Inverted because (0, 0) is the top-left corner of the component)
+        // Steps just outside the view are kept so the curve reaches its edges, so it's clipped to the map
+        g.saveState();
+        g.reduceClipRegion (8, 0, getWidth() - 13, getHeight() - 30);
+        
+        if (surface != nullptr)
+        {
+            // Drawn a cell per pixel of the image, rather than smoothed
+            g.setImageResamplingQuality (Graphics::lowResamplingQuality);
+            g.drawImage (surfaceImage, Rectangle<float> (8, 0, getWidth() - 13, getHeight() - 30),
+                         RectanglePlacement::stretchToFit);
+        }
+        else if (curve.getNumSteps() <= numColumns)
+        {
+            // Fewer steps than pixels (or a coarse pass), so the steps are joined directly
+            Path path;
+            
+            for (int i = 0; i < curve.getNumSteps(); ++i)
+            {
+                dissHeight = normalizer.convertTo0to1 (curve.getRawDissonanceData()[i]);
+                dissHeight = abs (dissHeight - 1);
+                dissHeight = denormalizer.convertFrom0to1 (dissHeight);
+                
+                float x = 8 + curve.getPositionAtStep (i) * (getWidth() - 13);
+                
+                if (i == 0)
+                    path.startNewSubPath (x, dissHeight);
+                else
+                    path.lineTo (x, dissHeight);
+            }
+            
+            g.strokePath (path, PathStrokeType (2));
+        }
+        else
+        {
+            // Each column spans the steps under it, so narrow dips and peaks are never skipped
+            for (int i = 0; i < numColumns; ++i)
+            {
+                dissHeight = normalizer.convertTo0to1 (columnMin[i]);
+                dissHeight = abs (dissHeight - 1);
+                dissHeight = denormalizer.convertFrom0to1 (dissHeight);
+                
+                nextDissHeight = normalizer.convertTo0to1 (columnMax[i]);
+                nextDissHeight = abs (nextDissHeight - 1);
+                nextDissHeight = denormalizer.convertFrom0to1 (nextDissHeight);
+                
+                g.drawLine (i + 8.5f, dissHeight + 1, i + 8.5f, nextDissHeight - 1, 2);
+            }
+        }
+        
+        g.restoreState();
+        
+        // Draw mouse-over frequency and ratio boxes that show the frequency in Hz and as
+        // a ratio to the start frequency at the location of the cursor
+        if (isMouseOver()
+            && getMouseXYRelative().getY() < getHeight() - 30
+            && getMouseXYRelative().getX() > 7
+            && getMouseXYRelative().getX() < getWidth() - 3)
+        {
+            Rectangle<int> ratioBox (0, 0, surface != nullptr ? 140 : 90, 40);
+            ratioBox.setCentre (getLocalBounds().getCentre());
+            ratioBox.setY (0);
+            g.setColour (Theme::headerBackground);
+            g.fillRect (ratioBox);
+
+            Rectangle<int> freqBox (ratioBox.removeFromBottom (20));
+
+            g.setColour (Theme::mainBackground);
+            Font f = g.getCurrentFont();
+            f.setHeight (16.f);
+            f.setBold (true);
+            g.setFont (f);
+
+            float freq = getFreqAtX (getMouseXYRelative().getX());
+            
+            g.drawText (String (freq, 1) + String (" Hz"),
+                        freqBox.reduced (3), Justification::centred);
+            String ratio (freq / calc.getRange().getStart(), 3);
+            
+            // Surfaces show the y-axis ratio too
+            if (surface != nullptr)
+            {
+                float y = 1 - getMouseXYRelative().getY() / (float) jmax (1, getHeight() - 30);
+                ratio << ", " << String (curve.getRatioAtPosition (y) * referenceFreq / calc.getRange().getStart(), 3);
+            }
+            
+            g.drawText (ratio, ratioBox.reduced (3), Justification::centred);
+        }
+    }
+}
+
+void DissonanceMap::resized()
+{
+    Rectangle<int> area = getLocalBounds();
+    Rectangle<int> footer = area.removeFromBottom (30);
+    
+    startFreq.setBounds (footer.removeFromLeft (75).reduced (2));
+    dissonanceModel.setBounds (footer.removeFromLeft (150).reduced (-1, 2));
+    endRatio.setBounds (footer.removeFromRight (75).reduced (2));
+    resolution.setBounds (footer.removeFromRight (75).reduced (2));
+    
+    denormalizer.start = 5;
+    denormalizer.end = getHeight() - 35;
+    
+    // Only the drawn curve depends on the size, so the calculated steps are reused
+    decimate();
+    drawOptimaComponents();
+}
+
+void DissonanceMap::comboBoxChanged (ComboBox* changedBox)
+{
+    if (changedBox == &dissonanceModel)
+    {
+        mapData.setProperty (IDs::ModelName, changedBox->getText(), nullptr);
+    }
+}
+
+void DissonanceMap::textEditorFocusLost (TextEditor& editor)
+{
+    if (&editor == &startFreq)
+    {
+        if (startFreq.getEvaluated() >= 20
+            && startFreq.getEvaluated() <= 10000)
+        {
+            if (mapData[IDs::StartFreq].operator float() > 0)
+            {
+                findParentComponentOfClass<MapList>()->undo->beginNewTransaction();
+                
+                mapData.setProperty (IDs::StartFreq,
+                                     startFreq.getEvaluated(),
+                                     findParentComponentOfClass<MapList>()->undo);
+            }
+            else
+            {
+                mapData.setProperty (IDs::StartFreq,
+                                     startFreq.getEvaluated(),
+                                     nullptr);
+            }
+        }
+        else
+        {
+            editor.setText (mapData[IDs::StartFreq].toString());
+        }
+    }
+    else if (&editor == &endRatio)
+    {
+        if (endRatio.getEvaluated() > 1)
+        {
+            findParentComponentOfClass<MapList>()->undo->beginNewTransaction();
+            
+            mapData.setProperty (IDs::EndRatio,
+                                 endRatio.getEvaluated(),
+                                 findParentComponentOfClass<MapList>()->undo);
+        }
+        else
+        {
+            editor.setText (mapData[IDs::EndRatio].toString());
+        }
+    }
+    else if (&editor == &resolution)
+    {
+        setResolution();
+    }
+}
+
+void DissonanceMap::textEditorReturnKeyPressed (TextEditor& editor)
+{
+    if (&editor == &startFreq)
+    {
+        if (startFreq.getEvaluated() >= 20
+            && startFreq.getEvaluated() <= 10000)
+        {
+            findParentComponentOfClass<MapList>()->undo->beginNewTransaction();
+
+            mapData.setProperty (IDs::StartFreq,
+                                 startFreq.getEvaluated(),
+                                 findParentComponentOfClass<MapList>()->undo);
+        }
+        else
+        {
+            editor.setText (mapData[IDs::StartFreq].toString());
+        }
+    }
+    else if (&editor == &endRatio)
+    {
+        if (endRatio.getEvaluated() > 1)
+        {
+            findParentComponentOfClass<MapList>()->undo->beginNewTransaction();
+
+            mapData.setProperty (IDs::EndRatio,
+                                 endRatio.getEvaluated(),
+                                 findParentComponentOfClass<MapList>()->undo);
+        }
+        else
+        {
+            editor.setText (mapData[IDs::EndRatio].toString());
+        }
+    }
+    else if (&editor == &resolution)
+    {
+        setResolution();
+    }
+    
+    unfocusAllComponents();
+}
+
+void DissonanceMap::setResolution()
+{
+    int numSteps = resolution.getText().getIntValue();
+    
+    if (numSteps >= 16 && numSteps != mapData[IDs::NumSteps].operator int())
+    {
+        findParentComponentOfClass<MapList>()->undo->beginNewTransaction();
+        
+        mapData.setProperty (IDs::NumSteps,
+                             numSteps,
+                             findParentComponentOfClass<MapList>()->undo);
+    }
+    else
+    {
+        resolution.setText (mapData[IDs::NumSteps].toString());
+    }
+}
+
+void DissonanceMap::mouseMove (const MouseEvent& event)
+{
+    if (isMouseOver()
+        && getMouseXYRelative().getY() < getHeight() - 30
+        && getMouseXYRelative().getX() > 0
+        && getMouseXYRelative().getX() < getWidth() - 2)
+        repaint();
+}
+
+void DissonanceMap::mouseDown (const MouseEvent& event)
+{
+    if (event.mods.isPopupMenu())
+    {
+        dragStartRange = Range<float>();
+        
+        Array<DissonanceMap*> thisMap;
+        thisMap.add (this);
+        
+        if (MapList* list = findParentComponentOfClass<MapList>())
+            list->showExportMenu (thisMap, "Export this map");
+        
+        return;
+    }
+    
+    // Drags on the footer don't pan
+    if (calc.isReadyToProcess() && event.y < getHeight() - 30)
+        dragStartRange = getViewRange();
+    else
+        dragStartRange = Range<float>();
+}
+
+void DissonanceMap::mouseDrag (const MouseEvent& event)
+{
+    if (dragStartRange.isEmpty())
+        return;
+    
+    setMouseCursor (MouseCursor::DraggingHandCursor);
+    
+    // Keeps the freq that was under the cursor when the drag started under it
+    float offset = -event.getDistanceFromDragStartX() / (float) jmax (1, getWidth() - 13);
+    float start = dragStartRange.getStart();
+    float end = dragStartRange.getEnd();
+    
+    if (mapData[IDs::LogSteps])
+        setViewRange ({ start * std::pow (end / start, offset), end * std::pow (end / start, offset) });
+    else
+        setViewRange ({ start + offset * (end - start), end + offset * (end - start) });
+}
+
+void DissonanceMap::mouseUp (const MouseEvent& event)
+{
+    setMouseCursor (MouseCursor::NormalCursor);
+}
+
+void DissonanceMap::mouseDoubleClick (const MouseEvent& event)
+{
+    if (event.y < getHeight() - 30)
+        resetView();
+}
+
+void DissonanceMap::mouseWheelMove (const MouseEvent& event, const MouseWheelDetails& wheel)
+{
+    // Plain scrolling is left to the map viewport
+    if (! event.mods.isCommandDown()
+        || ! calc.isReadyToProcess()
+        || curve.getNumSteps() == 0)
+    {
+        Component::mouseWheelMove (event, wheel);
+        return;
+    }
+    
+    // Zooms around the freq under the cursor
+    float centre = getFreqAtX (event.x);
+    float scale = std::pow (2.f, -wheel.deltaY * 4);
+    float start = getViewRange().getStart();
+    float end = getViewRange().getEnd();
+    
+    if (mapData[IDs::LogSteps])
+        setViewRange ({ centre * std::pow (start / centre, scale), centre * std::pow (end / centre, scale) });
+    else
+        setViewRange ({ centre - (centre - start) * scale, centre + (end - centre) * scale });
+}
+
+void DissonanceMap::valueTreeChildAdded (ValueTree& parent, ValueTree& newChild)
+{
+    if (newChild.hasType (IDs::OvertoneDistribution)
+        && parent == mapData)
+    {
         calc.addOvertoneDistribution (new OvertoneDistribution());
         
-        OvertoneDistribution* dist = calc.getDistributionReference (parent.indexOf (newChild));
+        DistributionBinding* binding = bindings.add (new DistributionBinding (*this, newChild,
+                                                                             calc.numOvertoneDistributions() - 1));
         
         /*
             If the new distribution's valuetree already has fundamental and
@@ -348,54 +1138,14 @@ void DissonanceMap::valueTreeChildAdded (ValueTree& parent, ValueTree& newChild)
         if (newChild[IDs::FundamentalFreq].operator float() > 0
             && newChild[IDs::FundamentalAmp].operator float() > 0)
         {
-            if (mapData.hasProperty (IDs::StartFreq)
-                && newChild[IDs::FundamentalFreq].operator float() < 20)
-            {
-                dist->setFundamentalFreq (newChild[IDs::FundamentalFreq].operator float()
-                                          * mapData[IDs::StartFreq].operator float());
-            }
-            else if (newChild[IDs::FundamentalFreq].operator float() > 0)
-            {
-                dist->setFundamentalFreq (newChild[IDs::FundamentalFreq]);
-            }
-
-            if (newChild[IDs::FundamentalAmp].operator float() > 0)
-                dist->setFundamentalAmp (newChild[IDs::FundamentalAmp]);
-        }
-        
-        for (auto subChild : newChild)
-        {
-            if (subChild.hasType (IDs::Partial)
-                && subChild[IDs::Freq].operator float() > 0
-                && subChild[IDs::Amp].operator float() > 0)
-            {
-                dist->addPartial (subChild[IDs::Freq],
-                                  subChild[IDs::Amp]);
-            }
+            binding->updateFundamentalFreq (mapData[IDs::StartFreq]);
+            binding->getDistribution()->setFundamentalAmp (newChild[IDs::FundamentalAmp]);
         }
-    }
-    else if (newChild.hasType (IDs::Partial)
-             && parent.hasType (IDs::OvertoneDistribution))
-    {
-        OvertoneDistribution* dist = calc.getDistributionReference (parent.getParent().indexOf (parent));
         
-        // Checks if the new partial already has valuetree data to set in corresponding DisMAL data
-        if (newChild.hasProperty (IDs::Freq) && newChild.hasProperty (IDs::Amp)
-            && newChild[IDs::Freq].operator float() > 0 && newChild[IDs::Amp].operator float() > 0)
-        {
-            dist->addPartial (newChild[IDs::Freq], newChild[IDs::Amp]);
-        }
-        else
-        {
-            dist->addPartial();
-        }
+        binding->addAllPartials();
         
-        parent.sort (comparator, nullptr, false);
+        refresh();
     }
-    
-    recalculateDissonance();
-    repaint();
-    updateOptima();
 }
 
 void DissonanceMap::valueTreeChildRemoved (ValueTree& parent, ValueTree& removedChild, int childIndex)
@@ -403,29 +1153,37 @@ void DissonanceMap::valueTreeChildRemoved (ValueTree& parent, ValueTree& removed
     if (removedChild.hasType (IDs::OvertoneDistribution)
         && parent == mapData)
     {
-        calc.removeOvertoneDistribution (childIndex);
-    }
-    else if (removedChild.hasType (IDs::Partial)
-             && parent.hasType (IDs::OvertoneDistribution))
-    {
-        calc.getDistributionReference (parent.getParent().indexOf (parent))->removePartial (childIndex);
+        // The valuetree index can't be trusted after reordering, so use the binding's DisMAL index
+        for (int i = 0; i < bindings.size(); ++i)
+        {
+            if (bindings[i]->distribution == removedChild)
+            {
+                calc.removeOvertoneDistribution (bindings[i]->index);
+                bindings.remove (i);
+                
+                for (int j = i; j < bindings.size(); ++j)
+                    bindings[j]->index = j;
+                
+                break;
+            }
+        }
+        
+        refresh();
     }
-    
-    recalculateDissonance();
-    repaint();
-    updateOptima();
 }
 
 /*  These callbacks set DisMAL data from the value tree data model.
  
     While DisMAL does the actual processing internally, the value tree data model is used
     in the app's MVC for all the functionalities it provides (undo management, callbacks, etc)
+ 
+    Distribution and partial properties are routed by their bindings, so only calc
+    properties are handled here.
 */
 void DissonanceMap::valueTreePropertyChanged (ValueTree& parent, const Identifier& ID)
 {
     // So we don't have to redraw when just trying to view a distribution's partials
-    if ((parent != mapData && ! parent.isAChildOf (mapData))
-        || ID == IDs::IsViewed
+    if (parent != mapData
         || ID == IDs::ScaleMin
         || ID == IDs::ScaleMax
         || ID == IDs::GridLines
@@ -433,17 +1191,19 @@ void DissonanceMap::valueTreePropertyChanged (ValueTree& parent, const Identifie
         return;
     
     // Set the changed parameter in the DissonanceCalc object
-    if (parent == mapData && ID == IDs::NumSteps)
+    if (ID == IDs::NumSteps)
     {
         if (mapData[ID].operator int() > 0)
             calc.setNumSteps (mapData[ID]);
         
+        resolution.setText (mapData[ID]);
+        
         recalculateDissonance();
         repaint();
         drawOptimaComponents();
         return;
     }
-    else if (parent == mapData && ID == IDs::LogSteps)
+    else if (ID == IDs::LogSteps)
     {
         calc.useLogarithmicSteps (mapData[ID].operator bool());
         
@@ -452,31 +1212,23 @@ void DissonanceMap::valueTreePropertyChanged (ValueTree& parent, const Identifie
         drawOptimaComponents();
         return;
     }
-    else if (parent == mapData && ID == IDs::StartFreq)
+    else if (ID == IDs::StartFreq)
     {
+        float start = mapData[ID];
+        
         // Ranges require both start and end to init
         if (parent.hasProperty (IDs::EndRatio)
-            && mapData[ID].operator float() > 0)
-            calc.setRange (mapData[ID],
-                           mapData[ID].operator float()
-                           * mapData[IDs::EndRatio].operator float());
+            && start > 0)
+            calc.setRange (start, start * mapData[IDs::EndRatio].operator float());
         
         // Update all distributions using a ratio to init their fundamental freq
-        for (int i = 0; i < calc.numOvertoneDistributions(); ++i)
-        {
-            float fundamentalFreq = mapData.getChild (i)[IDs::FundamentalFreq];
-            
-            if (fundamentalFreq < 20
-                && mapData[ID].operator float() > 0)
-            {
-                calc.getDistributionReference (i)->setFundamentalFreq (fundamentalFreq
-                                                                       * mapData[ID].operator float());
-            }
-        }
+        for (auto* binding : bindings)
+            binding->updateFundamentalFreq (start);
         
         startFreq.setText (mapData[ID]);
+        viewRange = Range<float>();
     }
-    else if (parent == mapData && ID == IDs::EndRatio)
+    else if (ID == IDs::EndRatio)
     {
         // Ranges require both start and end to init
         if (parent.hasProperty (IDs::StartFreq)
@@ -486,8 +1238,9 @@ void DissonanceMap::valueTreePropertyChanged (ValueTree& parent, const Identifie
                            * mapData[IDs::StartFreq].operator float());
         
         endRatio.setText (mapData[ID]);
+        viewRange = Range<float>();
     }
-    else if (parent == mapData && ID == IDs::ModelName)
+    else if (ID == IDs::ModelName)
     {
         // This will be modified when dynamic lib support is added
         if (mapData[ID] == "Sethares")
@@ -500,153 +1253,475 @@ void DissonanceMap::valueTreePropertyChanged (ValueTree& parent, const Identifie
             calc.setModel (new VassilakisModel());
             dissonanceModel.setSelectedId (2);
         }
+        
+        // The input's roughness uses the first calc's model, as the adaptive tuner does
+        if (mapData == mapData.getParent().getChild (0))
+            if (DissMapComponent* mapComponent = findParentComponentOfClass<DissMapComponent>())
+                mapComponent->setInputModel (mapData[ID] == "Vassilakis" ? Roughness::vassilakis
+                                                                         : Roughness::sethares);
     }
-    else if (parent == mapData && ID == IDs::ScaleLocked)
+    else if (ID == IDs::ScaleLocked)
     {
         recalculateDissonance();
         repaint();
         drawOptimaComponents();
         return;
     }
-    else if (parent.hasType (IDs::OvertoneDistribution)
-             || parent.hasType (IDs::Partial))
+    
+    // Redraw the dissonance map (or remove the old map, if new data is needed)
+    refresh();
+}
+
+void DissonanceMap::refresh()
+{
+    recalculateDissonance();
+    repaint();
+    updateOptima();
+}
+
+void DissonanceMap::requestRefresh()
+{
+    refresher.requestRefresh();
+}
+
+void DissonanceMap::recalculateDissonance()
+{
+    TRACE_SCOPE ("recalculateDissonance");
+    
+    MapList* list = findParentComponentOfClass<MapList>();
+    
+    // Fundamental freqs are kept in sync by the distribution bindings
+    if (calc.isReadyToProcess() && list != nullptr)
     {
-        for (int i = 0; i < calc.numOvertoneDistributions(); ++i)
+        // A running job is only told to exit, and the calc is snapshot again on the next frame once
+        // it has, as the snapshot can't change under it
+        if (! list->threadPool.removeJob (&curveJob, true, 0))
         {
-            if (parent.hasType (IDs::OvertoneDistribution)
-                && parent == mapData.getChild (i))
-            {
-                OvertoneDistribution* dist = calc.getDistributionReference (i);
-                
-                if (ID == IDs::XAxis && parent[ID].operator bool() == true)
-                {
-                    calc.set2dVariableDistribution (i);
-                }
-                else if (ID == IDs::Mute)
-                {
-                    dist->mute (parent[IDs::Mute]);
-                }
-                else if (ID == IDs::Name)
-                {
-                    dist->setDistributionName (parent[IDs::Name]);
-                    return;
-                }
-                else if (ID == IDs::FundamentalFreq)
-                {
-                    if (mapData.hasProperty (IDs::StartFreq)
-                        && parent[ID].operator float() < 20
-                        && parent[ID].operator float() > 0)
-                    {
-                        dist->setFundamentalFreq (parent[ID].operator float()
-                                                  * mapData[IDs::StartFreq].operator float());
-                    }
-                    else if (parent[ID].operator float() > 0)
-                    {
-                        dist->setFundamentalFreq (parent[ID]);
-                    }
-                }
-                else if (ID == IDs::FundamentalAmp)
-                {
-                    if (parent[ID].operator float() > 0)
-                        dist->setFundamentalAmp (parent[ID]);
-                }
-                else if (ID == IDs::FundamentalMute)
-                {
-                    dist->muteFundamental (parent[ID]);
-                }
-            }
-            else if (parent.hasType (IDs::Partial)
-                     && parent.getParent() == mapData.getChild (i))
+            refresher.retryRefresh();
+            return;
+        }
+        
+        // Optima can only follow a change from a curve whose optima have all been created
+        const bool hasOptima = (curveFinished || trackingOptima)
+                               && optimaReferenceFreq > 0
+                               && ! list->threadPool.contains (&updateMinimaJob)
+                               && ! list->threadPool.contains (&updateMaximaJob)
+                               && minima.size() == curveMinima.size()
+                               && maxima.size() == curveMaxima.size();
+        
+        trackingOptima = false;
+        
+        if (surface != nullptr)
+        {
+            surface->cancel();
+            surface = nullptr;
+            
+            const ScopedLock sl (curveOptimaLock);
+            optimaSurface = nullptr;
+        }
+        
+        if (DissonanceSurface::hasTwoVariables (mapData))
+        {
+            calculateSurface();
+            return;
+        }
+        
+        const bool isSmallChange = curveJob.setCalc (mapData, getViewRange().getStart(), getViewRange().getEnd(), calc.getNumSteps());
+        
+        curveFinished = false;
+        trackingOptima = hasOptima && isSmallChange;
+        
+        if (trackingOptima)
+            curveJob.followOptima (curveMinima, curveMaxima, optimaReferenceFreq);
+        
+        list->threadPool.addJob (&curveJob, false);
+    }
+}
+
+void DissonanceMap::curveCalculated()
+{
+    TRACE_SCOPE ("curveCalculated");
+    
+    // A pass that landed before switching to a surface
+    if (surface != nullptr)
+        return;
+    
+    curveFinished = curveJob.getLatestCurve (curve);
+    referenceFreq = curveJob.getReferenceFreq();
+    
+    if (curve.getNumSteps() == 0)
+        return;
+    
+    {
+        TRACE_SCOPE ("findMinAndMax");
+        
+        findMinAndMax (curve.getRawDissonanceData(), curve.getNumSteps(),
+                       normalizer.start, normalizer.end);
+    }
+    
+    // Lock the dissonance scale or use locked scale values unless the scale needs to be expanded
+    // Might want to let dissonance values fall outside of the locked scale, we'll see...
+    if (mapData[IDs::ScaleLocked].operator bool())
+    {
+        if (! mapData.hasProperty (IDs::ScaleMax)
+            || mapData[IDs::ScaleMax].operator float() < normalizer.end)
+        {
+            mapData.setProperty (IDs::ScaleMax, normalizer.end, nullptr);
+        }
+        
+        if (! mapData.hasProperty (IDs::ScaleMin)
+            || mapData[IDs::ScaleMin].operator float() > normalizer.start)
+        {
+            mapData.setProperty (IDs::ScaleMin, normalizer.start, nullptr);
+        }
+        
+        normalizer.start = mapData[IDs::ScaleMin];
+        normalizer.end = mapData[IDs::ScaleMax];
+    }
+    
+    // Prevents attempting to draw within an invalid range
+    // This should only happen when only a single partial is present (creates no dissonance by itself)
+    if (normalizer.start == 0 && normalizer.end == 0)
+        return;
+    
+    decimate();
+    repaint();
+    
+    // Tracked optima stay where they were on the coarser passes, and move with the last one
+    if (curveFinished && trackingOptima)
+        trackOptima();
+    
+    drawOptimaComponents();
+    
+    if (curveFinished)
+    {
+        Array<float> newMinima, newMaxima;
+        
+        // Optima that the job followed have been moved already
+        if (curveJob.getTrackedOptima (newMinima, newMaxima))
+            return;
+        
+        // Uniform maps come with DisMAL's optima, and adaptive curves are searched here
+        const bool isUniform = curveJob.getOptima (newMinima, newMaxima);
+        
+        if (! isUniform)
+        {
+            const float minInterval = mapData.getProperty (IDs::MinInterval, 1.001);
+            
+            for (auto ratio : curve.findOptima (true, minInterval))
+                newMinima.add (ratio * referenceFreq);
+            
+            for (auto ratio : curve.findOptima (false, minInterval))
+                newMaxima.add (ratio * referenceFreq);
+        }
+        
+        // The tracked optima of an adaptive curve are kept unless some have appeared or vanished
+        if (trackingOptima && ! isUniform
+            && newMinima.size() == curveMinima.size()
+            && newMaxima.size() == curveMaxima.size())
+            return;
+        
+        const bool wasTracking = trackingOptima;
+        trackingOptima = false;
+        
+        {
+            const ScopedLock sl (curveOptimaLock);
+            
+            curveMinima.swapWith (newMinima);
+            curveMaxima.swapWith (newMaxima);
+            optimaReferenceFreq = referenceFreq;
+        }
+        
+        if (optimaRequested || wasTracking)
+        {
+            optimaRequested = false;
+            updateOptima();
+        }
+    }
+}
+
+void DissonanceMap::trackOptima()
+{
+    Array<float> newMinima, newMaxima;
+    
+    // The job follows a uniform map's optima, in the same order as the components
+    if (curveJob.getTrackedOptima (newMinima, newMaxima))
+    {
+        const ScopedLock sl (curveOptimaLock);
+        
+        moveOptima (newMinima, curveMinima, minima);
+        moveOptima (newMaxima, curveMaxima, maxima);
+        
+        optimaReferenceFreq = referenceFreq;
+        return;
+    }
+    
+    // Uniform map optima that couldn't be followed are searched for again
+    if (curveJob.getOptima (newMinima, newMaxima))
+        return;
+    
+    const float minInterval = mapData.getProperty (IDs::MinInterval, 1.001);
+    
+    {
+        const ScopedLock sl (curveOptimaLock);
+        
+        trackOptima (curveMinima, minima, true, minInterval);
+        trackOptima (curveMaxima, maxima, false, minInterval);
+        
+        optimaReferenceFreq = referenceFreq;
+    }
+}
+
+void DissonanceMap::trackOptima (Array<float>& freqs, OwnedArray<OptimaComponent>& components, bool isMin, float minInterval)
+{
+    Array<float> previousRatios;
+    
+    for (auto freq : freqs)
+        previousRatios.add (freq / optimaReferenceFreq);
+    
+    Array<float> newFreqs;
+    
+    for (auto ratio : curve.trackOptima (previousRatios, isMin, minInterval))
+        newFreqs.add (ratio * referenceFreq);
+    
+    moveOptima (newFreqs, freqs, components);
+}
+
+void DissonanceMap::moveOptima (const Array<float>& newFreqs, Array<float>& freqs, OwnedArray<OptimaComponent>& components)
+{
+    // Components are in the same order as the freqs they were created from
+    for (int i = jmin (newFreqs.size(), components.size()); --i >= 0;)
+    {
+        if (newFreqs[i] > 0)
+        {
+            freqs.set (i, newFreqs[i]);
+            components[i]->setFreq (newFreqs[i], getOptimumTooltip (newFreqs[i]));
+        }
+        else
+        {
+            freqs.remove (i);
+            components.remove (i);
+        }
+    }
+}
+
+void DissonanceMap::calculateSurface()
+{
+    TRACE_SCOPE ("calculateSurface");
+    
+    ThreadPool& pool = findParentComponentOfClass<MapList>()->threadPool;
+    Range<float> view = getViewRange();
+    bool isLog = mapData[IDs::LogSteps];
+    
+    surface = new DissonanceSurface();
+    surface->setCalc (mapData, view.getStart(), view.getEnd(), isLog, jlimit (16, maxSurfaceSteps, calc.getNumSteps()));
+    surface->setListener (&asyncSurfaceUpdater);
+    
+    // The curve's range is kept for converting between freqs and positions on the map
+    referenceFreq = surface->getReferenceFreq();
+    curve.setRange (view.getStart() / referenceFreq, view.getEnd() / referenceFreq, isLog);
+    curve.setSteps (Array<float>(), Array<float>());
+    
+    // Surfaces have no optima on the curve, and their own optima are found once every tile lands
+    {
+        const ScopedLock sl (curveOptimaLock);
+        
+        curveMinima.clearQuick();
+        curveMaxima.clearQuick();
+        optimaReferenceFreq = 0;
+        optimaSurface = nullptr;
+    }
+    
+    curveFinished = false;
+    
+    const int imageSize = jmin (maxSurfaceImageSize, surface->getNumSteps());
+    surfaceImage = Image (Image::RGB, imageSize, imageSize, false);
+    surfaceImage.clear (surfaceImage.getBounds(), Theme::mainBackground);
+    
+    drawnTiles.clearQuick();
+    drawnTiles.insertMultiple (0, false, surface->getNumTiles());
+    drawnRange = Range<float>();
+    
+    for (int i = 0; i < surface->getNumTiles(); ++i)
+        pool.addJob (new SurfaceTileJob (surface, i), true);
+}
+
+void DissonanceMap::surfaceCalculated()
+{
+    TRACE_SCOPE ("surfaceCalculated");
+    
+    if (surface == nullptr)
+        return;
+    
+    Range<float> range = surface->getDissonanceRange();
+    
+    // Every tile is redrawn when the finished tiles widen the scale
+    if (range != drawnRange)
+    {
+        for (int i = 0; i < drawnTiles.size(); ++i)
+            drawnTiles.set (i, false);
+        
+        drawnRange = range;
+    }
+    
+    const int64 numSteps = surface->getNumSteps();
+    const int64 imageSize = surfaceImage.getWidth();
+    Image::BitmapData pixels (surfaceImage, Image::BitmapData::writeOnly);
+    
+    // The first pixel at or after a step, for pixels that take the step at or before them
+    auto getPixel = [numSteps, imageSize] (int step) { return (int) ((step * imageSize + numSteps - 1) / numSteps); };
+    
+    for (int tile = 0; tile < drawnTiles.size(); ++tile)
+    {
+        if (drawnTiles[tile] || ! surface->isTileFinished (tile))
+            continue;
+        
+        // Only the steps that land on a pixel are read, so a stored surface's tiles are paged in once
+        Rectangle<int> bounds = surface->getTileBounds (tile);
+        
+        for (int py = getPixel (bounds.getY()); py < getPixel (bounds.getBottom()); ++py)
+        {
+            const int y = (int) (py * numSteps / imageSize);
+            
+            for (int px = getPixel (bounds.getX()); px < getPixel (bounds.getRight()); ++px)
             {
-                OvertoneDistribution* dist = calc.getDistributionReference (i);
+                float level = range.getLength() > 0
+                              ? (surface->getDissonance ((int) (px * numSteps / imageSize), y) - range.getStart()) / range.getLength()
+                              : 0;
                 
-                if (ID == IDs::Freq && parent[ID].operator float() > 0)
-                {
-                    dist->setFreqRatio (parent.getParent().indexOf (parent),
-                                        parent[IDs::Freq]);
-                    
-                    parent.getParent().sort (comparator, nullptr, false);
-                }
-                else if (ID == IDs::Amp)
-                {
-                    if (parent[ID].operator float() > 0)
-                        dist->setAmpRatio (parent.getParent().indexOf (parent),
-                                           parent[IDs::Amp]);
-                }
-                else if (ID == IDs::Mute)
-                {
-                    dist->mutePartial(parent.getParent().indexOf (parent),
-                                      parent[IDs::Mute]);
-                }
+                // The least dissonant cells are brightest, so the minima stand out
+                // (Rows are flipped so the y-axis ratios rise from the bottom)
+                pixels.setPixelColour (px, (int) imageSize - 1 - py, Theme::activeText.interpolatedWith (Theme::headerBackground, level));
             }
         }
+        
+        drawnTiles.set (tile, true);
+    }
+    
+    repaint();
+    
+    if (surface->isFinished() && ! curveFinished)
+    {
+        {
+            const ScopedLock sl (curveOptimaLock);
+            
+            optimaSurface = surface;
+            surfaceMinInterval = mapData.getProperty (IDs::MinInterval, 1.001);
+        }
+        
+        curveFinished = true;
+        
+        if (optimaRequested)
+        {
+            optimaRequested = false;
+            updateOptima();
+        }
     }
-
-    // Redraw the dissonance map (or remove the old map, if new data is needed)
-    recalculateDissonance();
-    repaint();
-    updateOptima();
 }
 
-void DissonanceMap::recalculateDissonance()
+void DissonanceMap::decimate()
 {
-    if (calc.isReadyToProcess())
+    numColumns = jmax (0, getWidth() - 12);
+    
+    const int numSteps = curve.getNumSteps();
+    
+    if (numColumns == 0 || numSteps <= numColumns)
+        return;
+    
+    columnMin.malloc ((size_t) numColumns);
+    columnMax.malloc ((size_t) numColumns);
+    
+    const float* dissonance = curve.getRawDissonanceData();
+    int step = 0;
+    
+    // The step before the view is only used for the first column's start
+    while (step < numSteps && curve.getPositionAtStep (step) < 0)
+        ++step;
+    
+    for (int i = 0; i < numColumns; ++i)
     {
-        for (int i = 0; i < calc.numOvertoneDistributions(); ++i)
-        {
-            OvertoneDistribution* dist = calc.getDistributionReference (i);
-            
-            if (dist->getFundamentalFreq() != mapData.getChild (i)[IDs::FundamentalFreq].operator float())
-            {
-                ValueTree tree = mapData.getChild (i);
-                
-                if (tree[IDs::FundamentalFreq].operator float() < 20
-                    && tree[IDs::FundamentalFreq].operator float() > 0)
-                {
-                    dist->setFundamentalFreq (tree[IDs::FundamentalFreq].operator float()
-                                              * mapData[IDs::StartFreq].operator float());
-                }
-                else if (tree[IDs::FundamentalFreq].operator float() > 0)
-                {
-                    dist->setFundamentalFreq (tree[IDs::FundamentalFreq]);
-                }
-            }
-        }
+        // Starts from the curve at the column's left edge, so adjacent columns join up
+        // even where steps are sparser than pixels
+        const float columnEnd = (float) (i + 1) / numColumns;
         
-        calc.calculateDissonanceMap();
+        columnMin[i] = columnMax[i] = curve.getDissonanceAtPosition ((float) i / numColumns);
         
-        findMinAndMax (calc.get2dRawDissonanceData(), calc.getNumSteps(),
-                       normalizer.start, normalizer.end);
-        
-        // Lock the dissonance scale or use locked scale values unless the scale needs to be expanded
-        // Might want to let dissonance values fall outside of the locked scale, we'll see...
-        if (mapData[IDs::ScaleLocked].operator bool())
+        while (step < numSteps && curve.getPositionAtStep (step) < columnEnd)
         {
-            if (! mapData.hasProperty (IDs::ScaleMax)
-                || mapData[IDs::ScaleMax].operator float() < normalizer.end)
-            {
-                mapData.setProperty (IDs::ScaleMax, normalizer.end, nullptr);
-            }
-            
-            if (! mapData.hasProperty (IDs::ScaleMin)
-                || mapData[IDs::ScaleMin].operator float() > normalizer.start)
-            {
-                mapData.setProperty (IDs::ScaleMin, normalizer.start, nullptr);
-            }
-            
-            normalizer.start = mapData[IDs::ScaleMin];
-            normalizer.end = mapData[IDs::ScaleMax];
+            columnMin[i] = jmin (columnMin[i], dissonance[step]);
+            columnMax[i] = jmax (columnMax[i], dissonance[step]);
+            ++step;
         }
         
-        // Prevents attempting to draw within an invalid range
-        // This should only happen when only a single partial is present (creates no dissonance by itself)
-        if (normalizer.start == 0 && normalizer.end == 0)
-            return;
+        const float next = curve.getDissonanceAtPosition (columnEnd);
+        
+        columnMin[i] = jmin (columnMin[i], next);
+        columnMax[i] = jmax (columnMax[i], next);
     }
 }
 
+float DissonanceMap::getXOfFreq (float freq)
+{
+    if (referenceFreq <= 0)
+        return 8;
+    
+    return 8 + curve.getPositionOfRatio (freq / referenceFreq) * (getWidth() - 13);
+}
+
+float DissonanceMap::getFreqAtX (float x)
+{
+    return curve.getRatioAtPosition ((x - 8) / jmax (1, getWidth() - 13)) * referenceFreq;
+}
+
+float DissonanceMap::getDissonanceAtFreq (float freq)
+{
+    return referenceFreq > 0 ? curve.getDissonanceAtRatio (freq / referenceFreq) : 0;
+}
+
+Range<float> DissonanceMap::getViewRange()
+{
+    if (viewRange.isEmpty())
+        return Range<float> (calc.getRange().getStart(), calc.getRange().getEnd());
+    
+    return viewRange;
+}
+
+void DissonanceMap::setViewRange (Range<float> newRange)
+{
+    // Ranges narrower than about a 5th of a cent can't be resolved with float ratios
+    if (newRange.getStart() < 1
+        || newRange.getEnd() > 100000
+        || newRange.getEnd() / newRange.getStart() < 1.0001f)
+        return;
+    
+    viewRange = newRange;
+    
+    // Only the view has changed, so the job's cached tiles are reused for the coarse passes
+    refresher.requestRefresh();
+}
+
+void DissonanceMap::resetView()
+{
+    if (viewRange.isEmpty())
+        return;
+    
+    viewRange = Range<float>();
+    refresher.requestRefresh();
+}
+
 void DissonanceMap::updateOptima()
 {
+    // Tracked optima are updated as the curve's passes land
+    if (trackingOptima)
+        return;
+    
+    // Searched for once the curve's last pass lands
+    if (! curveFinished)
+    {
+        optimaRequested = true;
+        return;
+    }
+    
     ThreadPool& pool = findParentComponentOfClass<MapList>()->threadPool;
     
     if (! pool.contains (&updateMinimaJob))
@@ -654,7 +1729,7 @@ void DissonanceMap::updateOptima()
         minima.clear();
         pool.addJob (&updateMinimaJob, false);
     }
-    else if (pool.isJobRunning (&updateMaximaJob))
+    else if (pool.isJobRunning (&updateMinimaJob))
     {
         updateMinimaJob.rerunWhenDone();
     }
@@ -677,44 +1752,64 @@ void DissonanceMap::createOptimaComponents (bool isMin)
     
     if (calc.isReadyToProcess())
     {
-        float ratioDenomenator = calc.numOvertoneDistributions() == 2
-                                 ? calc.getDistributionReference (1 - calc.get2dVariableDistributionIndex())->getFundamentalFreq()
-                                 : calc.getRange().getStart();
+        Array<float> freqs;
+        DissonanceSurface::Ptr finishedSurface;
+        float minInterval;
         
-        if (isMin)
+        // Optima are found on the finished curve, so they're just copied
+        {
+            const ScopedLock sl (curveOptimaLock);
+            freqs = isMin ? curveMinima : curveMaxima;
+            finishedSurface = optimaSurface;
+            minInterval = surfaceMinInterval;
+        }
+        
+        // A surface's tiles have already found their optima, so they're only merged here
+        // (with both ratios to the surface's reference freq)
+        if (finishedSurface != nullptr)
         {
-            calc.optimize2D();
+            const float surfaceReference = finishedSurface->getReferenceFreq();
             
-            for (auto min : calc.getOptimalFreqs())
+            for (auto& optimum : finishedSurface->getOptima (isMin, minInterval))
             {
-                minima.add (new OptimaComponent (min,
-                                                 String ("Freq: " + String (min) + "\n"
-                                                         + "Ratio: " + String (min / ratioDenomenator)),
-                                                 true));
+                if (isMin ? updateMinimaJob.shouldExit() : updateMaximaJob.shouldExit())
+                    return;
+                
+                const float xFreq = optimum.xRatio * surfaceReference;
+                const float yFreq = optimum.yRatio * surfaceReference;
+                
+                auto* component = new OptimaComponent (xFreq,
+                                                       String ("Freqs: " + String (xFreq) + ", " + String (yFreq) + "\n"
+                                                               + "Ratios: " + String (optimum.xRatio) + ", "
+                                                               + String (optimum.yRatio) + "\n"
+                                                               + "Dissonance: " + String (optimum.dissonance)),
+                                                       isMin, yFreq);
+                
+                isMin ? minima.add (component) : maxima.add (component);
             }
+            
+            return;
+        }
+        
+        if (isMin)
+        {
+            for (auto min : freqs)
+                minima.add (new OptimaComponent (min, getOptimumTooltip (min), true));
         }
         else
         {
-            calc.optimize2D (false);
-            
-            for (auto max : calc.getOptimalFreqs (false))
-            {
-                maxima.add (new OptimaComponent (max,
-                                                 String ("Freq: " + String (max) + "\n"
-                                                         + "Ratio: " + String (max / ratioDenomenator)),
-                                                 false));
-            }
+            for (auto max : freqs)
+                maxima.add (new OptimaComponent (max, getOptimumTooltip (max), false));
         }
     }
 }
 
 void DissonanceMap::drawOptimaComponents()
 {
+    TRACE_SCOPE ("drawOptimaComponents");
+    
     if (calc.isReadyToProcess())
     {
-        float nearestStep;
-        float dissHeight;
-        
         for (auto min : minima)
         {
             addChildComponent (min);
@@ -724,15 +1819,7 @@ void DissonanceMap::drawOptimaComponents()
                 min->setVisible (true);
             }
             
-            nearestStep = std::clamp (juce::roundToInt (calc.getStepOfFrequency (min->getFreq())),
-                                      0,
-                                      mapData[IDs::NumSteps].operator int() - 1);
-            
-            dissHeight = normalizer.convertTo0to1 (calc.getDissonanceAtStep (nearestStep));
-            dissHeight = abs (dissHeight - 1);
-            dissHeight = denormalizer.convertFrom0to1 (dissHeight);
-            
-            min->setCentrePosition (nearestStep + 8, dissHeight);
+            min->setCentrePosition (roundToInt (getXOfFreq (min->getFreq())), getYOfOptimum (min));
         }
         
         for (auto max : maxima)
@@ -744,17 +1831,162 @@ void DissonanceMap::drawOptimaComponents()
                 max->setVisible (true);
             }
             
-            nearestStep = std::clamp (juce::roundToInt (calc.getStepOfFrequency (max->getFreq())),
-                                      0,
-                                      mapData[IDs::NumSteps].operator int() - 1);
+            max->setCentrePosition (roundToInt (getXOfFreq (max->getFreq())), getYOfOptimum (max));
+        }
+    }
+}
+
+float DissonanceMap::getYOfOptimum (OptimaComponent* optimum)
+{
+    // A surface's optima sit at their y-axis ratio, which rises from the bottom like the heatmap
+    if (surface != nullptr)
+        return (1 - curve.getPositionOfRatio (optimum->getYFreq() / referenceFreq)) * (getHeight() - 30);
+    
+    float dissHeight = normalizer.convertTo0to1 (getDissonanceAtFreq (optimum->getFreq()));
+    dissHeight = abs (dissHeight - 1);
+    
+    return denormalizer.convertFrom0to1 (dissHeight);
+}
+
+String DissonanceMap::getOptimumTooltip (float freq)
+{
+    return String ("Freq: " + String (freq) + "\n"
+                   + "Ratio: " + String (freq / getRatioDenominator()));
+}
+
+void DissonanceMap::readOutSensitivity (OptimaComponent* optimum)
+{
+    ThreadPool& pool = findParentComponentOfClass<MapList>()->threadPool;
+    const int generation = ++sensitivityGeneration;
+    
+    // A running readout is told to exit without waiting for it, and this one is queued once it
+    // has, unless another optimum has been hovered by then
+    if (! pool.removeJob (&sensitivityJob, true, 0))
+    {
+        Component::SafePointer<DissonanceMap> map (this);
+        Component::SafePointer<OptimaComponent> hovered (optimum);
+        
+        Timer::callAfterDelay (10, [map, hovered, generation]
+        {
+            if (map != nullptr && hovered != nullptr && map->sensitivityGeneration == generation)
+                map->readOutSensitivity (hovered);
+        });
+        
+        return;
+    }
+    
+    sensitivityJob.setOptimum (mapData, optimum);
+    pool.addJob (&sensitivityJob, false);
+}
+
+float DissonanceMap::getRatioDenominator()
+{
+    return calc.numOvertoneDistributions() == 2
+           ? calc.getDistributionReference (1 - calc.get2dVariableDistributionIndex())->getFundamentalFreq()
+           : calc.getRange().getStart();
+}
+
+Array<float> DissonanceMap::getMinimaRatios()
+{
+    Array<float> ratios;
+    
+    if (calc.isReadyToProcess())
+    {
+        float ratioDenomenator = getRatioDenominator();
+        float surfaceReference = 0;
+        
+        {
+            const ScopedLock sl (curveOptimaLock);
             
-            dissHeight = normalizer.convertTo0to1 (calc.getDissonanceAtStep (nearestStep));
-            dissHeight = abs (dissHeight - 1);
-            dissHeight = denormalizer.convertFrom0to1 (dissHeight);
+            if (optimaSurface != nullptr)
+                surfaceReference = optimaSurface->getReferenceFreq();
+        }
+        
+        for (auto min : minima)
+        {
+            // A triad's minimum is a pair of intervals from the surface's reference freq
+            if (min->getYFreq() > 0 && surfaceReference > 0)
+            {
+                ratios.add (min->getFreq() / surfaceReference);
+                ratios.add (min->getYFreq() / surfaceReference);
+            }
+            else
+            {
+                ratios.add (min->getFreq() / ratioDenomenator);
+            }
+        }
+    }
+    
+    return ratios;
+}
+
+void DissonanceMap::exportTo (MapExporter& exporter, const String& name)
+{
+    exporter.beginMap (name, mapData[IDs::ModelName].toString());
+    
+    Array<MapExporter::Optimum> minimaToExport, maximaToExport;
+    
+    if (surface != nullptr)
+    {
+        // A surface's steps are only all there once it's finished
+        if (surface->isFinished())
+        {
+            exporter.writeSurface (*surface);
             
-            max->setCentrePosition (nearestStep + 8, dissHeight);
+            for (auto isMin : { true, false })
+            {
+                for (auto& optimum : surface->getOptima (isMin, surfaceMinInterval))
+                {
+                    MapExporter::Optimum exported = { optimum.xRatio * surface->getReferenceFreq(),
+                                                      optimum.yRatio * surface->getReferenceFreq(),
+                                                      optimum.dissonance };
+                    
+                    (isMin ? minimaToExport : maximaToExport).add (exported);
+                }
+            }
+        }
+    }
+    else if (curveFinished)
+    {
+        // Like surfaces, curves are only exported once their last pass is in
+        exporter.writeCurve (curve, referenceFreq);
+        
+        for (auto min : minima)
+        {
+            MapExporter::Optimum exported = { min->getFreq(), 0, getDissonanceAtFreq (min->getFreq()) };
+            minimaToExport.add (exported);
+        }
+        
+        for (auto max : maxima)
+        {
+            MapExporter::Optimum exported = { max->getFreq(), 0, getDissonanceAtFreq (max->getFreq()) };
+            maximaToExport.add (exported);
         }
     }
+    
+    exporter.writeOptima (minimaToExport, true);
+    exporter.writeOptima (maximaToExport, false);
+    exporter.endMap();
+}
+
+void DissonanceMap::stopJobs (ThreadPool& pool)
+{
+    if (surface != nullptr)
+        surface->cancel();
+    
+    // Queued jobs are removed, and running ones are only told to exit
+    pool.removeJob (&curveJob, true, 0);
+    pool.removeJob (&updateMinimaJob, true, 0);
+    pool.removeJob (&updateMaximaJob, true, 0);
+    pool.removeJob (&sensitivityJob, true, 0);
+}
+
+bool DissonanceMap::hasJobsIn (ThreadPool& pool)
+{
+    return pool.contains (&curveJob)
+           || pool.contains (&updateMinimaJob)
+           || pool.contains (&updateMaximaJob)
+           || pool.contains (&sensitivityJob);
 }
 
 void DissonanceMap::clearOptima (bool isMinima)
@@ -762,6 +1994,20 @@ void DissonanceMap::clearOptima (bool isMinima)
     isMinima ? minima.clear() : maxima.clear();
 }
 
+bool DissonanceMap::isTrackingOptima() const
+{
+    return trackingOptima;
+}
+
+void DissonanceMap::hideOptima()
+{
+    for (auto min : minima)
+        min->setVisible (false);
+    
+    for (auto max : maxima)
+        max->setVisible (false);
+}
+
 void DissonanceMap::showOptima (bool isMin)
 {
     if (isMin)
@@ -786,6 +2032,66 @@ MapList::MapList()   : mapsData (IDs::CalculatorList)
 
 MapList::~MapList()
 {
+    // Jobs hold pointers to their maps, so they're stopped before the maps are deleted
+    for (auto* map : maps)
+        map->stopJobs (threadPool);
+    
+    threadPool.removeAllJobs (true, 5000);
+    
+    maps.clear();
+    removedMaps.clear();
+}
+
+void MapList::exportMaps (const Array<DissonanceMap*>& mapsToExport, MapExporter::Format format)
+{
+    File directory (findParentComponentOfClass<MainComponent>()->getSettings()->getValue ("Tuning Export Location"));
+    
+    if (! directory.exists())
+        directory.createDirectory();
+    
+    File file = directory.getChildFile ("Dissonance Maps" + MapExporter::getFileExtension (format)).getNonexistentSibling();
+    
+    // Every array is its own .npy file, so they're kept together in a new folder
+    if (format == MapExporter::npy)
+    {
+        File folder = directory.getChildFile ("Dissonance Maps").getNonexistentSibling();
+        folder.createDirectory();
+        file = folder.getChildFile ("Dissonance Maps.npy");
+    }
+    
+    MapExporter exporter (file, format);
+    
+    if (! exporter.openedOk())
+        return;
+    
+    for (auto* map : mapsToExport)
+        map->exportTo (exporter, "Map " + String (maps.indexOf (map) + 1));
+}
+
+void MapList::showExportMenu (const Array<DissonanceMap*>& mapsToExport, const String& title)
+{
+    PopupMenu menu;
+    menu.addSectionHeader (title);
+    menu.addItem (MapExporter::csv, "CSV");
+    menu.addItem (MapExporter::json, "JSON");
+    menu.addItem (MapExporter::npy, "NumPy (.npy)");
+    
+    Component::SafePointer<MapList> safePointer (this);
+    
+    menu.showMenuAsync (PopupMenu::Options(), ModalCallbackFunction::create ([safePointer, mapsToExport] (int result)
+    {
+        if (safePointer == nullptr || result == 0)
+            return;
+        
+        // Maps could have been removed while the menu was open
+        Array<DissonanceMap*> remaining;
+        
+        for (auto* map : mapsToExport)
+            if (safePointer->maps.contains (map))
+                remaining.add (map);
+        
+        safePointer->exportMaps (remaining, (MapExporter::Format) result);
+    }));
 }
 
 void MapList::paint (Graphics& g)
@@ -820,12 +2126,30 @@ void MapList::valueTreeChildRemoved (ValueTree& parent, ValueTree& removedChild,
 {
     if (parent == mapsData)
     {
-        maps.remove (childIndex);
+        DissonanceMap* map = maps.removeAndReturn (childIndex);
+        
+        // Jobs still in the pool hold a pointer to the map, so it's only deleted once they've exited
+        map->stopJobs (threadPool);
+        removeChildComponent (map);
+        removedMaps.add (map);
+        
+        if (! isTimerRunning())
+            startTimer (100);
         
         setSize (getWidth(), maps.size() * mapHeight);
     }
 }
 
+void MapList::timerCallback()
+{
+    for (int i = removedMaps.size(); --i >= 0;)
+        if (! removedMaps[i]->hasJobsIn (threadPool))
+            removedMaps.remove (i);
+    
+    if (removedMaps.isEmpty())
+        stopTimer();
+}
+
 void MapList::valueTreePropertyChanged (ValueTree& parent, const Identifier& ID)
 {
     if (parent == mapsData && (ID == IDs::ShowMinima || ID == IDs::ShowMaxima))
@@ -841,6 +2165,71 @@ void MapViewport::visibleAreaChanged (const Rectangle<int>& newVisibleArea)
     findParentComponentOfClass<DissCalcView>()->repositionCalcPanel (newVisibleArea.getY());
 }
 
+//==============================================================================
+RoughnessMeter::RoughnessMeter()
+{
+    inputAnalyzer = nullptr;
+    level = 0;
+    peak = 0;
+    
+    setTooltip ("Input Roughness");
+}
+
+RoughnessMeter::~RoughnessMeter()
+{
+    if (inputAnalyzer != nullptr)
+        inputAnalyzer->removeChangeListener (this);
+}
+
+void RoughnessMeter::paint (Graphics& g)
+{
+    Rectangle<float> area = getLocalBounds().toFloat().reduced (0.5f);
+    
+    g.setColour (Theme::mapBackground);
+    g.fillRoundedRectangle (area, 3);
+    
+    if (peak > 0)
+    {
+        g.setColour (Theme::activeText);
+        g.fillRoundedRectangle (area.withWidth (area.getWidth() * jlimit (0.f, 1.f, level / peak)), 3);
+    }
+    
+    g.setColour (Theme::border);
+    g.drawRoundedRectangle (area, 3, 1);
+}
+
+void RoughnessMeter::changeListenerCallback (ChangeBroadcaster* source)
+{
+    float roughness = inputAnalyzer->getLatestAnalysis().roughness;
+    
+    // Rise quickly and fall slowly, so the meter is readable
+    level += (roughness - level) * (roughness > level ? 0.5f : 0.1f);
+    peak = jmax (roughness, peak * 0.995f);
+    
+    setTooltip ("Input Roughness: " + String (level, 3));
+    repaint();
+}
+
+void RoughnessMeter::setInputAnalyzer (InputAnalyzer& analyzer)
+{
+    if (inputAnalyzer != nullptr)
+        inputAnalyzer->removeChangeListener (this);
+    
+    inputAnalyzer = &analyzer;
+    inputAnalyzer->addChangeListener (this);
+}
+
+void RoughnessMeter::setModel (Roughness::Model model)
+{
+    if (inputAnalyzer != nullptr)
+        inputAnalyzer->setModel (model);
+    
+    // Roughness from the other model isn't comparable
+    level = 0;
+    peak = 0;
+    repaint();
+}
+
 //==============================================================================
 DissMapComponentFooter::DissMapComponentFooter()
 {
@@ -853,6 +2242,12 @@ DissMapComponentFooter::DissMapComponentFooter()
     gridLines.setTooltip ("Set grid lines");
     gridLines.setSelectedId (4);
     
+    exportMaps.setIcon (true, FontAwesome_Share);
+    exportMaps.setIconSize (18);
+    exportMaps.addListener (this);
+    addAndMakeVisible (exportMaps);
+    exportMaps.setTooltip ("Export every map's steps and optima\n(right click a map to export only that one)");
+    
     showMinima.setIcon (true, FontAwesome_ChevronDown);
     showMinima.setIconSize (22);
     showMinima.addListener (this);
@@ -864,6 +2259,14 @@ DissMapComponentFooter::DissMapComponentFooter()
     showMaxima.addListener (this);
     addAndMakeVisible (showMaxima);
     showMaxima.setTooltip ("Show Maxima");
+    
+    generateTuning.setIcon (true, FontAwesome_Music);
+    generateTuning.setIconSize (18);
+    generateTuning.addListener (this);
+    addAndMakeVisible (generateTuning);
+    generateTuning.setTooltip ("Generate a tuning from the minima");
+    
+    addAndMakeVisible (roughness);
 }
 
 DissMapComponentFooter::~DissMapComponentFooter()
@@ -882,6 +2285,9 @@ void DissMapComponentFooter::resized()
     gridLines.setBounds (area.removeFromRight (100).reduced (3));
     showMinima.setBounds (area.removeFromLeft (area.getHeight()).reduced (3));
     showMaxima.setBounds (area.removeFromLeft (area.getHeight()).reduced (3).withX (area.getHeight()));
+    generateTuning.setBounds (area.removeFromLeft (area.getHeight()).reduced (3).withX (area.getHeight() * 2));
+    exportMaps.setBounds (area.removeFromLeft (area.getHeight()).reduced (3).withX (area.getHeight() * 3));
+    roughness.setBounds (area.removeFromRight (100).reduced (3, 10));
 }
 
 void DissMapComponentFooter::comboBoxChanged (ComboBox* changedBox)
@@ -910,6 +2316,15 @@ void DissMapComponentFooter::buttonClicked (Button* clickedButton)
         
         showMaxima.setTooltip (showMaxima.getToggleState() ? "Hide Maxima" : "Show Maxima");
     }
+    else if (clickedButton == &generateTuning)
+    {
+        DissCalcView* view = findParentComponentOfClass<DissCalcView>();
+        view->tuningWindow.show (view->getMinimaRatios());
+    }
+    else if (clickedButton == &exportMaps)
+    {
+        findParentComponentOfClass<DissMapComponent>()->showExportMenu();
+    }
 }
 
 //==============================================================================
@@ -955,3 +2370,34 @@ void DissMapComponent::setData (ValueTree& calcList, UndoManager& undo)
     
     footer.data = calcList;
 }
+
+void DissMapComponent::setInputAnalyzer (InputAnalyzer& analyzer)
+{
+    footer.roughness.setInputAnalyzer (analyzer);
+}
+
+void DissMapComponent::setInputModel (Roughness::Model model)
+{
+    footer.roughness.setModel (model);
+}
+
+Array<float> DissMapComponent::getMinimaRatios()
+{
+    Array<float> ratios;
+    
+    for (auto* map : maps.maps)
+        ratios.addArray (map->getMinimaRatios());
+    
+    return ratios;
+}
+
+void DissMapComponent::showExportMenu()
+{
+    Array<DissonanceMap*> mapsToExport;
+    
+    for (auto* map : maps.maps)
+        mapsToExport.add (map);
+    
+    if (! mapsToExport.isEmpty())
+        maps.showExportMenu (mapsToExport, "Export all maps");
+}
@@ -17,6 +17,11 @@
 #include "ThemedComponents.h"
 #include "../../../DisMAL/DisMAL.h"
 #include "DistributionPanel.h"
+#include "InputAnalyzer.h"
+#include "AdaptiveCurve.h"
+#include "MapTileCache.h"
+#include "DissonanceSurface.h"
+#include "MapExporter.h"
 
 class DissonanceMap;
 
@@ -25,21 +30,27 @@ class DissonanceMap;
     Class for creating dissonance optima objects that will display the optima's frequency and ratio on mouse hover.
  
     The component will be drawn on the dissonance curve at the corresponding optima, and can be clicked to add the
-    optima to the tuning panel.
+    optima to the tuning panel. Hovering a curve's optimum also reads out which partials it depends on most (see
+    OptimumSensitivityJob).
 */
 class OptimaComponent   : public Component,
                           public SettableTooltipClient
 {
 public:
-    OptimaComponent (float frequency, String tooltip, bool isMinima);
+    OptimaComponent (float frequency, String tooltip, bool isMinima, float yFrequency = 0);
     ~OptimaComponent();
     
     void paint (Graphics& g) override;
+    void mouseEnter (const MouseEvent& event) override;
     
     float getFreq();
+    void setFreq (float frequency, String tooltip);
+    
+    // The y-axis freq of a surface's optimum, or 0 for a curve's
+    float getYFreq();
     
 private:
-    float freq;
+    float freq, yFreq;
     bool isMin;
     
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (OptimaComponent)
@@ -69,9 +80,211 @@ public:
     ~AsyncOptimaUpdater(){}
     
     void handleAsyncUpdate() override;
+
+private:
+    DissonanceMap* parent;
+};
+
+// Draws the tiles of a map's surface as they're calculated
+class AsyncSurfaceUpdater   : public AsyncUpdater
+{
+public:
+    AsyncSurfaceUpdater (DissonanceMap* parentComponent);
+    ~AsyncSurfaceUpdater(){}
+    
+    void handleAsyncUpdate() override;
+    
+private:
+    DissonanceMap* parent;
+};
+
+/*
+    Calculates a map's dissonance curve over its visible range on the thread pool, from a
+    snapshot of its calc.
+ 
+    Uniform maps are calculated by DisMAL, in the job's tile cache. Each pass is taken from the
+    tiles (every 8th step first, then every 4th, every 2nd and every step), and is handed to the
+    map as it lands so a rough curve shows straight away. Cached tiles are reused between runs,
+    so a pass over tiles that are already calculated lands at once. The last pass is handed
+    over with DisMAL's optima of its tiles, or with the map's previous optima followed onto it
+    when the change was small and no optima have appeared or vanished.
+ 
+    Adaptive steps are sampled for the visible range and handed over once done, and their
+    optima are found by the map. When the calc or view changes, the map tells the job to exit
+    (it checks between tiles and batches of steps) and only takes a new snapshot once it has.
+*/
+class ProgressiveMapJob   : public ThreadPoolJob,
+                            private AsyncUpdater
+{
+public:
+    ProgressiveMapJob (DissonanceMap* parentComponent);
+    ~ProgressiveMapJob();
+    
+    /*  Takes a snapshot of the calc, for the given visible range (message thread, while the job isn't in the pool)
+ 
+        Returns whether the previous curve's optima can be tracked on the new one, which is when
+        only the freqs or amps of partials have changed.
+    */
+    bool setCalc (const ValueTree& calcData, float startFreq, float endFreq, int numSteps);
+    
+    // Has the last pass follow these optima, rather than search for them (message thread, while the job isn't in the pool)
+    void followOptima (const Array<float>& minima, const Array<float>& maxima, float optimaReferenceFreq);
+    
+    JobStatus runJob() override;
+    
+    // Copies the latest pass into the curve, and returns whether it was the last pass
+    bool getLatestCurve (AdaptiveCurve& curve);
+    
+    // Copies DisMAL's optima freqs, and returns false unless the last pass of a uniform map has landed with them
+    bool getOptima (Array<float>& minima, Array<float>& maxima);
     
+    // Copies the followed optima freqs in the order they were given, with 0 for any that ran off the curve,
+    // and returns false unless the last pass of a uniform map has landed with them
+    bool getTrackedOptima (Array<float>& minima, Array<float>& maxima);
+    
+    // The freq that the curve's ratios are relative to
+    float getReferenceFreq() const;
+
 private:
     DissonanceMap* parent;
+    
+    MapTileCache tiles;
+    Range<float> freqRange;
+    float startRatio, endRatio;
+    bool isLog, isAdaptive;
+    int steps;
+    float minInterval;
+    Array<float> followedMinima, followedMaxima;
+    int numCurveMinima, numCurveMaxima;
+    
+    Array<float> positions, dissonance;
+    Array<float> passMinima, passMaxima;
+    bool isFinal, hasPass, hasOptima, hasTrackedOptima;
+    CriticalSection passLock;
+    
+    void handleAsyncUpdate() override;
+    void publish (const Array<float>& newPositions, const Array<float>& newDissonance, bool isLastPass,
+                  const Array<float>& newMinima = Array<float>(), const Array<float>& newMaxima = Array<float>(),
+                  bool areTracked = false);
+    
+    // Follows the previous optima onto the last pass, returning false if some have appeared or vanished
+    bool trackOptima (const AdaptiveCurve& curve, Array<float>& newMinima, Array<float>& newMaxima);
+};
+
+/*
+    Reads out which partials a curve's optimum depends on most, on the thread pool, from a
+    snapshot of its calc taken when the optimum is hovered.
+ 
+    Partials are ranked by their share of the dissonance at the optimum, and each shows how
+    far the optimum would move per cent that the partial's freq moves, and per percent that its
+    amp changes (see IntervalDissonance::getSensitivity()). The readout is added to the
+    optimum's tooltip once it's done, unless the optimum has been moved or deleted since.
+*/
+class OptimumSensitivityJob   : public ThreadPoolJob,
+                                private AsyncUpdater
+{
+public:
+    OptimumSensitivityJob (DissonanceMap* parentComponent);
+    ~OptimumSensitivityJob();
+    
+    // Takes a snapshot of the calc and the optimum (message thread, while the job isn't in the pool)
+    void setOptimum (const ValueTree& calcData, OptimaComponent* optimaComponent);
+    
+    JobStatus runJob() override;
+
+private:
+    DissonanceMap* parent;
+    
+    IntervalDissonance intervals;
+    Component::SafePointer<OptimaComponent> optimum;
+    float freq;
+    StringArray distributionNames;
+    
+    String readout;
+    CriticalSection readoutLock;
+    
+    void handleAsyncUpdate() override;
+};
+
+/*
+    Coalesces DisMAL data changes into at most one dissonance recalculation per display frame.
+ 
+    Changes made between frames (ie, while dragging a partial) only set DisMAL data, and the
+    curve is recalculated once on the next frame with the latest values. Optima follow changes
+    to partials' freqs and amps from where they were, and are otherwise hidden and searched for
+    again after a frame passes without changes.
+*/
+class MapRefresher   : public Timer
+{
+public:
+    MapRefresher (DissonanceMap* parentComponent);
+    ~MapRefresher();
+    
+    void requestRefresh();
+    void timerCallback() override;
+    
+    // Recalculates on the next frame, for a recalculation that had to wait for the last job to exit
+    void retryRefresh();
+
+private:
+    DissonanceMap* parent;
+    bool refreshPending;
+};
+
+//==============================================================================
+/*
+    Binds an OvertoneDistribution valuetree node to its DisMAL distribution.
+ 
+    Indices are only updated when distributions or partials are added or removed,
+    which keeps property routing constant time regardless of the number of
+    distributions and partials in the calc.
+ 
+    DisMAL partials keep the order they were added in, so the binding maps each
+    index of the distribution's packed partial array to its DisMAL partial index.
+*/
+class DistributionBinding   : public ValueTree::Listener
+{
+public:
+    DistributionBinding (DissonanceMap& owner, ValueTree& distributionNode, int dismalIndex);
+    ~DistributionBinding();
+    
+    // Data model callbacks to set DisMAL data
+    void valueTreePropertyChanged (ValueTree& parent, const Identifier& ID) override;
+    
+    // Unused pure-virtual callbacks inhereted from ValueTree::Listener
+    void valueTreeChildAdded (ValueTree& parent, ValueTree& newChild) override {}
+    void valueTreeChildRemoved (ValueTree& parent, ValueTree& removedChild, int childIndex) override {}
+    void valueTreeChildOrderChanged (ValueTree& parent, int oldIndex, int newIndex) override {}
+    void valueTreeParentChanged (ValueTree& adoptedTree) override {}
+    void valueTreeRedirected (ValueTree& redirectedTree) override {}
+    
+    OvertoneDistribution* getDistribution();
+    
+    // Sets the DisMAL fundamental from the node's freq, which may be a ratio to the start freq
+    void updateFundamentalFreq (float startFreq);
+    
+    // Adds a DisMAL partial for every partial in the node's partial array
+    void addAllPartials();
+    
+    ValueTree distribution;
+    int index;
+    DissonanceMap& map;
+
+private:
+    // DisMAL partial index for each index of the packed partial array
+    Array<int> dismalIndices;
+    int numDismalPartials;
+    
+    // Version of the partial array the DisMAL partials were last updated to
+    uint64 partialsVersion;
+    
+    void addPartial (int partialIndex, const PartialData& partial);
+    void removeAllPartials();
+    
+    // Applies the partial array's latest edit to the DisMAL distribution
+    void partialsChanged();
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (DistributionBinding)
 };
 
 //==============================================================================
@@ -82,6 +295,27 @@ private:
     It has gui components for setting some calc data into the valuetree data model,
     callbacks received from the valuetree data model for setting DisMAL data,
     and the ability to draw dissonance maps.
+ 
+    The number of steps calculated is independent of the map's width. The curve is drawn from
+    the min and max dissonance of the steps under each pixel column, which are recomputed from
+    the calculated steps when the map is resized rather than recalculating the map.
+ 
+    The curve is calculated progressively off the message thread (see ProgressiveMapJob), and
+    its optima are found once the last pass lands. With adaptive steps, the number of steps is
+    the most the curve can be refined to.
+ 
+    When the calc has both x-axis and y-axis distributions, the map shows the triad's dissonance
+    surface as a heatmap in place of the curve (see DissonanceSurface), with the y-axis ratios
+    rising from the bottom over the same range as the x-axis. The grid has the calc's number of
+    steps per side, up to 1024, and the least dissonant cells are brightest. The surface's optima
+    are drawn at their pair of ratios once every tile is calculated.
+ 
+    Cmd/ctrl + scrolling zooms around the cursor, dragging pans, and double clicking returns to
+    the calc's range. Zooming and panning only change the visible range (not the start freq or
+    end ratio), and the optima shown are those of the visible range.
+ 
+    Right clicking exports the map's steps and optima (see MapExporter), as they're currently
+    calculated for the visible range.
 */
 class DissonanceMap   : public Component,
                         public TextEditor::Listener,
@@ -99,8 +333,16 @@ public:
     void comboBoxChanged (ComboBox* changedBox) override;
     void textEditorFocusLost (TextEditor& editor) override;
     void textEditorReturnKeyPressed (TextEditor& editor) override;
+    void setResolution();
     void mouseMove (const MouseEvent& event) override;
     
+    // Zoom & pan callbacks
+    void mouseDown (const MouseEvent& event) override;
+    void mouseDrag (const MouseEvent& event) override;
+    void mouseUp (const MouseEvent& event) override;
+    void mouseDoubleClick (const MouseEvent& event) override;
+    void mouseWheelMove (const MouseEvent& event, const MouseWheelDetails& wheel) override;
+    
     // Data model callbacks to set DisMAL data
     void valueTreeChildAdded (ValueTree& parent, ValueTree& newChild) override;
     void valueTreeChildRemoved (ValueTree& parent, ValueTree& removedChild, int childIndex) override;
@@ -112,27 +354,124 @@ public:
     void valueTreeRedirected (ValueTree& redirectedTree) override {}
     
     void showOptima (bool isMin);
+    void hideOptima();
     void recalculateDissonance();
     void updateOptima();
     void createOptimaComponents (bool isMin);
     void drawOptimaComponents();
     void clearOptima (bool isMinima);
     
+    // Whether the optima are following a small edit, rather than being searched for again
+    bool isTrackingOptima() const;
+    
+    // Recalculates, redraws and updates optima after a DisMAL data change
+    void refresh();
+    
+    // Same as refresh(), but throttled to the display frame rate for continuous edits
+    void requestRefresh();
+    
+    // Minima as ratios to the fixed distribution's fundamental, or the start freq
+    Array<float> getMinimaRatios();
+    float getRatioDenominator();
+    
+    // Height of an optimum on the curve, or of its y-axis ratio on a surface
+    float getYOfOptimum (OptimaComponent* optimum);
+    String getOptimumTooltip (float freq);
+    
+    // Starts reading out the partials a curve's optimum depends on, when it's hovered
+    void readOutSensitivity (OptimaComponent* optimum);
+    
+    // Writes the calculated steps and the optima to an export
+    void exportTo (MapExporter& exporter, const String& name);
+    
+    // Tells the map's jobs to exit without waiting for them, before the map is removed from its list
+    void stopJobs (ThreadPool& pool);
+    
+    // Whether any of the map's jobs are still queued or running, so it can't be deleted yet
+    bool hasJobsIn (ThreadPool& pool);
+    
+    // Takes the latest pass of the curve job (message thread)
+    void curveCalculated();
+    
+    // Starts calculating the triad surface, and draws its tiles as they're calculated
+    void calculateSurface();
+    void surfaceCalculated();
+    
+    // Reduces the calculated steps to a min and max per pixel column
+    void decimate();
+    
+    // Conversions between freqs and the curve's position on the map
+    float getXOfFreq (float freq);
+    float getFreqAtX (float x);
+    float getDissonanceAtFreq (float freq);
+    
+    // The visible freq range, which is the calc's range unless the map is zoomed or panned
+    Range<float> getViewRange();
+    void setViewRange (Range<float> newRange);
+    void resetView();
+    
     ValueTree mapData;
     AsyncOptimaUpdater asyncOptimaUpdater;
+    AsyncSurfaceUpdater asyncSurfaceUpdater;
+    MapRefresher refresher;
 
 private:
+    friend class DistributionBinding;
+    
     ThemedComboBox dissonanceModel;
-    ThemedTextEditor startFreq, endRatio;
+    ThemedTextEditor startFreq, endRatio, resolution;
     
     DissonanceCalc calc;
+    
+    // Min and max dissonance of the steps under each pixel column
+    HeapBlock<float> columnMin, columnMax;
+    int numColumns;
+    
+    // Empty while the calc's range is shown
+    Range<float> viewRange, dragStartRange;
+    
+    // The latest pass of the curve, and its optima for the optima jobs once it's finished
+    ProgressiveMapJob curveJob;
+    AdaptiveCurve curve;
+    float referenceFreq;
+    bool curveFinished, optimaRequested;
+    
+    Array<float> curveMinima, curveMaxima;
+    CriticalSection curveOptimaLock;
+    
+    // Optima are moved to the nearest optima of the finished curve while only partials' freqs or
+    // amps change, and searched for again if any appear or vanish
+    bool trackingOptima;
+    float optimaReferenceFreq;
+    
+    void trackOptima();
+    void trackOptima (Array<float>& freqs, OwnedArray<OptimaComponent>& components, bool isMin, float minInterval);
+    
+    // Moves each component to the new freq in its place, and removes those whose new freq is 0
+    void moveOptima (const Array<float>& newFreqs, Array<float>& freqs, OwnedArray<OptimaComponent>& components);
+    
+    // Null unless the calc has both x-axis and y-axis distributions
+    DissonanceSurface::Ptr surface;
+    Image surfaceImage;
+    Array<bool> drawnTiles;
+    Range<float> drawnRange;
+    
+    // The finished surface, for the optima jobs
+    DissonanceSurface::Ptr optimaSurface;
+    float surfaceMinInterval;
+    
+    // One binding per DisMAL distribution, in DisMAL index order
+    OwnedArray<DistributionBinding> bindings;
+    
     NormalisableRange<float> normalizer, denormalizer;
     OwnedArray<OptimaComponent> minima, maxima;
     
     FindAndCreateOptimaJob updateMinimaJob, updateMaximaJob;
-    
-    PartialComparator comparator;
+    OptimumSensitivityJob sensitivityJob;
         
+    // Counts hovers, so a readout waiting on the last one is dropped when another optimum is hovered
+    int sensitivityGeneration;
+    
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (DissonanceMap)
 };
 
@@ -141,7 +480,8 @@ private:
     Simple container component for DissonanceMap components.  Goes inside a MapViewport.
 */
 class MapList   : public Component,
-                  public ValueTree::Listener
+                  public ValueTree::Listener,
+                  private Timer
 {
 public:
     MapList();
@@ -160,6 +500,12 @@ public:
     void valueTreeParentChanged (ValueTree& adoptedTree) override {}
     void valueTreeRedirected (ValueTree& redirectedTree) override {}
     
+    // Exports maps to a new file in the export location (or a new folder of .npy files)
+    void exportMaps (const Array<DissonanceMap*>& mapsToExport, MapExporter::Format format);
+    
+    // Shows a menu of export formats, then exports the maps in the one chosen
+    void showExportMenu (const Array<DissonanceMap*>& mapsToExport, const String& title);
+    
     OwnedArray<DissonanceMap> maps;
     ValueTree mapsData;
     UndoManager* undo;
@@ -167,6 +513,12 @@ public:
 private:
     int mapHeight;
     
+    // Removed maps are kept until their jobs have left the pool, as the jobs use them
+    OwnedArray<DissonanceMap> removedMaps;
+    
+    // Deletes the removed maps whose jobs are done
+    void timerCallback() override;
+    
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MapList)
 };
 
@@ -187,6 +539,38 @@ private:
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MapViewport)
 };
 
+//==============================================================================
+/*
+    Displays the roughness of the audio input, as analyzed by an InputAnalyzer.
+ 
+    The bar is smoothed so it can be read while playing, and its scale follows the
+    loudest roughness heard recently, decaying slowly back down.
+*/
+class RoughnessMeter   : public Component,
+                         public SettableTooltipClient,
+                         public ChangeListener
+{
+public:
+    RoughnessMeter();
+    ~RoughnessMeter();
+    
+    void paint (Graphics& g) override;
+    
+    // Called by the InputAnalyzer whenever a new analysis is available
+    void changeListenerCallback (ChangeBroadcaster* source) override;
+    
+    void setInputAnalyzer (InputAnalyzer& analyzer);
+    
+    // Sets the model the analyzer measures the input's roughness with
+    void setModel (Roughness::Model model);
+
+private:
+    InputAnalyzer* inputAnalyzer;
+    float level, peak;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (RoughnessMeter)
+};
+
 //==============================================================================
 class DissMapComponentFooter   : public Component,
                                  public ComboBox::Listener,
@@ -203,10 +587,11 @@ public:
     void buttonClicked (Button* clickedButton) override;
     
     ValueTree data;
+    RoughnessMeter roughness;
     
 private:
     ThemedComboBox gridLines;
-    ThemedButton showMinima, showMaxima;
+    ThemedButton showMinima, showMaxima, generateTuning, exportMaps;
 };
 
 //==============================================================================
@@ -223,6 +608,16 @@ public:
     void resized() override;
     
     void setData (ValueTree& calcList, UndoManager& undo);
+    void setInputAnalyzer (InputAnalyzer& analyzer);
+    
+    // Sets the model the input's roughness is measured with, from the first calc's model
+    void setInputModel (Roughness::Model model);
+    
+    // Minima of every map, as ratios
+    Array<float> getMinimaRatios();
+    
+    // Exports every map, in the format chosen from a menu
+    void showExportMenu();
     
 private:
     MapList maps;
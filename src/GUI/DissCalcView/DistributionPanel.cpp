@@ -14,6 +14,14 @@
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "DistributionPanel.h"
 #include "DissCalcView.h"
+#include "MainComponent.h"
+
+//==============================================================================
+void PartialEditorViewport::visibleAreaChanged (const Rectangle<int>& newVisibleArea)
+{
+    if (PartialEditorList* list = dynamic_cast<PartialEditorList*> (getViewedComponent()))
+        list->updateVisibleRows();
+}
 
 //==============================================================================
 PartialOptions::PartialOptions()
@@ -57,7 +65,7 @@ void PartialOptions::resized()
                           .reduced (3, 6)
                           .withY (6));
     
-    if (partial != nullptr && partial->getPartialData().hasType (IDs::Partial))
+    if (partial != nullptr)
     {
         removeButton.setBounds (Rectangle<int> (getHeight(), getHeight())
                                 .reduced (6, 6)
@@ -72,7 +80,7 @@ void PartialOptions::resized()
 }
 
 //==============================================================================
-PartialEditor::PartialEditor()   : partial (IDs::Partial)
+PartialEditor::PartialEditor()   : distribution (IDs::OvertoneDistribution)
 {    
     optionsButton.setIcon (true, FontAwesome_EllipsisV);
     optionsButton.setPanelButton (true);
@@ -92,8 +100,15 @@ PartialEditor::PartialEditor()   : partial (IDs::Partial)
     addAndMakeVisible (amplitudeEditor);
     amplitudeEditor.addListener (this);
     
+    frequencyEditor.setScrubbable (true);
+    frequencyEditor.addScrubListener (this);
+    amplitudeEditor.setScrubbable (true);
+    amplitudeEditor.addScrubListener (this);
+    
     addMouseListener (getTopLevelComponent(), true);
-    partial.addListener (this);
+    
+    index = -1;
+    showingMuted = false;
 }
 
 PartialEditor::~PartialEditor()
@@ -114,6 +129,9 @@ void PartialEditor::resized()
     
     frequencyEditor.setBounds (area.removeFromLeft (area.getWidth() / 2).reduced (2).withTop (0).withRight (area.getWidth()));
     amplitudeEditor.setBounds (area.reduced (2).withTop (0).withX (area.getWidth() + 1).withRight (area.getWidth() * 2));
+    
+    if (showingMuted)
+        amplitudeEditor.setBounds (amplitudeEditor.getBounds().reduced (1));
 }
 
 void PartialEditor::buttonClicked (Button* clickedButton)
@@ -126,51 +144,56 @@ void PartialEditor::buttonClicked (Button* clickedButton)
 
 void PartialEditor::textEditorFocusLost (TextEditor& editor)
 {
+    PartialArray partials (distribution);
+    
+    if (! isPositiveAndBelow (index, partials.size()))
+        return;
+    
     if (&editor == &frequencyEditor
-        && frequencyEditor.getEvaluated() != partial[IDs::Freq].operator float())
+        && frequencyEditor.getEvaluated() != partials.getFreq (index))
     {
         if (frequencyEditor.getEvaluated() > 0 && ! containsFreq (frequencyEditor.getEvaluated()))
         {
             // Check if it's the first entry of a freq value so an initial value isn't undone
             // Prevents partial freqs/amps from being set to 0
-            if (partial[IDs::Freq].operator float() > 0)
+            if (partials.getFreq (index) > 0)
             {
                 findParentComponentOfClass<DistributionPanel>()->undo->beginNewTransaction();
-
-                partial.setProperty (IDs::Freq, frequencyEditor.getEvaluated(),
-                                     findParentComponentOfClass<DistributionPanel>()->undo);
+                
+                partials.setFreq (index, frequencyEditor.getEvaluated(),
+                                  findParentComponentOfClass<DistributionPanel>()->undo);
             }
             else
             {
-                partial.setProperty (IDs::Freq, frequencyEditor.getEvaluated(), nullptr);
+                partials.setFreq (index, frequencyEditor.getEvaluated(), nullptr);
             }
         }
         else
         {
             // TODO: Popup warning that another partial contains the input frequency
-            editor.setText (partial[IDs::Freq].toString());
+            update();
         }
     }
     else if (&editor == &amplitudeEditor
-             && amplitudeEditor.getEvaluated() != partial[IDs::Amp].operator float())
+             && amplitudeEditor.getEvaluated() != partials.getAmp (index))
     {
         if (amplitudeEditor.getEvaluated() > 0)
         {
-            if (partial[IDs::Amp].operator float() > 0)
+            if (partials.getAmp (index) > 0)
             {
                 findParentComponentOfClass<DistributionPanel>()->undo->beginNewTransaction();
                 
-                partial.setProperty (IDs::Amp, amplitudeEditor.getEvaluated(),
-                                     findParentComponentOfClass<DistributionPanel>()->undo);
+                partials.setAmp (index, amplitudeEditor.getEvaluated(),
+                                 findParentComponentOfClass<DistributionPanel>()->undo);
             }
             else
             {
-                partial.setProperty (IDs::Amp, amplitudeEditor.getEvaluated(), nullptr);
+                partials.setAmp (index, amplitudeEditor.getEvaluated(), nullptr);
             }
         }
         else
         {
-            editor.setText (partial[IDs::Amp].toString());
+            update();
         }
     }
 }
@@ -180,54 +203,86 @@ void PartialEditor::textEditorReturnKeyPressed (TextEditor& editor)
     unfocusAllComponents();
 }
 
-bool PartialEditor::containsFreq (float freq)
+void PartialEditor::textEditorScrubStarted (ThemedTextEditor& editor)
 {
-    for (auto child : partial.getParent())
+    // The whole drag is undone at once, as the partial's edits coalesce into a single action
+    findParentComponentOfClass<DistributionPanel>()->undo->beginNewTransaction();
+}
+
+void PartialEditor::textEditorScrubbed (ThemedTextEditor& editor, double newValue)
+{
+    PartialArray partials (distribution);
+    
+    if (! isPositiveAndBelow (index, partials.size()))
+        return;
+    
+    if (&editor == &frequencyEditor)
     {
-        if ((child[IDs::Freq].operator float() == freq
-             && child.hasType (IDs::Partial))
-            || freq == 1.0
-            || freq <= 0)
-        {
-            return true;
-        }
+        if (! containsFreq ((float) newValue))
+            partials.setFreq (index, (float) newValue, findParentComponentOfClass<DistributionPanel>()->undo);
+    }
+    else if (&editor == &amplitudeEditor)
+    {
+        partials.setAmp (index, (float) newValue, findParentComponentOfClass<DistributionPanel>()->undo);
     }
+}
+
+void PartialEditor::textEditorScrubEnded (ThemedTextEditor& editor)
+{
+    update();
+    
+    if (&editor == &frequencyEditor)
+        findParentComponentOfClass<PartialEditorList>()->updateSortOrder (index);
+}
+
+bool PartialEditor::containsFreq (float freq)
+{
+    return PartialArray (distribution).containsFreq (freq);
+}
+
+void PartialEditor::setPartial (const ValueTree& distributionNode, int partialIndex)
+{
+    distribution = distributionNode;
+    index = partialIndex;
     
-    return false;
+    update();
 }
 
-void PartialEditor::setPartialData (ValueTree& data)
+int PartialEditor::getIndex() const
 {
-    partial = data;
+    return index;
 }
 
-ValueTree& PartialEditor::getPartialData()
+void PartialEditor::setIndex (int partialIndex)
 {
-    return partial;
+    index = partialIndex;
 }
 
-void PartialEditor::valueTreePropertyChanged (ValueTree& parent, const Identifier& ID)
+float PartialEditor::getFreq() const
 {
-    if (parent == partial)
+    return PartialArray (distribution).get (index).freq;
+}
+
+bool PartialEditor::isMuted() const
+{
+    return PartialArray (distribution).get (index).mute;
+}
+
+void PartialEditor::update()
+{
+    PartialData partial = PartialArray (distribution).get (index);
+    
+    // Partials that haven't been entered yet have 0 freq/amp and show empty editors
+    frequencyEditor.setText (partial.freq > 0 ? String (partial.freq) : String());
+    
+    amplitudeEditor.setEnabled (! partial.mute);
+    amplitudeEditor.setText (partial.mute ? String ("Muted")
+                                          : (partial.amp > 0 ? String (partial.amp) : String()));
+    
+    if (showingMuted != partial.mute)
     {
-        if (ID == IDs::Mute)
-        {
-            jassert (partial[IDs::Mute].isBool());
-            
-            amplitudeEditor.setEnabled (! partial[ID]);
-            amplitudeEditor.setText (partial[ID] ? "Muted" : partial[IDs::Amp]);
-            amplitudeEditor.setBounds (partial[ID]
-                                       ? amplitudeEditor.getBounds().reduced (1)
-                                       : amplitudeEditor.getBounds().expanded (1));
-        }
-        else if (ID == IDs::Freq)
-        {
-            frequencyEditor.setText (partial[ID]);
-        }
-        else if (ID == IDs::Amp)
-        {
-            amplitudeEditor.setText (partial[ID]);
-        }
+        showingMuted = partial.mute;
+        resized();
     }
 }
 
@@ -235,13 +290,11 @@ void PartialEditor::valueTreePropertyChanged (ValueTree& parent, const Identifie
 PartialEditorList::PartialEditorList()   : distribution (IDs::OvertoneDistribution)
 {
     distribution.addListener (this);
-    
-    for (auto partial : distribution)
-    {
-        partial.addListener (this);
-    }
         
     editorHeight = 30;
+    updatingRows = false;
+    rowsNeedUpdate = false;
+    partialsVersion = 0;
 }
 
 PartialEditorList::~PartialEditorList()
@@ -255,10 +308,7 @@ void PartialEditorList::paint (Graphics& g)
 
 void PartialEditorList::resized()
 {
-    Rectangle<int> area = getLocalBounds();
-        
-    for (auto* editor : partialEditors)
-        editor->setBounds (area.removeFromTop (editorHeight));
+    updateVisibleRows();
 }
 
 void PartialEditorList::valueTreePropertyChanged (ValueTree& parent, const Identifier& ID)
@@ -280,81 +330,112 @@ void PartialEditorList::valueTreePropertyChanged (ValueTree& parent, const Ident
             fAmp.setEnabled (parent[ID] ? false : true);
             fAmp.setBounds (parent[ID] ? fAmp.getBounds().reduced (1) : fAmp.getBounds().expanded (1));
         }
-    }
-    
-    if (parent.getParent() == distribution)
-    {
-        for (int i = 0; i < distribution.getNumChildren(); ++i)
+        else if (ID == IDs::Partials)
         {
-            if (parent == distribution.getChild (i) && ID == IDs::Freq)
-            {
-                partialEditors.sort (comparator);
-                resized();
-                return;
-            }
+            PartialArray partials (parent);
+            PartialArray::Edit edit = partials.getEditSince (partialsVersion);
+            partialsVersion = partials.getVersion();
+            
+            if (edit.type == PartialArray::added)
+                partialAdded (edit.index);
+            else if (edit.type == PartialArray::removed)
+                partialRemoved (edit.index);
+            else if (edit.type == PartialArray::changed)
+                partialChanged (edit.index, edit.field);
+            else
+                setDistribution (distribution);
         }
     }
 }
 
-void PartialEditorList::valueTreeChildAdded (ValueTree& parent, ValueTree& newChild)
+void PartialEditorList::partialAdded (int index)
 {
-    if (parent == distribution)
+    for (auto* editor : partialEditors)
+        if (editor->getIndex() >= index)
+            editor->setIndex (editor->getIndex() + 1);
+    
+    for (auto& sortedIndex : sortedIndices)
+        if (sortedIndex >= index)
+            ++sortedIndex;
+    
+    addSortedIndex (index);
+    
+    updateSize();
+    updateVisibleRows();
+    
+    findParentComponentOfClass<DistributionPanel>()->titleBar.repaint();
+}
+
+void PartialEditorList::partialRemoved (int index)
+{
+    for (auto* editor : partialEditors)
     {
-        partialEditors.add (new PartialEditor());
-        addAndMakeVisible (partialEditors.getLast());
-        
-        newChild.addListener (this);
-        partialEditors.getLast()->setPartialData (newChild);
-        
-        if (newChild[IDs::Freq])
+        if (editor->getIndex() == index)
         {
-            partialEditors.getLast()->frequencyEditor.setText (newChild[IDs::Freq]);
-            partialEditors.getLast()->amplitudeEditor.setText (newChild[IDs::Amp]);
-            partialEditors.sort (comparator);
+            // Cleared first so text being edited isn't committed to the partial after it
+            editor->setIndex (-1);
+            closeOptionsFor (editor);
+            editor->setVisible (false);
         }
-        
-        setSize (getWidth(), partialEditors.size() * editorHeight);
-        
-        findParentComponentOfClass<DistributionPanel>()->titleBar.repaint();
-        
-        if (newChild[IDs::Mute])
+        else if (editor->getIndex() > index)
         {
-            jassert (newChild[IDs::Mute].isBool());
-            
-            ThemedTextEditor& amp = partialEditors[parent.indexOf (newChild)]->amplitudeEditor;
-            
-            amp.setEnabled (! newChild[IDs::Mute]);
-            amp.setText (newChild[IDs::Mute] ? "Muted" : newChild[IDs::Amp]);
-            amp.setBounds (newChild[IDs::Mute]
-                           ? amp.getBounds().reduced (1)
-                           : amp.getBounds().expanded (1));
+            editor->setIndex (editor->getIndex() - 1);
         }
     }
+    
+    sortedIndices.removeFirstMatchingValue (index);
+    
+    for (auto& sortedIndex : sortedIndices)
+        if (sortedIndex > index)
+            --sortedIndex;
+    
+    updateSize();
+    updateVisibleRows();
+    
+    findParentComponentOfClass<DistributionPanel>()->titleBar.repaint();
 }
 
-void PartialEditorList::valueTreeChildRemoved (ValueTree& parent, ValueTree& removedChild, int childIndex)
+void PartialEditorList::partialChanged (int index, const Identifier& field)
 {
-    if (parent == distribution
-        && removedChild.hasType (IDs::Partial))
+    for (auto* editor : partialEditors)
     {
-        for (auto* editor : partialEditors)
+        if (editor->getIndex() == index)
         {
-            if (editor->getPartialData() == removedChild)
-                partialEditors.removeObject (editor);
+            editor->update();
+            break;
         }
-        
-        setSize (getWidth(), partialEditors.size() * editorHeight);
-        
-        PartialOptions* options = findParentComponentOfClass<DistributionPanel>()->options;
-        
-        if (options->partial != nullptr
-            && options->partial->getPartialData() == removedChild)
-        {
-            options->partial = nullptr;
-            options->setVisible (false);
-        }
-        
-        findParentComponentOfClass<DistributionPanel>()->titleBar.repaint();
+    }
+    
+    if (field != IDs::Freq && field.isValid())
+        return;
+    
+    // A row isn't moved while its freq is being dragged, so it stays under the mouse
+    for (auto* editor : partialEditors)
+        if (editor->getIndex() == index && editor->frequencyEditor.isScrubbing())
+            return;
+    
+    updateSortOrder (index);
+}
+
+void PartialEditorList::updateSortOrder (int index)
+{
+    // Only the changed partial needs to move, everything else is still in order
+    sortedIndices.removeFirstMatchingValue (index);
+    addSortedIndex (index);
+    
+    updateVisibleRows();
+}
+
+void PartialEditorList::closeOptionsFor (PartialEditor* editor)
+{
+    DistributionPanel* panel = findParentComponentOfClass<DistributionPanel>();
+    
+    if (panel != nullptr
+        && panel->options != nullptr
+        && panel->options->partial == editor)
+    {
+        panel->options->partial = nullptr;
+        panel->options->setVisible (false);
     }
 }
 
@@ -362,33 +443,131 @@ void PartialEditorList::setDistribution (ValueTree& distributionNode)
 {
     distribution = distributionNode;
     
-    partialEditors.clear();
+    for (auto* editor : partialEditors)
+    {
+        closeOptionsFor (editor);
+        editor->setVisible (false);
+        editor->setIndex (-1);
+    }
+    
+    sortIndices();
+    
+    updateSize();
+    updateVisibleRows();
+}
+
+void PartialEditorList::sortIndices()
+{
+    PartialArray partials (distribution);
+    partialsVersion = partials.getVersion();
+    
+    sortedIndices.clearQuick();
+    sortedIndices.ensureStorageAllocated (partials.size());
+    
+    for (int i = 0; i < partials.size(); ++i)
+        sortedIndices.add (i);
     
-    for (auto partial : distribution)
+    // Stable, so partials without a freq stay in the order they were added
+    comparator.freqs = partials.getFreqs();
+    sortedIndices.sort (comparator, true);
+}
+
+void PartialEditorList::addSortedIndex (int index)
+{
+    comparator.freqs = PartialArray (distribution).getFreqs();
+    sortedIndices.addSorted (comparator, index);
+}
+
+void PartialEditorList::updateSize()
+{
+    setSize (getWidth(), sortedIndices.size() * editorHeight);
+}
+
+void PartialEditorList::updateVisibleRows()
+{
+    /*
+        Committing a text editor's value when it loses focus to a recycled editor will
+        change the partial data, which comes back here. The rows are updated again once
+        the current update has finished.
+    */
+    if (updatingRows)
     {
-        if (partial.hasType (IDs::Partial))
+        rowsNeedUpdate = true;
+        return;
+    }
+    
+    updatingRows = true;
+    
+    do
+    {
+        rowsNeedUpdate = false;
+        
+        Viewport* viewport = findParentComponentOfClass<Viewport>();
+        Rectangle<int> visibleArea = viewport != nullptr ? viewport->getViewArea() : getLocalBounds();
+        
+        int firstRow = jlimit (0, sortedIndices.size(), visibleArea.getY() / editorHeight);
+        int lastRow = jlimit (0, sortedIndices.size(), visibleArea.getBottom() / editorHeight + 1);
+        
+        // Editors that are already showing a visible partial only need to be moved
+        Array<PartialEditor*> spareEditors;
+        Array<int> rowsToFill;
+        
+        for (auto* editor : partialEditors)
+            spareEditors.add (editor);
+        
+        for (int row = firstRow; row < lastRow; ++row)
         {
-            partialEditors.add (new PartialEditor());
-            addAndMakeVisible (partialEditors.getLast());
+            bool isShown = false;
             
-            PartialEditor* editor = partialEditors.getLast();
+            for (int i = 0; i < spareEditors.size(); ++i)
+            {
+                if (spareEditors[i]->getIndex() == sortedIndices[row])
+                {
+                    spareEditors[i]->setBounds (0, row * editorHeight, getWidth(), editorHeight);
+                    spareEditors.remove (i);
+                    isShown = true;
+                    break;
+                }
+            }
             
-            editor->setPartialData (partial);
-            editor->getPartialData().addListener (this);
+            if (! isShown)
+                rowsToFill.add (row);
+        }
+        
+        for (auto row : rowsToFill)
+        {
+            PartialEditor* editor;
+            
+            if (spareEditors.isEmpty())
+            {
+                editor = partialEditors.add (new PartialEditor());
+                addChildComponent (editor);
+            }
+            else
+            {
+                editor = spareEditors.removeAndReturn (spareEditors.size() - 1);
+                closeOptionsFor (editor);
+                
+                if (editor->hasKeyboardFocus (true))
+                    unfocusAllComponents();
+            }
             
-            editor->frequencyEditor.setText (partial[IDs::Freq]);
-            editor->amplitudeEditor.setEnabled (! partial[IDs::Mute]);
-            editor->amplitudeEditor.setText (partial[IDs::Mute] ? "Muted" : partial[IDs::Amp]);
-            editor->amplitudeEditor.setBounds (partial[IDs::Mute]
-                                               ? editor->amplitudeEditor.getBounds().reduced (1)
-                                               : editor->amplitudeEditor.getBounds().expanded (1));
+            editor->setPartial (distribution, sortedIndices[row]);
+            editor->setBounds (0, row * editorHeight, getWidth(), editorHeight);
+            editor->setVisible (true);
+        }
+        
+        // Anything left over has scrolled out of view, and is kept for reuse
+        for (auto* editor : spareEditors)
+        {
+            closeOptionsFor (editor);
+            editor->setVisible (false);
+            editor->setIndex (-1);
         }
     }
+    while (rowsNeedUpdate);
     
-    partialEditors.sort (comparator);
-    
-    setSize (getWidth(), partialEditors.size() * editorHeight);
-    resized();
+    updatingRows = false;
 }
 
 //==============================================================================
@@ -449,7 +628,7 @@ void DistributionPanelTitleBar::paint (Graphics& g)
     g.setFont (f);
     g.drawText ("Fundamental", 0, 25, getWidth(), 25, Justification::centred);
     
-    if (findParentComponentOfClass<DistributionPanel>()->getDistribution().getNumChildren() > 0)
+    if (PartialArray (findParentComponentOfClass<DistributionPanel>()->getDistribution()).size() > 0)
     {
         g.drawLine (10, getHeight() - 26, getWidth() - 10, getHeight() - 26, 3);
         g.drawText ("Overtones", 0, getHeight() - 25, getWidth(), 25, Justification::centred);
@@ -491,10 +670,21 @@ DistributionPanel::DistributionPanel()
     addButton.addListener (this);
     addButton.setIconSize (20);
 
+    fitButton.setIcon (true, FontAwesome_Magic);
+    addAndMakeVisible (&fitButton);
+    fitButton.addListener (this);
+    fitButton.setIconSize (18);
+    fitButton.setTooltip ("Move the partials so the tuning's intervals land in dissonance minima");
+    
+    fitting = false;
+    optimizer.addChangeListener (this);
+    
     distributionListView.setViewedComponent (&partialList, false);
     distributionListView.setScrollBarsShown (false, false, true, false);
     addAndMakeVisible (distributionListView);
     
+    addAndMakeVisible (spectrum);
+    
     addAndMakeVisible (titleBar);
     
     addChildComponent (options);
@@ -510,6 +700,8 @@ DistributionPanel::DistributionPanel()
 
 DistributionPanel::~DistributionPanel()
 {
+    optimizer.removeChangeListener (this);
+    optimizer.stopThread (5000);
 }
 
 void DistributionPanel::paint (Graphics& g)
@@ -520,6 +712,17 @@ void DistributionPanel::paint (Graphics& g)
     g.drawLine (getWidth(), 0, getWidth(), getHeight(), 6);
     g.drawLine (0, 0, 0, getHeight(), 6);
     g.fillRect (getLocalBounds().removeFromBottom (35));
+    
+    // Progress of the fit, between the footer's buttons
+    if (fitting)
+    {
+        Rectangle<int> footer = getLocalBounds().removeFromBottom (35).reduced (38, 14);
+        
+        g.setColour (Theme::mainBackground);
+        g.fillRect (footer);
+        g.setColour (Theme::activeText);
+        g.fillRect (footer.withWidth (roundToInt (footer.getWidth() * jlimit (0.0, 1.0, optimizer.getProgress()))));
+    }
 }
 
 void DistributionPanel::resized()
@@ -530,16 +733,24 @@ void DistributionPanel::resized()
     
     titleBar.setBounds (header);
     addButton.setBounds (footer.removeFromRight (footer.getHeight()).reduced (3));
+    fitButton.setBounds (footer.removeFromLeft (footer.getHeight()).reduced (3));
 
+    spectrum.setBounds (area.removeFromBottom (100).reduced (3, 0));
+    
     distributionListView.setBounds (area.withHeight (area.getHeight() - 1));
-    partialList.setBounds (area.withHeight (area.getHeight() - 1));
+    partialList.setSize (area.getWidth(), partialList.getHeight());
 }
 
 void DistributionPanel::setDistribution (ValueTree& newDistribution)
 {
     if (newDistribution.hasType (IDs::OvertoneDistribution))
     {
+        // A fit only applies to the distribution it started from
+        if (fitting && newDistribution != getDistribution())
+            stopFitting();
+        
         partialList.setDistribution (newDistribution);
+        spectrum.setDistribution (newDistribution);
         titleBar.distributionName.setText (getDistribution().getProperty (IDs::Name, ""));
         titleBar.fundamentalFreq.setText (getDistribution()[IDs::FundamentalFreq]);
         
@@ -595,16 +806,18 @@ void DistributionPanel::buttonClicked (Button* clickedButton)
     if (clickedButton == &addButton)
     {
         undo->beginNewTransaction();
-        partialList.distribution.appendChild (ValueTree (IDs::Partial), undo);
+        PartialArray (partialList.distribution).add (PartialData(), undo);
+    }
+    else if (clickedButton == &fitButton)
+    {
+        fitting ? stopFitting() : startFitting();
     }
     else if (clickedButton == &options->removeButton)
     {
-        undo->beginNewTransaction();
-        options->partial->getPartialData().setProperty (IDs::Freq,
-                                                       options->partial->getPartialData()[IDs::Freq],
-                                                       undo);
+        int index = options->partial->getIndex();
         
-        partialList.distribution.removeChild (options->partial->getPartialData(), undo);
+        undo->beginNewTransaction();
+        PartialArray (partialList.distribution).remove (index, undo);
         
         options->setVisible (false);
         options->partial = nullptr;
@@ -613,8 +826,10 @@ void DistributionPanel::buttonClicked (Button* clickedButton)
     {
         if (options->partial != nullptr)
         {
-            ValueTree partial = options->partial->getPartialData();
-            partial.setProperty (IDs::Mute, ! partial[IDs::Mute], nullptr);
+            PartialArray partials (partialList.distribution);
+            int index = options->partial->getIndex();
+            
+            partials.setMute (index, ! partials.isMuted (index), nullptr);
         }
         else
         {
@@ -679,3 +894,53 @@ void DistributionPanel::textEditorReturnKeyPressed (TextEditor& editor)
 {
     unfocusAllComponents();
 }
+
+void DistributionPanel::changeListenerCallback (ChangeBroadcaster* source)
+{
+    if (! fitting)
+        return;
+    
+    if (optimizer.isFinished())
+    {
+        // Edits made during the search win over the fit
+        if (optimizer.applyResult (getDistribution(), undo))
+            fitButton.setTooltip ("Dissonance over the tuning went from "
+                                  + String (optimizer.getStartDissonance()) + " to "
+                                  + String (optimizer.getBestDissonance()));
+        
+        fitting = false;
+        fitButton.setIcon (true, FontAwesome_Magic);
+    }
+    
+    repaint();
+}
+
+void DistributionPanel::startFitting()
+{
+    DissCalcView* view = findParentComponentOfClass<DissCalcView>();
+    MainComponent* main = findParentComponentOfClass<MainComponent>();
+    
+    if (view == nullptr || main == nullptr || ! getDistribution().isValid())
+        return;
+    
+    PropertiesFile* settings = main->getSettings();
+    
+    // Partials move up to a whole tone by default, and the search runs from a start per thread
+    optimizer.setTimbre (getDistribution(), view->tuningWindow.tuning,
+                         (float) settings->getDoubleValue ("Optim. Fit Range", 200));
+    optimizer.startSearch (jmax (1, SystemStats::getNumCpus() - 1),
+                           jmax (1, settings->getIntValue ("Optim. Fit Iterations", 300)));
+    
+    fitting = true;
+    fitButton.setIcon (true, FontAwesome_TimesCircle);
+    repaint();
+}
+
+void DistributionPanel::stopFitting()
+{
+    optimizer.stopThread (5000);
+    
+    fitting = false;
+    fitButton.setIcon (true, FontAwesome_Magic);
+    repaint();
+}
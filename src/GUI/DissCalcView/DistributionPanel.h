@@ -15,26 +15,22 @@
 
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "IDs.h"
+#include "PartialArray.h"
+#include "SpectrumPlot.h"
 #include "ThemedComponents.h"
+#include "TimbreOptimizer.h"
 
 //==============================================================================
 // Component that displays and edits partial data
 class PartialEditor   : public Component,
                         public Button::Listener,
                         public TextEditor::Listener,
-                        public ValueTree::Listener
+                        public ThemedTextEditor::ScrubListener
 {
 public:
     PartialEditor();
     ~PartialEditor();
     
-    // For sorting by ascending frequency
-    friend bool operator< (const PartialEditor& first, const PartialEditor& second) noexcept
-    {
-        return (first.frequencyEditor.getText().getFloatValue()
-                < second.frequencyEditor.getText().getFloatValue());
-    }
-    
     void paint (Graphics& g) override;
     void resized() override;
     
@@ -43,19 +39,21 @@ public:
     void textEditorFocusLost (TextEditor& editor) override;
     void textEditorReturnKeyPressed (TextEditor& editor) override;
     
-    // Data model callbacks
-    void valueTreePropertyChanged (ValueTree& parent, const Identifier& ID) override;
+    // Drag-to-edit callbacks
+    void textEditorScrubStarted (ThemedTextEditor& editor) override;
+    void textEditorScrubbed (ThemedTextEditor& editor, double newValue) override;
+    void textEditorScrubEnded (ThemedTextEditor& editor) override;
     
-    // Unused pure-virtual callbacks inhereted from ValueTree::Listener
-    void valueTreeChildAdded (ValueTree& parent, ValueTree& newChild) override {}
-    void valueTreeChildRemoved (ValueTree& parent, ValueTree& removedChild, int childIndex) override {}
-    void valueTreeChildOrderChanged (ValueTree& parent, int oldIndex, int newIndex) override {}
-    void valueTreeParentChanged (ValueTree& adoptedTree) override {}
-    void valueTreeRedirected (ValueTree& redirectedTree) override {}
+    // Get/set the partial shown by this editor, as an index into the distribution's partial array
+    void setPartial (const ValueTree& distributionNode, int partialIndex);
+    int getIndex() const;
+    void setIndex (int partialIndex);
+    
+    float getFreq() const;
+    bool isMuted() const;
     
-    // Get/set the valuetree for the partial's data
-    void setPartialData (ValueTree& data);
-    ValueTree& getPartialData();
+    // Refreshes the text editors from the partial array
+    void update();
     
     // Checks if the overtone distribution that this partial belongs to
     // already contains a partial with the given frequency
@@ -65,74 +63,66 @@ public:
     ThemedButton optionsButton;
     
 private:
-    ValueTree partial;
+    ValueTree distribution;
+    int index;
+    bool showingMuted;
         
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PartialEditor)
 };
 
 //==============================================================================
-// This class enables the sorting of PartialEditor components as well as Partial valuetree nodes
+/*
+    This class enables the sorting of partial array indices by ascending frequency.
+ 
+    Sorting is done on the packed freq array, so no components are needed to order the partials.
+*/
 class PartialComparator
 {
 public:
-    PartialComparator(){}
+    PartialComparator()   : freqs (nullptr) {}
     ~PartialComparator(){}
     
-    int compareElements (PartialEditor* first, PartialEditor* second)
+    int compareElements (int first, int second)
     {
-        if (first->frequencyEditor.isEmpty()
-            && second->frequencyEditor.isEmpty())
+        float firstFreq = freqs[first];
+        float secondFreq = freqs[second];
+        
+        // Partials without a freq yet go at the end
+        if (firstFreq <= 0 && secondFreq <= 0)
         {
             return 0;
         }
-        else if (second->frequencyEditor.isEmpty())
+        else if (secondFreq <= 0)
         {
             return -1;
         }
-        else if (first->frequencyEditor.isEmpty())
+        else if (firstFreq <= 0)
         {
             return 1;
         }
-        else if (first->getPartialData()[IDs::Freq].operator float()
-            < second->getPartialData()[IDs::Freq].operator float())
+        else if (firstFreq < secondFreq)
         {
-            first->frequencyEditor.setText (first->getPartialData()[IDs::Freq]);
-            second->frequencyEditor.setText (second->getPartialData()[IDs::Freq]);
-
             return -1;
         }
-        else if (first->getPartialData()[IDs::Freq].operator float()
-                 > second->getPartialData()[IDs::Freq].operator float())
+        else if (firstFreq > secondFreq)
         {
-            first->frequencyEditor.setText (first->getPartialData()[IDs::Freq]);
-            second->frequencyEditor.setText (second->getPartialData()[IDs::Freq]);
-            
             return 1;
         }
         
         return 0;
     }
     
-    int compareElements (const ValueTree& first, const ValueTree& second)
-    {
-        if (first[IDs::Freq].operator float() < second[IDs::Freq].operator float())
-        {
-            return -1;
-        }
-        else if (first[IDs::Freq].operator float() > second[IDs::Freq].operator float())
-        {
-            return 1;
-        }
-        
-        return 0;
-    }
+    // Set from PartialArray::getFreqs() before sorting
+    const float* freqs;
 };
 
 //==============================================================================
 /*
     Contains all partials for the currently viewed overtone distribution.
  
-    This component goes in a viewport owned by DistributionPanel.
+    This component goes in a viewport owned by DistributionPanel. It is sized to fit
+    every partial, but only creates editors for the rows in the viewport's visible area,
+    and reuses them for other partials as the list is scrolled.
 */
 class PartialEditorList   : public Component,
                             public ValueTree::Listener
@@ -146,10 +136,10 @@ public:
     
     // Data model callbacks
     void valueTreePropertyChanged (ValueTree& parent, const Identifier& ID) override;
-    void valueTreeChildAdded (ValueTree& parent, ValueTree& newChild) override;
-    void valueTreeChildRemoved (ValueTree& parent, ValueTree& removedChild, int childIndex) override;
     
     // Unused pure-virtual callbacks inhereted from ValueTree::Listener
+    void valueTreeChildAdded (ValueTree& parent, ValueTree& newChild) override {}
+    void valueTreeChildRemoved (ValueTree& parent, ValueTree& removedChild, int childIndex) override {}
     void valueTreeChildOrderChanged (ValueTree& parent, int oldIndex, int newIndex) override {}
     void valueTreeParentChanged (ValueTree& adoptedTree) override {}
     void valueTreeRedirected (ValueTree& redirectedTree) override {}
@@ -157,15 +147,58 @@ public:
     void setDistribution (ValueTree& distributionNode);
     ValueTree distribution;
     
+    // Shows the partials in the visible rows, recycling editors for rows that scrolled out of view
+    void updateVisibleRows();
+    
+    // Moves a partial to its place in the sorted order after its freq has changed
+    void updateSortOrder (int index);
+    
 private:
+    // Editors for the visible rows, which aren't kept in any particular order
     OwnedArray<PartialEditor> partialEditors;
+    
+    // Partial array indices, in the order they're displayed
+    Array<int> sortedIndices;
+    
     int editorHeight;
+    bool updatingRows, rowsNeedUpdate;
     
     PartialComparator comparator;
+    
+    // Version of the partial array the rows were last updated to
+    uint64 partialsVersion;
+    
+    void sortIndices();
+    void addSortedIndex (int index);
+    void updateSize();
+    
+    // Fine-grained updates for single partial edits
+    void partialAdded (int index);
+    void partialRemoved (int index);
+    void partialChanged (int index, const Identifier& field);
+    
+    void closeOptionsFor (PartialEditor* editor);
         
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PartialEditorList)
 };
 
+//==============================================================================
+/*
+    This subclass of Viewport is only created to override visibleAreaChanged(),
+    so the PartialEditorList can update its visible rows when it is scrolled.
+*/
+class PartialEditorViewport   : public Viewport
+{
+public:
+    PartialEditorViewport(){}
+    ~PartialEditorViewport(){}
+    
+    void visibleAreaChanged (const Rectangle<int>& newVisibleArea) override;
+
+private:
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PartialEditorViewport)
+};
+
 //==============================================================================
 /*
     Simple component that will become visible and reposition when a partial's
@@ -217,10 +250,15 @@ private:
 //==============================================================================
 /*
     Panel for viewing/editing overtone distribution data
+ 
+    The fit button moves the distribution's partials so that the app's tuning lands in the
+    timbre's dissonance minima (see TimbreOptimizer), showing the search's progress in the
+    footer. The fitted partials are set as a single undoable transaction.
 */
 class DistributionPanel   : public Component,
                             public Button::Listener,
-                            public TextEditor::Listener
+                            public TextEditor::Listener,
+                            public ChangeListener
 {
 public:
     DistributionPanel();
@@ -235,6 +273,9 @@ public:
     void textEditorFocusLost (TextEditor& editor) override;
     void textEditorReturnKeyPressed (TextEditor& editor) override;
     
+    // Called by the optimizer as it progresses and when it's done
+    void changeListenerCallback (ChangeBroadcaster* source) override;
+    
     // Get/set the currently viewed distribution data
     void setDistribution (ValueTree& newDistribution);
     ValueTree& getDistribution();
@@ -244,10 +285,17 @@ public:
     DistributionPanelTitleBar titleBar;
 
 private:
-    Viewport distributionListView;
+    PartialEditorViewport distributionListView;
     PartialEditorList partialList;
+    SpectrumPlot spectrum;
+    
+    ThemedButton addButton, fitButton;
+    
+    TimbreOptimizer optimizer;
+    bool fitting;
     
-    ThemedButton addButton;
+    void startFitting();
+    void stopFitting();
     
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (DistributionPanel)
 };
@@ -234,18 +234,22 @@ void SaveDistributionWindow::save()
     temp.removeProperty (IDs::IsViewed, nullptr);
     temp.removeProperty (IDs::XAxis, nullptr);
     temp.removeProperty (IDs::Mute, nullptr);
+    temp.removeProperty (IDs::LiveInput, nullptr);
     temp.setProperty (IDs::FundamentalFreq, 1, nullptr);
     temp.setProperty (IDs::FundamentalAmp, 1, nullptr);
     
-    for (auto child : temp)
+    Array<PartialData> partials;
+    
+    for (auto partial : PartialArray (temp).getAll())
     {
-        child.removeProperty (IDs::Mute, nullptr);
+        partial.mute = false;
         
-        if (child[IDs::Freq].operator float() <= 0
-            || child[IDs::Amp].operator float() <= 0)
-            temp.removeChild (child, nullptr);
+        if (partial.freq > 0 && partial.amp > 0)
+            partials.add (partial);
     }
     
+    PartialArray (temp).replaceAll (partials, nullptr);
+    
     file.saveTreeToFile (temp, true);
     
     setVisible (false);
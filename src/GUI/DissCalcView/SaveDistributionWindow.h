@@ -16,6 +16,7 @@
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "ThemedComponents.h"
 #include "IDs.h"
+#include "PartialArray.h"
 #include "../../../DisMAL/DisMAL.h"
 
 class SaveDistributionWindow   : public Component,
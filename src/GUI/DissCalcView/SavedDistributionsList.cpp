@@ -15,6 +15,44 @@
 #include "SavedDistributionsList.h"
 #include "DissCalcView.h"
 #include "MainComponent.h"
+#include "TuningGenerator.h"
+#include "Trace.h"
+
+namespace
+{
+    enum RankingColumns
+    {
+        nameColumn = 1,
+        partialsColumn,
+        dissonanceColumn,
+        relativeColumn
+    };
+    
+    const int numSimilarTimbres = 20;
+    
+    // Sorts ranked timbres by a column of the ranking table
+    struct RankingSorter
+    {
+        int column;
+        bool forwards;
+        
+        int compareElements (const TimbreRanking::Result& first, const TimbreRanking::Result& second) const
+        {
+            int result;
+            
+            if (column == nameColumn)
+                result = first.name.compareNatural (second.name);
+            else if (column == partialsColumn)
+                result = first.numPartials - second.numPartials;
+            else if (column == relativeColumn)
+                result = first.relative < second.relative ? -1 : (first.relative > second.relative ? 1 : 0);
+            else
+                result = first.dissonance < second.dissonance ? -1 : (first.dissonance > second.dissonance ? 1 : 0);
+            
+            return forwards ? result : -result;
+        }
+    };
+}
 
 //==============================================================================
 SavedDistributionsList::SavedDistributionsList()
@@ -41,6 +79,45 @@ SavedDistributionsList::SavedDistributionsList()
     view.setScrollBarsShown (false, false, true, false);
     addAndMakeVisible (view);
     
+    intervals.setTextToShowWhenEmpty ("Intervals (blank for the tuning)", Theme::border);
+    intervals.setTooltip (String ("Ratios to rank the timbres at, ie: 6/5 5/4 3/2\n")
+                          + String ("(every interval of the tuning when blank)"));
+    intervals.addListener (this);
+    addChildComponent (intervals);
+    
+    rankButton.setIcon (true, FontAwesome_SortAmountAsc);
+    rankButton.setIconSize (20);
+    rankButton.setPanelButton (true);
+    rankButton.addListener (this);
+    addAndMakeVisible (rankButton);
+    rankButton.setTooltip ("Rank every saved timbre by its dissonance at a set of intervals");
+    
+    similarButton.setIcon (true, FontAwesome_Search);
+    similarButton.setIconSize (18);
+    similarButton.setPanelButton (true);
+    similarButton.addListener (this);
+    addAndMakeVisible (similarButton);
+    similarButton.setTooltip ("List the saved timbres most similar to this distribution");
+    
+    TableHeaderComponent& header = rankingTable.getHeader();
+    header.addColumn ("Name", nameColumn, 130, 50, -1, TableHeaderComponent::defaultFlags);
+    header.addColumn ("Partials", partialsColumn, 55, 40, -1, TableHeaderComponent::defaultFlags);
+    header.addColumn ("Dissonance", dissonanceColumn, 75, 50, -1, TableHeaderComponent::defaultFlags);
+    header.addColumn ("Relative", relativeColumn, 65, 50, -1, TableHeaderComponent::defaultFlags);
+    header.setSortColumnId (dissonanceColumn, true);
+    header.setStretchToFitActive (true);
+    
+    rankingTable.setModel (this);
+    rankingTable.setRowHeight (25);
+    rankingTable.setColour (ListBox::backgroundColourId, Theme::mainBackground);
+    addChildComponent (rankingTable);
+    
+    showingRanking = false;
+    ranking.addChangeListener (this);
+    
+    showingSimilar = false;
+    index.addChangeListener (this);
+    
     addMouseListener (this, true);
     
     addKeyListener (this);
@@ -49,6 +126,11 @@ SavedDistributionsList::SavedDistributionsList()
 
 SavedDistributionsList::~SavedDistributionsList()
 {
+    ranking.removeChangeListener (this);
+    ranking.stopThread (5000);
+    
+    index.removeChangeListener (this);
+    index.stopThread (5000);
 }
 
 void SavedDistributionsList::paint (Graphics& g)
@@ -61,20 +143,34 @@ void SavedDistributionsList::paint (Graphics& g)
     f.setBold (true);
     g.setFont (f);
     
-    g.drawText ("Saved Timbres", 10, 5, 150, 25, Justification::centredLeft);
+    g.drawText (showingRanking ? "Ranked Timbres" : "Saved Timbres", 10, 5, 170, 25, Justification::centredLeft);
     g.fillRect (getLocalBounds().reduced (3).withTop (35).withBottom (getHeight() - 45));
+    
+    // Progress of the ranking, between the title and the close button
+    if (showingRanking && ranking.isThreadRunning())
+    {
+        Rectangle<int> progress = getLocalBounds().removeFromTop (35).withTrimmedLeft (180).withTrimmedRight (45).reduced (0, 14);
+        
+        g.fillRect (progress);
+        g.setColour (Theme::activeText);
+        g.fillRect (progress.withWidth (roundToInt (progress.getWidth() * jlimit (0.0, 1.0, ranking.getProgress()))));
+    }
 }
 
 void SavedDistributionsList::resized()
 {
     view.setBounds (Rectangle<int> (15, 40, getWidth() - 30, getHeight() - 90).reduced (5));
     viewComponent.setBounds (view.getBounds());
+    rankingTable.setBounds (view.getBounds());
     
     Rectangle<int> footer = getLocalBounds().removeFromBottom (45);
     Rectangle<int> header = getLocalBounds().removeFromTop (35);
 
     openButton.setBounds (footer.removeFromRight (45).reduced (10));
-    searchBar.setBounds (footer.reduced (10).withWidth (footer.getWidth() - 10));
+    rankButton.setBounds (footer.removeFromLeft (45).reduced (10));
+    similarButton.setBounds (footer.removeFromLeft (35).reduced (0, 10).withTrimmedRight (10));
+    searchBar.setBounds (footer.reduced (0, 10));
+    intervals.setBounds (searchBar.getBounds());
     
     closeButton.setBounds (header.removeFromRight (header.getHeight()).reduced (3));
     closeButton.setTopLeftPosition (closeButton.getX() - 1, closeButton.getY());
@@ -86,7 +182,12 @@ void SavedDistributionsList::show (ValueTree& treeNode)
     selectedFile = "";
     
     distributionNode = treeNode;
+    showingSimilar = false;
     
+    // Picks up timbres saved since the list was last shown
+    index.setDirectory (getSavedDirectory());
+    
+    showRanking (false);
     displayFiles();
     
     toFront (false);
@@ -107,7 +208,13 @@ void SavedDistributionsList::buttonClicked (Button* clickedButton)
         FileIO io = selectedFile;
         int index = parent.indexOf (current);
         bool x = current[IDs::XAxis];
-        newCalc.copyPropertiesAndChildrenFrom (io.loadTreeFromFile(), nullptr);
+        
+        {
+            TRACE_SCOPE ("SavedDistributionsList load");
+            
+            newCalc.copyPropertiesAndChildrenFrom (io.loadTreeFromFile(), nullptr);
+            PartialArray::convertLegacyPartials (newCalc);
+        }
         
         undo->beginNewTransaction();
         
@@ -115,14 +222,31 @@ void SavedDistributionsList::buttonClicked (Button* clickedButton)
         parent.addChild (newCalc, index, undo);
         newCalc.setProperty (IDs::XAxis, x, undo);
         
+        showRanking (false);
         exitModalState (1);
         setVisible (false);
     }
     else if (clickedButton == &closeButton)
     {
+        showRanking (false);
         exitModalState (1);
         setVisible (false);
     }
+    else if (clickedButton == &similarButton)
+    {
+        if (showingRanking)
+            showRanking (false);
+        
+        showingSimilar = ! showingSimilar;
+        showingSimilar ? displaySimilar() : displayFiles (searchBar.getText());
+    }
+    else if (clickedButton == &rankButton)
+    {
+        showRanking (! showingRanking);
+        
+        if (showingRanking)
+            startRanking();
+    }
     else
     {
         for (auto* button : fileButtons)
@@ -172,6 +296,7 @@ void SavedDistributionsList::textEditorTextChanged (TextEditor& editor)
 {
     if (&editor == &searchBar)
     {
+        showingSimilar = false;
         displayFiles (editor.getText());
     }
 }
@@ -182,6 +307,11 @@ void SavedDistributionsList::textEditorReturnKeyPressed (TextEditor& editor)
     {
         unfocusAllComponents();
     }
+    else if (&editor == &intervals)
+    {
+        unfocusAllComponents();
+        startRanking();
+    }
 }
 
 bool SavedDistributionsList::keyPressed (const KeyPress& key, Component* originatingComponent)
@@ -190,6 +320,7 @@ bool SavedDistributionsList::keyPressed (const KeyPress& key, Component* origina
     {
         if (key == KeyPress::escapeKey)
         {
+            showRanking (false);
             setVisible (false);
             exitModalState (1);
         }
@@ -221,17 +352,40 @@ void SavedDistributionsList::mouseDoubleClick (const MouseEvent& event)
     }
 }
 
-void SavedDistributionsList::displayFiles (String searchParam)
+File SavedDistributionsList::getSavedDirectory()
 {
     File dismalDirectory (findParentComponentOfClass<MainComponent>()->getSettings()->getValue ("Saved Distribution Location"));
     
     if (! dismalDirectory.exists())
         dismalDirectory.createDirectory();
     
-    fileList = dismalDirectory.findChildFiles (File::findFiles, true,
-                                               searchParam + String ("*.dismal"));
+    return dismalDirectory;
+}
+
+void SavedDistributionsList::displayFiles (String searchParam)
+{
+    fileList = getSavedDirectory().findChildFiles (File::findFiles, true,
+                                                   searchParam + String ("*.dismal"));
     
     fileList.sort();
+    createFileButtons();
+}
+
+void SavedDistributionsList::displaySimilar()
+{
+    // Listed once the index is ready
+    fileList.clearQuick();
+    
+    if (index.isReady())
+        fileList = index.findNearest (distributionNode, numSimilarTimbres);
+    
+    createFileButtons();
+}
+
+void SavedDistributionsList::createFileButtons()
+{
+    TRACE_SCOPE ("SavedDistributionsList::createFileButtons");
+    
     fileButtons.clear();
 
     for (int i = 0; i < fileList.size(); ++i)
@@ -239,17 +393,29 @@ void SavedDistributionsList::displayFiles (String searchParam)
         fileButtons.add (new ThemedButton());
         
         FileIO current = fileList[i];
-        ValueTree tree = current.loadTreeFromFile();
+        ValueTree tree;
+        
+        {
+            TRACE_SCOPE ("SavedDistributionsList load");
+            
+            tree = current.loadTreeFromFile();
+            PartialArray::convertLegacyPartials (tree);
+        }
+        
+        PartialArray partials (tree);
+        Array<float> freqs (partials.getFreqs(), partials.size());
+        freqs.sort();
+        
         String buttonText = (tree[IDs::Name].toString()
                              + String (" - ")
-                             + String (tree.getNumChildren())
+                             + String (partials.size())
                              + String ("p : "));
         
-        for (auto child : tree)
+        for (int j = 0; j < freqs.size(); ++j)
         {
-            buttonText.append (child[IDs::Freq].toString(), 4);
+            buttonText.append (String (freqs[j]), 4);
 
-            if (tree.indexOf (child) != tree.getNumChildren() - 1)
+            if (j != freqs.size() - 1)
             {
                 buttonText.append (", ", 2);
             }
@@ -294,3 +460,158 @@ void SavedDistributionsList::displayFiles (String searchParam)
         current->setBounds (viewArea.removeFromTop (25));
     }
 }
+
+//==============================================================================
+int SavedDistributionsList::getNumRows()
+{
+    return rankedTimbres.size();
+}
+
+void SavedDistributionsList::paintRowBackground (Graphics& g, int rowNumber, int width, int height, bool rowIsSelected)
+{
+    g.fillAll (rowIsSelected ? Theme::buttonHighlighted : Theme::mainButton);
+    
+    g.setColour (Theme::mainBackground);
+    g.fillRect (0, height - 2, width, 2);
+}
+
+void SavedDistributionsList::paintCell (Graphics& g, int rowNumber, int columnId, int width, int height, bool rowIsSelected)
+{
+    if (! isPositiveAndBelow (rowNumber, rankedTimbres.size()))
+        return;
+    
+    const TimbreRanking::Result& result = rankedTimbres.getReference (rowNumber);
+    String text;
+    
+    if (columnId == nameColumn)
+        text = result.name;
+    else if (columnId == partialsColumn)
+        text = String (result.numPartials);
+    else if (columnId == dissonanceColumn)
+        text = String (result.dissonance, 4);
+    else
+        text = String (result.relative, 3);
+    
+    g.setColour (rowIsSelected ? Theme::activeText : Theme::text);
+    g.setFont (14.f);
+    g.drawText (text, 4, 0, width - 8, height, columnId == nameColumn ? Justification::centredLeft
+                                                                       : Justification::centredRight, true);
+}
+
+void SavedDistributionsList::sortOrderChanged (int newSortColumnId, bool isForwards)
+{
+    sortRanking();
+    rankingTable.updateContent();
+    rankingTable.repaint();
+}
+
+void SavedDistributionsList::selectedRowsChanged (int lastRowSelected)
+{
+    if (! showingRanking)
+        return;
+    
+    selectedFile = isPositiveAndBelow (lastRowSelected, rankedTimbres.size()) ? rankedTimbres[lastRowSelected].file : File();
+    openButton.setEnabled (selectedFile.existsAsFile());
+}
+
+void SavedDistributionsList::cellDoubleClicked (int rowNumber, int columnId, const MouseEvent& event)
+{
+    selectedRowsChanged (rowNumber);
+    
+    if (openButton.isEnabled())
+        openButton.triggerClick();
+}
+
+void SavedDistributionsList::changeListenerCallback (ChangeBroadcaster* source)
+{
+    if (source == &index)
+    {
+        if (showingSimilar && ! showingRanking)
+            displaySimilar();
+        
+        return;
+    }
+    
+    if (! showingRanking)
+        return;
+    
+    // Keeps the selected timbre selected as results land around it
+    File selected = selectedFile;
+    
+    rankedTimbres = ranking.getResults();
+    sortRanking();
+    rankingTable.deselectAllRows();
+    rankingTable.updateContent();
+    
+    for (int i = 0; i < rankedTimbres.size(); ++i)
+        if (rankedTimbres.getReference (i).file == selected)
+            rankingTable.selectRow (i, true, true);
+    
+    rankingTable.repaint();
+    repaint();
+}
+
+void SavedDistributionsList::showRanking (bool show)
+{
+    if (! show)
+        ranking.stopThread (5000);
+    
+    showingRanking = show;
+    selectedFile = File();
+    openButton.setEnabled (false);
+    
+    view.setVisible (! show);
+    searchBar.setVisible (! show);
+    rankingTable.setVisible (show);
+    intervals.setVisible (show);
+    
+    if (! show)
+        showingSimilar ? displaySimilar() : displayFiles (searchBar.getText());
+    
+    repaint();
+}
+
+void SavedDistributionsList::startRanking()
+{
+    ValueTree tuning = findParentComponentOfClass<DissCalcView>()->tuningWindow.tuning;
+    ValueTree calc = distributionNode.getParent();
+    
+    // Typed ratios, or every interval of the tuning
+    StringArray tokens;
+    tokens.addTokens (intervals.getText().replaceCharacter (',', ' '), " ", "");
+    tokens.removeEmptyStrings();
+    
+    Array<float> ratios;
+    
+    for (auto& token : tokens)
+    {
+        float ratio = TuningGenerator::parseRatio (token);
+        
+        if (ratio > 0)
+            ratios.add (ratio);
+    }
+    
+    if (ratios.isEmpty())
+        ratios = TimbreRanking::getIntervals (tuning);
+    
+    // The lower note sits at the tuning's middle C, or the calc's start freq
+    float fundamentalFreq = tuning.getProperty (IDs::ReferenceFreq, calc[IDs::StartFreq]);
+    
+    rankedTimbres.clearQuick();
+    rankingTable.deselectAllRows();
+    rankingTable.updateContent();
+    
+    ranking.setIntervals (ratios, TuningGenerator::getRepeatRatio (tuning), fundamentalFreq, calc[IDs::ModelName]);
+    ranking.startRanking (getSavedDirectory().findChildFiles (File::findFiles, true, "*.dismal"));
+    
+    repaint();
+}
+
+void SavedDistributionsList::sortRanking()
+{
+    RankingSorter sorter;
+    sorter.column = rankingTable.getHeader().getSortColumnId();
+    sorter.forwards = rankingTable.getHeader().isSortedForwards();
+    
+    rankedTimbres.sort (sorter, true);
+}
@@ -15,15 +15,28 @@
 
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "ThemedComponents.h"
+#include "PartialArray.h"
+#include "TimbreRanking.h"
+#include "TimbreIndex.h"
 #include "../../../DisMAL/FileIO.h"
 
 //==============================================================================
 /*
+    Lists the saved timbres for opening into a distribution.
+ 
+    The rank button swaps the list for a table of every saved timbre ranked by its dissonance
+    at a set of intervals (see TimbreRanking), which are typed into the footer as ratios, or
+    are every interval of the tuning when left blank. Clicking a column header sorts by it.
+ 
+    The similar button lists the saved timbres nearest to the distribution being opened into,
+    by their partials and dissonance curves (see TimbreIndex), from most to least similar.
 */
 class SavedDistributionsList    : public Component,
                                   public Button::Listener,
                                   public TextEditor::Listener,
-                                  public KeyListener
+                                  public KeyListener,
+                                  public TableListBoxModel,
+                                  public ChangeListener
 {
 public:
     SavedDistributionsList();
@@ -40,6 +53,17 @@ public:
     bool keyPressed (const KeyPress& key, Component* originatingComponent) override;
     void mouseDoubleClick (const MouseEvent& event) override;
 
+    // Ranking table callbacks
+    int getNumRows() override;
+    void paintRowBackground (Graphics& g, int rowNumber, int width, int height, bool rowIsSelected) override;
+    void paintCell (Graphics& g, int rowNumber, int columnId, int width, int height, bool rowIsSelected) override;
+    void sortOrderChanged (int newSortColumnId, bool isForwards) override;
+    void selectedRowsChanged (int lastRowSelected) override;
+    void cellDoubleClicked (int rowNumber, int columnId, const MouseEvent& event) override;
+    
+    // Called by the ranking as it progresses, and the index when it's ready
+    void changeListenerCallback (ChangeBroadcaster* source) override;
+    
     void paint (Graphics& g) override;
     void resized() override;
     
@@ -50,16 +74,30 @@ private:
     Viewport view;
     Component viewComponent;
     OwnedArray<ThemedButton> fileButtons;
-    ThemedTextEditor searchBar;
-    ThemedButton openButton, closeButton;
+    ThemedTextEditor searchBar, intervals;
+    ThemedButton openButton, closeButton, rankButton, similarButton;
+    TableListBox rankingTable;
     
     // Data
     ValueTree distributionNode;
     File selectedFile;
     Array<File> fileList;
     
+    TimbreRanking ranking;
+    Array<TimbreRanking::Result> rankedTimbres;
+    bool showingRanking;
+    
+    TimbreIndex index;
+    bool showingSimilar;
     
+    File getSavedDirectory();
     void displayFiles (String searchParam = "");
+    void displaySimilar();
+    void createFileButtons();
+    
+    void showRanking (bool show);
+    void startRanking();
+    void sortRanking();
     
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SavedDistributionsList)
 };
@@ -0,0 +1,238 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "SpectrumPlot.h"
+#include "DistributionPanel.h"
+
+//==============================================================================
+SpectrumPlot::SpectrumPlot()   : distribution (IDs::OvertoneDistribution)
+{
+    distribution.addListener (this);
+    
+    hoveredIndex = -1;
+    draggedIndex = -1;
+    
+    updateRanges();
+}
+
+SpectrumPlot::~SpectrumPlot()
+{
+}
+
+void SpectrumPlot::paint (Graphics& g)
+{
+    g.fillAll (Theme::mainBackground);
+    
+    g.setColour (Theme::headerBackground);
+    g.drawLine (plotArea.getX(), plotArea.getBottom(), plotArea.getRight(), plotArea.getBottom(), 2);
+    
+    // Octave grid lines
+    g.setColour (Theme::border);
+    
+    for (int octave = (int) std::ceil (octaveRange.getStart()); octave <= octaveRange.getEnd(); ++octave)
+    {
+        float x = getXForFreq (std::pow (2.f, (float) octave));
+        g.drawVerticalLine (roundToInt (x), plotArea.getY(), plotArea.getBottom());
+    }
+    
+    // The fundamental's amp is the reference for partial amps, so it's always drawn at 1
+    g.setColour (distribution[IDs::FundamentalMute] ? Theme::buttonDisabled : Theme::text);
+    g.drawLine (getXForFreq (1), plotArea.getBottom(), getXForFreq (1), getYForAmp (1), 3);
+    
+    PartialArray partials (distribution);
+    
+    for (int i = 0; i < partials.size(); ++i)
+    {
+        PartialData partial = partials.get (i);
+        
+        if (partial.freq <= 0 || partial.amp <= 0)
+            continue;
+        
+        if (i == draggedIndex || i == hoveredIndex)
+            g.setColour (Theme::buttonHighlighted);
+        else
+            g.setColour (partial.mute ? Theme::buttonDisabled : Theme::activeText);
+        
+        float x = getXForFreq (partial.freq);
+        float y = getYForAmp (partial.amp);
+        
+        g.drawLine (x, plotArea.getBottom(), x, y, 2);
+        g.fillEllipse (x - 3, y - 3, 6, 6);
+    }
+}
+
+void SpectrumPlot::resized()
+{
+    plotArea = getLocalBounds().toFloat().reduced (8, 6);
+}
+
+void SpectrumPlot::mouseMove (const MouseEvent& event)
+{
+    int index = getPartialAt (event.position);
+    
+    if (index != hoveredIndex)
+    {
+        hoveredIndex = index;
+        setMouseCursor (index >= 0 ? MouseCursor::DraggingHandCursor : MouseCursor::NormalCursor);
+        repaint();
+    }
+}
+
+void SpectrumPlot::mouseExit (const MouseEvent& event)
+{
+    if (hoveredIndex >= 0 && draggedIndex < 0)
+    {
+        hoveredIndex = -1;
+        repaint();
+    }
+}
+
+void SpectrumPlot::mouseDown (const MouseEvent& event)
+{
+    draggedIndex = getPartialAt (event.position);
+    
+    // The whole drag is undone at once, as the partial's edits coalesce into a single action
+    if (draggedIndex >= 0)
+        findParentComponentOfClass<DistributionPanel>()->undo->beginNewTransaction();
+}
+
+void SpectrumPlot::mouseDrag (const MouseEvent& event)
+{
+    PartialArray partials (distribution);
+    
+    if (! isPositiveAndBelow (draggedIndex, partials.size()))
+        return;
+    
+    PartialData partial = partials.get (draggedIndex);
+    
+    Point<float> position = plotArea.getConstrainedPoint (event.position);
+    
+    // Rounded like values entered into a PartialEditor, so they can be typed back in exactly
+    float newFreq = std::round (getFreqForX (position.getX()) * 10000) / 10000.f;
+    float newAmp = std::round (getAmpForY (position.getY()) * 10000) / 10000.f;
+    
+    // Keeps the old freq if another partial (or the fundamental) is already at the new one
+    if (newFreq != partial.freq && ! partials.containsFreq (newFreq))
+        partial.freq = newFreq;
+    
+    if (newAmp > 0)
+        partial.amp = newAmp;
+    
+    partials.set (draggedIndex, partial, findParentComponentOfClass<DistributionPanel>()->undo);
+}
+
+void SpectrumPlot::mouseUp (const MouseEvent& event)
+{
+    if (draggedIndex >= 0)
+    {
+        draggedIndex = -1;
+        updateRanges();
+        repaint();
+    }
+}
+
+void SpectrumPlot::valueTreePropertyChanged (ValueTree& parent, const Identifier& ID)
+{
+    if (parent == distribution
+        && (ID == IDs::Partials || ID == IDs::FundamentalMute))
+    {
+        if (draggedIndex < 0)
+            updateRanges();
+        
+        repaint();
+    }
+}
+
+void SpectrumPlot::setDistribution (ValueTree& distributionNode)
+{
+    distribution = distributionNode;
+    
+    hoveredIndex = -1;
+    draggedIndex = -1;
+    
+    updateRanges();
+    repaint();
+}
+
+void SpectrumPlot::updateRanges()
+{
+    float lowestFreq = 1;
+    float highestFreq = 2;
+    float highestAmp = 1;
+    
+    PartialArray partials (distribution);
+    const float* freqs = partials.getFreqs();
+    const float* amps = partials.getAmps();
+    
+    for (int i = 0; i < partials.size(); ++i)
+    {
+        if (freqs[i] > 0)
+        {
+            lowestFreq = jmin (lowestFreq, freqs[i]);
+            highestFreq = jmax (highestFreq, freqs[i]);
+        }
+        
+        highestAmp = jmax (highestAmp, amps[i]);
+    }
+    
+    // Leaves some room around the outermost partials to drag them further out
+    octaveRange = Range<float> (std::log2 (lowestFreq) - 0.25f, std::log2 (highestFreq) + 0.25f);
+    ampRange = Range<float> (0, highestAmp * 1.2f);
+}
+
+float SpectrumPlot::getXForFreq (float freq) const
+{
+    return jmap (std::log2 (freq), octaveRange.getStart(), octaveRange.getEnd(), plotArea.getX(), plotArea.getRight());
+}
+
+float SpectrumPlot::getFreqForX (float x) const
+{
+    return std::pow (2.f, jmap (x, plotArea.getX(), plotArea.getRight(), octaveRange.getStart(), octaveRange.getEnd()));
+}
+
+float SpectrumPlot::getYForAmp (float amp) const
+{
+    return jmap (amp, ampRange.getStart(), ampRange.getEnd(), plotArea.getBottom(), plotArea.getY());
+}
+
+float SpectrumPlot::getAmpForY (float y) const
+{
+    return jmap (y, plotArea.getBottom(), plotArea.getY(), ampRange.getStart(), ampRange.getEnd());
+}
+
+int SpectrumPlot::getPartialAt (Point<float> position) const
+{
+    PartialArray partials (distribution);
+    const float* freqs = partials.getFreqs();
+    const float* amps = partials.getAmps();
+    
+    int closest = -1;
+    float closestDistance = 6;
+    
+    for (int i = 0; i < partials.size(); ++i)
+    {
+        if (freqs[i] <= 0 || amps[i] <= 0)
+            continue;
+        
+        float distance = std::abs (getXForFreq (freqs[i]) - position.getX());
+        
+        if (distance < closestDistance && position.getY() >= getYForAmp (amps[i]) - 6)
+        {
+            closest = i;
+            closestDistance = distance;
+        }
+    }
+    
+    return closest;
+}
@@ -0,0 +1,78 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "IDs.h"
+#include "PartialArray.h"
+#include "ThemedComponents.h"
+
+//==============================================================================
+/*
+    Plots the partials of the currently viewed overtone distribution as a spectrum,
+    with freq ratios on a log scale and amps relative to the fundamental's.
+ 
+    Partials can be dragged left/right to change their freq and up/down to change their amp.
+    The plot's ranges are held while dragging, so the partial stays under the mouse.
+*/
+class SpectrumPlot   : public Component,
+                       public ValueTree::Listener
+{
+public:
+    SpectrumPlot();
+    ~SpectrumPlot();
+    
+    void paint (Graphics& g) override;
+    void resized() override;
+    
+    // Mouse callbacks for dragging partials
+    void mouseMove (const MouseEvent& event) override;
+    void mouseExit (const MouseEvent& event) override;
+    void mouseDown (const MouseEvent& event) override;
+    void mouseDrag (const MouseEvent& event) override;
+    void mouseUp (const MouseEvent& event) override;
+    
+    // Data model callback
+    void valueTreePropertyChanged (ValueTree& parent, const Identifier& ID) override;
+    
+    // Unused pure-virtual callbacks inhereted from ValueTree::Listener
+    void valueTreeChildAdded (ValueTree& parent, ValueTree& newChild) override {}
+    void valueTreeChildRemoved (ValueTree& parent, ValueTree& removedChild, int childIndex) override {}
+    void valueTreeChildOrderChanged (ValueTree& parent, int oldIndex, int newIndex) override {}
+    void valueTreeParentChanged (ValueTree& adoptedTree) override {}
+    void valueTreeRedirected (ValueTree& redirectedTree) override {}
+    
+    void setDistribution (ValueTree& distributionNode);
+
+private:
+    ValueTree distribution;
+    
+    // Plotted ranges, with freq ratios as octaves above the fundamental
+    Range<float> octaveRange, ampRange;
+    Rectangle<float> plotArea;
+    
+    int hoveredIndex, draggedIndex;
+    
+    void updateRanges();
+    
+    float getXForFreq (float freq) const;
+    float getFreqForX (float x) const;
+    float getYForAmp (float amp) const;
+    float getAmpForY (float y) const;
+    
+    // Returns the index of the partial drawn closest to the given position, or -1 if none are close enough
+    int getPartialAt (Point<float> position) const;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (SpectrumPlot)
+};
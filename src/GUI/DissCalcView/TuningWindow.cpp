@@ -0,0 +1,382 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "TuningWindow.h"
+#include "MainComponent.h"
+
+namespace
+{
+    enum SearchTypes
+    {
+        minimaScales = 1,
+        edosByAverage,
+        edosByWorst
+    };
+    
+    const int minEdoDivisions = 5;
+    const int maxEdoDivisions = 240;
+    const int numResults = 20;
+}
+
+//==============================================================================
+TuningWindow::TuningWindow()
+{
+    undo = nullptr;
+    selectedScale = -1;
+    searching = false;
+    
+    numNotes.setTextToShowWhenEmpty ("Notes", Theme::border);
+    numNotes.setTooltip ("Number of notes in each scale, including 1/1");
+    numNotes.setInputRestrictions (2, "1234567890");
+    numNotes.setFont (15.f);
+    numNotes.setText ("7");
+    numNotes.addListener (this);
+    addAndMakeVisible (numNotes);
+    
+    searchType.addItem ("Minima Scales", minimaScales);
+    searchType.addItem ("EDOs by Average", edosByAverage);
+    searchType.addItem ("EDOs by Worst", edosByWorst);
+    searchType.setTooltip ("Search scales of the minima, or equal divisions of the repeat ratio");
+    searchType.setSelectedId (minimaScales, dontSendNotification);
+    searchType.addListener (this);
+    addAndMakeVisible (searchType);
+    
+    generateButton.setIcon (true, FontAwesome_Cogs);
+    generateButton.setIconSize (22);
+    generateButton.setPanelButton (true);
+    generateButton.addListener (this);
+    addAndMakeVisible (generateButton);
+    generateButton.setTooltip ("Find the least dissonant scales");
+    
+    useButton.setIcon (true, FontAwesome_CheckCircle);
+    useButton.setIconSize (22);
+    useButton.setPanelButton (true);
+    useButton.setEnabled (false);
+    useButton.addListener (this);
+    addAndMakeVisible (useButton);
+    useButton.setTooltip ("Use as the tuning");
+    
+    exportButton.setIcon (true, FontAwesome_Save);
+    exportButton.setIconSize (22);
+    exportButton.setPanelButton (true);
+    exportButton.setEnabled (false);
+    exportButton.addListener (this);
+    addAndMakeVisible (exportButton);
+    exportButton.setTooltip ("Export as a Scala file");
+    
+    closeButton.setIcon (true, FontAwesome_WindowClose);
+    closeButton.addListener (this);
+    closeButton.setPanelButton (true);
+    closeButton.setIconSize (26);
+    addAndMakeVisible (closeButton);
+    
+    view.setViewedComponent (&viewComponent, false);
+    view.setScrollBarsShown (false, false, true, false);
+    addAndMakeVisible (view);
+    
+    generator.addChangeListener (this);
+    edoSearch.addChangeListener (this);
+    
+    addKeyListener (this);
+    setWantsKeyboardFocus (true);
+}
+
+TuningWindow::~TuningWindow()
+{
+    generator.removeChangeListener (this);
+    edoSearch.removeChangeListener (this);
+}
+
+void TuningWindow::paint (Graphics& g)
+{
+    g.fillAll (Theme::headerBackground);
+    
+    g.setColour (Theme::mainBackground);
+    Font f = g.getCurrentFont();
+    f.setHeight (22.f);
+    f.setBold (true);
+    g.setFont (f);
+    
+    g.drawText ("Generate Tuning", 10, 5, 250, 25, Justification::centredLeft);
+    g.fillRect (getLocalBounds().reduced (3).withTop (35).withBottom (getHeight() - 45));
+    
+    if (scales.isEmpty())
+    {
+        String message;
+        
+        if (searching)
+            message = "Searching...";
+        else if (searchType.getSelectedId() == minimaScales)
+            message = String (generator.getCandidates().size()) + " candidate notes from the minima";
+        else
+            message = String (minEdoDivisions) + " to " + String (maxEdoDivisions) + " equal divisions";
+        
+        g.setColour (Theme::text);
+        g.setFont (15.f);
+        g.drawText (message, view.getBounds(), Justification::centred);
+    }
+}
+
+void TuningWindow::resized()
+{
+    view.setBounds (Rectangle<int> (15, 40, getWidth() - 30, getHeight() - 90).reduced (5));
+    viewComponent.setSize (view.getWidth(), viewComponent.getHeight());
+    
+    Rectangle<int> footer = getLocalBounds().removeFromBottom (45);
+    Rectangle<int> header = getLocalBounds().removeFromTop (35);
+    
+    exportButton.setBounds (footer.removeFromRight (45).reduced (10));
+    useButton.setBounds (footer.removeFromRight (35).reduced (0, 10));
+    generateButton.setBounds (footer.removeFromRight (35).reduced (0, 10));
+    footer.reduce (10, 10);
+    numNotes.setBounds (footer.removeFromLeft (60));
+    searchType.setBounds (footer.removeFromLeft (150).withTrimmedLeft (10));
+    
+    closeButton.setBounds (header.removeFromRight (header.getHeight()).reduced (3));
+    closeButton.setTopLeftPosition (closeButton.getX() - 1, closeButton.getY());
+}
+
+void TuningWindow::show (const Array<float>& minimaRatios)
+{
+    PropertiesFile* settings = findParentComponentOfClass<MainComponent>()->getSettings();
+    
+    // Minima closer than the min interval are merged into one candidate note
+    float minInterval = tuning.getProperty (IDs::MinInterval, settings->getDoubleValue ("Optim. Min. Interval", 1.001));
+    float repeatRatio = tuning.getProperty (IDs::RepeatRatio, 2);
+    
+    generator.setCandidates (calcData, minimaRatios, minInterval, repeatRatio);
+    edoSearch.setCalcs (calcData, repeatRatio);
+    
+    scales.clear();
+    searching = false;
+    displayScales();
+    
+    toFront (false);
+    setVisible (true);
+    enterModalState();
+    unfocusAllComponents();
+}
+
+void TuningWindow::buttonClicked (Button* clickedButton)
+{
+    if (clickedButton == &generateButton)
+    {
+        generate();
+    }
+    else if (clickedButton == &useButton)
+    {
+        if (! isPositiveAndBelow (selectedScale, scales.size()))
+            return;
+        
+        undo->beginNewTransaction();
+        tuning.setProperty (IDs::Notes, TuningGenerator::toNotes (scales[selectedScale]), undo);
+        tuning.setProperty (IDs::RepeatRatio, generator.getRepeatRatio(), undo);
+    }
+    else if (clickedButton == &exportButton)
+    {
+        if (! isPositiveAndBelow (selectedScale, scales.size()))
+            return;
+        
+        File directory (findParentComponentOfClass<MainComponent>()->getSettings()->getValue ("Tuning Export Location"));
+        
+        if (! directory.exists())
+            directory.createDirectory();
+        
+        const String& name = scaleNames[selectedScale];
+        File file = directory.getChildFile (name + ".scl").getNonexistentSibling();
+        
+        file.replaceWithText (TuningGenerator::toScala (scales.getReference (selectedScale), generator.getRepeatRatio(),
+                                                        name + ", " + scaleDescriptions[selectedScale]));
+    }
+    else if (clickedButton == &closeButton)
+    {
+        generator.stopThread (5000);
+        edoSearch.stopThread (5000);
+        
+        exitModalState (1);
+        setVisible (false);
+    }
+    else
+    {
+        int index = scaleButtons.indexOf (static_cast<ThemedButton*> (clickedButton));
+        
+        if (index >= 0)
+            selectScale (index == selectedScale ? -1 : index);
+    }
+}
+
+void TuningWindow::buttonStateChanged (Button* button)
+{
+    if (button == scaleButtons[selectedScale]
+        && button->getState() == Button::buttonNormal)
+    {
+        button->setState (Button::buttonOver);
+    }
+}
+
+void TuningWindow::textEditorReturnKeyPressed (TextEditor& editor)
+{
+    if (&editor == &numNotes)
+    {
+        unfocusAllComponents();
+        generate();
+    }
+}
+
+void TuningWindow::comboBoxChanged (ComboBox* changedBox)
+{
+    if (changedBox == &searchType)
+    {
+        generator.stopThread (5000);
+        edoSearch.stopThread (5000);
+        
+        // EDOs are searched over a fixed range of divisions
+        numNotes.setEnabled (searchType.getSelectedId() == minimaScales);
+        
+        scales.clear();
+        searching = false;
+        displayScales();
+    }
+}
+
+bool TuningWindow::keyPressed (const KeyPress& key, Component* originatingComponent)
+{
+    if (originatingComponent == this)
+    {
+        if (key == KeyPress::escapeKey)
+            closeButton.triggerClick();
+        else if (key == KeyPress::returnKey)
+            generate();
+        
+        return true;
+    }
+    
+    return false;
+}
+
+void TuningWindow::changeListenerCallback (ChangeBroadcaster* source)
+{
+    scales.clear();
+    scaleNames.clear();
+    scaleDescriptions.clear();
+    
+    if (source == &generator)
+    {
+        for (auto& scale : generator.getResults())
+        {
+            scales.add (scale);
+            scaleNames.add (String (scale.ratios.size() + 1) + " note minima scale");
+            scaleDescriptions.add ("dissonance " + String (scale.dissonance, 4));
+        }
+    }
+    else if (source == &edoSearch)
+    {
+        for (auto& result : edoSearch.getResults())
+        {
+            TuningGenerator::Scale scale;
+            scale.ratios = EdoSearch::getRatios (result.divisions, edoSearch.getRepeatRatio());
+            scale.dissonance = searchType.getSelectedId() == edosByWorst ? result.worst : result.average;
+            
+            scales.add (scale);
+            scaleNames.add (String (result.divisions) + " EDO");
+            scaleDescriptions.add ("average " + String (result.average, 4) + ", worst " + String (result.worst, 4));
+        }
+    }
+    
+    searching = false;
+    displayScales();
+}
+
+void TuningWindow::generate()
+{
+    const int type = searchType.getSelectedId();
+    int notes = numNotes.getText().getIntValue();
+    
+    if (type == minimaScales && notes < 1)
+        return;
+    
+    scales.clear();
+    searching = true;
+    displayScales();
+    
+    if (type == minimaScales)
+        generator.startSearch (notes, numResults);
+    else
+        edoSearch.startSearch (minEdoDivisions, maxEdoDivisions, type == edosByWorst, numResults);
+}
+
+void TuningWindow::displayScales()
+{
+    scaleButtons.clear();
+    selectScale (-1);
+    
+    for (int i = 0; i < scales.size(); ++i)
+    {
+        const TuningGenerator::Scale& scale = scales.getReference (i);
+        String buttonText = String (scale.dissonance, 4) + String (" : ");
+        
+        // EDOs are listed by name, as their notes are evenly spaced
+        if (searchType.getSelectedId() == minimaScales)
+        {
+            for (int j = 0; j < scale.ratios.size(); ++j)
+            {
+                buttonText << String (1200 * std::log2 (scale.ratios[j]), 1);
+                
+                if (j != scale.ratios.size() - 1)
+                    buttonText << ", ";
+            }
+        }
+        else
+        {
+            buttonText << scaleNames[i];
+        }
+        
+        scaleButtons.add (new ThemedButton());
+        scaleButtons[i]->setButtonText (buttonText);
+        scaleButtons[i]->setTooltip (scaleNames[i] + ", " + scaleDescriptions[i]);
+        scaleButtons[i]->addListener (this);
+        
+        if (scales.size() > 1)
+            scaleButtons[i]->setBorders (false, i != 0, false, i != scales.size() - 1, 2);
+    }
+    
+    viewComponent.setSize (view.getWidth(), scaleButtons.size() * 25);
+    
+    Rectangle<int> viewArea = viewComponent.getLocalBounds();
+    
+    for (auto* current : scaleButtons)
+    {
+        viewComponent.addAndMakeVisible (current);
+        current->setBounds (viewArea.removeFromTop (25));
+    }
+    
+    generateButton.setEnabled (! searching);
+    repaint();
+}
+
+void TuningWindow::selectScale (int index)
+{
+    ThemedButton* previous = scaleButtons[selectedScale];
+    
+    selectedScale = index;
+    
+    if (previous != nullptr)
+        previous->setState (Button::buttonNormal);
+    
+    if (ThemedButton* selected = scaleButtons[selectedScale])
+        selected->setState (Button::buttonOver);
+    
+    useButton.setEnabled (selectedScale >= 0);
+    exportButton.setEnabled (selectedScale >= 0);
+}
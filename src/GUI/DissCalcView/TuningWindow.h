@@ -0,0 +1,81 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "ThemedComponents.h"
+#include "IDs.h"
+#include "TuningGenerator.h"
+#include "EdoSearch.h"
+
+//==============================================================================
+/*
+    Generates scales from the minima of every dissonance map, and lists the least
+    dissonant ones for the chosen number of notes. Can also rank equal divisions of the
+    repeat ratio by the average or worst dissonance of their intervals.
+ 
+    The selected scale can be used as the app's tuning or exported as a Scala file.
+*/
+class TuningWindow   : public Component,
+                       public Button::Listener,
+                       public TextEditor::Listener,
+                       public ComboBox::Listener,
+                       public ChangeListener,
+                       public KeyListener
+{
+public:
+    TuningWindow();
+    ~TuningWindow();
+    
+    void paint (Graphics& g) override;
+    void resized() override;
+    
+    // GUI callbacks
+    void buttonClicked (Button* clickedButton) override;
+    void buttonStateChanged (Button* button) override;
+    void textEditorReturnKeyPressed (TextEditor& editor) override;
+    void comboBoxChanged (ComboBox* changedBox) override;
+    bool keyPressed (const KeyPress& key, Component* originatingComponent) override;
+    
+    // Called by the generator or the EDO search when a search is done
+    void changeListenerCallback (ChangeBroadcaster* source) override;
+    
+    // Inits & shows the component, pooling the given minima as candidate notes
+    void show (const Array<float>& minimaRatios);
+    
+    ValueTree calcData, tuning;
+    UndoManager* undo;
+
+private:
+    TuningGenerator generator;
+    EdoSearch edoSearch;
+    Array<TuningGenerator::Scale> scales;
+    StringArray scaleNames, scaleDescriptions;
+    int selectedScale;
+    bool searching;
+    
+    // GUI components
+    Viewport view;
+    Component viewComponent;
+    OwnedArray<ThemedButton> scaleButtons;
+    ThemedTextEditor numNotes;
+    ThemedComboBox searchType;
+    ThemedButton generateButton, useButton, exportButton, closeButton;
+    
+    void generate();
+    void displayScales();
+    void selectScale (int index);
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (TuningWindow)
+};
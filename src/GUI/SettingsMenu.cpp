@@ -49,6 +49,31 @@ GeneralOptions::GeneralOptions()
     savedDistributionLocationLabel.setTooltip ("Overtone distributions will be stored here as '.dismal' files. This is for internal app use.");
     savedDistributionLocationLabel.setFont (13);
     savedDistributionLocationLabel.attachToComponent (&savedDistributionLocation, false);
+    
+    adaptiveTuning.setButtonText ("Adaptive Tuning");
+    adaptiveTuning.setTooltip ("Plays the chosen MIDI input through the adaptive tuner, and sends the retuned notes to the chosen MIDI output as MPE.");
+    adaptiveTuning.setToggleState (false, dontSendNotification);
+    addAndMakeVisible (adaptiveTuning);
+    
+    midiInput.setTooltip ("The MIDI input that the adaptive tuner plays.");
+    midiInput.setTextWhenNothingSelected ("None");
+    midiInput.setTextWhenNoChoicesAvailable ("No MIDI Inputs");
+    addAndMakeVisible (midiInput);
+    
+    midiOutput.setTooltip ("The MIDI output that the adaptive tuner sends its retuned notes and MPE zone setup to.");
+    midiOutput.setTextWhenNothingSelected ("None");
+    midiOutput.setTextWhenNoChoicesAvailable ("No MIDI Outputs");
+    addAndMakeVisible (midiOutput);
+    
+    midiInputLabel.setText ("MIDI Input", dontSendNotification);
+    midiInputLabel.setTooltip (midiInput.getTooltip());
+    midiInputLabel.setFont (14);
+    midiInputLabel.attachToComponent (&midiInput, true);
+    
+    midiOutputLabel.setText ("MIDI Output", dontSendNotification);
+    midiOutputLabel.setTooltip (midiOutput.getTooltip());
+    midiOutputLabel.setFont (14);
+    midiOutputLabel.attachToComponent (&midiOutput, true);
 }
 
 GeneralOptions::~GeneralOptions()
@@ -74,6 +99,23 @@ void GeneralOptions::resized()
     tuningExportLocation.setBounds (area.removeFromTop (25));
     area.removeFromTop (30);
     savedDistributionLocation.setBounds (area.removeFromTop (25));
+    area.removeFromTop (10);
+    adaptiveTuning.setBounds (area.removeFromTop (25).withRight (area.getRight()));
+    area.removeFromTop (10);
+    midiInput.setBounds (area.removeFromTop (25).withWidth (200).withRight (area.getRight()));
+    area.removeFromTop (10);
+    midiOutput.setBounds (area.removeFromTop (25).withWidth (200).withRight (area.getRight()));
+}
+
+void GeneralOptions::showMidiDevices (const String& inputName, const String& outputName)
+{
+    midiInput.clear (dontSendNotification);
+    midiInput.addItemList (MidiInput::getDevices(), 1);
+    midiInput.setSelectedItemIndex (MidiInput::getDevices().indexOf (inputName), dontSendNotification);
+    
+    midiOutput.clear (dontSendNotification);
+    midiOutput.addItemList (MidiOutput::getDevices(), 1);
+    midiOutput.setSelectedItemIndex (MidiOutput::getDevices().indexOf (outputName), dontSendNotification);
 }
 
 //==============================================================================
@@ -97,6 +139,16 @@ MapOptions::MapOptions()
     dissonanceModelLabel.setTooltip ("The default dissonance model to use in dissonance calculations.");
     dissonanceModelLabel.setFont (14);
     dissonanceModelLabel.attachToComponent (&dissonanceModel, true);
+    
+    resolution.setTooltip ("The default number of steps calculated for new dissonance maps. Maps are drawn at the window's width whatever the resolution, so higher resolutions give more precise curves on wide ranges at the cost of processing time.");
+    resolution.setInputRestrictions (7, "1234567890");
+    resolution.setFont (15.f);
+    addAndMakeVisible (resolution);
+    
+    resolutionLabel.setText ("Default Resolution (Steps)", dontSendNotification);
+    resolutionLabel.setTooltip (resolution.getTooltip());
+    resolutionLabel.setFont (14);
+    resolutionLabel.attachToComponent (&resolution, true);
 }
 
 MapOptions::~MapOptions()
@@ -120,6 +172,8 @@ void MapOptions::resized()
     dissonanceModel.setBounds (area.removeFromTop (25).withWidth (125).withRight (area.getRight()));
     area.removeFromTop (10);
     hearingRangePreprocessor.setBounds (area.removeFromTop (25).withRight (area.getRight()));
+    area.removeFromTop (10);
+    resolution.setBounds (area.removeFromTop (25).withWidth (125).withRight (area.getRight()));
 }
 
 //==============================================================================
@@ -154,6 +208,26 @@ OptimizationOptions::OptimizationOptions()
     minIntervalLabel.setTooltip ("Sets the allowed minimum interval ratio between two minima or maxima. This is necessary to prevent the algorithm from reporting multiple minima around the true minima, but can also be used to automatically select the interval with the lowest (or highest) dissonance among multiple close-lying minima. This has no effect on processing time.");
     minIntervalLabel.setFont (14);
     minIntervalLabel.attachToComponent (&minInterval, true);
+    
+    fitRange.setTooltip ("Sets how far (in cents) fitting a timbre to a tuning may move each partial from where it started. Wider ranges can find better fits, but may change the timbre's character more.");
+    fitRange.setInputRestrictions (10, "1234567890.");
+    fitRange.setFont (15.f);
+    addAndMakeVisible (fitRange);
+    
+    fitIterations.setTooltip ("Sets the number of iterations each search runs for when fitting a timbre to a tuning. More iterations can find better fits, at the cost of processing time.");
+    fitIterations.setInputRestrictions (7, "1234567890");
+    fitIterations.setFont (15.f);
+    addAndMakeVisible (fitIterations);
+    
+    fitRangeLabel.setText ("Timbre Fit Range (Cents)", dontSendNotification);
+    fitRangeLabel.setTooltip (fitRange.getTooltip());
+    fitRangeLabel.setFont (14);
+    fitRangeLabel.attachToComponent (&fitRange, true);
+    
+    fitIterationsLabel.setText ("Timbre Fit Iterations", dontSendNotification);
+    fitIterationsLabel.setTooltip (fitIterations.getTooltip());
+    fitIterationsLabel.setFont (14);
+    fitIterationsLabel.attachToComponent (&fitIterations, true);
 }
 
 OptimizationOptions::~OptimizationOptions()
@@ -177,6 +251,10 @@ void OptimizationOptions::resized()
     stopValue.setBounds (area.removeFromTop (25).withWidth (100).withRight (area.getRight()));
     area.removeFromTop (10);
     minInterval.setBounds (area.removeFromTop (25).withWidth (100).withRight (area.getRight()));
+    area.removeFromTop (10);
+    fitRange.setBounds (area.removeFromTop (25).withWidth (100).withRight (area.getRight()));
+    area.removeFromTop (10);
+    fitIterations.setBounds (area.removeFromTop (25).withWidth (100).withRight (area.getRight()));
 }
 
 //==============================================================================
@@ -330,6 +408,13 @@ void SettingsMenu::init (ApplicationProperties* properties)
         settings->setValue ("Saved Distribution Location", dismalDirectory.getFullPathName());
     }
     
+    // MIDI devices are only opened once they've been chosen
+    if (! settings->containsKey ("Adaptive Tuning"))
+        settings->setValue ("Adaptive Tuning", false);
+    
+    if (! settings->containsKey ("Map Resolution"))
+        settings->setValue ("Map Resolution", 2048);
+    
     if (! settings->containsKey ("Optim. Step Size"))
         settings->setValue ("Optim. Step Size", 1.0008);
     
@@ -339,6 +424,12 @@ void SettingsMenu::init (ApplicationProperties* properties)
     if (! settings->containsKey ("Optim. Min. Interval"))
         settings->setValue ("Optim. Min. Interval", 1.001);
     
+    if (! settings->containsKey ("Optim. Fit Range"))
+        settings->setValue ("Optim. Fit Range", 200);
+    
+    if (! settings->containsKey ("Optim. Fit Iterations"))
+        settings->setValue ("Optim. Fit Iterations", 300);
+    
     if (! settings->containsKey ("Hearing Range Start"))
         settings->setValue ("Hearing Range Start", 20);
     
@@ -421,6 +512,8 @@ void SettingsMenu::buttonClicked (Button* clickedButton)
         general.distributionExportLocation.setText (settings->getValue ("Distribution Export Location"));
         general.tuningExportLocation.setText (settings->getValue ("Tuning Export Location"));
         general.savedDistributionLocation.setText (settings->getValue ("Tuning Export Location"));
+        general.adaptiveTuning.setToggleState (settings->getBoolValue ("Adaptive Tuning"), dontSendNotification);
+        general.showMidiDevices (settings->getValue ("MIDI Input"), settings->getValue ("MIDI Output"));
     }
     else if (clickedButton == &dissonanceMapsButton)
     {
@@ -439,6 +532,8 @@ void SettingsMenu::buttonClicked (Button* clickedButton)
         
         if (settings->containsKey ("Dissonance Model"))
             maps.dissonanceModel.setSelectedId (settings->getIntValue ("Dissonance Model"));
+        
+        maps.resolution.setText (String (settings->getIntValue ("Map Resolution")));
     }
     else if (clickedButton == &optimizationButton)
     {
@@ -452,6 +547,8 @@ void SettingsMenu::buttonClicked (Button* clickedButton)
         optimizations.stepSize.setText (String (settings->getDoubleValue ("Optim. Step Size")));
         optimizations.stopValue.setText (String (settings->getDoubleValue ("Optim. Stop Value")));
         optimizations.minInterval.setText (String (settings->getDoubleValue ("Optim. Min. Interval")));
+        optimizations.fitRange.setText (String (settings->getDoubleValue ("Optim. Fit Range")));
+        optimizations.fitIterations.setText (String (settings->getIntValue ("Optim. Fit Iterations")));
     }
     else if (clickedButton == &preprocessorsButton)
     {
@@ -473,6 +570,10 @@ void SettingsMenu::buttonClicked (Button* clickedButton)
     {
         settings->setValue ("Load Previous Session", general.loadPreviousSession.getToggleStateValue());
         
+        settings->setValue ("Adaptive Tuning", general.adaptiveTuning.getToggleStateValue());
+        settings->setValue ("MIDI Input", general.midiInput.getText());
+        settings->setValue ("MIDI Output", general.midiOutput.getText());
+        
         if (File::isAbsolutePath (general.distributionExportLocation.getText())
             && File (general.distributionExportLocation.getText()).isDirectory())
         {
@@ -505,10 +606,19 @@ void SettingsMenu::buttonClicked (Button* clickedButton)
         if (maps.dissonanceModel.getSelectedItemIndex() >= 0)
             settings->setValue ("Dissonance Model", maps.dissonanceModel.getSelectedItemIndex());
         
+        if (maps.resolution.getText().getIntValue() >= 16)
+            settings->setValue ("Map Resolution", maps.resolution.getText().getIntValue());
+        
         settings->setValue ("Optim. Step Size", optimizations.stepSize.getText().getFloatValue());
         settings->setValue ("Optim. Stop Value", optimizations.stopValue.getText().getFloatValue());
         settings->setValue ("Optim. Min. Interval", optimizations.minInterval.getText().getFloatValue());
         
+        if (optimizations.fitRange.getText().getFloatValue() > 0)
+            settings->setValue ("Optim. Fit Range", optimizations.fitRange.getText().getFloatValue());
+        
+        if (optimizations.fitIterations.getText().getIntValue() >= 1)
+            settings->setValue ("Optim. Fit Iterations", optimizations.fitIterations.getText().getIntValue());
+        
         settings->setValue ("Hearing Range Start", preprocessors.hearingRangeStart.getText().getFloatValue());
         settings->setValue ("Hearing Range End", preprocessors.hearingRangeEnd.getText().getFloatValue());
 
@@ -29,6 +29,13 @@ public:
     ThemedTextEditor savedDistributionLocation, distributionExportLocation, tuningExportLocation;
     Label savedDistributionLocationLabel, distributionExportLocationLabel, tuningExportLocationLabel;
     
+    ThemedToggleButton adaptiveTuning;
+    ThemedComboBox midiInput, midiOutput;
+    Label midiInputLabel, midiOutputLabel;
+    
+    // Fills the MIDI device choosers with the current devices, selecting the named ones
+    void showMidiDevices (const String& inputName, const String& outputName);
+    
 private:
     
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (GeneralOptions)
@@ -45,7 +52,8 @@ public:
 
     ThemedToggleButton logSteps, hearingRangePreprocessor;
     ThemedComboBox dissonanceModel;
-    Label dissonanceModelLabel;
+    ThemedTextEditor resolution;
+    Label dissonanceModelLabel, resolutionLabel;
     
 private:
     
@@ -61,8 +69,8 @@ public:
     void paint (Graphics& g) override;
     void resized() override;
     
-    ThemedTextEditor stepSize, stopValue, minInterval;
-    Label stepSizeLabel, stopValueLabel, minIntervalLabel;
+    ThemedTextEditor stepSize, stopValue, minInterval, fitRange, fitIterations;
+    Label stepSizeLabel, stopValueLabel, minIntervalLabel, fitRangeLabel, fitIterationsLabel;
     
 private:
     
@@ -171,6 +171,11 @@ ThemedTextEditor::ThemedTextEditor()
     
     setInputRestrictions (30, String ("abcdefghijklmnopqrstuvwxyz1234567890")
                           + String ("ABCDEFGHIJKLMNOPQRSTUVWXYZ _-'"));
+    
+    scrubEnabled = false;
+    scrubPending = false;
+    scrubbing = false;
+    scrubStartValue = 0;
 }
 
 ThemedTextEditor::~ThemedTextEditor()
@@ -225,6 +230,93 @@ double ThemedTextEditor::getEvaluated()
     return -1;
 }
 
+void ThemedTextEditor::setScrubbable (bool scrubbable)
+{
+    scrubEnabled = scrubbable;
+    setMouseCursor (scrubbable ? MouseCursor::UpDownResizeCursor : MouseCursor::IBeamCursor);
+}
+
+bool ThemedTextEditor::isScrubbing() const
+{
+    return scrubbing;
+}
+
+void ThemedTextEditor::addScrubListener (ScrubListener* listener)
+{
+    scrubListeners.add (listener);
+}
+
+void ThemedTextEditor::removeScrubListener (ScrubListener* listener)
+{
+    scrubListeners.remove (listener);
+}
+
+void ThemedTextEditor::mouseDown (const MouseEvent& event)
+{
+    // Hold off on focusing until it's known whether this is a click or a drag
+    if (scrubEnabled && isEnabled() && ! hasKeyboardFocus (false) && getEvaluated() > 0)
+    {
+        scrubPending = true;
+        scrubStartValue = getEvaluated();
+        return;
+    }
+    
+    TextEditor::mouseDown (event);
+}
+
+void ThemedTextEditor::mouseDrag (const MouseEvent& event)
+{
+    if (! scrubPending)
+    {
+        TextEditor::mouseDrag (event);
+        return;
+    }
+    
+    if (! scrubbing)
+    {
+        if (abs (event.getDistanceFromDragStartY()) < 3)
+            return;
+        
+        scrubbing = true;
+        scrubListeners.call ([this] (ScrubListener& l) { l.textEditorScrubStarted (*this); });
+    }
+    
+    double pixelsPerOctave = event.mods.isShiftDown() ? 2400 : 200;
+    double newValue = scrubStartValue * pow (2.0, -event.getDistanceFromDragStartY() / pixelsPerOctave);
+    
+    // Rounded to what's shown, so the value can be typed back in exactly
+    newValue = std::round (newValue * 10000) / 10000.0;
+    
+    if (newValue > 0)
+    {
+        setText (String (newValue), false);
+        scrubListeners.call ([this, newValue] (ScrubListener& l) { l.textEditorScrubbed (*this, newValue); });
+    }
+}
+
+void ThemedTextEditor::mouseUp (const MouseEvent& event)
+{
+    if (! scrubPending)
+    {
+        TextEditor::mouseUp (event);
+        return;
+    }
+    
+    scrubPending = false;
+    
+    if (scrubbing)
+    {
+        scrubbing = false;
+        scrubListeners.call ([this] (ScrubListener& l) { l.textEditorScrubEnded (*this); });
+    }
+    else
+    {
+        // Just a click, so focus for typing as usual
+        TextEditor::mouseDown (event);
+        TextEditor::mouseUp (event);
+    }
+}
+
 //==============================================================================
 ThemedComboBox::ThemedComboBox()
 {
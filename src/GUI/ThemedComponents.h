@@ -54,10 +54,43 @@ public:
     void setEvaluateExpressions (bool evaluate);
     double getEvaluated();
     
+    //==============================================================================
+    // Receives value changes from dragging up/down on a scrubbable editor
+    class ScrubListener
+    {
+    public:
+        virtual ~ScrubListener() {}
+        
+        virtual void textEditorScrubStarted (ThemedTextEditor& editor) = 0;
+        virtual void textEditorScrubbed (ThemedTextEditor& editor, double newValue) = 0;
+        virtual void textEditorScrubEnded (ThemedTextEditor& editor) = 0;
+    };
+    
+    /*
+        Lets the evaluated value be changed by dragging up or down on the editor while it
+        doesn't have focus. Dragging up an octave's worth of pixels doubles the value,
+        or only moves it by a semitone's worth while shift is held.
+ 
+        A click without a drag still focuses the editor for typing.
+    */
+    void setScrubbable (bool scrubbable);
+    bool isScrubbing() const;
+    
+    void addScrubListener (ScrubListener* listener);
+    void removeScrubListener (ScrubListener* listener);
+    
+    void mouseDown (const MouseEvent& event) override;
+    void mouseDrag (const MouseEvent& event) override;
+    void mouseUp (const MouseEvent& event) override;
+    
 private:
     bool evaluateExpressions;
     String expression;
     
+    bool scrubEnabled, scrubPending, scrubbing;
+    double scrubStartValue;
+    ListenerList<ScrubListener> scrubListeners;
+    
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ThemedTextEditor)
 };
 
@@ -17,7 +17,7 @@ namespace IDs
 {
     #define DECLARE_ID(name) const juce::Identifier name (#name);
     
-    // Tree
+    // Tree (legacy, partials are now packed into OvertoneDistribution::Partials)
     DECLARE_ID (Partial); 
     // Properties
     DECLARE_ID (Freq);
@@ -35,7 +35,8 @@ namespace IDs
     DECLARE_ID (XAxis);
     DECLARE_ID (YAxis);
     DECLARE_ID (IsViewed);
-    // Children: Partial[], Fundamental
+    DECLARE_ID (Partials);  // Packed freq/amp/mute arrays, see PartialArray
+    DECLARE_ID (LiveInput); // Partials are continuously replaced by the input analysis
     
     // Tree
     DECLARE_ID (Calculator);
@@ -45,6 +46,7 @@ namespace IDs
     DECLARE_ID (EndRatio);
     DECLARE_ID (LogSteps);
     DECLARE_ID (NumSteps);
+    DECLARE_ID (AdaptiveSteps); // Steps are refined around bends and optima, see AdaptiveCurve
     DECLARE_ID (PreprocessorName);
     DECLARE_ID (ScaleLocked);
     DECLARE_ID (ScaleMin);
@@ -62,7 +64,7 @@ namespace IDs
     // Tree
     DECLARE_ID (Tuning);
     // Properties
-    DECLARE_ID (Notes);
-    DECLARE_ID (ReferenceFreq);
+    DECLARE_ID (Notes);         // Space separated ratios of each scale degree above 1/1 (ie, "9/8 5/4 1.5")
+    DECLARE_ID (ReferenceFreq); // Freq of MIDI note 60
     DECLARE_ID (RepeatRatio);
 }
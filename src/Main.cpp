@@ -13,6 +13,8 @@
 
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "MainComponent.h"
+#include "BatchSweep.h"
+#include "Trace.h"
 
 //==============================================================================
 class PsychotonalCATApplication  : public JUCEApplication
@@ -28,12 +30,38 @@ public:
     //==============================================================================
     void initialise (const String& commandLine) override
     {
+        // Setting PSYCHOCAT_TRACE to a file path records a trace, which is written there on quit
+        traceFile = SystemStats::getEnvironmentVariable ("PSYCHOCAT_TRACE", String());
+        Trace::setEnabled (traceFile.isNotEmpty());
+
+        // Batch sweeps run headless: "--sweep <job directory> [--workers <number>]" runs a sweep
+        // in worker processes, which are started with "--sweep-worker <job directory>"
+        StringArray arguments = getCommandLineParameterArray();
+
+        if (arguments[0] == "--sweep" || arguments[0] == "--sweep-worker")
+        {
+            BatchSweep sweep (File::getCurrentWorkingDirectory().getChildFile (arguments[1].unquoted()));
+            bool succeeded = sweep.load();
+
+            if (succeeded)
+                succeeded = arguments[0] == "--sweep-worker" ? sweep.runWorker()
+                                                             : sweep.runCoordinator (arguments[2] == "--workers" ? arguments[3].getIntValue() : 0);
+
+            setApplicationReturnValue (succeeded ? 0 : 1);
+            quit();
+            return;
+        }
+
         mainWindow.reset (new MainWindow (getApplicationName()));
     }
 
     void shutdown() override
     {
         mainWindow = nullptr; // (deletes our window)
+
+        // Sweep workers share the variable, so each process writes its own file
+        if (traceFile.isNotEmpty())
+            Trace::writeJson (File::getCurrentWorkingDirectory().getChildFile (traceFile).getNonexistentSibling());
     }
 
     //==============================================================================
@@ -97,6 +125,7 @@ public:
 
 private:
     std::unique_ptr<MainWindow> mainWindow;
+    String traceFile;
 };
 
 //==============================================================================
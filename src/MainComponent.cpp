@@ -14,7 +14,12 @@
 #include "MainComponent.h"
 
 //==============================================================================
-MainComponent::MainComponent()   : calcData (IDs::CalculatorList)
+MainComponent::MainComponent()   : calcData (IDs::CalculatorList),
+                                   tuningData (IDs::Tuning),
+                                   midiInFifo (1024),
+                                   midiOutFifo (1024),
+                                   midiSender (midiOutFifo),
+                                   sampleRate (44100)
 {
     options.applicationName = "PsychoCAT";
     options.filenameSuffix = "settings";
@@ -26,6 +31,9 @@ MainComponent::MainComponent()   : calcData (IDs::CalculatorList)
     
     addAndMakeVisible (&calcView);
     calcView.setData (calcData);
+    calcView.setInputAnalyzer (inputAnalyzer);
+    calcView.setTuningData (tuningData);
+    tuner.setData (calcData, tuningData);
     
     if (! settings.getUserSettings()->containsKey ("Window Height"))
         settings.getUserSettings()->setValue ("Window Height", 600);
@@ -49,29 +57,86 @@ MainComponent::MainComponent()   : calcData (IDs::CalculatorList)
         // Specify the number of input and output channels that we want to open
         setAudioChannels (2, 2);
     }
+    
+    // The adaptive tuner plays the MIDI input chosen in the settings, and sends its retuned notes to the chosen output
+    deviceManager.addMidiInputCallback ({}, this);
+    
+    updateMidiDevices();
+    settings.getUserSettings()->addChangeListener (this);
 }
 
 MainComponent::~MainComponent()
 {
+    settings.getUserSettings()->removeChangeListener (this);
+    deviceManager.removeMidiInputCallback ({}, this);
+    
     // This shuts down the audio device and clears the audio source.
     shutdownAudio();
 }
 
 //==============================================================================
-void MainComponent::prepareToPlay (int samplesPerBlockExpected, double sampleRate)
+void MainComponent::prepareToPlay (int samplesPerBlockExpected, double newSampleRate)
 {
+    inputAnalyzer.prepare (samplesPerBlockExpected, newSampleRate);
     
+    sampleRate = newSampleRate;
+    midiIn.ensureSize (4096);
+    midiOut.ensureSize (4096);
+    tuner.prepare (newSampleRate);
 }
 
 void MainComponent::getNextAudioBlock (const AudioSourceChannelInfo& bufferToFill)
 {
-
+    inputAnalyzer.pushInput (bufferToFill);
     bufferToFill.clearActiveBufferRegion();
+    
+    // MIDI goes through lock-free fifos, and is sent to the device from the MIDI output thread
+    midiInFifo.removeNextBlockOfMessages (midiIn, bufferToFill.numSamples, sampleRate);
+    tuner.process (midiIn, midiOut, bufferToFill);
+    midiOutFifo.addBlock (midiOut);
 }
 
-void MainComponent::releaseResources()
+void MainComponent::handleIncomingMidiMessage (MidiInput* source, const MidiMessage& message)
 {
+    // The device manager calls MIDI input callbacks one at a time, so there's only one writer
+    midiInFifo.add (message);
+}
+
+void MainComponent::updateMidiDevices()
+{
+    PropertiesFile* userSettings = settings.getUserSettings();
+    
+    const bool isTuning = userSettings->getBoolValue ("Adaptive Tuning", false);
+    const String inputName = isTuning ? userSettings->getValue ("MIDI Input") : String();
+    const String outputName = isTuning ? userSettings->getValue ("MIDI Output") : String();
+    
+    if (inputName != midiInputName)
+    {
+        if (midiInputName.isNotEmpty())
+            deviceManager.setMidiInputEnabled (midiInputName, false);
+        
+        if (inputName.isNotEmpty())
+            deviceManager.setMidiInputEnabled (inputName, true);
+        
+        midiInputName = inputName;
+    }
     
+    // A device that isn't there closes the output
+    if (outputName != midiOutputName)
+    {
+        midiSender.setOutput (MidiOutput::getDevices().indexOf (outputName), AdaptiveTuner::getZoneSetup());
+        midiOutputName = outputName;
+    }
+}
+
+void MainComponent::changeListenerCallback (ChangeBroadcaster* source)
+{
+    updateMidiDevices();
+}
+
+void MainComponent::releaseResources()
+{
+    inputAnalyzer.release();
 }
 
 //==============================================================================
@@ -15,6 +15,9 @@
 
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "DissCalcView.h"
+#include "InputAnalyzer.h"
+#include "AdaptiveTuner.h"
+#include "MidiFifo.h"
 #include "SettingsMenu.h"
 
 //==============================================================================
@@ -22,7 +25,9 @@
     This component lives inside our window, and this is where you should put all
     your controls and content.
 */
-class MainComponent   : public AudioAppComponent
+class MainComponent   : public AudioAppComponent,
+                        private MidiInputCallback,
+                        private ChangeListener
 {
 public:
     //==============================================================================
@@ -41,8 +46,22 @@ public:
     PropertiesFile* getSettings();
 
 private:
+    // MIDI input thread
+    void handleIncomingMidiMessage (MidiInput* source, const MidiMessage& message) override;
+    
+    // Opens the MIDI devices chosen in the settings, when adaptive tuning is on
+    void updateMidiDevices();
+    void changeListenerCallback (ChangeBroadcaster* source) override;
+    
     //==============================================================================
-    ValueTree calcData;
+    ValueTree calcData, tuningData;
+    InputAnalyzer inputAnalyzer;
+    AdaptiveTuner tuner;
+    MidiFifo midiInFifo, midiOutFifo;
+    MidiSender midiSender;
+    MidiBuffer midiIn, midiOut;
+    String midiInputName, midiOutputName;
+    double sampleRate;
     DissCalcView calcView;
     ApplicationProperties settings;
     PropertiesFile::Options options;
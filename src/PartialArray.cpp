@@ -0,0 +1,571 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#include "PartialArray.h"
+
+/*
+    Packed layout: a header, followed by the freq array, the amp array and one
+    mute byte per partial.
+ 
+    The header holds the partial count, the last edit's type, index and field,
+    the version the edit was made on and the version it produced. Header values
+    are little-endian, the arrays are native so they can be read in place.
+*/
+namespace
+{
+    enum HeaderOffsets
+    {
+        countOffset = 0,
+        editTypeOffset = 4,
+        editIndexOffset = 8,
+        editFieldOffset = 12,
+        baseVersionOffset = 16,
+        versionOffset = 24,
+        headerSize = 32
+    };
+    
+    uint32 readUint32 (const MemoryBlock& block, size_t offset)
+    {
+        return ByteOrder::littleEndianInt (static_cast<const char*> (block.getData()) + offset);
+    }
+    
+    uint64 readUint64 (const MemoryBlock& block, size_t offset)
+    {
+        return ByteOrder::littleEndianInt64 (static_cast<const char*> (block.getData()) + offset);
+    }
+    
+    void writeUint32 (MemoryBlock& block, size_t offset, uint32 value)
+    {
+        value = ByteOrder::swapIfBigEndian (value);
+        block.copyFrom (&value, (int) offset, sizeof (value));
+    }
+    
+    void writeUint64 (MemoryBlock& block, size_t offset, uint64 value)
+    {
+        value = ByteOrder::swapIfBigEndian (value);
+        block.copyFrom (&value, (int) offset, sizeof (value));
+    }
+    
+    // Edited fields are stored as small codes, 0 for edits that may have changed any field
+    uint32 getFieldCode (const Identifier& field)
+    {
+        if (field == IDs::Freq)  return 1;
+        if (field == IDs::Amp)   return 2;
+        if (field == IDs::Mute)  return 3;
+        
+        return 0;
+    }
+    
+    Identifier getField (uint32 fieldCode)
+    {
+        switch (fieldCode)
+        {
+            case 1:  return IDs::Freq;
+            case 2:  return IDs::Amp;
+            case 3:  return IDs::Mute;
+            default: return {};
+        }
+    }
+    
+    size_t freqsOffset()                  { return headerSize; }
+    size_t ampsOffset (int numPartials)   { return headerSize + sizeof (float) * (size_t) numPartials; }
+    size_t mutesOffset (int numPartials)  { return headerSize + sizeof (float) * 2 * (size_t) numPartials; }
+    size_t blockSize (int numPartials)    { return mutesOffset (numPartials) + (size_t) numPartials; }
+    
+    // Blocks too small for the count they hold (from a corrupt or truncated file) are read as empty
+    int readSize (const MemoryBlock& block)
+    {
+        if (block.getSize() < headerSize)
+            return 0;
+        
+        const uint32 numPartials = readUint32 (block, countOffset);
+        
+        if (numPartials > (uint32) std::numeric_limits<int>::max() / 16
+            || block.getSize() < blockSize ((int) numPartials))
+            return 0;
+        
+        return (int) numPartials;
+    }
+}
+
+//==============================================================================
+PartialArray::PartialArray (const ValueTree& distributionNode)   : distribution (distributionNode)
+{
+}
+
+PartialArray::~PartialArray()
+{
+}
+
+const MemoryBlock& PartialArray::getBlock() const
+{
+    static const MemoryBlock empty;
+    
+    if (MemoryBlock* block = distribution[IDs::Partials].getBinaryData())
+        return *block;
+    
+    return empty;
+}
+
+int PartialArray::size() const
+{
+    return readSize (getBlock());
+}
+
+float PartialArray::getFreq (int index) const
+{
+    jassert (isPositiveAndBelow (index, size()));
+    return getFreqs()[index];
+}
+
+float PartialArray::getAmp (int index) const
+{
+    jassert (isPositiveAndBelow (index, size()));
+    return getAmps()[index];
+}
+
+bool PartialArray::isMuted (int index) const
+{
+    jassert (isPositiveAndBelow (index, size()));
+    return getMutes()[index] != 0;
+}
+
+PartialData PartialArray::get (int index) const
+{
+    PartialData partial;
+    
+    if (isPositiveAndBelow (index, size()))
+    {
+        partial.freq = getFreqs()[index];
+        partial.amp = getAmps()[index];
+        partial.mute = getMutes()[index] != 0;
+    }
+    
+    return partial;
+}
+
+Array<PartialData> PartialArray::getAll() const
+{
+    return unpack (getBlock());
+}
+
+const float* PartialArray::getFreqs() const
+{
+    return addBytesToPointer (static_cast<const float*> (getBlock().getData()), freqsOffset());
+}
+
+const float* PartialArray::getAmps() const
+{
+    const MemoryBlock& block = getBlock();
+    return addBytesToPointer (static_cast<const float*> (block.getData()), ampsOffset (readSize (block)));
+}
+
+const uint8* PartialArray::getMutes() const
+{
+    const MemoryBlock& block = getBlock();
+    return addBytesToPointer (static_cast<const uint8*> (block.getData()), mutesOffset (readSize (block)));
+}
+
+bool PartialArray::containsFreq (float freq) const
+{
+    if (freq == 1.0 || freq <= 0)
+        return true;
+    
+    const float* freqs = getFreqs();
+    
+    for (int i = size(); --i >= 0;)
+        if (freqs[i] == freq)
+            return true;
+    
+    return false;
+}
+
+//==============================================================================
+void PartialArray::add (const PartialData& newPartial, UndoManager* undo)
+{
+    PartialEditAction* action = new PartialEditAction (distribution, added, size(), {}, {}, newPartial);
+    
+    if (undo != nullptr)
+    {
+        undo->perform (action);
+    }
+    else
+    {
+        action->perform();
+        delete action;
+    }
+}
+
+void PartialArray::remove (int index, UndoManager* undo)
+{
+    if (! isPositiveAndBelow (index, size()))
+        return;
+    
+    PartialEditAction* action = new PartialEditAction (distribution, removed, index, {}, get (index), {});
+    
+    if (undo != nullptr)
+    {
+        undo->perform (action);
+    }
+    else
+    {
+        action->perform();
+        delete action;
+    }
+}
+
+void PartialArray::setFreq (int index, float newFreq, UndoManager* undo)
+{
+    if (! isPositiveAndBelow (index, size()) || getFreq (index) == newFreq)
+        return;
+    
+    PartialData partial = get (index);
+    partial.freq = newFreq;
+    
+    PartialEditAction* action = new PartialEditAction (distribution, changed, index, IDs::Freq, get (index), partial);
+    
+    if (undo != nullptr)
+    {
+        undo->perform (action);
+    }
+    else
+    {
+        action->perform();
+        delete action;
+    }
+}
+
+void PartialArray::setAmp (int index, float newAmp, UndoManager* undo)
+{
+    if (! isPositiveAndBelow (index, size()) || getAmp (index) == newAmp)
+        return;
+    
+    PartialData partial = get (index);
+    partial.amp = newAmp;
+    
+    PartialEditAction* action = new PartialEditAction (distribution, changed, index, IDs::Amp, get (index), partial);
+    
+    if (undo != nullptr)
+    {
+        undo->perform (action);
+    }
+    else
+    {
+        action->perform();
+        delete action;
+    }
+}
+
+void PartialArray::setMute (int index, bool shouldMute, UndoManager* undo)
+{
+    if (! isPositiveAndBelow (index, size()) || isMuted (index) == shouldMute)
+        return;
+    
+    PartialData partial = get (index);
+    partial.mute = shouldMute;
+    
+    PartialEditAction* action = new PartialEditAction (distribution, changed, index, IDs::Mute, get (index), partial);
+    
+    if (undo != nullptr)
+    {
+        undo->perform (action);
+    }
+    else
+    {
+        action->perform();
+        delete action;
+    }
+}
+
+void PartialArray::set (int index, const PartialData& newPartial, UndoManager* undo)
+{
+    if (! isPositiveAndBelow (index, size()))
+        return;
+    
+    PartialData partial = get (index);
+    
+    if (partial.freq == newPartial.freq && partial.amp == newPartial.amp && partial.mute == newPartial.mute)
+        return;
+    
+    PartialEditAction* action = new PartialEditAction (distribution, changed, index, {}, partial, newPartial);
+    
+    if (undo != nullptr)
+    {
+        undo->perform (action);
+    }
+    else
+    {
+        action->perform();
+        delete action;
+    }
+}
+
+void PartialArray::replaceAll (const Array<PartialData>& newPartials, UndoManager* undo)
+{
+    if (undo != nullptr)
+    {
+        undo->perform (new PartialResetAction (distribution, getBlock(), pack (newPartials)));
+    }
+    else
+    {
+        write (distribution, pack (newPartials), { reset, -1, {} });
+    }
+}
+
+//==============================================================================
+uint64 PartialArray::getVersion() const
+{
+    const MemoryBlock& block = getBlock();
+    return block.getSize() < headerSize ? 0 : readUint64 (block, versionOffset);
+}
+
+PartialArray::Edit PartialArray::getEditSince (uint64 version) const
+{
+    const MemoryBlock& block = getBlock();
+    
+    if (version == 0 || block.getSize() < headerSize || readUint64 (block, baseVersionOffset) != version)
+        return { reset, -1, {} };
+    
+    const uint32 type = readUint32 (block, editTypeOffset);
+    const int index = (int) readUint32 (block, editIndexOffset);
+    
+    if (type > changed || (type != reset && ! isPositiveAndNotGreaterThan (index, readSize (block))))
+        return { reset, -1, {} };
+    
+    return { (EditType) type, index, getField (readUint32 (block, editFieldOffset)) };
+}
+
+void PartialArray::write (ValueTree& distributionNode, const MemoryBlock& block, Edit edit)
+{
+    JUCE_ASSERT_MESSAGE_THREAD
+    
+    const uint64 baseVersion = PartialArray (distributionNode).getVersion();
+    uint64 version;
+    
+    // Random, so versions from other sessions or other trees don't match the one a listener kept
+    do
+    {
+        version = (uint64) Random::getSystemRandom().nextInt64();
+    }
+    while (version == 0 || version == baseVersion);
+    
+    MemoryBlock stamped (block);
+    
+    if (stamped.getSize() < headerSize)
+        stamped = pack ({});
+    
+    writeUint32 (stamped, editTypeOffset, (uint32) edit.type);
+    writeUint32 (stamped, editIndexOffset, (uint32) edit.index);
+    writeUint32 (stamped, editFieldOffset, getFieldCode (edit.field));
+    writeUint64 (stamped, baseVersionOffset, baseVersion);
+    writeUint64 (stamped, versionOffset, version);
+    
+    distributionNode.setProperty (IDs::Partials, var (stamped), nullptr);
+}
+
+void PartialArray::convertLegacyPartials (ValueTree& distributionNode)
+{
+    // Trees read back from xml hold the packed data as a base64 string
+    if (distributionNode[IDs::Partials].isString())
+    {
+        MemoryBlock block;
+        
+        if (block.fromBase64Encoding (distributionNode[IDs::Partials].toString()))
+            distributionNode.setProperty (IDs::Partials, var (block), nullptr);
+        else
+            distributionNode.removeProperty (IDs::Partials, nullptr);
+    }
+    
+    if (distributionNode.getChildWithName (IDs::Partial).isValid())
+    {
+        Array<PartialData> partials (PartialArray (distributionNode).getAll());
+        
+        for (int i = distributionNode.getNumChildren(); --i >= 0;)
+        {
+            ValueTree child = distributionNode.getChild (i);
+            
+            if (child.hasType (IDs::Partial))
+            {
+                PartialData partial;
+                partial.freq = child[IDs::Freq];
+                partial.amp = child[IDs::Amp];
+                partial.mute = child[IDs::Mute];
+                
+                partials.insert (0, partial);
+                distributionNode.removeChild (i, nullptr);
+            }
+        }
+        
+        distributionNode.setProperty (IDs::Partials, var (pack (partials)), nullptr);
+    }
+}
+
+MemoryBlock PartialArray::pack (const Array<PartialData>& partials)
+{
+    const int numPartials = partials.size();
+    // Cleared, so packing the same partials always gives the same block
+    MemoryBlock block (blockSize (numPartials), true);
+    
+    writeUint32 (block, countOffset, (uint32) numPartials);
+    
+    float* freqs = addBytesToPointer (static_cast<float*> (block.getData()), freqsOffset());
+    float* amps = addBytesToPointer (static_cast<float*> (block.getData()), ampsOffset (numPartials));
+    uint8* mutes = addBytesToPointer (static_cast<uint8*> (block.getData()), mutesOffset (numPartials));
+    
+    for (int i = 0; i < numPartials; ++i)
+    {
+        freqs[i] = partials.getReference (i).freq;
+        amps[i] = partials.getReference (i).amp;
+        mutes[i] = partials.getReference (i).mute ? 1 : 0;
+    }
+    
+    return block;
+}
+
+Array<PartialData> PartialArray::unpack (const MemoryBlock& block)
+{
+    Array<PartialData> partials;
+    const int numPartials = readSize (block);
+    
+    if (numPartials <= 0)
+        return partials;
+    
+    const float* freqs = addBytesToPointer (static_cast<const float*> (block.getData()), freqsOffset());
+    const float* amps = addBytesToPointer (static_cast<const float*> (block.getData()), ampsOffset (numPartials));
+    const uint8* mutes = addBytesToPointer (static_cast<const uint8*> (block.getData()), mutesOffset (numPartials));
+    
+    partials.ensureStorageAllocated (numPartials);
+    
+    for (int i = 0; i < numPartials; ++i)
+    {
+        PartialData partial;
+        partial.freq = freqs[i];
+        partial.amp = amps[i];
+        partial.mute = mutes[i] != 0;
+        
+        partials.add (partial);
+    }
+    
+    return partials;
+}
+
+//==============================================================================
+PartialEditAction::PartialEditAction (const ValueTree& distributionNode, PartialArray::EditType editType,
+                                      int partialIndex, const Identifier& changedField,
+                                      const PartialData& before, const PartialData& after)
+    : distribution (distributionNode),
+      type (editType),
+      index (partialIndex),
+      field (changedField),
+      oldPartial (before),
+      newPartial (after)
+{
+}
+
+bool PartialEditAction::perform()
+{
+    apply (type, newPartial);
+    return true;
+}
+
+bool PartialEditAction::undo()
+{
+    if (type == PartialArray::added)
+        apply (PartialArray::removed, oldPartial);
+    else if (type == PartialArray::removed)
+        apply (PartialArray::added, oldPartial);
+    else
+        apply (PartialArray::changed, oldPartial);
+    
+    return true;
+}
+
+int PartialEditAction::getSizeInUnits()
+{
+    return (int) sizeof (*this);
+}
+
+UndoableAction* PartialEditAction::createCoalescedAction (UndoableAction* nextAction)
+{
+    if (auto* next = dynamic_cast<PartialEditAction*> (nextAction))
+    {
+        if (type == PartialArray::changed && next->type == PartialArray::changed
+            && next->distribution == distribution && next->index == index)
+        {
+            // Whole partial values are stored, so changes to different fields can be merged too
+            return new PartialEditAction (distribution, type, index,
+                                          next->field == field ? field : Identifier(),
+                                          oldPartial, next->newPartial);
+        }
+    }
+    
+    return nullptr;
+}
+
+void PartialEditAction::apply (PartialArray::EditType editType, const PartialData& partial)
+{
+    const MemoryBlock& current = PartialArray (distribution).getBlock();
+    
+    if (editType == PartialArray::changed)
+    {
+        // Only the changed value is written, the rest of the block is copied as is
+        MemoryBlock block (current);
+        const int numPartials = readSize (block);
+        
+        if (! isPositiveAndBelow (index, numPartials))
+            return;
+        
+        addBytesToPointer (static_cast<float*> (block.getData()), freqsOffset())[index] = partial.freq;
+        addBytesToPointer (static_cast<float*> (block.getData()), ampsOffset (numPartials))[index] = partial.amp;
+        addBytesToPointer (static_cast<uint8*> (block.getData()), mutesOffset (numPartials))[index] = partial.mute ? 1 : 0;
+        
+        PartialArray::write (distribution, block, { editType, index, field });
+    }
+    else
+    {
+        Array<PartialData> partials (PartialArray::unpack (current));
+        
+        if (editType == PartialArray::added)
+            partials.insert (index, partial);
+        else
+            partials.remove (index);
+        
+        PartialArray::write (distribution, PartialArray::pack (partials), { editType, index, field });
+    }
+}
+
+//==============================================================================
+PartialResetAction::PartialResetAction (const ValueTree& distributionNode,
+                                        const MemoryBlock& before,
+                                        const MemoryBlock& after)   : distribution (distributionNode),
+                                                                      oldBlock (before),
+                                                                      newBlock (after)
+{
+}
+
+bool PartialResetAction::perform()
+{
+    PartialArray::write (distribution, newBlock, { PartialArray::reset, -1, {} });
+    return true;
+}
+
+bool PartialResetAction::undo()
+{
+    PartialArray::write (distribution, oldBlock, { PartialArray::reset, -1, {} });
+    return true;
+}
+
+int PartialResetAction::getSizeInUnits()
+{
+    return (int) (oldBlock.getSize() + newBlock.getSize());
+}
@@ -0,0 +1,163 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "IDs.h"
+
+//==============================================================================
+// A single partial, as stored in a distribution's packed partial array
+struct PartialData
+{
+    float freq = 0;
+    float amp = 0;
+    bool mute = false;
+};
+
+//==============================================================================
+/*
+    View onto the partials of an OvertoneDistribution node.
+ 
+    Partials are stored in the distribution's IDs::Partials property as a single
+    MemoryBlock holding contiguous freq, amp and mute arrays, instead of one valuetree
+    child per partial. Partials with a freq or amp of 0 haven't been entered yet.
+ 
+    Edits go through small undoable actions that only record the partial that changed.
+    Each edit stamps the packed data with a new version and a record of the edit, so
+    listeners of the distribution node can keep the version they last read, and call
+    getEditSince() with it on an IDs::Partials change to find out which partial was added,
+    removed or changed. A change with an invalid field identifier may have changed any of
+    the partial's values.
+*/
+class PartialArray
+{
+public:
+    PartialArray (const ValueTree& distributionNode);
+    ~PartialArray();
+    
+    enum EditType
+    {
+        reset = 0,
+        added,
+        removed,
+        changed
+    };
+    
+    struct Edit
+    {
+        EditType type;
+        int index;
+        Identifier field;
+    };
+    
+    int size() const;
+    float getFreq (int index) const;
+    float getAmp (int index) const;
+    bool isMuted (int index) const;
+    PartialData get (int index) const;
+    Array<PartialData> getAll() const;
+    
+    // Contiguous arrays for bulk reads, only valid until the next edit
+    const float* getFreqs() const;
+    const float* getAmps() const;
+    const uint8* getMutes() const;
+    
+    // Checks if a partial with the given freq ratio exists (1 belongs to the fundamental)
+    bool containsFreq (float freq) const;
+    
+    // Edits, which are added to the undo manager's current transaction if one is given
+    void add (const PartialData& newPartial, UndoManager* undo);
+    void remove (int index, UndoManager* undo);
+    void setFreq (int index, float newFreq, UndoManager* undo);
+    void setAmp (int index, float newAmp, UndoManager* undo);
+    void setMute (int index, bool shouldMute, UndoManager* undo);
+    void set (int index, const PartialData& newPartial, UndoManager* undo);
+    void replaceAll (const Array<PartialData>& newPartials, UndoManager* undo);
+    
+    // Changes with every edit, 0 for data that hasn't been edited since it was packed
+    uint64 getVersion() const;
+    
+    // Returns the edit that turned the data with the given version into the current data,
+    // or a reset if there were other edits in between or the data was set some other way
+    Edit getEditSince (uint64 version) const;
+    
+    // Moves IDs::Partial children (from older .dismal files) into the packed array
+    static void convertLegacyPartials (ValueTree& distributionNode);
+    
+    static MemoryBlock pack (const Array<PartialData>& partials);
+    static Array<PartialData> unpack (const MemoryBlock& block);
+
+private:
+    ValueTree distribution;
+    
+    const MemoryBlock& getBlock() const;
+    
+    // Sets the packed data without undo, stamping it with a new version and the given edit
+    static void write (ValueTree& distributionNode, const MemoryBlock& block, Edit edit);
+    
+    friend class PartialEditAction;
+    friend class PartialResetAction;
+    
+    JUCE_LEAK_DETECTOR (PartialArray)
+};
+
+//==============================================================================
+/*
+    Undo record for adding, removing or changing a single partial.
+ 
+    Only the index and the partial's before/after values are kept, so large timbres
+    don't cost a copy of the whole array per edit. Consecutive changes to the same
+    partial coalesce into one action, so dragging a value only leaves a single undo record.
+*/
+class PartialEditAction   : public UndoableAction
+{
+public:
+    PartialEditAction (const ValueTree& distributionNode, PartialArray::EditType editType,
+                       int partialIndex, const Identifier& changedField,
+                       const PartialData& before, const PartialData& after);
+    
+    bool perform() override;
+    bool undo() override;
+    int getSizeInUnits() override;
+    UndoableAction* createCoalescedAction (UndoableAction* nextAction) override;
+
+private:
+    ValueTree distribution;
+    PartialArray::EditType type;
+    int index;
+    Identifier field;
+    PartialData oldPartial, newPartial;
+    
+    void apply (PartialArray::EditType editType, const PartialData& partial);
+    
+    JUCE_DECLARE_NON_COPYABLE (PartialEditAction)
+};
+
+//==============================================================================
+// Undo record for replacing every partial at once (loading, clearing, importing)
+class PartialResetAction   : public UndoableAction
+{
+public:
+    PartialResetAction (const ValueTree& distributionNode, const MemoryBlock& before, const MemoryBlock& after);
+    
+    bool perform() override;
+    bool undo() override;
+    int getSizeInUnits() override;
+
+private:
+    ValueTree distribution;
+    MemoryBlock oldBlock, newBlock;
+    
+    JUCE_DECLARE_NON_COPYABLE (PartialResetAction)
+};
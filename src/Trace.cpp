@@ -0,0 +1,128 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#include "Trace.h"
+
+namespace
+{
+    // A power of 2, so positions wrap with a mask
+    const uint32 capacity = 1 << 16;
+    
+    struct Event
+    {
+        // The event's position + 1 once it's written, and 0 while it's being written
+        std::atomic<uint32> sequence;
+        
+        const char* name;
+        int64 start, end;
+        pointer_sized_int thread;
+    };
+    
+    Event events[capacity];
+    std::atomic<uint32> writePosition (0);
+}
+
+std::atomic<bool> Trace::enabled (false);
+
+//==============================================================================
+void Trace::setEnabled (bool shouldBeEnabled)
+{
+    enabled.store (shouldBeEnabled, std::memory_order_relaxed);
+}
+
+void Trace::addEvent (const char* name, int64 startTicks, int64 endTicks) noexcept
+{
+    const uint32 position = writePosition.fetch_add (1, std::memory_order_relaxed);
+    Event& event = events[position & (capacity - 1)];
+    
+    event.sequence.store (0, std::memory_order_relaxed);
+    std::atomic_thread_fence (std::memory_order_release);
+    
+    event.name = name;
+    event.start = startTicks;
+    event.end = endTicks;
+    event.thread = (pointer_sized_int) Thread::getCurrentThreadId();
+    
+    event.sequence.store (position + 1, std::memory_order_release);
+}
+
+bool Trace::writeJson (const File& file)
+{
+    struct Copy
+    {
+        const char* name;
+        int64 start, end;
+        pointer_sized_int thread;
+    };
+    
+    Array<Copy> copies;
+    
+    const uint32 end = writePosition.load (std::memory_order_acquire);
+    const uint32 begin = end > capacity ? end - capacity : 0;
+    
+    for (uint32 position = begin; position < end; ++position)
+    {
+        const Event& event = events[position & (capacity - 1)];
+        
+        // Skipped if it's being written, or overwritten while it's copied
+        if (event.sequence.load (std::memory_order_acquire) != position + 1)
+            continue;
+        
+        Copy copy = { event.name, event.start, event.end, event.thread };
+        std::atomic_thread_fence (std::memory_order_acquire);
+        
+        if (event.sequence.load (std::memory_order_relaxed) == position + 1)
+            copies.add (copy);
+    }
+    
+    file.deleteFile();
+    FileOutputStream stream (file);
+    
+    if (! stream.openedOk())
+        return false;
+    
+    int64 origin = copies.isEmpty() ? 0 : copies.getReference (0).start;
+    
+    for (auto& copy : copies)
+        origin = jmin (origin, copy.start);
+    
+    // Threads are numbered in the order they first show up, with the message thread named
+    Array<pointer_sized_int> threads;
+    const pointer_sized_int messageThread = (pointer_sized_int) MessageManager::getInstance()->getCurrentMessageThread();
+    
+    stream << "{\"traceEvents\": [\n";
+    
+    for (int i = 0; i < copies.size(); ++i)
+    {
+        const Copy& copy = copies.getReference (i);
+        
+        if (! threads.contains (copy.thread))
+            threads.add (copy.thread);
+        
+        stream << (i > 0 ? ",\n" : "")
+               << "{\"name\": " << JSON::toString (String (copy.name))
+               << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << String (threads.indexOf (copy.thread) + 1)
+               << ", \"ts\": " << String (Time::highResolutionTicksToSeconds (copy.start - origin) * 1.0e6, 3)
+               << ", \"dur\": " << String (Time::highResolutionTicksToSeconds (copy.end - copy.start) * 1.0e6, 3) << "}";
+    }
+    
+    if (threads.contains (messageThread))
+        stream << (copies.isEmpty() ? "" : ",\n")
+               << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << String (threads.indexOf (messageThread) + 1)
+               << ", \"args\": {\"name\": \"Message Thread\"}}";
+    
+    stream << "\n], \"displayTimeUnit\": \"ms\"}\n";
+    stream.flush();
+    
+    return stream.getStatus().wasOk();
+}
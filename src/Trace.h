@@ -0,0 +1,85 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+// Set to 0 to compile every trace event out
+#ifndef PSYCHOCAT_TRACING
+ #define PSYCHOCAT_TRACING 1
+#endif
+
+//==============================================================================
+/*
+    Timings of the compute and paint pipeline, written as Chrome trace events (for
+    chrome://tracing or Perfetto).
+ 
+    Events are recorded into a fixed ring buffer that keeps the latest 65536 of them. Each event
+    takes its slot with one atomic increment, so threads never wait on each other, and a slot
+    that's overwritten while the trace is written is left out. Event names have to be string
+    literals, as only their pointers are kept.
+ 
+    Recording is off until it's enabled at runtime, and while it's off a scope costs a relaxed
+    load of a flag. Setting PSYCHOCAT_TRACE to a file path before launching the app enables it,
+    and writes the trace there when the app quits. Defining PSYCHOCAT_TRACING as 0 compiles the
+    scopes out entirely.
+*/
+class Trace
+{
+public:
+    static void setEnabled (bool shouldBeEnabled);
+    
+    static bool isEnabled() noexcept
+    {
+        return enabled.load (std::memory_order_relaxed);
+    }
+    
+    // A finished event, in high resolution ticks
+    static void addEvent (const char* name, int64 startTicks, int64 endTicks) noexcept;
+    
+    // Writes the events in the buffer, oldest first
+    static bool writeJson (const File& file);
+    
+    //==============================================================================
+    // Records the time between its construction and destruction as an event
+    class Scope
+    {
+    public:
+        Scope (const char* eventName) noexcept   : name (eventName),
+                                                   start (isEnabled() ? Time::getHighResolutionTicks() : 0)
+        {
+        }
+        
+        ~Scope() noexcept
+        {
+            if (start != 0)
+                addEvent (name, start, Time::getHighResolutionTicks());
+        }
+    
+    private:
+        const char* name;
+        int64 start;
+        
+        JUCE_DECLARE_NON_COPYABLE (Scope)
+    };
+
+private:
+    static std::atomic<bool> enabled;
+};
+
+#if PSYCHOCAT_TRACING
+ #define TRACE_SCOPE(name)   const Trace::Scope JUCE_JOIN_MACRO (traceScope, __LINE__) (name)
+#else
+ #define TRACE_SCOPE(name)
+#endif
@@ -0,0 +1,620 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#include "AdaptiveTuner.h"
+#include "TuningGenerator.h"
+#include "Trace.h"
+
+namespace
+{
+    // Freq of the lowest register row of the dissonance table, each row is an octave above the last
+    const float lowestRegisterFreq = 27.5f;
+    
+    // The tuning's reference freq belongs to middle C
+    const int referenceNote = 60;
+    const float defaultReferenceFreq = 261.6256f;
+    
+    const float voiceGain = 0.2f;
+    const float attackTime = 0.005f;
+    const float releaseTime = 0.15f;
+    
+    struct AmpComparator
+    {
+        static int compareElements (const PartialData& first, const PartialData& second)
+        {
+            return first.amp > second.amp ? -1 : (first.amp < second.amp ? 1 : 0);
+        }
+    };
+    
+    struct FreqComparator
+    {
+        static int compareElements (const PartialData& first, const PartialData& second)
+        {
+            return first.freq < second.freq ? -1 : (first.freq > second.freq ? 1 : 0);
+        }
+    };
+    
+    // Keeps the strongest partials of a timbre, sorted by freq, with amps relative to the strongest
+    void addTimbre (TuningTables& tables, Array<PartialData>& partials)
+    {
+        const int timbre = tables.numTimbres++;
+        
+        AmpComparator ampComparator;
+        partials.sort (ampComparator);
+        partials.removeRange (TuningTables::maxPartials, partials.size());
+        
+        FreqComparator freqComparator;
+        partials.sort (freqComparator);
+        
+        float strongest = 0;
+        float sum = 0;
+        
+        for (auto& partial : partials)
+        {
+            strongest = jmax (strongest, partial.amp);
+            sum += partial.amp;
+        }
+        
+        tables.numPartials[timbre] = partials.size();
+        tables.gains[timbre] = strongest / sum;
+        
+        for (int i = 0; i < partials.size(); ++i)
+        {
+            tables.ratios[timbre][i] = partials.getReference (i).freq;
+            tables.amps[timbre][i] = partials.getReference (i).amp / strongest;
+        }
+    }
+    
+    void getRows (const TuningTables& tables, int lowerTimbre, int upperTimbre, float lowerFreq,
+                  const float* rows[2], float& mix)
+    {
+        const float position = jlimit (0.f, (float) (TuningTables::numRegisters - 1),
+                                       std::log2 (lowerFreq / lowestRegisterFreq));
+        const int index = jmin ((int) position, TuningTables::numRegisters - 2);
+        
+        rows[0] = tables.getRow (lowerTimbre, upperTimbre, index);
+        rows[1] = tables.getRow (lowerTimbre, upperTimbre, index + 1);
+        mix = position - index;
+    }
+    
+    // Tables are only freed on the message thread, so freeing a large table never holds up a build
+    void deleteOnMessageThread (TuningTables* tables)
+    {
+        if (tables == nullptr)
+            return;
+        
+        if (MessageManager::getInstance()->isThisTheMessageThread())
+            delete tables;
+        else
+            MessageManager::callAsync ([tables] { delete tables; });
+    }
+    
+    inline float lookUp (const float* const rows[2], float mix, float cents)
+    {
+        const int index = (int) (cents + 0.5f);
+        
+        if (index >= TuningTables::tableSize)
+            return 0;
+        
+        return rows[0][index] + mix * (rows[1][index] - rows[0][index]);
+    }
+}
+
+//==============================================================================
+const float* TuningTables::getRow (int lowerTimbre, int upperTimbre, int registerIndex) const
+{
+    return dissonance + ((lowerTimbre * numTimbres + upperTimbre) * numRegisters + registerIndex) * tableSize;
+}
+
+//==============================================================================
+BuildTuningTablesJob::BuildTuningTablesJob (AdaptiveTuner& owner,
+                                            TuningTables* tablesToBuild,
+                                            Roughness::Model dissonanceModel,
+                                            int tablesGeneration)   : ThreadPoolJob ("Build Tuning Tables"),
+                                                                      tuner (owner),
+                                                                      tables (tablesToBuild),
+                                                                      model (dissonanceModel),
+                                                                      generation (tablesGeneration)
+{
+}
+
+BuildTuningTablesJob::~BuildTuningTablesJob()
+{
+    // Tables from a build that was cancelled
+    deleteOnMessageThread (tables.release());
+}
+
+ThreadPoolJob::JobStatus BuildTuningTablesJob::runJob()
+{
+    TRACE_SCOPE ("BuildTuningTablesJob");
+    
+    const int numTimbres = tables->numTimbres;
+    
+    tables->dissonance.allocate ((size_t) (numTimbres * numTimbres * TuningTables::numRegisters * TuningTables::tableSize), true);
+    
+    for (int lower = 0; lower < numTimbres; ++lower)
+    {
+        for (int upper = 0; upper < numTimbres; ++upper)
+        {
+            for (int registerIndex = 0; registerIndex < TuningTables::numRegisters; ++registerIndex)
+            {
+                // Superseded by a newer build
+                if (shouldExit())
+                    return jobHasFinished;
+                
+                float* row = const_cast<float*> (tables->getRow (lower, upper, registerIndex));
+                const float lowerFreq = lowestRegisterFreq * (float) (1 << registerIndex);
+                
+                for (int cents = 0; cents < TuningTables::tableSize; ++cents)
+                {
+                    const float upperFreq = lowerFreq * std::exp2 (cents / 1200.f);
+                    float total = 0;
+                    
+                    for (int i = 0; i < tables->numPartials[lower]; ++i)
+                        for (int j = 0; j < tables->numPartials[upper]; ++j)
+                            total += Roughness::ofPair (lowerFreq * tables->ratios[lower][i], tables->amps[lower][i],
+                                                        upperFreq * tables->ratios[upper][j], tables->amps[upper][j],
+                                                        model);
+                    
+                    row[cents] = total;
+                }
+            }
+        }
+    }
+    
+    tuner.tablesBuilt (tables.release(), generation);
+    
+    return jobHasFinished;
+}
+
+//==============================================================================
+AdaptiveTuner::AdaptiveTuner()   : pool (1)
+{
+    activeTables = nullptr;
+    nextAge = 0;
+    searchRange = 30;
+    
+    prepare (44100);
+    
+    for (int i = 0; i <= sineTableSize; ++i)
+        sineTable[i] = std::sin (MathConstants<float>::twoPi * i / sineTableSize);
+    
+    startTimerHz (10);
+    
+    // Builds tables for a sine timbre in 12 tone equal temperament until data is set
+    triggerAsyncUpdate();
+}
+
+AdaptiveTuner::~AdaptiveTuner()
+{
+    calcData.removeListener (this);
+    tuningData.removeListener (this);
+    
+    pool.removeAllJobs (true, 5000);
+    
+    delete pendingTables.exchange (nullptr);
+    delete retiredTables.exchange (nullptr);
+    delete activeTables;
+}
+
+void AdaptiveTuner::setData (ValueTree& calcList, ValueTree& tuning)
+{
+    calcData.removeListener (this);
+    tuningData.removeListener (this);
+    
+    calcData = calcList;
+    tuningData = tuning;
+    
+    calcData.addListener (this);
+    tuningData.addListener (this);
+    
+    triggerAsyncUpdate();
+}
+
+void AdaptiveTuner::setSearchRange (int cents)
+{
+    searchRange = jmax (0, cents);
+}
+
+void AdaptiveTuner::prepare (double newSampleRate)
+{
+    sampleRate = newSampleRate;
+    attackStep = (float) (1 / (attackTime * sampleRate));
+    releaseStep = (float) (1 / (releaseTime * sampleRate));
+    
+    for (auto& voice : voices)
+        voice.active = false;
+}
+
+void AdaptiveTuner::process (const MidiBuffer& midiIn, MidiBuffer& midiOut, const AudioSourceChannelInfo& bufferToFill)
+{
+    // New tables are only swapped in once the last ones replaced have been deleted
+    if (retiredTables.get() == nullptr)
+    {
+        if (TuningTables* newTables = pendingTables.exchange (nullptr))
+        {
+            retiredTables = activeTables;
+            activeTables = newTables;
+        }
+    }
+    
+    midiOut.clear();
+    
+    if (activeTables == nullptr)
+        return;
+    
+    MidiBuffer::Iterator iterator (midiIn);
+    MidiMessage message;
+    int samplePosition;
+    int numRendered = 0;
+    
+    // Renders up to each event, so notes start and stop at the right sample
+    while (iterator.getNextEvent (message, samplePosition))
+    {
+        const int position = jlimit (numRendered, bufferToFill.numSamples, samplePosition);
+        
+        render (*bufferToFill.buffer, bufferToFill.startSample + numRendered, position - numRendered);
+        numRendered = position;
+        
+        handleMessage (message, position, midiOut);
+    }
+    
+    render (*bufferToFill.buffer, bufferToFill.startSample + numRendered, bufferToFill.numSamples - numRendered);
+}
+
+MidiBuffer AdaptiveTuner::getZoneSetup()
+{
+    return MPEMessages::setLowerZone (maxVoices, pitchBendRange);
+}
+
+void AdaptiveTuner::tablesBuilt (TuningTables* newTables, int tablesGeneration)
+{
+    if (tablesGeneration != generation.get())
+    {
+        deleteOnMessageThread (newTables);
+        return;
+    }
+    
+    // Tables the audio thread hasn't picked up yet are out of date
+    deleteOnMessageThread (pendingTables.exchange (newTables));
+}
+
+void AdaptiveTuner::timerCallback()
+{
+    delete retiredTables.exchange (nullptr);
+}
+
+//==============================================================================
+void AdaptiveTuner::valueTreePropertyChanged (ValueTree& parent, const Identifier& ID)
+{
+    if (affectsTables (parent, ID))
+        triggerAsyncUpdate();
+}
+
+void AdaptiveTuner::valueTreeChildAdded (ValueTree& parent, ValueTree& newChild)
+{
+    if (newChild.hasType (IDs::Calculator) || affectsTables (newChild, IDs::Partials))
+        triggerAsyncUpdate();
+}
+
+void AdaptiveTuner::valueTreeChildRemoved (ValueTree& parent, ValueTree& removedChild, int childIndex)
+{
+    triggerAsyncUpdate();
+}
+
+bool AdaptiveTuner::affectsTables (const ValueTree& tree, const Identifier& ID) const
+{
+    if (tree.hasType (IDs::Tuning))
+        return true;
+    
+    ValueTree calc = calcData.getChildWithName (IDs::Calculator);
+    
+    if (tree.hasType (IDs::Calculator))
+        return tree == calc && ID == IDs::ModelName;
+    
+    // Live input distributions change too often to be used as timbres
+    if (tree.hasType (IDs::OvertoneDistribution))
+        return tree.getParent() == calc
+               && ! tree[IDs::LiveInput]
+               && (ID == IDs::Partials || ID == IDs::FundamentalAmp || ID == IDs::FundamentalMute);
+    
+    return false;
+}
+
+void AdaptiveTuner::handleAsyncUpdate()
+{
+    Roughness::Model model;
+    TuningTables* tables = createTables (model);
+    
+    // Any build still running is for data that's out of date, so it's told to exit and its tables
+    // are dropped if it finishes anyway. The pool has one thread, so the new build waits for it.
+    const int tablesGeneration = ++generation;
+    
+    pool.removeAllJobs (true, 0);
+    pool.addJob (new BuildTuningTablesJob (*this, tables, model, tablesGeneration), true);
+}
+
+TuningTables* AdaptiveTuner::createTables (Roughness::Model& model) const
+{
+    TuningTables* tables = new TuningTables();
+    
+    // Nominal freqs repeat the scale degrees (ratios above 1/1) every repeat ratio, from the reference note
+    float repeatRatio = TuningGenerator::getRepeatRatio (tuningData);
+    float referenceFreq = tuningData.getProperty (IDs::ReferenceFreq, defaultReferenceFreq);
+    
+    Array<float> scale = TuningGenerator::getScale (tuningData);
+    
+    for (int note = 0; note < 128; ++note)
+    {
+        const int steps = note - referenceNote;
+        const int repeats = (int) std::floor ((float) steps / scale.size());
+        
+        tables->nominalFreqs[note] = referenceFreq * std::pow (repeatRatio, (float) repeats) * scale[steps - repeats * scale.size()];
+    }
+    
+    // Timbres, from the distributions of the first calc
+    ValueTree calc = calcData.getChildWithName (IDs::Calculator);
+    
+    model = calc[IDs::ModelName] == "Vassilakis" ? Roughness::vassilakis : Roughness::sethares;
+    
+    for (int i = 0; i < calc.getNumChildren() && tables->numTimbres < TuningTables::maxTimbres; ++i)
+    {
+        ValueTree distribution = calc.getChild (i);
+        
+        if (! distribution.hasType (IDs::OvertoneDistribution) || distribution[IDs::LiveInput])
+            continue;
+        
+        Array<PartialData> partials;
+        
+        // Partial amps are ratios to the fundamental's, so it's always 1 here
+        if (! distribution[IDs::FundamentalMute])
+        {
+            PartialData fundamental;
+            fundamental.freq = 1;
+            fundamental.amp = 1;
+            
+            partials.add (fundamental);
+        }
+        
+        for (auto& partial : PartialArray (distribution).getAll())
+            if (! partial.mute && partial.freq > 0 && partial.amp > 0)
+                partials.add (partial);
+        
+        if (! partials.isEmpty())
+            addTimbre (*tables, partials);
+    }
+    
+    if (tables->numTimbres == 0)
+    {
+        Array<PartialData> sine;
+        sine.add (PartialData());
+        sine.getReference (0).freq = 1;
+        sine.getReference (0).amp = 1;
+        
+        addTimbre (*tables, sine);
+    }
+    
+    return tables;
+}
+
+//==============================================================================
+void AdaptiveTuner::handleMessage (const MidiMessage& message, int samplePosition, MidiBuffer& midiOut)
+{
+    const TuningTables& tables = *activeTables;
+    
+    if (message.isNoteOn())
+    {
+        const int timbre = (message.getChannel() - 1) % tables.numTimbres;
+        
+        Voice& voice = allocateVoice();
+        const int outputChannel = (int) (&voice - voices) + 2;
+        
+        // A stolen voice stops as this note starts, so it isn't tuned against
+        const float freq = findBestFreq (tables.nominalFreqs[message.getNoteNumber()], timbre, voice);
+        
+        if (voice.active && voice.held)
+            midiOut.addEvent (MidiMessage::noteOff (outputChannel, voice.outputNote), samplePosition);
+        
+        // MIDI out plays the nearest 12 tone equal tempered note, bent to the retuned freq
+        const float semitones = 69 + 12 * std::log2 (freq / 440);
+        voice.outputNote = jlimit (0, 127, roundToInt (semitones));
+        
+        const int bend = jlimit (0, 16383, roundToInt (8192 + (semitones - voice.outputNote) * 8192 / pitchBendRange));
+        
+        voice.active = true;
+        voice.held = true;
+        voice.inputChannel = message.getChannel();
+        voice.note = message.getNoteNumber();
+        voice.timbre = timbre;
+        voice.age = nextAge++;
+        voice.freq = freq;
+        voice.velocity = message.getFloatVelocity();
+        voice.level = 0;
+        voice.numPartials = 0;
+        
+        // Partials are sorted by freq, so stop at the first one above nyquist
+        for (int i = 0; i < tables.numPartials[timbre]; ++i)
+        {
+            const float increment = (float) (freq * tables.ratios[timbre][i] / sampleRate);
+            
+            if (increment >= 0.5f)
+                break;
+            
+            voice.increments[i] = increment;
+            voice.phases[i] = 0;
+            ++voice.numPartials;
+        }
+        
+        midiOut.addEvent (MidiMessage::pitchWheel (outputChannel, bend), samplePosition);
+        midiOut.addEvent (MidiMessage::noteOn (outputChannel, voice.outputNote, message.getVelocity()), samplePosition);
+    }
+    else if (message.isNoteOff())
+    {
+        for (int i = 0; i < maxVoices; ++i)
+        {
+            Voice& voice = voices[i];
+            
+            if (voice.active && voice.held
+                && voice.inputChannel == message.getChannel()
+                && voice.note == message.getNoteNumber())
+            {
+                voice.held = false;
+                midiOut.addEvent (MidiMessage::noteOff (i + 2, voice.outputNote), samplePosition);
+                break;
+            }
+        }
+    }
+    else if (message.isAllNotesOff() || message.isAllSoundOff())
+    {
+        for (int i = 0; i < maxVoices; ++i)
+        {
+            if (voices[i].active && voices[i].held)
+            {
+                voices[i].held = false;
+                midiOut.addEvent (MidiMessage::noteOff (i + 2, voices[i].outputNote), samplePosition);
+            }
+        }
+    }
+    else if (message.getChannel() > 0)
+    {
+        // Everything else goes to the MPE master channel
+        MidiMessage forwarded (message);
+        forwarded.setChannel (1);
+        
+        midiOut.addEvent (forwarded, samplePosition);
+    }
+}
+
+float AdaptiveTuner::findBestFreq (float nominalFreq, int timbre, const Voice& replacedVoice)
+{
+    const TuningTables& tables = *activeTables;
+    int numSounding = 0;
+    
+    for (auto& voice : voices)
+    {
+        if (! voice.active || &voice == &replacedVoice)
+            continue;
+        
+        // Timbre indices can be out of range for notes started before the tables were last rebuilt
+        const int voiceTimbre = jmin (voice.timbre, tables.numTimbres - 1);
+        SoundingNote& note = sounding[numSounding++];
+        
+        // Held notes count fully even if they've just started, so chords are tuned as a whole
+        note.interval = 1200 * std::log2 (nominalFreq / voice.freq);
+        note.weight = voice.velocity * (voice.held ? 1 : voice.level);
+        
+        // The lower note sets the register, which barely changes over the search range
+        getRows (tables, voiceTimbre, timbre, voice.freq, note.above, note.aboveMix);
+        getRows (tables, timbre, voiceTimbre, nominalFreq, note.below, note.belowMix);
+    }
+    
+    if (numSounding == 0)
+        return nominalFreq;
+    
+    const int range = searchRange.get();
+    int bestOffset = 0;
+    float lowest = std::numeric_limits<float>::max();
+    
+    // Offsets are tried nearest first, so ties keep the note closest to its nominal freq
+    for (int step = 0; step <= range * 2; ++step)
+    {
+        const int offset = (step & 1) != 0 ? (step + 1) / 2 : -(step / 2);
+        float total = 0;
+        
+        for (int i = 0; i < numSounding; ++i)
+        {
+            const SoundingNote& note = sounding[i];
+            const float interval = note.interval + offset;
+            
+            total += note.weight * (interval >= 0 ? lookUp (note.above, note.aboveMix, interval)
+                                                  : lookUp (note.below, note.belowMix, -interval));
+        }
+        
+        if (total < lowest)
+        {
+            lowest = total;
+            bestOffset = offset;
+        }
+    }
+    
+    return nominalFreq * std::exp2 (bestOffset / 1200.f);
+}
+
+AdaptiveTuner::Voice& AdaptiveTuner::allocateVoice()
+{
+    Voice* oldest = nullptr;
+    
+    // Use a free voice if there is one, otherwise steal the oldest released voice, then the oldest held one
+    for (auto& voice : voices)
+        if (! voice.active)
+            return voice;
+    
+    for (auto& voice : voices)
+        if (! voice.held && (oldest == nullptr || voice.age < oldest->age))
+            oldest = &voice;
+    
+    if (oldest == nullptr)
+        for (auto& voice : voices)
+            if (oldest == nullptr || voice.age < oldest->age)
+                oldest = &voice;
+    
+    return *oldest;
+}
+
+void AdaptiveTuner::render (AudioBuffer<float>& buffer, int startSample, int numSamples)
+{
+    const TuningTables& tables = *activeTables;
+    const int numChannels = buffer.getNumChannels();
+    
+    for (auto& voice : voices)
+    {
+        if (! voice.active)
+            continue;
+        
+        const int timbre = jmin (voice.timbre, tables.numTimbres - 1);
+        const int numPartials = jmin (voice.numPartials, tables.numPartials[timbre]);
+        const float* amps = tables.amps[timbre];
+        const float gain = tables.gains[timbre] * voice.velocity * voiceGain;
+        
+        for (int i = 0; i < numSamples; ++i)
+        {
+            voice.level = voice.held ? jmin (1.f, voice.level + attackStep) : voice.level - releaseStep;
+            
+            if (voice.level <= 0)
+            {
+                voice.active = false;
+                break;
+            }
+            
+            float sample = 0;
+            
+            for (int partial = 0; partial < numPartials; ++partial)
+            {
+                const float position = voice.phases[partial] * sineTableSize;
+                const int index = (int) position;
+                
+                sample += amps[partial] * (sineTable[index] + (position - index) * (sineTable[index + 1] - sineTable[index]));
+                
+                voice.phases[partial] += voice.increments[partial];
+                
+                if (voice.phases[partial] >= 1)
+                    voice.phases[partial] -= 1;
+            }
+            
+            sample *= gain * voice.level;
+            
+            for (int channel = 0; channel < numChannels; ++channel)
+                buffer.addSample (channel, startSample + i, sample);
+        }
+    }
+}
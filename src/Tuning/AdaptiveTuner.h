@@ -0,0 +1,199 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "IDs.h"
+#include "PartialArray.h"
+#include "Roughness.h"
+
+class AdaptiveTuner;
+
+//==============================================================================
+/*
+    Everything the adaptive tuner needs on the audio thread, built ahead of time.
+ 
+    Timbres hold the strongest partials of each distribution, sorted by freq ratio.
+    The dissonance table holds the roughness of a lower note of one timbre against
+    a higher note of another, for every interval up to three octaves in cents, with
+    one row per octave of register (as roughness depends on absolute freq).
+*/
+struct TuningTables
+{
+    enum
+    {
+        maxTimbres = 4,
+        maxPartials = 16,
+        numRegisters = 8,
+        tableSize = 3601
+    };
+    
+    // Freq of each MIDI note before adaptive retuning
+    float nominalFreqs[128];
+    
+    int numTimbres = 0;
+    int numPartials[maxTimbres];
+    float ratios[maxTimbres][maxPartials];
+    float amps[maxTimbres][maxPartials];
+    float gains[maxTimbres];
+    
+    HeapBlock<float> dissonance;
+    
+    const float* getRow (int lowerTimbre, int upperTimbre, int registerIndex) const;
+};
+
+//==============================================================================
+/*
+    Fills in the dissonance table of a TuningTables object off the message thread,
+    then hands it to the tuner.
+*/
+class BuildTuningTablesJob   : public ThreadPoolJob
+{
+public:
+    BuildTuningTablesJob (AdaptiveTuner& owner, TuningTables* tablesToBuild, Roughness::Model model, int tablesGeneration);
+    ~BuildTuningTablesJob();
+    
+    JobStatus runJob() override;
+
+private:
+    AdaptiveTuner& tuner;
+    std::unique_ptr<TuningTables> tables;
+    Roughness::Model model;
+    int generation;
+};
+
+//==============================================================================
+/*
+    Retunes incoming MIDI notes to the local dissonance minimum against the notes
+    already sounding, and plays them with a simple additive synth and as MPE-style
+    MIDI out (one channel per note, tuned with pitch bend).
+ 
+    Each MIDI input channel plays one distribution of the first calc as its timbre,
+    using that calc's dissonance model. A note-on is tuned within a small range of
+    cents around its nominal freq from the Tuning node, by looking up every candidate
+    interval in the precomputed dissonance table, so no dissonance is computed and
+    nothing is allocated on the audio thread.
+ 
+    Tables are rebuilt on a background thread whenever the timbres or tuning change,
+    and are swapped in lock-free at the start of the next audio block.
+*/
+class AdaptiveTuner   : public ValueTree::Listener,
+                        public AsyncUpdater,
+                        private Timer
+{
+public:
+    AdaptiveTuner();
+    ~AdaptiveTuner();
+    
+    // Sets the calc list to take timbres from, and the tuning node for nominal note freqs
+    void setData (ValueTree& calcList, ValueTree& tuning);
+    
+    // Sets how far from its nominal freq a note may be retuned, in cents either way
+    void setSearchRange (int cents);
+    
+    void prepare (double sampleRate);
+    
+    // Audio thread: retunes the note-ons in midiIn into midiOut, and adds the synth's output to the buffer
+    void process (const MidiBuffer& midiIn, MidiBuffer& midiOut, const AudioSourceChannelInfo& bufferToFill);
+    
+    // Called by the build job with a finished table, which is dropped if the data has changed since the job started
+    void tablesBuilt (TuningTables* newTables, int tablesGeneration);
+    
+    // Data model callbacks to rebuild the tables
+    void valueTreePropertyChanged (ValueTree& parent, const Identifier& ID) override;
+    void valueTreeChildAdded (ValueTree& parent, ValueTree& newChild) override;
+    void valueTreeChildRemoved (ValueTree& parent, ValueTree& removedChild, int childIndex) override;
+    
+    // Unused pure-virtual callbacks inhereted from ValueTree::Listener
+    void valueTreeChildOrderChanged (ValueTree& parent, int oldIndex, int newIndex) override {}
+    void valueTreeParentChanged (ValueTree& adoptedTree) override {}
+    void valueTreeRedirected (ValueTree& redirectedTree) override {}
+    
+    void handleAsyncUpdate() override;
+    
+    // MPE's default pitch bend range for member channels
+    static const int pitchBendRange = 48;
+    
+    // MPE zone setup for the MIDI output, with a member channel per voice and the
+    // pitch bend range the retuned notes are bent with
+    static MidiBuffer getZoneSetup();
+
+private:
+    enum
+    {
+        maxVoices = 15,
+        sineTableSize = 2048
+    };
+    
+    struct Voice
+    {
+        bool active = false;
+        bool held = false;
+        int inputChannel = 0;
+        int note = 0;
+        int outputNote = 0;
+        int timbre = 0;
+        uint32 age = 0;
+        float freq = 0;
+        float velocity = 0;
+        float level = 0;
+        int numPartials = 0;
+        float increments[TuningTables::maxPartials];
+        float phases[TuningTables::maxPartials];
+    };
+    
+    // Table rows for a sounding note, in both orders since the new note may be above or below it
+    struct SoundingNote
+    {
+        float interval, weight;
+        const float* above[2];
+        const float* below[2];
+        float aboveMix, belowMix;
+    };
+    
+    ValueTree calcData, tuningData;
+    
+    ThreadPool pool;
+    
+    // Counts table rebuilds, so a build that finishes after the data changed again is dropped
+    Atomic<int> generation;
+    
+    // Tables being handed over to the audio thread, and ones it's finished with
+    Atomic<TuningTables*> pendingTables, retiredTables;
+    
+    // Audio thread only
+    TuningTables* activeTables;
+    Voice voices[maxVoices];
+    SoundingNote sounding[maxVoices];
+    uint32 nextAge;
+    double sampleRate;
+    float attackStep, releaseStep;
+    
+    Atomic<int> searchRange;
+    
+    float sineTable[sineTableSize + 1];
+    
+    // Deletes tables the audio thread is finished with
+    void timerCallback() override;
+    
+    bool affectsTables (const ValueTree& tree, const Identifier& ID) const;
+    TuningTables* createTables (Roughness::Model& model) const;
+    
+    void handleMessage (const MidiMessage& message, int samplePosition, MidiBuffer& midiOut);
+    float findBestFreq (float nominalFreq, int timbre, const Voice& replacedVoice);
+    Voice& allocateVoice();
+    void render (AudioBuffer<float>& buffer, int startSample, int numSamples);
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AdaptiveTuner)
+};
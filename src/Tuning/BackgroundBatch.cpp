@@ -0,0 +1,138 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#include "BackgroundBatch.h"
+
+namespace
+{
+    // Time between progress messages, in ms
+    const int progressInterval = 50;
+}
+
+//==============================================================================
+struct BackgroundBatch::SharedPool
+{
+    ThreadPool& getPool()
+    {
+        const ScopedLock sl (lock);
+        
+        if (pool == nullptr)
+            pool.reset (new ThreadPool (jmax (1, SystemStats::getNumCpus() - 1)));
+        
+        return *pool;
+    }
+    
+    std::unique_ptr<ThreadPool> pool;
+    CriticalSection lock;
+};
+
+//==============================================================================
+BackgroundBatch::Job::Job (const String& jobName, BackgroundBatch& owner)   : ThreadPoolJob (jobName),
+                                                                              batch (owner)
+{
+}
+
+BackgroundBatch::Job::~Job()
+{
+    // Deleted by the pool once it's run or removed, so this is the last the batch waits for.
+    // The lock is held until the batch is signalled, so it isn't deleted before that
+    const ScopedLock sl (batch.jobsLock);
+    
+    if (--batch.numJobs == 0)
+        batch.jobsDone.signal();
+}
+
+bool BackgroundBatch::Job::belongsTo (const BackgroundBatch& other) const
+{
+    return &batch == &other;
+}
+
+//==============================================================================
+BackgroundBatch::BackgroundBatch (const String& threadName, bool sendsProgress)   : Thread (threadName),
+                                                                                    progress (sendsProgress)
+{
+}
+
+BackgroundBatch::~BackgroundBatch()
+{
+    stopThread (5000);
+}
+
+void BackgroundBatch::run()
+{
+    startBatch();
+    
+    uint32 lastProgress = Time::getMillisecondCounter();
+    
+    while (numJobs.get() > 0)
+    {
+        if (threadShouldExit())
+        {
+            removeJobs();
+            return;
+        }
+        
+        if (progress && Time::getMillisecondCounter() - lastProgress >= (uint32) progressInterval)
+        {
+            lastProgress = Time::getMillisecondCounter();
+            sendChangeMessage();
+        }
+        
+        wait (5);
+    }
+    
+    // A batch stopped while it was being set up
+    if (threadShouldExit())
+        return;
+    
+    batchFinished();
+    sendChangeMessage();
+}
+
+void BackgroundBatch::addJob (Job* job)
+{
+    ++numJobs;
+    sharedPool->getPool().addJob (job, true);
+}
+
+void BackgroundBatch::removeJobs()
+{
+    struct Selector   : public ThreadPool::JobSelector
+    {
+        Selector (const BackgroundBatch& owner)   : batch (owner) {}
+        
+        bool isJobSuitable (ThreadPoolJob* job) override
+        {
+            auto* batchJob = dynamic_cast<Job*> (job);
+            return batchJob != nullptr && batchJob->belongsTo (batch);
+        }
+        
+        const BackgroundBatch& batch;
+    };
+    
+    Selector selector (*this);
+    sharedPool->getPool().removeAllJobs (true, 5000, &selector);
+    
+    // Jobs still reference the batch, so it isn't done with until every one has been deleted
+    for (;;)
+    {
+        {
+            const ScopedLock sl (jobsLock);
+            
+            if (numJobs.get() == 0)
+                return;
+        }
+        
+        jobsDone.wait();
+    }
+}
@@ -0,0 +1,79 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+//==============================================================================
+/*
+    A batch of jobs run on the app's background pool, from a thread of its own that waits for
+    them and sends a change message when they're done (and every 50 ms as they progress, if
+    it's set to).
+ 
+    Subclasses set up and queue the batch in startBatch(), on the batch's thread. Stopping the
+    thread removes the batch's jobs from the pool, waiting for the running ones to exit, and
+    no change message is sent for a stopped batch. Jobs check the batch's threadShouldExit().
+ 
+    Every batch shares one pool, with a thread per core but one, which is created the first
+    time a batch runs and deleted along with the last batch.
+*/
+class BackgroundBatch   : public Thread,
+                          public ChangeBroadcaster
+{
+public:
+    BackgroundBatch (const String& threadName, bool sendsProgress);
+    ~BackgroundBatch();
+    
+    void run() override;
+    
+    //==============================================================================
+    // A job of a batch, which the pool deletes once it's run or removed
+    class Job   : public ThreadPoolJob
+    {
+    public:
+        Job (const String& jobName, BackgroundBatch& owner);
+        ~Job();
+        
+        bool belongsTo (const BackgroundBatch& other) const;
+    
+    private:
+        BackgroundBatch& batch;
+        
+        JUCE_DECLARE_NON_COPYABLE (Job)
+    };
+
+protected:
+    // Sets up the batch and queues its jobs (batch thread)
+    virtual void startBatch() = 0;
+    
+    // Called once every job has run, before the change message is sent (batch thread)
+    virtual void batchFinished() {}
+    
+    void addJob (Job* job);
+
+private:
+    struct SharedPool;
+    SharedResourcePointer<SharedPool> sharedPool;
+    
+    bool progress;
+    Atomic<int> numJobs;
+    
+    // Signalled by the job that takes the count to 0
+    WaitableEvent jobsDone;
+    CriticalSection jobsLock;
+    
+    void removeJobs();
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (BackgroundBatch)
+};
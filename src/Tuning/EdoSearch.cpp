@@ -0,0 +1,180 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#include "EdoSearch.h"
+#include "Trace.h"
+
+namespace
+{
+    // Steps are scored in batches, with the bound checked between them
+    const int batchSize = 16;
+}
+
+//==============================================================================
+EdoScoreJob::EdoScoreJob (EdoSearch& owner, int numDivisions)   : BackgroundBatch::Job ("EDO Score", owner),
+                                                                   search (owner),
+                                                                   divisions (numDivisions)
+{
+}
+
+EdoScoreJob::~EdoScoreJob()
+{
+}
+
+ThreadPoolJob::JobStatus EdoScoreJob::runJob()
+{
+    TRACE_SCOPE ("EdoScoreJob");
+    
+    search.score (divisions);
+    return jobHasFinished;
+}
+
+//==============================================================================
+EdoSearch::EdoSearch()   : BackgroundBatch ("EDO Search", false)
+{
+    repeat = 2;
+    minDivisions = 0;
+    maxDivisions = 0;
+    numResults = 0;
+    byWorst = false;
+}
+
+EdoSearch::~EdoSearch()
+{
+    stopThread (5000);
+}
+
+void EdoSearch::setCalcs (const ValueTree& calcList, float repeatRatio)
+{
+    stopThread (5000);
+    
+    repeat = repeatRatio > 1 ? repeatRatio : 2;
+    intervals.setCalcs (calcList);
+}
+
+float EdoSearch::getRepeatRatio() const
+{
+    return repeat;
+}
+
+void EdoSearch::startSearch (int minimum, int maximum, bool rankByWorst, int maxResults)
+{
+    stopThread (5000);
+    
+    minDivisions = jmax (1, minimum);
+    maxDivisions = maximum;
+    byWorst = rankByWorst;
+    numResults = jmax (1, maxResults);
+    
+    startThread();
+}
+
+Array<EdoSearch::Result> EdoSearch::getResults() const
+{
+    const ScopedLock sl (resultsLock);
+    return results;
+}
+
+void EdoSearch::startBatch()
+{
+    {
+        const ScopedLock sl (resultsLock);
+        results.clearQuick();
+        bound = std::numeric_limits<float>::max();
+    }
+    
+    if (intervals.isEmpty())
+        return;
+    
+    // Smaller EDOs are quicker to score, so they're queued first to tighten the bound early
+    for (int divisions = minDivisions; divisions <= maxDivisions; ++divisions)
+        addJob (new EdoScoreJob (*this, divisions));
+}
+
+void EdoSearch::score (int divisions)
+{
+    Result result;
+    result.divisions = divisions;
+    result.worst = 0;
+    
+    const int numIntervals = divisions - 1;
+    const float step = std::log (repeat) / divisions;
+    float total = 0;
+    
+    // Each step count is weighted by the number of note pairs spanning it
+    const float numPairs = divisions * (divisions - 1) * 0.5f;
+    
+    float ratios[batchSize], dissonance[batchSize];
+    
+    for (int start = 1; start <= numIntervals; start += batchSize)
+    {
+        if (threadShouldExit())
+            return;
+        
+        const int num = jmin (batchSize, numIntervals - start + 1);
+        
+        for (int i = 0; i < num; ++i)
+            ratios[i] = std::exp (step * (start + i));
+        
+        intervals.getDissonance (ratios, dissonance, num);
+        
+        for (int i = 0; i < num; ++i)
+        {
+            total += (divisions - start - i) * dissonance[i];
+            result.worst = jmax (result.worst, dissonance[i]);
+        }
+        
+        // Dissonance is never negative, so the rank can only get worse from here
+        result.average = total / numPairs;
+        
+        if (getRank (result) >= bound.get())
+            return;
+    }
+    
+    result.average = numIntervals > 0 ? total / numPairs : 0;
+    addResult (result);
+}
+
+float EdoSearch::getRank (const Result& result) const
+{
+    return byWorst ? result.worst : result.average;
+}
+
+void EdoSearch::addResult (const Result& result)
+{
+    const ScopedLock sl (resultsLock);
+    
+    const float rank = getRank (result);
+    int index = 0;
+    
+    while (index < results.size() && getRank (results.getReference (index)) <= rank)
+        ++index;
+    
+    results.insert (index, result);
+    
+    if (results.size() > numResults)
+        results.removeLast();
+    
+    if (results.size() == numResults)
+        bound = getRank (results.getLast());
+}
+
+Array<float> EdoSearch::getRatios (int divisions, float repeatRatio)
+{
+    Array<float> ratios;
+    
+    for (int i = 1; i < divisions; ++i)
+        ratios.add (std::pow (repeatRatio, (float) i / divisions));
+    
+    return ratios;
+}
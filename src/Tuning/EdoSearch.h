@@ -0,0 +1,93 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "IntervalDissonance.h"
+#include "BackgroundBatch.h"
+
+class EdoSearch;
+
+//==============================================================================
+/*
+    Scores one equal division of the repeat ratio, for the EDO search.
+*/
+class EdoScoreJob   : public BackgroundBatch::Job
+{
+public:
+    EdoScoreJob (EdoSearch& owner, int numDivisions);
+    ~EdoScoreJob();
+    
+    JobStatus runJob() override;
+
+private:
+    EdoSearch& search;
+    int divisions;
+};
+
+//==============================================================================
+/*
+    Ranks equal divisions of the repeat ratio by the dissonance of their intervals, using the
+    timbres of the calcs.
+ 
+    Every interval of an EDO is a whole number of steps, so only the dissonance of each step
+    count within the repeat is needed. Each EDO is scored by the worst of those, or by the average
+    over every pair of notes within the repeat, where k steps are spanned by n - k of the pairs.
+    EDOs are scored in parallel, and one is abandoned as soon as the steps scored so far can't
+    beat the worst of the best EDOs found yet.
+*/
+class EdoSearch   : public BackgroundBatch
+{
+public:
+    EdoSearch();
+    ~EdoSearch();
+    
+    struct Result
+    {
+        int divisions;
+        float average, worst;
+    };
+    
+    // Takes a snapshot of the calcs' timbres (message thread)
+    void setCalcs (const ValueTree& calcList, float repeatRatio);
+    float getRepeatRatio() const;
+    
+    // Scores every EDO in the given range in the background, and sends a change message when done
+    void startSearch (int minDivisions, int maxDivisions, bool rankByWorst, int numResults);
+    Array<Result> getResults() const;
+    
+    // Called by the score jobs
+    void score (int divisions);
+    
+    // Ratios of an EDO's steps above 1/1 and below the repeat ratio
+    static Array<float> getRatios (int divisions, float repeatRatio);
+
+private:
+    IntervalDissonance intervals;
+    float repeat;
+    
+    int minDivisions, maxDivisions, numResults;
+    bool byWorst;
+    
+    Array<Result> results;
+    CriticalSection mutable resultsLock;
+    Atomic<float> bound;
+    
+    void startBatch() override;
+    
+    float getRank (const Result& result) const;
+    void addResult (const Result& result);
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (EdoSearch)
+};
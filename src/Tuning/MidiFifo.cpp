@@ -0,0 +1,137 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#include "MidiFifo.h"
+
+//==============================================================================
+MidiFifo::MidiFifo (int capacity)   : fifo (capacity),
+                                      events ((size_t) capacity)
+{
+}
+
+MidiFifo::~MidiFifo()
+{
+}
+
+void MidiFifo::add (const MidiMessage& message)
+{
+    const int size = message.getRawDataSize();
+    
+    if (size > 3)
+        return;
+    
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite (1, start1, size1, start2, size2);
+    
+    if (size1 + size2 == 0)
+        return;
+    
+    Event& event = events[size1 > 0 ? start1 : start2];
+    event.timeStamp = message.getTimeStamp();
+    event.size = size;
+    memcpy (event.data, message.getRawData(), (size_t) size);
+    
+    fifo.finishedWrite (1);
+}
+
+void MidiFifo::addBlock (const MidiBuffer& messages)
+{
+    MidiBuffer::Iterator iterator (messages);
+    MidiMessage message;
+    int samplePosition;
+    
+    while (iterator.getNextEvent (message, samplePosition))
+        add (message);
+}
+
+bool MidiFifo::getNext (MidiMessage& message)
+{
+    int start1, size1, start2, size2;
+    fifo.prepareToRead (1, start1, size1, start2, size2);
+    
+    if (size1 + size2 == 0)
+        return false;
+    
+    const Event& event = events[size1 > 0 ? start1 : start2];
+    message = MidiMessage (event.data, event.size, event.timeStamp);
+    
+    fifo.finishedRead (1);
+    return true;
+}
+
+void MidiFifo::removeNextBlockOfMessages (MidiBuffer& destBuffer, int numSamples, double sampleRate)
+{
+    destBuffer.clear();
+    
+    if (numSamples <= 0)
+        return;
+    
+    const double now = Time::getMillisecondCounterHiRes() * 0.001;
+    
+    int start1, size1, start2, size2;
+    fifo.prepareToRead (fifo.getNumReady(), start1, size1, start2, size2);
+    
+    for (int i = 0; i < size1 + size2; ++i)
+    {
+        const Event& event = events[i < size1 ? start1 + i : start2 + i - size1];
+        
+        // Messages from before the last block are played at its start
+        const int position = numSamples - 1 - roundToInt ((now - event.timeStamp) * sampleRate);
+        
+        destBuffer.addEvent (event.data, event.size, jlimit (0, numSamples - 1, position));
+    }
+    
+    fifo.finishedRead (size1 + size2);
+}
+
+//==============================================================================
+MidiSender::MidiSender (MidiFifo& queue)   : Thread ("MIDI Output"),
+                                             fifo (queue)
+{
+    startThread();
+}
+
+MidiSender::~MidiSender()
+{
+    stopThread (1000);
+}
+
+void MidiSender::setOutput (int deviceIndex, const MidiBuffer& setupMessages)
+{
+    std::unique_ptr<MidiOutput> newOutput (MidiOutput::openDevice (deviceIndex));
+    
+    if (newOutput != nullptr)
+        newOutput->sendBlockOfMessagesNow (setupMessages);
+    
+    const ScopedLock lock (outputLock);
+    output = std::move (newOutput);
+}
+
+void MidiSender::run()
+{
+    MidiMessage message;
+    
+    while (! threadShouldExit())
+    {
+        {
+            const ScopedLock lock (outputLock);
+            
+            while (fifo.getNext (message))
+                if (output != nullptr)
+                    output->sendMessageNow (message);
+        }
+        
+        // Polled rather than signalled, as signalling would take a lock on the audio thread
+        wait (1);
+    }
+}
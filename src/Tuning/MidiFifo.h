@@ -0,0 +1,79 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+//==============================================================================
+/*
+    Lock-free queue of MIDI messages from one thread to another, so MIDI can be passed
+    to and from the audio thread without it waiting on a lock.
+ 
+    Messages are copied into fixed slots, so only messages of up to 3 bytes are queued
+    (sysex is dropped), and messages added while the queue is full are dropped.
+*/
+class MidiFifo
+{
+public:
+    MidiFifo (int capacity);
+    ~MidiFifo();
+    
+    // Writing thread
+    void add (const MidiMessage& message);
+    void addBlock (const MidiBuffer& messages);
+    
+    // Reading thread: takes the next message, with the timestamp it was added with
+    bool getNext (MidiMessage& message);
+    
+    // Reading thread: takes every waiting message into a block, placing each one by how long
+    // before now it arrived (MIDI input timestamps are in seconds of the hi-res ms counter)
+    void removeNextBlockOfMessages (MidiBuffer& destBuffer, int numSamples, double sampleRate);
+
+private:
+    struct Event
+    {
+        double timeStamp;
+        int size;
+        uint8 data[3];
+    };
+    
+    AbstractFifo fifo;
+    HeapBlock<Event> events;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MidiFifo)
+};
+
+//==============================================================================
+/*
+    Sends the messages queued in a MidiFifo to a MIDI output from its own thread,
+    so the device is never written to from the audio thread.
+*/
+class MidiSender   : private Thread
+{
+public:
+    MidiSender (MidiFifo& queue);
+    ~MidiSender();
+    
+    // Opens an output, sending it the setup messages before anything from the queue
+    void setOutput (int deviceIndex, const MidiBuffer& setupMessages);
+
+private:
+    MidiFifo& fifo;
+    std::unique_ptr<MidiOutput> output;
+    CriticalSection outputLock;
+    
+    void run() override;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MidiSender)
+};
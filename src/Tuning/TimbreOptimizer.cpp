@@ -0,0 +1,363 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#include "TimbreOptimizer.h"
+#include "TuningGenerator.h"
+#include "Trace.h"
+
+namespace
+{
+    // Line search steps, as the largest move of any partial in log freq (about 17 cents to start)
+    const float initialStep = 0.01f;
+    const float minStep = 1e-6f;
+    
+    // The search stops once an iteration improves the score by less than this fraction
+    const float tolerance = 1e-6f;
+    
+    // Intervals closer than this (in log freq) are scored as one
+    const float intervalTolerance = 1e-5f;
+}
+
+//==============================================================================
+TimbreSearchJob::TimbreSearchJob (TimbreOptimizer& owner, int startIndex)   : BackgroundBatch::Job ("Timbre Search", owner),
+                                                                               optimizer (owner),
+                                                                               start (startIndex)
+{
+}
+
+TimbreSearchJob::~TimbreSearchJob()
+{
+}
+
+ThreadPoolJob::JobStatus TimbreSearchJob::runJob()
+{
+    TRACE_SCOPE ("TimbreSearchJob");
+    
+    optimizer.search (start);
+    return jobHasFinished;
+}
+
+//==============================================================================
+TimbreOptimizer::TimbreOptimizer()   : BackgroundBatch ("Timbre Optimizer", true)
+{
+    numFixed = 0;
+    fundamentalFreq = 0;
+    maxShift = 0;
+    numStarts = 0;
+    maxIterations = 0;
+    startDissonance = 0;
+    bestDissonance = 0;
+}
+
+TimbreOptimizer::~TimbreOptimizer()
+{
+    stopThread (5000);
+}
+
+void TimbreOptimizer::setTimbre (const ValueTree& distribution, const ValueTree& tuning, float maxCents)
+{
+    stopThread (5000);
+    
+    ValueTree calc = distribution.getParent();
+    float startFreq = calc[IDs::StartFreq];
+    Roughness::Model model = calc[IDs::ModelName] == "Vassilakis" ? Roughness::vassilakis : Roughness::sethares;
+    
+    IntervalDissonance::Timbre timbre = IntervalDissonance::createTimbre (distribution, startFreq);
+    
+    // An x-axis fundamental moves with the map, so the timbre is placed at the start freq instead
+    fundamentalFreq = timbre.fundamentalFreq > 0 && ! distribution[IDs::XAxis] ? timbre.fundamentalFreq : startFreq;
+    
+    if (fundamentalFreq <= 0)
+        fundamentalFreq = 261.6256f;
+    
+    partials = PartialArray (distribution).getAll();
+    partialIndices.clearQuick();
+    
+    // Same partials as the timbre, in the same order
+    for (auto index : timbre.partials)
+        if (index >= 0)
+            partialIndices.add (index);
+    
+    numFixed = timbre.ratios.size() - partialIndices.size();
+    startLogRatios.clearQuick();
+    
+    for (auto ratio : timbre.ratios)
+        startLogRatios.add (std::log (ratio));
+    
+    const int num = timbre.ratios.size();
+    weights.malloc ((size_t) jmax (1, num * num));
+    
+    for (int i = 0; i < num; ++i)
+        for (int j = 0; j < num; ++j)
+            weights[i * num + j] = Roughness::getAmpWeight (timbre.amps[i], timbre.amps[j], model);
+    
+    maxShift = jmax (0.f, maxCents) * std::log (2.f) / 1200;
+    
+    // Every interval between two notes, with repeated intervals scored once and counted
+    Array<float> notes = TuningGenerator::getScale (tuning);
+    notes.add (TuningGenerator::getRepeatRatio (tuning));
+    
+    intervals.clearQuick();
+    
+    for (int i = 0; i < notes.size(); ++i)
+    {
+        for (int j = i + 1; j < notes.size(); ++j)
+        {
+            const float ratio = notes[j] / notes[i];
+            bool isRepeated = false;
+            
+            for (auto& interval : intervals)
+            {
+                if (std::abs (std::log (interval.ratio / ratio)) < intervalTolerance)
+                {
+                    interval.count += 1;
+                    isRepeated = true;
+                    break;
+                }
+            }
+            
+            if (! isRepeated)
+            {
+                Interval interval = { ratio, 1 };
+                intervals.add (interval);
+            }
+        }
+    }
+    
+    const ScopedLock sl (resultLock);
+    
+    bestLogRatios = startLogRatios;
+    startDissonance = 0;
+    bestDissonance = 0;
+    finished = 0;
+}
+
+void TimbreOptimizer::startSearch (int starts, int iterations)
+{
+    stopThread (5000);
+    
+    numStarts = jmax (1, starts);
+    maxIterations = jmax (1, iterations);
+    
+    startThread();
+}
+
+bool TimbreOptimizer::isFinished() const
+{
+    return finished.get() != 0;
+}
+
+double TimbreOptimizer::getProgress() const
+{
+    return (double) iterationsDone.get() / jmax (1, numStarts * maxIterations);
+}
+
+float TimbreOptimizer::getStartDissonance() const
+{
+    const ScopedLock sl (resultLock);
+    return startDissonance;
+}
+
+float TimbreOptimizer::getBestDissonance() const
+{
+    const ScopedLock sl (resultLock);
+    return bestDissonance;
+}
+
+bool TimbreOptimizer::applyResult (ValueTree& distribution, UndoManager* undo)
+{
+    PartialArray current (distribution);
+    
+    if (! isFinished()
+        || PartialArray::pack (current.getAll()) != PartialArray::pack (partials))
+        return false;
+    
+    Array<PartialData> newPartials = partials;
+    
+    {
+        const ScopedLock sl (resultLock);
+        
+        for (int i = 0; i < partialIndices.size(); ++i)
+            newPartials.getReference (partialIndices[i]).freq = std::exp (bestLogRatios[numFixed + i]);
+    }
+    
+    if (undo != nullptr)
+        undo->beginNewTransaction();
+    
+    current.replaceAll (newPartials, undo);
+    return true;
+}
+
+void TimbreOptimizer::startBatch()
+{
+    iterationsDone = 0;
+    finished = 0;
+    
+    {
+        HeapBlock<float> gradient ((size_t) jmax (1, startLogRatios.size()));
+        
+        const ScopedLock sl (resultLock);
+        
+        bestLogRatios = startLogRatios;
+        startDissonance = getDissonance (startLogRatios.getRawDataPointer(), gradient);
+        bestDissonance = startDissonance;
+    }
+    
+    // Nothing can move, so the timbre as it is is the result
+    if (partialIndices.isEmpty() || maxShift <= 0)
+        return;
+    
+    for (int start = 0; start < numStarts; ++start)
+        addJob (new TimbreSearchJob (*this, start));
+}
+
+void TimbreOptimizer::batchFinished()
+{
+    finished = 1;
+}
+
+void TimbreOptimizer::search (int start)
+{
+    const int num = startLogRatios.size();
+    
+    HeapBlock<float> position ((size_t) num), gradient ((size_t) num);
+    HeapBlock<float> trial ((size_t) num), trialGradient ((size_t) num);
+    
+    // The first search starts from the timbre itself, and the rest from random points within reach of it
+    Random random (start);
+    
+    for (int i = 0; i < num; ++i)
+    {
+        position[i] = startLogRatios[i];
+        
+        if (i >= numFixed && start > 0)
+            position[i] += (random.nextFloat() * 2 - 1) * 0.5f * maxShift;
+    }
+    
+    float dissonance = getDissonance (position, gradient);
+    float step = initialStep;
+    int iteration = 0;
+    
+    while (iteration < maxIterations && ! threadShouldExit())
+    {
+        ++iteration;
+        ++iterationsDone;
+        
+        // Steps are scaled so the partial with the steepest slope moves by the step size
+        float steepest = 0;
+        
+        for (int i = numFixed; i < num; ++i)
+            steepest = jmax (steepest, std::abs (gradient[i]));
+        
+        if (steepest <= 0)
+            break;
+        
+        bool improved = false;
+        float trialDissonance = dissonance;
+        
+        while (step > minStep)
+        {
+            FloatVectorOperations::copy (trial, position, num);
+            
+            for (int i = numFixed; i < num; ++i)
+                trial[i] = jlimit (startLogRatios[i] - maxShift, startLogRatios[i] + maxShift,
+                                   position[i] - step * gradient[i] / steepest);
+            
+            trialDissonance = getDissonance (trial, trialGradient);
+            
+            if (trialDissonance < dissonance)
+            {
+                improved = true;
+                break;
+            }
+            
+            step *= 0.5f;
+        }
+        
+        if (! improved)
+            break;
+        
+        const bool hasConverged = dissonance - trialDissonance < tolerance * dissonance;
+        
+        position.swapWith (trial);
+        gradient.swapWith (trialGradient);
+        dissonance = trialDissonance;
+        
+        if (hasConverged)
+            break;
+        
+        // Tries a longer step next time, so the search speeds up again after backtracking
+        step *= 1.5f;
+    }
+    
+    // Searches that stop early count as done for the progress
+    iterationsDone += maxIterations - iteration;
+    
+    const ScopedLock sl (resultLock);
+    
+    if (dissonance < bestDissonance)
+    {
+        bestDissonance = dissonance;
+        bestLogRatios = Array<float> (position.getData(), num);
+    }
+}
+
+float TimbreOptimizer::getDissonance (const float* logRatios, float* gradient) const
+{
+    const int num = startLogRatios.size();
+    
+    HeapBlock<float> lower ((size_t) jmax (1, num)), upper ((size_t) jmax (1, num));
+    
+    for (int i = 0; i < num; ++i)
+        lower[i] = fundamentalFreq * std::exp (logRatios[i]);
+    
+    FloatVectorOperations::clear (gradient, num);
+    float total = 0;
+    
+    for (auto& interval : intervals)
+    {
+        FloatVectorOperations::copyWithMultiply (upper, lower, interval.ratio, num);
+        
+        for (int i = 0; i < num; ++i)
+        {
+            for (int j = 0; j < num; ++j)
+            {
+                const float weight = weights[i * num + j] * interval.count;
+                
+                if (weight <= 0)
+                    continue;
+                
+                float slope1, slope2;
+                
+                // A freq's slope with respect to its log ratio is the freq itself
+                total += weight * Roughness::getCurve (lower[i], upper[j], slope1, slope2);
+                gradient[i] += weight * slope1 * lower[i];
+                gradient[j] += weight * slope2 * upper[j];
+                
+                // Pairs within each note
+                if (j > i)
+                {
+                    total += weight * Roughness::getCurve (lower[i], lower[j], slope1, slope2);
+                    gradient[i] += weight * slope1 * lower[i];
+                    gradient[j] += weight * slope2 * lower[j];
+                    
+                    total += weight * Roughness::getCurve (upper[i], upper[j], slope1, slope2);
+                    gradient[i] += weight * slope1 * upper[i];
+                    gradient[j] += weight * slope2 * upper[j];
+                }
+            }
+        }
+    }
+    
+    return total;
+}
@@ -0,0 +1,116 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "IntervalDissonance.h"
+#include "BackgroundBatch.h"
+
+class TimbreOptimizer;
+
+//==============================================================================
+/*
+    Runs the gradient search from one starting timbre, for the timbre optimizer.
+*/
+class TimbreSearchJob   : public BackgroundBatch::Job
+{
+public:
+    TimbreSearchJob (TimbreOptimizer& owner, int startIndex);
+    ~TimbreSearchJob();
+    
+    JobStatus runJob() override;
+
+private:
+    TimbreOptimizer& optimizer;
+    int start;
+};
+
+//==============================================================================
+/*
+    Moves the partials of a distribution so that the intervals of a tuning land in the
+    timbre's dissonance minima (Sethares' spectral mapping).
+ 
+    A timbre is scored by the total dissonance of every interval between the tuning's notes,
+    including 1/1 and the repeat ratio, with the timbre played on both notes of each interval.
+    Partials move in cents, up to the given distance from where they started, and the search
+    follows the analytic gradient of the score with a backtracking line search. The fundamental
+    stays where it is, and muted partials are left alone.
+ 
+    Gradient search only finds the nearest minimum, so it's run from several starting points
+    in parallel (the timbre itself, then jittered copies of it), keeping the best.
+*/
+class TimbreOptimizer   : public BackgroundBatch
+{
+public:
+    TimbreOptimizer();
+    ~TimbreOptimizer();
+    
+    // Takes a snapshot of the distribution, its calc's model and the tuning's notes (message thread)
+    void setTimbre (const ValueTree& distribution, const ValueTree& tuning, float maxCents);
+    
+    // Searches in the background, sending change messages as it progresses and when it's done
+    void startSearch (int numStarts, int maxIterations);
+    
+    bool isFinished() const;
+    double getProgress() const;
+    
+    // Dissonance of the timbre as it was, and as the best timbre found
+    float getStartDissonance() const;
+    float getBestDissonance() const;
+    
+    /*  Replaces the distribution's partials with the best timbre found, as one undoable
+        transaction (message thread)
+ 
+        Returns false if the search hasn't finished, or the partials have been edited since the
+        snapshot was taken.
+    */
+    bool applyResult (ValueTree& distribution, UndoManager* undo);
+    
+    // Called by the search jobs
+    void search (int start);
+
+private:
+    // An interval between two of the tuning's notes, and how many times it appears
+    struct Interval
+    {
+        float ratio, count;
+    };
+    
+    Array<PartialData> partials;
+    
+    // The timbre's sounding partials, as log ratios to the fundamental (if it sounds) then the
+    // partials being moved, with the amp weight of every pair
+    Array<float> startLogRatios;
+    Array<int> partialIndices;
+    HeapBlock<float> weights;
+    int numFixed;
+    
+    float fundamentalFreq, maxShift;
+    Array<Interval> intervals;
+    
+    int numStarts, maxIterations;
+    Atomic<int> iterationsDone, finished;
+    
+    Array<float> bestLogRatios;
+    float startDissonance, bestDissonance;
+    CriticalSection mutable resultLock;
+    
+    void startBatch() override;
+    void batchFinished() override;
+    
+    // Total dissonance of a timbre over the intervals, and its gradient with respect to each log ratio
+    float getDissonance (const float* logRatios, float* gradient) const;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (TimbreOptimizer)
+};
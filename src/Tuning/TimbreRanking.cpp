@@ -0,0 +1,216 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#include "TimbreRanking.h"
+#include "TuningGenerator.h"
+#include "Trace.h"
+#include "../../DisMAL/FileIO.h"
+
+namespace
+{
+    // Files loaded and scored by each job
+    const int filesPerJob = 32;
+    
+    // Steps across the repeat ratio that a timbre's relative score is measured against
+    const int numReferenceSteps = 128;
+}
+
+//==============================================================================
+TimbreRankingJob::TimbreRankingJob (TimbreRanking& owner, int firstFile)   : BackgroundBatch::Job ("Timbre Ranking", owner),
+                                                                              ranking (owner),
+                                                                              first (firstFile)
+{
+}
+
+TimbreRankingJob::~TimbreRankingJob()
+{
+}
+
+ThreadPoolJob::JobStatus TimbreRankingJob::runJob()
+{
+    TRACE_SCOPE ("TimbreRankingJob");
+    
+    ranking.score (first);
+    return jobHasFinished;
+}
+
+//==============================================================================
+TimbreRanking::TimbreRanking()   : BackgroundBatch ("Timbre Ranking", true)
+{
+    numIntervals = 0;
+    fundamental = 261.6256f;
+}
+
+TimbreRanking::~TimbreRanking()
+{
+    stopThread (5000);
+}
+
+void TimbreRanking::setIntervals (const Array<float>& intervalRatios, float repeatRatio,
+                                  float fundamentalFreq, const String& modelName)
+{
+    stopThread (5000);
+    
+    ratios.clearQuick();
+    
+    for (auto ratio : intervalRatios)
+        if (ratio > 0)
+            ratios.add (ratio);
+    
+    numIntervals = ratios.size();
+    
+    // Log spaced, and offset by half a step so 1/1 isn't one of them
+    const float repeat = repeatRatio > 1 ? repeatRatio : 2;
+    
+    for (int i = 0; i < numReferenceSteps; ++i)
+        ratios.add (std::pow (repeat, (i + 0.5f) / numReferenceSteps));
+    
+    fundamental = fundamentalFreq > 0 ? fundamentalFreq : 261.6256f;
+    model = modelName;
+}
+
+void TimbreRanking::startRanking (const Array<File>& files)
+{
+    stopThread (5000);
+    
+    fileList = files;
+    startThread();
+}
+
+bool TimbreRanking::isFinished() const
+{
+    return finished.get() != 0;
+}
+
+double TimbreRanking::getProgress() const
+{
+    return (double) filesDone.get() / jmax (1, fileList.size());
+}
+
+Array<TimbreRanking::Result> TimbreRanking::getResults() const
+{
+    const ScopedLock sl (resultsLock);
+    return results;
+}
+
+void TimbreRanking::startBatch()
+{
+    filesDone = 0;
+    finished = 0;
+    
+    {
+        const ScopedLock sl (resultsLock);
+        results.clearQuick();
+    }
+    
+    if (numIntervals > 0)
+    {
+        for (int first = 0; first < fileList.size(); first += filesPerJob)
+            addJob (new TimbreRankingJob (*this, first));
+    }
+}
+
+void TimbreRanking::batchFinished()
+{
+    finished = 1;
+}
+
+void TimbreRanking::score (int firstFile)
+{
+    IntervalDissonance intervals;
+    HeapBlock<float> dissonance ((size_t) ratios.size());
+    Array<Result> batch;
+    
+    const int end = jmin (fileList.size(), firstFile + filesPerJob);
+    
+    for (int i = firstFile; i < end; ++i)
+    {
+        if (threadShouldExit())
+            return;
+        
+        FileIO io = fileList[i];
+        ValueTree distribution = io.loadTreeFromFile();
+        PartialArray::convertLegacyPartials (distribution);
+        
+        Result result;
+        result.file = fileList[i];
+        
+        if (scoreTimbre (distribution, result, intervals, dissonance))
+            batch.add (result);
+        
+        ++filesDone;
+    }
+    
+    const ScopedLock sl (resultsLock);
+    
+    // Merged in order, so the results are always ranked
+    for (auto& result : batch)
+    {
+        int index = 0;
+        
+        while (index < results.size() && results.getReference (index).dissonance <= result.dissonance)
+            ++index;
+        
+        results.insert (index, result);
+    }
+}
+
+bool TimbreRanking::scoreTimbre (const ValueTree& distribution, Result& result, IntervalDissonance& intervals,
+                                 HeapBlock<float>& dissonance) const
+{
+    if (! distribution.hasType (IDs::OvertoneDistribution))
+        return false;
+    
+    result.name = distribution[IDs::Name].toString();
+    
+    if (result.name.isEmpty())
+        result.name = result.file.getFileNameWithoutExtension();
+    
+    result.numPartials = PartialArray (distribution).size();
+    
+    intervals.setTimbre (distribution, fundamental, model);
+    
+    if (intervals.isEmpty())
+        return false;
+    
+    intervals.getDissonance (ratios.getRawDataPointer(), dissonance, ratios.size());
+    
+    float intervalTotal = 0, referenceTotal = 0;
+    
+    for (int i = 0; i < numIntervals; ++i)
+        intervalTotal += dissonance[i];
+    
+    for (int i = numIntervals; i < ratios.size(); ++i)
+        referenceTotal += dissonance[i];
+    
+    result.dissonance = intervalTotal / numIntervals;
+    
+    const float referenceAverage = referenceTotal / jmax (1, ratios.size() - numIntervals);
+    result.relative = referenceAverage > 0 ? result.dissonance / referenceAverage : 0;
+    
+    return true;
+}
+
+Array<float> TimbreRanking::getIntervals (const ValueTree& tuning)
+{
+    Array<float> notes = TuningGenerator::getScale (tuning);
+    notes.add (TuningGenerator::getRepeatRatio (tuning));
+    
+    Array<float> intervalRatios;
+    
+    for (int i = 0; i < notes.size(); ++i)
+        for (int j = i + 1; j < notes.size(); ++j)
+            intervalRatios.add (notes[j] / notes[i]);
+    
+    return intervalRatios;
+}
@@ -0,0 +1,109 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "IntervalDissonance.h"
+#include "BackgroundBatch.h"
+
+class TimbreRanking;
+
+//==============================================================================
+/*
+    Loads and scores a batch of saved timbres, for the timbre ranking.
+*/
+class TimbreRankingJob   : public BackgroundBatch::Job
+{
+public:
+    TimbreRankingJob (TimbreRanking& owner, int firstFile);
+    ~TimbreRankingJob();
+    
+    JobStatus runJob() override;
+
+private:
+    TimbreRanking& ranking;
+    int first;
+};
+
+//==============================================================================
+/*
+    Ranks saved timbres by how consonant they are at a set of intervals.
+ 
+    Each timbre is played against itself at every interval, with the lower note at the given
+    fundamental freq, and scored by its average dissonance over the intervals. Timbres with
+    more or louder partials are rougher everywhere, so each is also scored relative to its
+    average dissonance over the whole repeat ratio, which shows how well the intervals land in
+    its own minima.
+ 
+    Files are loaded and scored in batches on the background pool, so the library is streamed
+    rather than held in memory, and every interval of a timbre (plus its reference steps) is
+    evaluated in one batch by IntervalDissonance.
+*/
+class TimbreRanking   : public BackgroundBatch
+{
+public:
+    TimbreRanking();
+    ~TimbreRanking();
+    
+    struct Result
+    {
+        File file;
+        String name;
+        int numPartials;
+        
+        // Average dissonance at the intervals, and that over the average across the repeat ratio
+        float dissonance, relative;
+    };
+    
+    // Sets the intervals every timbre is scored at, as ratios above the lower note
+    void setIntervals (const Array<float>& ratios, float repeatRatio, float fundamentalFreq, const String& modelName);
+    
+    // Scores the files in the background, sending change messages as it progresses and when it's done
+    void startRanking (const Array<File>& files);
+    
+    bool isFinished() const;
+    double getProgress() const;
+    
+    // Results so far, from least to most dissonant
+    Array<Result> getResults() const;
+    
+    // Called by the ranking jobs
+    void score (int firstFile);
+    
+    // Every interval between two notes of a tuning (including 1/1 and the repeat ratio)
+    static Array<float> getIntervals (const ValueTree& tuning);
+
+private:
+    Array<File> fileList;
+    
+    // The intervals, then the reference steps across the repeat ratio
+    Array<float> ratios;
+    int numIntervals;
+    float fundamental;
+    String model;
+    
+    Atomic<int> filesDone, finished;
+    
+    Array<Result> results;
+    CriticalSection mutable resultsLock;
+    
+    void startBatch() override;
+    void batchFinished() override;
+    
+    // Scores a timbre loaded from a file, returning false if it has no sounding partials
+    bool scoreTimbre (const ValueTree& distribution, Result& result, IntervalDissonance& intervals,
+                      HeapBlock<float>& dissonance) const;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (TimbreRanking)
+};
@@ -0,0 +1,355 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#include "TuningGenerator.h"
+#include "Trace.h"
+
+//==============================================================================
+ScaleSearchJob::ScaleSearchJob (TuningGenerator& owner, int firstCandidate)   : BackgroundBatch::Job ("Scale Search", owner),
+                                                                                generator (owner),
+                                                                                first (firstCandidate)
+{
+}
+
+ScaleSearchJob::~ScaleSearchJob()
+{
+}
+
+ThreadPoolJob::JobStatus ScaleSearchJob::runJob()
+{
+    TRACE_SCOPE ("ScaleSearchJob");
+    
+    generator.searchFrom (first);
+    return jobHasFinished;
+}
+
+//==============================================================================
+TuningGenerator::TuningGenerator()   : BackgroundBatch ("Tuning Generator", false)
+{
+    repeat = 2;
+    numPairs = 0;
+    numNotes = 0;
+    numResults = 0;
+}
+
+TuningGenerator::~TuningGenerator()
+{
+    stopThread (5000);
+}
+
+void TuningGenerator::setCandidates (const ValueTree& calcList, const Array<float>& minimaRatios,
+                                     float minInterval, float repeatRatio)
+{
+    stopThread (5000);
+    
+    repeat = repeatRatio > 1 ? repeatRatio : 2;
+    minInterval = jmax (1.f, minInterval);
+    
+    // Minima are brought within the repeat ratio, as a scale only spans one repeat
+    Array<float> ratios;
+    
+    for (auto ratio : minimaRatios)
+    {
+        if (ratio <= 0)
+            continue;
+        
+        ratio /= std::pow (repeat, std::floor (std::log (ratio) / std::log (repeat)));
+        ratios.add (ratio);
+    }
+    
+    ratios.sort();
+    
+    // Clusters minima closer than the min interval, using the geometric mean of each cluster
+    candidates.clearQuick();
+    
+    for (int i = 0; i < ratios.size();)
+    {
+        int end = i + 1;
+        float logSum = std::log (ratios[i]);
+        
+        while (end < ratios.size() && ratios[end] / ratios[i] < minInterval)
+            logSum += std::log (ratios[end++]);
+        
+        float ratio = std::exp (logSum / (end - i));
+        
+        // 1/1 and the repeat ratio belong to every scale
+        if (ratio >= minInterval && repeat / ratio >= minInterval)
+            candidates.add (ratio);
+        
+        i = end;
+    }
+    
+    // The notes of a scale are played with each calc's x-axis timbre, against its other timbres
+    intervals.setCalcs (calcList);
+}
+
+const Array<float>& TuningGenerator::getCandidates() const
+{
+    return candidates;
+}
+
+float TuningGenerator::getRepeatRatio() const
+{
+    return repeat;
+}
+
+void TuningGenerator::startSearch (int notes, int maxResults)
+{
+    stopThread (5000);
+    
+    numNotes = notes;
+    numResults = jmax (1, maxResults);
+    
+    startThread();
+}
+
+Array<TuningGenerator::Scale> TuningGenerator::getResults() const
+{
+    const ScopedLock sl (resultsLock);
+    return results;
+}
+
+void TuningGenerator::startBatch()
+{
+    {
+        const ScopedLock sl (resultsLock);
+        results.clearQuick();
+        bound = std::numeric_limits<float>::max();
+    }
+    
+    const int numCandidates = candidates.size();
+    const int numChoices = numNotes - 1;
+    
+    if (numChoices < 0 || numChoices > numCandidates)
+        return;
+    
+    if (numChoices == 0)
+    {
+        addResult (nullptr, intervals.getDissonance (repeat));
+        return;
+    }
+    
+    // Pair dissonances are all looked up during the search, so they're computed up front
+    // (a row at a time, as one batch of intervals)
+    numPairs = numCandidates + 2;
+    pairDissonance.allocate ((size_t) (numPairs * numPairs), true);
+    
+    HeapBlock<float> rowRatios ((size_t) numPairs), rowDissonance ((size_t) numPairs);
+    
+    for (int i = 0; i < numPairs; ++i)
+    {
+        if (threadShouldExit())
+            return;
+        
+        float lower = i < numCandidates ? candidates[i] : (i == numCandidates ? 1 : repeat);
+        int numInRow = 0;
+        
+        for (int j = i + 1; j < numPairs; ++j)
+        {
+            float upper = j < numCandidates ? candidates[j] : (j == numCandidates ? 1 : repeat);
+            rowRatios[numInRow++] = jmax (lower, upper) / jmin (lower, upper);
+        }
+        
+        intervals.getDissonance (rowRatios, rowDissonance, numInRow);
+        
+        for (int j = i + 1; j < numPairs; ++j)
+        {
+            pairDissonance[i * numPairs + j] = rowDissonance[j - i - 1];
+            pairDissonance[j * numPairs + i] = rowDissonance[j - i - 1];
+        }
+    }
+    
+    for (int first = 0; first <= numCandidates - numChoices; ++first)
+        addJob (new ScaleSearchJob (*this, first));
+}
+
+void TuningGenerator::searchFrom (int firstCandidate)
+{
+    const int numCandidates = candidates.size();
+    const int root = numCandidates;
+    
+    SearchState state;
+    state.chosen.allocate ((size_t) numNotes, true);
+    state.added.allocate ((size_t) numCandidates, true);
+    state.scratch.allocate ((size_t) numCandidates, true);
+    
+    // Dissonance each candidate would add against the notes in every scale, then the first note
+    for (int i = 0; i < numCandidates; ++i)
+        state.added[i] = getPairDissonance (i, root) + getPairDissonance (i, root + 1)
+                         + getPairDissonance (i, firstCandidate);
+    
+    state.chosen[0] = firstCandidate;
+    
+    descend (state, 1, getPairDissonance (root, root + 1)
+                       + getPairDissonance (firstCandidate, root)
+                       + getPairDissonance (firstCandidate, root + 1));
+}
+
+void TuningGenerator::descend (SearchState& state, int depth, float dissonance)
+{
+    const int numChoices = numNotes - 1;
+    
+    if (depth == numChoices)
+    {
+        if (dissonance < bound.get())
+            addResult (state.chosen, dissonance);
+        
+        return;
+    }
+    
+    if (threadShouldExit())
+        return;
+    
+    const int numCandidates = candidates.size();
+    const int start = state.chosen[depth - 1] + 1;
+    const int remaining = numChoices - depth;
+    const int numLeft = numCandidates - start;
+    
+    // Lower bound: each remaining note adds at least its dissonance against the notes chosen so far
+    for (int i = 0; i < numLeft; ++i)
+        state.scratch[i] = state.added[start + i];
+    
+    std::nth_element (state.scratch.get(), state.scratch + remaining - 1, state.scratch + numLeft);
+    
+    float least = 0;
+    
+    for (int i = 0; i < remaining; ++i)
+        least += state.scratch[i];
+    
+    if (dissonance + least >= bound.get())
+        return;
+    
+    for (int next = start; next <= numCandidates - remaining; ++next)
+    {
+        const float added = state.added[next];
+        
+        if (dissonance + added >= bound.get())
+            continue;
+        
+        state.chosen[depth] = next;
+        
+        for (int i = next + 1; i < numCandidates; ++i)
+            state.added[i] += getPairDissonance (next, i);
+        
+        descend (state, depth + 1, dissonance + added);
+        
+        for (int i = next + 1; i < numCandidates; ++i)
+            state.added[i] -= getPairDissonance (next, i);
+    }
+}
+
+void TuningGenerator::addResult (const int* chosen, float dissonance)
+{
+    Scale scale;
+    scale.dissonance = dissonance;
+    
+    for (int i = 0; i < numNotes - 1; ++i)
+        scale.ratios.add (candidates[chosen[i]]);
+    
+    const ScopedLock sl (resultsLock);
+    
+    int index = 0;
+    
+    while (index < results.size() && results.getReference (index).dissonance <= dissonance)
+        ++index;
+    
+    results.insert (index, scale);
+    
+    if (results.size() > numResults)
+        results.removeLast();
+    
+    if (results.size() == numResults)
+        bound = results.getLast().dissonance;
+}
+
+float TuningGenerator::getPairDissonance (int first, int second) const
+{
+    return first == second ? 0 : pairDissonance[first * numPairs + second];
+}
+
+//==============================================================================
+String TuningGenerator::toScala (const Scale& scale, float repeatRatio, const String& description)
+{
+    String scl;
+    
+    scl << "! Generated by PsychoCAT" << newLine
+        << "!" << newLine
+        << description << newLine
+        << " " << scale.ratios.size() + 1 << newLine
+        << "!" << newLine;
+    
+    // Pitches with a decimal point are read as cents
+    for (auto ratio : scale.ratios)
+        scl << " " << String (1200 * std::log2 (ratio), 5) << newLine;
+    
+    scl << " " << String (1200 * std::log2 (repeatRatio), 5) << newLine;
+    
+    return scl;
+}
+
+String TuningGenerator::toNotes (const Scale& scale)
+{
+    StringArray notes;
+    
+    for (auto ratio : scale.ratios)
+        notes.add (String (ratio, 6));
+    
+    return notes.joinIntoString (" ");
+}
+
+float TuningGenerator::parseRatio (const String& text)
+{
+    if (text.containsChar ('/'))
+    {
+        float denominator = text.fromFirstOccurrenceOf ("/", false, false).getFloatValue();
+        
+        return denominator > 0 ? text.upToFirstOccurrenceOf ("/", false, false).getFloatValue() / denominator : 0;
+    }
+    
+    return text.getFloatValue();
+}
+
+Array<float> TuningGenerator::getScale (const ValueTree& tuning)
+{
+    const float repeatRatio = getRepeatRatio (tuning);
+    
+    Array<float> scale;
+    scale.add (1);
+    
+    StringArray notes;
+    notes.addTokens (tuning[IDs::Notes].toString(), false);
+    
+    for (auto& note : notes)
+    {
+        float ratio = parseRatio (note);
+        
+        if (ratio > 1 && ratio < repeatRatio)
+            scale.addIfNotAlreadyThere (ratio);
+    }
+    
+    // Without notes, the repeat ratio is divided into 12 equal steps
+    if (scale.size() == 1)
+        for (int i = 1; i < 12; ++i)
+            scale.add (std::pow (repeatRatio, i / 12.f));
+    
+    scale.sort();
+    
+    return scale;
+}
+
+float TuningGenerator::getRepeatRatio (const ValueTree& tuning)
+{
+    float repeatRatio = tuning.getProperty (IDs::RepeatRatio, 2);
+    
+    return repeatRatio > 1 ? repeatRatio : 2;
+}
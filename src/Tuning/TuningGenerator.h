@@ -0,0 +1,122 @@
+/*
+  ==============================================================================
+ 
+    This file is part of the Psychotonal CAT (Composition and Analysis Tools) app
+    Copyright (c) 2019 - Spectral Discord
+    http://spectraldiscord.com
+ 
+    This program is provided under the terms of GPL v3
+    https://opensource.org/licenses/GPL-3.0
+ 
+  ==============================================================================
+*/
+
+#pragma once
+
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "IntervalDissonance.h"
+#include "BackgroundBatch.h"
+
+class TuningGenerator;
+
+//==============================================================================
+/*
+    Searches every scale starting with a given candidate, for the tuning generator.
+*/
+class ScaleSearchJob   : public BackgroundBatch::Job
+{
+public:
+    ScaleSearchJob (TuningGenerator& owner, int firstCandidate);
+    ~ScaleSearchJob();
+    
+    JobStatus runJob() override;
+
+private:
+    TuningGenerator& generator;
+    int first;
+};
+
+//==============================================================================
+/*
+    Generates scales from the dissonance minima of every calc.
+ 
+    Minima ratios are brought within the repeat ratio and clustered when they are closer
+    than the minimum interval, giving a pool of candidate notes. A scale is scored by the
+    total dissonance of every pair of its notes (including 1/1 and the repeat ratio), using
+    the timbres and dissonance models of the calcs the minima came from.
+ 
+    The best scales of a given size are found with a depth-first branch and bound search,
+    split across threads by the scale's first note. A branch is pruned when the dissonance
+    of its notes so far, plus the least dissonance each remaining note would add against
+    them, can't beat the worst of the best scales found yet.
+*/
+class TuningGenerator   : public BackgroundBatch
+{
+public:
+    TuningGenerator();
+    ~TuningGenerator();
+    
+    struct Scale
+    {
+        // Ratios above 1/1 and below the repeat ratio, in ascending order
+        Array<float> ratios;
+        float dissonance;
+    };
+    
+    // Takes a snapshot of the calcs' timbres and pools the minima as candidate notes (message thread)
+    void setCandidates (const ValueTree& calcList, const Array<float>& minimaRatios, float minInterval, float repeatRatio);
+    const Array<float>& getCandidates() const;
+    float getRepeatRatio() const;
+    
+    // Searches for the best scales with the given number of notes (including 1/1) in the background,
+    // and sends a change message when done
+    void startSearch (int numNotes, int numResults);
+    Array<Scale> getResults() const;
+    
+    // Called by the search jobs
+    void searchFrom (int firstCandidate);
+    
+    // Formats a scale as the contents of a Scala .scl file
+    static String toScala (const Scale& scale, float repeatRatio, const String& description);
+    
+    // Formats a scale's ratios for the IDs::Notes property of a tuning
+    static String toNotes (const Scale& scale);
+    
+    // Reads a ratio written as a decimal or a fraction (ie, "1.5" or "3/2")
+    static float parseRatio (const String& text);
+    
+    // A tuning's notes from 1/1 up to (not including) its repeat ratio, in ascending order,
+    // or 12 equal steps if it has no notes
+    static Array<float> getScale (const ValueTree& tuning);
+    static float getRepeatRatio (const ValueTree& tuning);
+
+private:
+    struct SearchState
+    {
+        HeapBlock<int> chosen;
+        HeapBlock<float> added, scratch;
+    };
+    
+    IntervalDissonance intervals;
+    Array<float> candidates;
+    float repeat;
+    
+    // Dissonance of every pair of candidates, with 1/1 and the repeat ratio as the last two
+    HeapBlock<float> pairDissonance;
+    int numPairs;
+    
+    int numNotes, numResults;
+    
+    Array<Scale> results;
+    CriticalSection mutable resultsLock;
+    Atomic<float> bound;
+    
+    void startBatch() override;
+    
+    float getPairDissonance (int first, int second) const;
+    
+    void descend (SearchState& state, int depth, float dissonance);
+    void addResult (const int* chosen, float dissonance);
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (TuningGenerator)
+};